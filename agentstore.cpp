@@ -0,0 +1,207 @@
+#include <algorithm>
+#include <cstdint>
+
+#include "agentstore.h"
+
+const int cacheLineFloats = 64 / sizeof(float);
+// The radix sort handles this many bits per pass
+const int radixBits = 8;
+const int radixSize = 1 << radixBits;
+// Fixed number of chunks in the radix sort, independent of the thread count, so the result never depends on it
+const int sortChunks = 64;
+
+// Interleave the bits of x and y: ... y1 x1 y0 x0
+unsigned int mortonKey(unsigned int x, unsigned int y) {
+    auto spread = [](unsigned int v) -> unsigned int {
+        v &= 0xffff;
+        v = (v | (v << 8)) & 0x00ff00ff;
+        v = (v | (v << 4)) & 0x0f0f0f0f;
+        v = (v | (v << 2)) & 0x33333333;
+        v = (v | (v << 1)) & 0x55555555;
+        return v;
+    };
+
+    return spread(x) | (spread(y) << 1);
+}
+
+AgentStore::AgentStore() {
+    x = nullptr;
+    y = nullptr;
+    direction = nullptr;
+    id = nullptr;
+    numAgents = 0;
+    numAgentsPadded = 0;
+}
+
+void AgentStore::bindArrays() {
+    // One allocation for all three arrays, with room to move the start up to the next cache line. blockSize floats is
+    //  a whole number of cache lines, so the second and third array are aligned as well.
+    const auto address = reinterpret_cast<std::uintptr_t>(storage.data());
+    const auto misalignment = static_cast<int>(address % 64) / static_cast<int>(sizeof(float));
+
+    x = storage.data() + (misalignment == 0 ? 0 : cacheLineFloats - misalignment);
+    y = x + numAgentsPadded;
+    direction = y + numAgentsPadded;
+    id = ids.data();
+}
+
+void AgentStore::assign(const std::vector<Agent>& agents) {
+    assign(agents.data(), nullptr, static_cast<int>(agents.size()));
+}
+
+void AgentStore::assign(const Agent* agents, const unsigned int* agentIds, int tNumAgents) {
+    numAgents = tNumAgents;
+    numAgentsPadded = (numAgents + blockSize - 1) / blockSize * blockSize;
+    storage.assign(3 * numAgentsPadded + cacheLineFloats, 0.0f);
+    ids.resize(numAgentsPadded);
+    bindArrays();
+
+    // Padding agents keep ids past the real ones. agentIds = nullptr gives every agent its index
+    for (int i = 0; i < numAgentsPadded; i++) {
+        ids[i] = (agentIds != nullptr && i < numAgents) ? agentIds[i] : i;
+    }
+
+    for (int i = 0; i < numAgents; i++) {
+        x[i] = agents[i].x;
+        y[i] = agents[i].y;
+        direction[i] = agents[i].direction;
+    }
+}
+
+std::vector<Agent> AgentStore::toAgents() const {
+    std::vector<Agent> agents(numAgents);
+
+    for (int i = 0; i < numAgents; i++) {
+        auto& agent = agents[id[i]];
+        agent.x = x[i];
+        agent.y = y[i];
+        agent.direction = direction[i];
+    }
+
+    return agents;
+}
+
+std::vector<unsigned int> AgentStore::getIds() const {
+    return std::vector<unsigned int>(ids.begin(), ids.begin() + numAgents);
+}
+
+int AgentStore::size() const {
+    return numAgents;
+}
+
+int AgentStore::paddedSize() const {
+    return numAgentsPadded;
+}
+
+void AgentStore::sortByMortonOrder(ThreadPool& threadPool, int width, int height) {
+    const int chunkSize = (numAgents + sortChunks - 1) / sortChunks;
+    int keyBits = 0;
+
+    if (numAgents == 0) {
+        return;
+    }
+
+    while ((1 << keyBits) < std::max(width, height)) {
+        keyBits++;
+    }
+
+    keyBits *= 2;
+
+    for (int i = 0; i < 2; i++) {
+        sortKeys[i].resize(numAgents);
+        sortOrder[i].resize(numAgents);
+    }
+
+    sortHistograms.resize(sortChunks * radixSize);
+
+    auto forEachChunk = [&](const std::function<void(int, int, int)>& fn) {
+        threadPool.parallelFor([&](int chunkStart, int chunkEndExclusive) {
+            for (int chunk = chunkStart; chunk < chunkEndExclusive; chunk++) {
+                fn(chunk, std::min(numAgents, chunk * chunkSize), std::min(numAgents, (chunk + 1) * chunkSize));
+            }
+        }, 0, sortChunks, 1);
+    };
+
+    forEachChunk([this, width, height](int, int idxStart, int idxEndExclusive) {
+        for (int i = idxStart; i < idxEndExclusive; i++) {
+            const int squareX = std::min(width - 1, std::max(0, static_cast<int>(x[i])));
+            const int squareY = std::min(height - 1, std::max(0, static_cast<int>(y[i])));
+            sortKeys[0][i] = mortonKey(squareX, squareY);
+            sortOrder[0][i] = i;
+        }
+    });
+
+    int current = 0;
+
+    for (int shift = 0; shift < keyBits; shift += radixBits) {
+        const auto& keysIn = sortKeys[current];
+        const auto& orderIn = sortOrder[current];
+        auto& keysOut = sortKeys[1 - current];
+        auto& orderOut = sortOrder[1 - current];
+
+        // 1. Count the digits in every chunk
+        forEachChunk([&](int chunk, int idxStart, int idxEndExclusive) {
+            int* histogram = &sortHistograms[chunk * radixSize];
+
+            std::fill(histogram, histogram + radixSize, 0);
+
+            for (int i = idxStart; i < idxEndExclusive; i++) {
+                histogram[(keysIn[i] >> shift) & (radixSize - 1)]++;
+            }
+        });
+
+        // 2. Turn the counts into output offsets: all of digit 0 (chunk by chunk), then all of digit 1 and so on
+        int offset = 0;
+
+        for (int digit = 0; digit < radixSize; digit++) {
+            for (int chunk = 0; chunk < sortChunks; chunk++) {
+                const int count = sortHistograms[chunk * radixSize + digit];
+                sortHistograms[chunk * radixSize + digit] = offset;
+                offset += count;
+            }
+        }
+
+        // 3. Every chunk scatters its elements in order, which keeps the sort stable
+        forEachChunk([&](int chunk, int idxStart, int idxEndExclusive) {
+            int* offsets = &sortHistograms[chunk * radixSize];
+
+            for (int i = idxStart; i < idxEndExclusive; i++) {
+                const int target = offsets[(keysIn[i] >> shift) & (radixSize - 1)]++;
+                keysOut[target] = keysIn[i];
+                orderOut[target] = orderIn[i];
+            }
+        });
+
+        current = 1 - current;
+    }
+
+    // Move the agents themselves in one gather. Padding stays where it is.
+    sortStorage.resize(storage.size());
+    sortIds.resize(ids.size());
+    std::swap(storage, sortStorage);
+    std::swap(ids, sortIds);
+
+    const float* previousX = x;
+    const float* previousY = y;
+    const float* previousDirection = direction;
+    const unsigned int* previousId = id;
+    const auto& order = sortOrder[current];
+
+    bindArrays();
+
+    forEachChunk([&](int, int idxStart, int idxEndExclusive) {
+        for (int i = idxStart; i < idxEndExclusive; i++) {
+            x[i] = previousX[order[i]];
+            y[i] = previousY[order[i]];
+            direction[i] = previousDirection[order[i]];
+            id[i] = previousId[order[i]];
+        }
+    });
+
+    for (int i = numAgents; i < numAgentsPadded; i++) {
+        x[i] = previousX[i];
+        y[i] = previousY[i];
+        direction[i] = previousDirection[i];
+        id[i] = previousId[i];
+    }
+}
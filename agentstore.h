@@ -0,0 +1,56 @@
+#pragma once
+
+#include <vector>
+
+#include "slimemold.h"
+#include "threadpool.h"
+
+/// <summary>
+/// Agents of the CPU backend as a structure of arrays: all x in one array, all y in another and all directions in a
+/// third. A SIMD register then loads the same field of consecutive agents with one instruction, instead of picking it
+/// out of every third float.
+///
+/// The arrays start on a cache line and are padded to a whole number of blocks, so vector code can always process full
+/// registers. Padding agents sit at (0, 0), are not part of size() and are never exported.
+///
+/// Every agent keeps the id it got from its position in the vector given to assign(). The storage order can change
+/// (see sortByMortonOrder), the ids don't, so per-agent random numbers are drawn by id.
+/// </summary>
+class AgentStore {
+public:
+    // Agents per block. A multiple of the widest Simd::width
+    static const int blockSize = 16;
+    AgentStore();
+    AgentStore(const AgentStore&) = delete;
+    AgentStore& operator=(const AgentStore&) = delete;
+    void assign(const std::vector<Agent>& agents);
+    // Agents in storage order with their ids, e.g. from a checkpoint. agentIds has to be a permutation of 0..numAgents-1
+    void assign(const Agent* agents, const unsigned int* agentIds, int numAgents);
+    // In id order, the same order as given to assign()
+    std::vector<Agent> toAgents() const;
+    // Id of the agent at each storage position
+    std::vector<unsigned int> getIds() const;
+    int size() const;
+    // size() rounded up to a multiple of blockSize
+    int paddedSize() const;
+    // Reorder the agents along a Z-order (Morton) curve over the squares they are on, so agents next to each other
+    //  in memory are also close to each other in the environment. Stable parallel LSD radix sort.
+    void sortByMortonOrder(ThreadPool& threadPool, int width, int height);
+    float* x;
+    float* y;
+    float* direction;
+    unsigned int* id;
+private:
+    // Point x, y and direction into storage
+    void bindArrays();
+    int numAgents;
+    int numAgentsPadded;
+    std::vector<float> storage;
+    std::vector<unsigned int> ids;
+    // Scratch space of the sort, kept between calls
+    std::vector<float> sortStorage;
+    std::vector<unsigned int> sortIds;
+    std::vector<unsigned int> sortKeys[2];
+    std::vector<unsigned int> sortOrder[2];
+    std::vector<int> sortHistograms;
+};
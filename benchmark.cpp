@@ -0,0 +1,1235 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "checkpoint.h"
+#include "runstatistics.h"
+#include "simd.h"
+#include "slimemoldcpu.h"
+#include "slimemoldensemble.h"
+#include "slimemoldmultidevice.h"
+#include "slimemoldopencl.h"
+#include "slimemoldtiled.h"
+#include "trailformat.h"
+
+/*
+Headless benchmark. Runs a number of warm-up steps followed by the measured steps, without a window, and reports the
+time spent in each phase. The report is printed and also written as JSON, so results can be compared across builds
+and machines.
+
+    benchmark [--backend cpu|tiled|opencl|multidevice] [--tile-size N] [--steps N] [--warmup N] [--sort-interval N] [--trail-format F]
+        [--compare-trail-formats] [--sparse-trail-map on|off] [--summed-area-sensing on|off] [--headings N]
+        [--compare-headings] [--local-size WxH|off] [--compare-local-size] [--tune-work-groups profile|retune] [--load-checkpoint path]
+        [--save-checkpoint path] [--ensemble N]
+        [--compare-multidevice] [--json path]
+
+--backend tiled runs SlimeMoldTiled, the CPU backend for large maps, with tiles of --tile-size squares (the default is
+RunConfiguration::Hardware::tileSize). It only stores float32 trail maps. --backend multidevice runs
+SlimeMoldMultiDevice on the devices selected by RunConfiguration::MultiDevice, and reports the final strip of each.
+With --compare-multidevice it also runs warm-up + steps steps on the devices and on the default device alone, from the
+same seed, and compares the final trail maps, render images and agents like --compare-trail-formats does. Random
+numbers are drawn per agent, so the runs only drift apart through float rounding; anything more points at the strip
+borders, the migration of agents or the deposits on claimed squares.
+
+--sort-interval overrides RunConfiguration::Hardware::agentSortInterval, so runs with and without sorting can be
+compared. The report includes how far apart in the trail map consecutive agents in memory are at the end of the run.
+
+--trail-format (float32, float16 or fixed8.8) overrides RunConfiguration::Hardware::trailFormat. With
+--compare-trail-formats the reduced formats are also checked for accuracy: every format runs warm-up + steps steps from
+the same seed, and the final trail map, render image and agents are compared with a float32 run.
+
+--sparse-trail-map overrides RunConfiguration::Hardware::sparseTrailMap on the cpu and opencl backends. The report
+includes the share of the tiles of the trail map that were active, averaged over the measured steps.
+
+--summed-area-sensing overrides the choice made from RunConfiguration::Hardware::summedAreaSensingMinWidth on the cpu
+and opencl backends, so sensing through the summed-area table can be timed against summing each sensor at any width.
+
+--headings overrides RunConfiguration::Hardware::numHeadings on the cpu and opencl backends, 0 being continuous
+directions. With --compare-headings, a run with continuous directions and one with the quantized headings go through
+warm-up + steps steps from the same seed. They diverge within a few steps, so they are compared by their statistics: time
+per step, mean, spread and coverage of the trail map, and how far apart the distributions of trail values and agent
+directions are. It also checks that the random new headings the move phase gives agents that can't move are uniform,
+on both the cpu and the opencl backend.
+
+--local-size runs diffusion and sense of the opencl backend with the tiled kernels in work-groups of W x H, or without
+them with off, instead of the choice SlimeMoldOpenCl makes for the device. --compare-local-size runs warm-up + steps
+steps with the tiled kernels, in work-groups of --local-size or 16 x 16 without it, and with diffuse and sense from the
+same seed, and compares the end states like --compare-trail-formats does. --tune-work-groups times the candidate local
+work sizes and kernel variants of every launch first and runs with the fastest (see SlimeMoldOpenCl::tuneWorkGroups).
+With profile, a profile saved by an earlier run on the device is used instead if there is one, retune always tunes.
+The report lists the local work size of every launch.
+
+--ensemble N runs SlimeMoldEnsemble instead of --backend: N members on the OpenCL device, sweeping the sensor angle
+from half to one and a half times RunConfiguration::Agent::sensorAngle, each with a seed of its own. It reports the time
+of a step of all members and of streaming the rendered images of all members back.
+
+--load-checkpoint starts every run from a checkpoint instead of from initAgents, e.g. to measure a developed pattern
+rather than the first steps. --save-checkpoint saves the state at the end of the measured run.
+*/
+
+struct BenchmarkOptions {
+    // cpu, tiled, opencl or multidevice
+    std::string backend = RunConfiguration::Hardware::onlyCpu ? (RunConfiguration::Hardware::tiledCpu ? "tiled" : "cpu")
+        : (RunConfiguration::MultiDevice::enabled ? "multidevice" : "opencl");
+    int tileSize = RunConfiguration::Hardware::tileSize;
+    int numSteps = 200;
+    int numWarmupSteps = 20;
+    int agentSortInterval = RunConfiguration::Hardware::agentSortInterval;
+    TrailFormat trailFormat = RunConfiguration::Hardware::trailFormat;
+    bool compareTrailFormats = false;
+    bool compareMultiDevice = false;
+    bool sparseTrailMap = RunConfiguration::Hardware::sparseTrailMap;
+    // 1 = on, 0 = off, -1 = as chosen from RunConfiguration::Hardware::summedAreaSensingMinWidth
+    int summedAreaSensing = -1;
+    // -1 = RunConfiguration::Hardware::numHeadings
+    int numHeadings = -1;
+    bool compareHeadings = false;
+    // Work-group size of the tiled OpenCL kernels, 0 x 0 = without them. -1 = as chosen for the device
+    int localWorkGroupWidth = -1;
+    int localWorkGroupHeight = -1;
+    bool compareLocalSize = false;
+    // "", profile or retune
+    std::string tuneWorkGroups;
+    std::string loadCheckpointPath;
+    std::string saveCheckpointPath;
+    // 0 = benchmark a single simulation on backend
+    int numEnsembleMembers = 0;
+    std::string jsonPath = "benchmark.json";
+};
+
+// Memory distance between the trail squares of agents that are next to each other in memory
+struct AgentLocality {
+    double medianStrideBytes;
+    // Share of consecutive agents whose squares are on the same 4 KiB page
+    double samePageRatio;
+};
+
+// Difference between the end state of a run with a reduced trail format and a float32 run, of a run with the tiled
+//  OpenCL kernels and one without, or of a multi-device and a single-device run. The simulation is chaotic, so the
+//  runs drift apart once a rounding difference changes a single decision; the numbers show how far.
+struct TrailFormatComparison {
+    TrailFormat format;
+    double trailMeanAbsError;
+    double trailMaxAbsError;
+    // Relative difference of the total amount of chemo on the map
+    double trailTotalRelativeError;
+    double renderPsnrDb;
+    // Share of agents that are on the same square in both runs
+    double agentsOnSameSquareRatio;
+};
+
+// End state of a run with continuous directions or with quantized headings. The runs diverge within a few steps, so
+//  they are compared by their distributions rather than square by square
+struct HeadingRunStatistics {
+    double stepMs;
+    double trailMean;
+    double trailStdDev;
+    // Share of squares with at least 1 chemo, i.e. lit in the render image
+    double coveredRatio;
+};
+
+struct HeadingComparison {
+    int numHeadings;
+    HeadingRunStatistics continuous;
+    HeadingRunStatistics quantized;
+    // Total variation distance between the histograms of both runs: 0 = same distribution, 1 = nothing in common. Trail
+    //  values in 64 bins up to the maximum chemo, agent directions in one bin per heading
+    double trailHistogramDistance;
+    double directionHistogramDistance;
+    // Chi-square of the random headings the move phase gives agents that can't move, against a uniform distribution,
+    //  divided by its degrees of freedom. About 1 when they are uniform. On the cpu and the opencl backend, NaN if it
+    //  can't run
+    double reorientationChiSquarePerDof[2];
+};
+
+struct PhaseSummary {
+    std::string name;
+    double meanMs;
+    double p50Ms;
+    double p99Ms;
+};
+
+int getNumHeadings(const BenchmarkOptions& options) {
+    return options.numHeadings >= 0 ? options.numHeadings : RunConfiguration::Hardware::numHeadings;
+}
+
+// At least minimum. False if value isn't a whole number
+bool parseInt(const std::string& value, int minimum, int& result) {
+    size_t numParsed = 0;
+
+    try {
+        result = std::max(minimum, std::stoi(value, &numParsed));
+    }
+    catch (const std::exception&) {
+        return false;
+    }
+
+    return numParsed == value.size();
+}
+
+bool parseArguments(int argc, char* argv[], BenchmarkOptions& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--backend" && hasValue) {
+            options.backend = argv[++i];
+
+            if (options.backend != "cpu" && options.backend != "tiled" && options.backend != "opencl" && options.backend != "multidevice") {
+                return false;
+            }
+        }
+        else if (arg == "--tile-size" && hasValue) {
+            if (!parseInt(argv[++i], 1, options.tileSize)) {
+                return false;
+            }
+        }
+        else if (arg == "--steps" && hasValue) {
+            if (!parseInt(argv[++i], 1, options.numSteps)) {
+                return false;
+            }
+        }
+        else if (arg == "--warmup" && hasValue) {
+            if (!parseInt(argv[++i], 0, options.numWarmupSteps)) {
+                return false;
+            }
+        }
+        else if (arg == "--sort-interval" && hasValue) {
+            if (!parseInt(argv[++i], 0, options.agentSortInterval)) {
+                return false;
+            }
+        }
+        else if (arg == "--trail-format" && hasValue) {
+            std::string format = argv[++i];
+
+            if (format == getTrailFormatName(TrailFormat::Float32)) {
+                options.trailFormat = TrailFormat::Float32;
+            }
+            else if (format == getTrailFormatName(TrailFormat::Float16)) {
+                options.trailFormat = TrailFormat::Float16;
+            }
+            else if (format == getTrailFormatName(TrailFormat::Fixed8_8)) {
+                options.trailFormat = TrailFormat::Fixed8_8;
+            }
+            else {
+                return false;
+            }
+        }
+        else if (arg == "--compare-trail-formats") {
+            options.compareTrailFormats = true;
+        }
+        else if (arg == "--compare-multidevice") {
+            options.compareMultiDevice = true;
+        }
+        else if (arg == "--sparse-trail-map" && hasValue) {
+            std::string value = argv[++i];
+
+            if (value != "on" && value != "off") {
+                return false;
+            }
+
+            options.sparseTrailMap = value == "on";
+        }
+        else if (arg == "--summed-area-sensing" && hasValue) {
+            std::string value = argv[++i];
+
+            if (value != "on" && value != "off") {
+                return false;
+            }
+
+            options.summedAreaSensing = value == "on" ? 1 : 0;
+        }
+        else if (arg == "--headings" && hasValue) {
+            if (!parseInt(argv[++i], 0, options.numHeadings)) {
+                return false;
+            }
+        }
+        else if (arg == "--compare-headings") {
+            options.compareHeadings = true;
+        }
+        else if (arg == "--local-size" && hasValue) {
+            std::string value = argv[++i];
+            const auto separator = value.find('x');
+
+            if (value == "off") {
+                options.localWorkGroupWidth = 0;
+                options.localWorkGroupHeight = 0;
+            }
+            else if (separator != std::string::npos) {
+                if (!parseInt(value.substr(0, separator), 1, options.localWorkGroupWidth)) {
+                    return false;
+                }
+                if (!parseInt(value.substr(separator + 1), 1, options.localWorkGroupHeight)) {
+                    return false;
+                }
+            }
+            else {
+                return false;
+            }
+        }
+        else if (arg == "--compare-local-size") {
+            options.compareLocalSize = true;
+        }
+        else if (arg == "--tune-work-groups" && hasValue) {
+            options.tuneWorkGroups = argv[++i];
+
+            if (options.tuneWorkGroups != "profile" && options.tuneWorkGroups != "retune") {
+                return false;
+            }
+        }
+        else if (arg == "--load-checkpoint" && hasValue) {
+            options.loadCheckpointPath = argv[++i];
+        }
+        else if (arg == "--save-checkpoint" && hasValue) {
+            options.saveCheckpointPath = argv[++i];
+        }
+        else if (arg == "--ensemble" && hasValue) {
+            if (!parseInt(argv[++i], 1, options.numEnsembleMembers)) {
+                return false;
+            }
+        }
+        else if (arg == "--json" && hasValue) {
+            options.jsonPath = argv[++i];
+        }
+        else {
+            return false;
+        }
+    }
+
+    // The comparison is of the multi-device run with the same run on one device
+    if (options.compareMultiDevice && (options.numEnsembleMembers > 0 || options.backend != "multidevice")) {
+        return false;
+    }
+
+    // Ensemble members always start from initial agents, and have no format comparison
+    if (options.numEnsembleMembers > 0 && (!options.loadCheckpointPath.empty() || !options.saveCheckpointPath.empty() || options.compareTrailFormats)) {
+        return false;
+    }
+
+    // The tiled backend has no reduced trail formats
+    if (options.backend == "tiled" && (options.trailFormat != TrailFormat::Float32 || options.compareTrailFormats)) {
+        return false;
+    }
+
+    // Only SlimeMoldCpu and SlimeMoldOpenCl track active tiles
+    if (options.sparseTrailMap && (options.numEnsembleMembers > 0 || (options.backend != "cpu" && options.backend != "opencl"))) {
+        return false;
+    }
+
+    // Neither has a summed-area table or quantized directions
+    if ((options.summedAreaSensing >= 0 || options.numHeadings >= 0 || options.compareHeadings)
+        && (options.numEnsembleMembers > 0 || (options.backend != "cpu" && options.backend != "opencl"))) {
+        return false;
+    }
+
+    // Only SlimeMoldOpenCl has the tiled kernels and the tuner, which picks the work-group size itself
+    if ((options.localWorkGroupWidth >= 0 || !options.tuneWorkGroups.empty()) && (options.numEnsembleMembers > 0 || options.backend != "opencl")) {
+        return false;
+    }
+
+    if (options.localWorkGroupWidth >= 0 && !options.tuneWorkGroups.empty()) {
+        return false;
+    }
+
+    // The comparison picks the kernels of both runs itself, and needs a size for the tiled ones
+    if (options.compareLocalSize && (options.numEnsembleMembers > 0 || options.backend != "opencl" || options.localWorkGroupWidth == 0
+        || !options.tuneWorkGroups.empty())) {
+        return false;
+    }
+
+    // The comparison needs headings to compare with
+    if (options.compareHeadings && getNumHeadings(options) == 0) {
+        return false;
+    }
+
+    return true;
+}
+
+// Nearest-rank percentile
+double percentile(std::vector<double> values, double p) {
+    std::sort(values.begin(), values.end());
+    auto rank = static_cast<size_t>(std::ceil(p / 100.0 * values.size()));
+
+    return values[std::min(values.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
+
+double mean(const std::vector<double>& values) {
+    double sum = 0.0;
+
+    for (auto v : values) {
+        sum += v;
+    }
+
+    return sum / values.size();
+}
+
+PhaseSummary summarize(const std::string& name, const std::vector<double>& secondsPerStep) {
+    return { name, 1000.0 * mean(secondsPerStep), 1000.0 * percentile(secondsPerStep, 50.0), 1000.0 * percentile(secondsPerStep, 99.0) };
+}
+
+SlimeMold* createSlimeMold(const BenchmarkOptions& options, TrailFormat trailFormat) {
+    SlimeMold* slimeMold;
+
+    if (options.backend == "cpu") {
+        slimeMold = new SlimeMoldCpu(trailFormat, options.sparseTrailMap, getNumHeadings(options));
+    }
+    else if (options.backend == "tiled") {
+        slimeMold = new SlimeMoldTiled(options.tileSize);
+    }
+    else if (options.backend == "multidevice") {
+        slimeMold = new SlimeMoldMultiDevice(trailFormat);
+    }
+    else {
+        auto openCl = new SlimeMoldOpenCl(trailFormat, options.sparseTrailMap, getNumHeadings(options));
+
+        if (options.localWorkGroupWidth >= 0) {
+            openCl->setLocalWorkGroupSize(options.localWorkGroupWidth, options.localWorkGroupHeight);
+        }
+
+        slimeMold = openCl;
+    }
+
+    slimeMold->setAgentSortInterval(options.agentSortInterval);
+
+    if (options.summedAreaSensing >= 0) {
+        slimeMold->setSummedAreaSensing(options.summedAreaSensing == 1);
+    }
+
+    if (!options.loadCheckpointPath.empty()) {
+        std::string error;
+
+        if (!loadCheckpoint(slimeMold, options.loadCheckpointPath, error)) {
+            std::cout << "Can't load checkpoint: " << error << std::endl;
+            delete slimeMold;
+            return nullptr;
+        }
+    }
+
+    // After everything that changes which kernels run, and on the state the benchmark starts from
+    if (!options.tuneWorkGroups.empty()) {
+        static_cast<SlimeMoldOpenCl*>(slimeMold)->tuneWorkGroups(options.tuneWorkGroups == "retune");
+    }
+
+    return slimeMold;
+}
+
+// End state of a run of warm-up + measured steps
+struct RunResult {
+    std::vector<float> trailMap;
+    std::vector<unsigned char> render;
+    std::vector<Agent> agents;
+    // Over all steps, warm-up included
+    double secondsPerStep;
+};
+
+RunResult runUnmeasured(const BenchmarkOptions& options, TrailFormat trailFormat) {
+    SlimeMold* slimeMold = createSlimeMold(options, trailFormat);
+    RunResult result;
+    const auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < options.numWarmupSteps + options.numSteps; i++) {
+        slimeMold->run();
+    }
+
+    slimeMold->finish();
+
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    result.secondsPerStep = elapsed.count() / (options.numWarmupSteps + options.numSteps);
+
+    const auto render = slimeMold->getDataTrailRender();
+
+    result.trailMap = slimeMold->exportTrailMap();
+    result.render.assign(render, render + RunConfiguration::Environment::numPixels());
+    result.agents = slimeMold->exportAgents();
+
+    delete slimeMold;
+
+    return result;
+}
+
+TrailFormatComparison compareWithReference(TrailFormat format, const RunResult& reference, const RunResult& result) {
+    TrailFormatComparison comparison = { format, 0.0, 0.0, 0.0, 0.0, 0.0 };
+    double sumAbsError = 0.0;
+    double totalReference = 0.0;
+    double total = 0.0;
+    double sumSquaredRenderError = 0.0;
+    size_t numOnSameSquare = 0;
+
+    for (size_t i = 0; i < reference.trailMap.size(); i++) {
+        const double error = std::abs(static_cast<double>(result.trailMap[i]) - reference.trailMap[i]);
+
+        sumAbsError += error;
+        comparison.trailMaxAbsError = std::max(comparison.trailMaxAbsError, error);
+        totalReference += reference.trailMap[i];
+        total += result.trailMap[i];
+    }
+
+    for (size_t i = 0; i < reference.render.size(); i++) {
+        const double error = static_cast<double>(result.render[i]) - reference.render[i];
+
+        sumSquaredRenderError += error * error;
+    }
+
+    for (size_t i = 0; i < reference.agents.size(); i++) {
+        if (static_cast<int>(reference.agents[i].x) == static_cast<int>(result.agents[i].x) && static_cast<int>(reference.agents[i].y) == static_cast<int>(result.agents[i].y)) {
+            numOnSameSquare++;
+        }
+    }
+
+    const double renderMse = sumSquaredRenderError / reference.render.size();
+
+    comparison.trailMeanAbsError = sumAbsError / reference.trailMap.size();
+    comparison.trailTotalRelativeError = totalReference > 0.0 ? std::abs(total - totalReference) / totalReference : 0.0;
+    // Identical images have an infinite PSNR. Report 100 dB, which is more than any real difference gives
+    comparison.renderPsnrDb = renderMse > 0.0 ? std::min(100.0, 10.0 * std::log10(255.0 * 255.0 / renderMse)) : 100.0;
+    comparison.agentsOnSameSquareRatio = reference.agents.empty() ? 1.0 : static_cast<double>(numOnSameSquare) / reference.agents.size();
+
+    return comparison;
+}
+
+std::vector<TrailFormatComparison> compareTrailFormats(const BenchmarkOptions& options) {
+    std::vector<TrailFormatComparison> comparisons;
+    const auto reference = runUnmeasured(options, TrailFormat::Float32);
+
+    for (auto format : { TrailFormat::Float16, TrailFormat::Fixed8_8 }) {
+        comparisons.push_back(compareWithReference(format, reference, runUnmeasured(options, format)));
+    }
+
+    return comparisons;
+}
+
+TrailFormatComparison compareLocalSize(const BenchmarkOptions& options) {
+    BenchmarkOptions plainOptions = options;
+    BenchmarkOptions tiledOptions = options;
+
+    plainOptions.localWorkGroupWidth = 0;
+    plainOptions.localWorkGroupHeight = 0;
+
+    if (tiledOptions.localWorkGroupWidth < 0) {
+        tiledOptions.localWorkGroupWidth = 16;
+        tiledOptions.localWorkGroupHeight = 16;
+    }
+
+    const auto reference = runUnmeasured(plainOptions, options.trailFormat);
+
+    return compareWithReference(options.trailFormat, reference, runUnmeasured(tiledOptions, options.trailFormat));
+}
+
+TrailFormatComparison compareMultiDevice(const BenchmarkOptions& options) {
+    BenchmarkOptions singleDeviceOptions = options;
+
+    singleDeviceOptions.backend = "opencl";
+
+    const auto reference = runUnmeasured(singleDeviceOptions, options.trailFormat);
+
+    return compareWithReference(options.trailFormat, reference, runUnmeasured(options, options.trailFormat));
+}
+
+// Share of the squares in each of numBins bins of chemo up to the maximum
+std::vector<double> makeTrailHistogram(const std::vector<float>& trailMap, int numBins) {
+    std::vector<double> histogram(numBins, 0.0);
+
+    for (auto chemo : trailMap) {
+        const int bin = std::min(numBins - 1, std::max(0, static_cast<int>(chemo / RunConfiguration::Agent::maxTotalChemo * numBins)));
+
+        histogram[bin] += 1.0 / trailMap.size();
+    }
+
+    return histogram;
+}
+
+double totalVariationDistance(const std::vector<double>& a, const std::vector<double>& b) {
+    double sum = 0.0;
+
+    for (size_t i = 0; i < a.size(); i++) {
+        sum += std::abs(a[i] - b[i]);
+    }
+
+    return sum / 2.0;
+}
+
+// In [0, 2 pi), shifted by half a heading so directions on a heading sit in the middle of its bin instead of on a
+//  border, where float rounding could put them in either
+double shiftedDirection(const Agent& agent, int numHeadings) {
+    const double fullCircle = 2.0 * Utils::PI;
+    const double direction = std::fmod(agent.direction + Utils::PI / numHeadings, fullCircle);
+
+    return direction < 0.0 ? direction + fullCircle : direction;
+}
+
+HeadingRunStatistics summarizeHeadingRun(const RunResult& result) {
+    HeadingRunStatistics statistics = { 1000.0 * result.secondsPerStep, 0.0, 0.0, 0.0 };
+    double sumSquares = 0.0;
+    size_t numCovered = 0;
+
+    for (auto chemo : result.trailMap) {
+        statistics.trailMean += chemo;
+        sumSquares += static_cast<double>(chemo) * chemo;
+        numCovered += chemo >= 1.0f ? 1 : 0;
+    }
+
+    statistics.trailMean /= result.trailMap.size();
+    statistics.trailStdDev = std::sqrt(std::max(0.0, sumSquares / result.trailMap.size() - statistics.trailMean * statistics.trailMean));
+    statistics.coveredRatio = static_cast<double>(numCovered) / result.trailMap.size();
+
+    return statistics;
+}
+
+// Chi-square per degree of freedom of the headings a move phase of backend gives the agents, against a uniform
+//  distribution. Every agent starts on the right edge facing out of the map, so none of them can move and all draw one
+double measureReorientation(const BenchmarkOptions& options, const std::string& backend, int numHeadings) {
+    BenchmarkOptions reorientationOptions = options;
+
+    reorientationOptions.backend = backend;
+    reorientationOptions.loadCheckpointPath = "";
+    reorientationOptions.tuneWorkGroups = "";
+
+    SlimeMold* slimeMold = createSlimeMold(reorientationOptions, options.trailFormat);
+    auto state = slimeMold->exportState();
+    SimulationStateView view;
+
+    for (size_t i = 0; i < state.agents.size(); i++) {
+        state.agents[i].x = RunConfiguration::Environment::width - 0.5f;
+        state.agents[i].y = i % RunConfiguration::Environment::height + 0.5f;
+        state.agents[i].direction = 0.0f;
+    }
+
+    view.step = state.step;
+    view.trailFormat = state.trailFormat;
+    view.numAgents = state.agents.size();
+    view.agents = state.agents.data();
+    view.agentIds = state.agentIds.data();
+
+    for (int i = 0; i < 2; i++) {
+        view.trailMaps[i] = state.trailMaps[i].data();
+    }
+
+    slimeMold->importState(view);
+    slimeMold->runPhase(SimulationPhase::Move);
+
+    const auto agents = slimeMold->exportAgents();
+    const double expected = static_cast<double>(agents.size()) / numHeadings;
+    std::vector<int> counts(numHeadings, 0);
+    double chiSquare = 0.0;
+
+    delete slimeMold;
+
+    for (auto& agent : agents) {
+        counts[std::min(numHeadings - 1, static_cast<int>(shiftedDirection(agent, numHeadings) / (2.0 * Utils::PI) * numHeadings))]++;
+    }
+
+    for (auto count : counts) {
+        chiSquare += (count - expected) * (count - expected) / expected;
+    }
+
+    return numHeadings > 1 ? chiSquare / (numHeadings - 1) : 0.0;
+}
+
+HeadingComparison compareHeadings(const BenchmarkOptions& options) {
+    const int numHeadings = getNumHeadings(options);
+    const int numTrailBins = 64;
+    const char* const reorientationBackends[] = { "cpu", "opencl" };
+    BenchmarkOptions continuousOptions = options;
+    HeadingComparison comparison;
+
+    continuousOptions.numHeadings = 0;
+
+    const auto continuous = runUnmeasured(continuousOptions, options.trailFormat);
+    const auto quantized = runUnmeasured(options, options.trailFormat);
+    std::vector<double> directionHistograms[2];
+
+    comparison.numHeadings = numHeadings;
+    comparison.continuous = summarizeHeadingRun(continuous);
+    comparison.quantized = summarizeHeadingRun(quantized);
+    comparison.trailHistogramDistance = totalVariationDistance(makeTrailHistogram(continuous.trailMap, numTrailBins), makeTrailHistogram(quantized.trailMap, numTrailBins));
+
+    for (int i = 0; i < 2; i++) {
+        const auto& agents = i == 0 ? continuous.agents : quantized.agents;
+
+        directionHistograms[i] = std::vector<double>(numHeadings, 0.0);
+
+        for (auto& agent : agents) {
+            const int bin = std::min(numHeadings - 1, static_cast<int>(shiftedDirection(agent, numHeadings) / (2.0 * Utils::PI) * numHeadings));
+
+            directionHistograms[i][bin] += 1.0 / agents.size();
+        }
+    }
+
+    comparison.directionHistogramDistance = totalVariationDistance(directionHistograms[0], directionHistograms[1]);
+
+    // Also on the backend that isn't benchmarked, which may not have a device here
+    for (int i = 0; i < 2; i++) {
+        try {
+            comparison.reorientationChiSquarePerDof[i] = measureReorientation(options, reorientationBackends[i], numHeadings);
+        }
+        catch (const std::exception& e) {
+            std::cout << "Can't check the random headings of the " << reorientationBackends[i] << " backend: " << e.what() << std::endl;
+            comparison.reorientationChiSquarePerDof[i] = std::numeric_limits<double>::quiet_NaN();
+        }
+    }
+
+    return comparison;
+}
+
+AgentLocality measureAgentLocality(SlimeMold* slimeMold, int bytesPerPixel) {
+    const auto agents = slimeMold->exportAgents();
+    const auto order = slimeMold->exportAgentOrder();
+    std::vector<double> strides;
+    int numSamePage = 0;
+
+    for (size_t i = 1; i < order.size(); i++) {
+        const auto& previous = agents[order[i - 1]];
+        const auto& current = agents[order[i]];
+        const long long previousIdx = static_cast<long long>(previous.x) + static_cast<long long>(previous.y) * RunConfiguration::Environment::width;
+        const long long currentIdx = static_cast<long long>(current.x) + static_cast<long long>(current.y) * RunConfiguration::Environment::width;
+        const long long strideBytes = std::abs(currentIdx - previousIdx) * bytesPerPixel;
+
+        strides.push_back(static_cast<double>(strideBytes));
+
+        if (previousIdx * bytesPerPixel / 4096 == currentIdx * bytesPerPixel / 4096) {
+            numSamePage++;
+        }
+    }
+
+    if (strides.empty()) {
+        return { 0.0, 0.0 };
+    }
+
+    return { percentile(strides, 50.0), static_cast<double>(numSamePage) / strides.size() };
+}
+
+// "driver", "256", "16x8" or "tiled 16x16"
+std::string describeWorkGroupChoice(const WorkGroupChoice& choice) {
+    std::string size = std::to_string(choice.localSize[0]);
+
+    if (choice.localSize[1] > 0) {
+        size += "x" + std::to_string(choice.localSize[1]);
+    }
+
+    if (choice.tiled) {
+        return "tiled " + size;
+    }
+
+    return choice.localSize[0] > 0 ? size : "driver";
+}
+
+std::string buildType() {
+#ifdef NDEBUG
+    return "release";
+#else
+    return "debug";
+#endif
+}
+
+std::string compiler() {
+    std::stringstream ss;
+#if defined(_MSC_VER)
+    ss << "msvc " << _MSC_VER;
+#elif defined(__clang__)
+    ss << "clang " << __clang_major__ << "." << __clang_minor__;
+#elif defined(__GNUC__)
+    ss << "gcc " << __GNUC__ << "." << __GNUC_MINOR__;
+#else
+    ss << "unknown";
+#endif
+    return ss.str();
+}
+
+std::string jsonEscape(const std::string& s) {
+    std::string escaped;
+
+    for (auto c : s) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+        }
+
+        escaped += c;
+    }
+
+    return escaped;
+}
+
+int runEnsembleBenchmark(const BenchmarkOptions& options) {
+    const int numMembers = options.numEnsembleMembers;
+    std::vector<EnsembleMember> members;
+
+    for (int i = 0; i < numMembers; i++) {
+        auto member = SlimeMoldEnsemble::getConfiguredMember();
+        const float scale = numMembers > 1 ? 0.5f + static_cast<float>(i) / (numMembers - 1) : 1.0f;
+
+        member.sensorAngle *= scale;
+        member.randomSeed += i;
+        members.push_back(member);
+    }
+
+    SlimeMoldEnsemble ensemble(members, options.trailFormat);
+    std::vector<double> stepSeconds;
+
+    for (int i = 0; i < options.numWarmupSteps; i++) {
+        ensemble.run();
+    }
+
+    ensemble.finish();
+
+    for (int i = 0; i < options.numSteps; i++) {
+        auto start = std::chrono::steady_clock::now();
+        ensemble.run();
+        ensemble.finish();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        stepSeconds.push_back(elapsed.count());
+    }
+
+    // Results come back member by member, as a sweep would consume them
+    auto renderStart = std::chrono::steady_clock::now();
+    double meanBrightness = 0.0;
+
+    ensemble.makeRenderImages();
+
+    for (int i = 0; i < numMembers; i++) {
+        const auto image = ensemble.getRenderImage(i);
+        unsigned long long sum = 0;
+
+        for (int j = 0; j < RunConfiguration::Environment::numPixels(); j++) {
+            sum += image[j];
+        }
+
+        meanBrightness += static_cast<double>(sum) / RunConfiguration::Environment::numPixels() / numMembers;
+    }
+
+    std::chrono::duration<double> renderSeconds = std::chrono::steady_clock::now() - renderStart;
+    const auto stepSummary = summarize("step", stepSeconds);
+    const auto population = RunConfiguration::Environment::populationSize();
+    double totalSeconds = 0.0;
+
+    for (auto s : stepSeconds) {
+        totalSeconds += s;
+    }
+
+    const double memberStepsPerSecond = numMembers * static_cast<double>(options.numSteps) / totalSeconds;
+    const double agentsPerSecond = population * memberStepsPerSecond;
+    const auto deviceName = ensemble.getDeviceName();
+
+    std::cout << "Backend: ensemble (" << deviceName << ")" << std::endl;
+    std::cout << "Members: " << numMembers << ", grid: " << RunConfiguration::Environment::width << "x" << RunConfiguration::Environment::height
+        << ", agents per member: " << population << std::endl;
+    std::cout << "Trail format: " << getTrailFormatName(options.trailFormat) << ", steps: " << options.numSteps << " (+" << options.numWarmupSteps << " warm-up)" << std::endl;
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << std::left << std::setw(20) << "phase" << std::right << std::setw(12) << "mean ms" << std::setw(12) << "p50 ms" << std::setw(12) << "p99 ms" << std::endl;
+    std::cout << std::left << std::setw(20) << stepSummary.name << std::right << std::setw(12) << stepSummary.meanMs << std::setw(12) << stepSummary.p50Ms << std::setw(12) << stepSummary.p99Ms << std::endl;
+    std::cout << "Render and read back all members: " << 1000.0 * renderSeconds.count() << " ms, mean brightness: " << meanBrightness << std::endl;
+    std::cout << "Member steps per second: " << std::setprecision(1) << memberStepsPerSecond << ", agents updated per second: " << std::setprecision(0) << agentsPerSecond << std::endl;
+
+    std::ofstream json(options.jsonPath);
+    auto timestamp = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+    json << std::setprecision(6);
+    json << "{\n";
+    json << "  \"timestamp\": " << timestamp << ",\n";
+    json << "  \"backend\": \"ensemble\",\n";
+    json << "  \"device\": \"" << jsonEscape(deviceName) << "\",\n";
+    json << "  \"build\": { \"type\": \"" << buildType() << "\", \"compiler\": \"" << compiler() << "\", \"simd\": \"" << Simd::name() << "\" },\n";
+    json << "  \"config\": { \"width\": " << RunConfiguration::Environment::width << ", \"height\": " << RunConfiguration::Environment::height
+        << ", \"population\": " << population << ", \"members\": " << numMembers << ", \"trailFormat\": \"" << getTrailFormatName(options.trailFormat) << "\" },\n";
+    json << "  \"steps\": " << options.numSteps << ",\n";
+    json << "  \"warmupSteps\": " << options.numWarmupSteps << ",\n";
+    json << "  \"step\": { \"meanMs\": " << stepSummary.meanMs << ", \"p50Ms\": " << stepSummary.p50Ms << ", \"p99Ms\": " << stepSummary.p99Ms << " },\n";
+    json << "  \"renderReadBackMs\": " << 1000.0 * renderSeconds.count() << ",\n";
+    json << "  \"memberStepsPerSecond\": " << memberStepsPerSecond << ",\n";
+    json << "  \"agentsUpdatedPerSecond\": " << agentsPerSecond << "\n";
+    json << "}\n";
+
+    std::cout << "Wrote " << options.jsonPath << std::endl;
+
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    BenchmarkOptions options;
+
+    if (!parseArguments(argc, argv, options)) {
+        std::cout << "Usage: benchmark [--backend cpu|tiled|opencl|multidevice] [--tile-size N] [--steps N] [--warmup N] [--sort-interval N]" << std::endl;
+        std::cout << "                 [--trail-format float32|float16|fixed8.8] [--compare-trail-formats] [--sparse-trail-map on|off]" << std::endl;
+        std::cout << "                 [--summed-area-sensing on|off] [--headings N] [--compare-headings] [--local-size WxH|off]" << std::endl;
+        std::cout << "                 [--compare-local-size] [--tune-work-groups profile|retune]" << std::endl;
+        std::cout << "                 [--load-checkpoint path] [--save-checkpoint path] [--ensemble N] [--compare-multidevice] [--json path]" << std::endl;
+        return 1;
+    }
+
+    if (options.numEnsembleMembers > 0) {
+        return runEnsembleBenchmark(options);
+    }
+
+    SlimeMold* slimeMold = createSlimeMold(options, options.trailFormat);
+
+    if (slimeMold == nullptr) {
+        return 1;
+    }
+
+    std::vector<SimulationPhase> phases;
+    std::map<SimulationPhase, std::vector<double>> phaseSeconds;
+    std::vector<double> stepSeconds;
+    // Share of the trail map tiles active after each measured step, with a sparse trail map
+    std::vector<double> activeTileRatios;
+
+    for (int i = 0; i < options.numWarmupSteps; i++) {
+        slimeMold->run();
+    }
+
+    // Phase timings below are measured here, including the wait for the device. The built-in instrumentation adds
+    //  the time spent by each device command, which is what the OpenCL phases are made of.
+    RunStatistics statistics;
+
+    slimeMold->setStatistics(&statistics);
+
+    for (int i = 0; i < options.numSteps; i++) {
+        double secondsThisStep = 0.0;
+
+        for (auto phase : slimeMold->getStepPhases()) {
+            auto start = std::chrono::steady_clock::now();
+            slimeMold->runPhase(phase);
+            slimeMold->finish();
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+            if (phaseSeconds[phase].empty()) {
+                phases.push_back(phase);
+            }
+
+            phaseSeconds[phase].push_back(elapsed.count());
+            secondsThisStep += elapsed.count();
+        }
+
+        slimeMold->completeStep();
+        stepSeconds.push_back(secondsThisStep);
+
+        // Outside the timed phases, since the OpenCL backend reads the flags back
+        if (slimeMold->getNumTrailTiles() > 0) {
+            activeTileRatios.push_back(static_cast<double>(slimeMold->getNumActiveTrailTiles()) / slimeMold->getNumTrailTiles());
+        }
+    }
+
+    std::vector<PhaseSummary> summaries;
+
+    for (auto phase : phases) {
+        summaries.push_back(summarize(SlimeMold::getPhaseName(phase), phaseSeconds[phase]));
+    }
+
+    const auto stepSummary = summarize("step", stepSeconds);
+    const auto population = RunConfiguration::Environment::populationSize();
+    double totalSeconds = 0.0;
+
+    for (auto s : stepSeconds) {
+        totalSeconds += s;
+    }
+
+    const double agentsPerSecond = population * static_cast<double>(options.numSteps) / totalSeconds;
+    const std::string backend = options.backend;
+    const auto deviceName = slimeMold->getDeviceName();
+    const bool summedAreaSensing = slimeMold->getSummedAreaSensing();
+    const int numHeadings = slimeMold->getNumHeadings();
+    std::string localWorkGroupSize = "off";
+    std::map<std::string, WorkGroupChoice> workGroupChoices;
+    const auto numThreads = slimeMold->getNumThreads();
+    const auto locality = measureAgentLocality(slimeMold, getTrailBytesPerPixel(options.trailFormat));
+
+    std::cout << "Backend: " << backend << " (" << deviceName << ")" << std::endl;
+
+    if (backend == "tiled") {
+        const auto tiled = static_cast<SlimeMoldTiled*>(slimeMold);
+
+        std::cout << "Tiles: " << tiled->getNumTiles() << " of " << options.tileSize << "x" << options.tileSize << ", halo: " << tiled->getHaloWidth() << std::endl;
+    }
+    else if (backend == "multidevice") {
+        const auto stripRows = static_cast<SlimeMoldMultiDevice*>(slimeMold)->getStripRows();
+
+        std::cout << "Strips (first rows):";
+
+        for (size_t i = 0; i + 1 < stripRows.size(); i++) {
+            std::cout << " " << stripRows[i];
+        }
+
+        std::cout << std::endl;
+    }
+    else if (backend == "opencl") {
+        const auto openCl = static_cast<SlimeMoldOpenCl*>(slimeMold);
+
+        if (openCl->getLocalWorkGroupWidth() > 0) {
+            localWorkGroupSize = std::to_string(openCl->getLocalWorkGroupWidth()) + "x" + std::to_string(openCl->getLocalWorkGroupHeight());
+        }
+
+        workGroupChoices = openCl->getWorkGroupChoices();
+        std::cout << "Tiled kernel work-groups: " << localWorkGroupSize << std::endl;
+        std::cout << "Local work sizes:";
+
+        for (auto& entry : workGroupChoices) {
+            std::cout << (entry.first == workGroupChoices.begin()->first ? " " : ", ") << entry.first << " " << describeWorkGroupChoice(entry.second);
+        }
+
+        std::cout << std::endl;
+    }
+
+    std::cout << "Grid: " << RunConfiguration::Environment::width << "x" << RunConfiguration::Environment::height << ", agents: " << population << std::endl;
+    std::cout << "Threads: " << numThreads << ", SIMD: " << Simd::name() << ", trail format: " << getTrailFormatName(options.trailFormat)
+        << ", steps: " << options.numSteps << " (+" << options.numWarmupSteps << " warm-up)" << std::endl;
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << std::left << std::setw(20) << "phase" << std::right << std::setw(12) << "mean ms" << std::setw(12) << "p50 ms" << std::setw(12) << "p99 ms" << std::endl;
+
+    for (auto& summary : summaries) {
+        std::cout << std::left << std::setw(20) << summary.name << std::right << std::setw(12) << summary.meanMs << std::setw(12) << summary.p50Ms << std::setw(12) << summary.p99Ms << std::endl;
+    }
+
+    std::cout << std::left << std::setw(20) << stepSummary.name << std::right << std::setw(12) << stepSummary.meanMs << std::setw(12) << stepSummary.p50Ms << std::setw(12) << stepSummary.p99Ms << std::endl;
+    std::cout << "Agents updated per second: " << std::setprecision(0) << agentsPerSecond << std::endl;
+    std::cout << "Agent sort interval: " << options.agentSortInterval << ", median stride between consecutive agents: " << locality.medianStrideBytes
+        << " bytes, on the same 4 KiB page: " << std::setprecision(1) << 100.0 * locality.samePageRatio << "%" << std::endl;
+
+    if (!activeTileRatios.empty()) {
+        std::cout << "Active trail map tiles: " << 100.0 * mean(activeTileRatios) << "% of " << slimeMold->getNumTrailTiles() << std::endl;
+    }
+
+    std::cout << "Summed-area sensing: " << (summedAreaSensing ? "on" : "off") << " (sensor width " << RunConfiguration::Agent::sensorWidth << ")" << std::endl;
+    std::cout << "Directions: " << (numHeadings > 0 ? std::to_string(numHeadings) + " headings" : "continuous") << std::endl;
+
+    const auto deviceCommandNames = statistics.getDeviceCommandNames();
+
+    if (!deviceCommandNames.empty()) {
+        std::cout << std::endl << statistics.getInstrumentationReport();
+    }
+
+    if (!options.saveCheckpointPath.empty()) {
+        CheckpointWriter checkpointWriter;
+
+        checkpointWriter.save(slimeMold, options.saveCheckpointPath);
+        std::cout << (checkpointWriter.wait() ? "Saved checkpoint " : "Can't save checkpoint ") << options.saveCheckpointPath << std::endl;
+    }
+
+    // The measured simulation isn't needed any more, and the comparison runs need memory of their own
+    delete slimeMold;
+    slimeMold = nullptr;
+
+    std::vector<TrailFormatComparison> comparisons;
+
+    if (options.compareTrailFormats) {
+        comparisons = compareTrailFormats(options);
+
+        std::cout << std::endl << "Accuracy against float32 after " << options.numWarmupSteps + options.numSteps << " steps" << std::endl;
+        std::cout << std::left << std::setw(12) << "format" << std::right << std::setw(14) << "trail MAE" << std::setw(14) << "trail max"
+            << std::setw(14) << "total diff %" << std::setw(14) << "render PSNR" << std::setw(16) << "same square %" << std::endl;
+
+        for (auto& comparison : comparisons) {
+            std::cout << std::left << std::setw(12) << getTrailFormatName(comparison.format) << std::right << std::setprecision(4)
+                << std::setw(14) << comparison.trailMeanAbsError << std::setw(14) << comparison.trailMaxAbsError
+                << std::setw(14) << 100.0 * comparison.trailTotalRelativeError << std::setprecision(2) << std::setw(14) << comparison.renderPsnrDb
+                << std::setw(16) << 100.0 * comparison.agentsOnSameSquareRatio << std::endl;
+        }
+    }
+
+    TrailFormatComparison localSizeComparison;
+
+    if (options.compareLocalSize) {
+        localSizeComparison = compareLocalSize(options);
+
+        std::cout << std::endl << "Tiled kernels in work-groups of " << (options.localWorkGroupWidth > 0 ? std::to_string(options.localWorkGroupWidth) : "16") << "x"
+            << (options.localWorkGroupHeight > 0 ? std::to_string(options.localWorkGroupHeight) : "16") << " against diffuse and sense after "
+            << options.numWarmupSteps + options.numSteps << " steps" << std::endl;
+        std::cout << std::right << std::setw(14) << "trail MAE" << std::setw(14) << "trail max" << std::setw(14) << "total diff %"
+            << std::setw(14) << "render PSNR" << std::setw(16) << "same square %" << std::endl;
+        std::cout << std::setprecision(4) << std::setw(14) << localSizeComparison.trailMeanAbsError << std::setw(14) << localSizeComparison.trailMaxAbsError
+            << std::setw(14) << 100.0 * localSizeComparison.trailTotalRelativeError << std::setprecision(2) << std::setw(14) << localSizeComparison.renderPsnrDb
+            << std::setw(16) << 100.0 * localSizeComparison.agentsOnSameSquareRatio << std::endl;
+    }
+
+    TrailFormatComparison multiDeviceComparison;
+
+    if (options.compareMultiDevice) {
+        multiDeviceComparison = compareMultiDevice(options);
+
+        std::cout << std::endl << "Multi-device against the default device alone after " << options.numWarmupSteps + options.numSteps << " steps" << std::endl;
+        std::cout << std::right << std::setw(14) << "trail MAE" << std::setw(14) << "trail max" << std::setw(14) << "total diff %"
+            << std::setw(14) << "render PSNR" << std::setw(16) << "same square %" << std::endl;
+        std::cout << std::setprecision(4) << std::setw(14) << multiDeviceComparison.trailMeanAbsError << std::setw(14) << multiDeviceComparison.trailMaxAbsError
+            << std::setw(14) << 100.0 * multiDeviceComparison.trailTotalRelativeError << std::setprecision(2) << std::setw(14) << multiDeviceComparison.renderPsnrDb
+            << std::setw(16) << 100.0 * multiDeviceComparison.agentsOnSameSquareRatio << std::endl;
+    }
+
+    HeadingComparison headingComparison;
+
+    if (options.compareHeadings) {
+        headingComparison = compareHeadings(options);
+
+        std::cout << std::endl << headingComparison.numHeadings << " headings against continuous directions after " << options.numWarmupSteps + options.numSteps << " steps" << std::endl;
+        std::cout << std::left << std::setw(12) << "directions" << std::right << std::setw(14) << "step ms" << std::setw(14) << "trail mean"
+            << std::setw(14) << "trail stddev" << std::setw(14) << "covered %" << std::endl;
+
+        for (int i = 0; i < 2; i++) {
+            const auto& run = i == 0 ? headingComparison.continuous : headingComparison.quantized;
+
+            std::cout << std::left << std::setw(12) << (i == 0 ? "continuous" : "headings") << std::right << std::setprecision(3)
+                << std::setw(14) << run.stepMs << std::setw(14) << run.trailMean << std::setw(14) << run.trailStdDev
+                << std::setprecision(2) << std::setw(14) << 100.0 * run.coveredRatio << std::endl;
+        }
+
+        std::cout << std::setprecision(4) << "Distance between the distributions of trail values: " << headingComparison.trailHistogramDistance
+            << ", of agent directions: " << headingComparison.directionHistogramDistance << std::endl;
+        std::cout << "Random new headings, chi-square per degree of freedom against uniform:";
+
+        for (int i = 0; i < 2; i++) {
+            const double chiSquarePerDof = headingComparison.reorientationChiSquarePerDof[i];
+
+            std::cout << (i == 0 ? " " : ", ");
+
+            if (std::isnan(chiSquarePerDof)) {
+                std::cout << "unavailable";
+            }
+            else {
+                std::cout << chiSquarePerDof;
+            }
+
+            std::cout << " on " << (i == 0 ? "cpu" : "opencl");
+        }
+
+        std::cout << std::endl;
+    }
+
+    std::ofstream json(options.jsonPath);
+    auto timestamp = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+    json << std::setprecision(6);
+    json << "{\n";
+    json << "  \"timestamp\": " << timestamp << ",\n";
+    json << "  \"backend\": \"" << backend << "\",\n";
+    json << "  \"device\": \"" << jsonEscape(deviceName) << "\",\n";
+    json << "  \"build\": { \"type\": \"" << buildType() << "\", \"compiler\": \"" << compiler() << "\", \"simd\": \"" << Simd::name() << "\" },\n";
+    json << "  \"machine\": { \"hardwareConcurrency\": " << std::thread::hardware_concurrency() << ", \"threads\": " << numThreads << " },\n";
+    json << "  \"config\": { \"width\": " << RunConfiguration::Environment::width << ", \"height\": " << RunConfiguration::Environment::height
+        << ", \"population\": " << population << ", \"fusedCpuPipeline\": " << (RunConfiguration::Hardware::fusedCpuPipeline ? "true" : "false")
+        << ", \"agentSortInterval\": " << options.agentSortInterval << ", \"trailFormat\": \"" << getTrailFormatName(options.trailFormat) << "\""
+        << ", \"sparseTrailMap\": " << (options.sparseTrailMap ? "true" : "false")
+        << ", \"summedAreaSensing\": " << (summedAreaSensing ? "true" : "false")
+        << ", \"numHeadings\": " << numHeadings;
+
+    if (backend == "tiled") {
+        json << ", \"tileSize\": " << options.tileSize;
+    }
+    else if (backend == "opencl") {
+        json << ", \"localWorkGroupSize\": \"" << localWorkGroupSize << "\", \"workGroups\": {";
+
+        for (auto& entry : workGroupChoices) {
+            json << (entry.first == workGroupChoices.begin()->first ? " " : ", ") << "\"" << entry.first << "\": \"" << describeWorkGroupChoice(entry.second) << "\"";
+        }
+
+        json << " }";
+    }
+
+    json << " },\n";
+    json << "  \"steps\": " << options.numSteps << ",\n";
+    json << "  \"warmupSteps\": " << options.numWarmupSteps << ",\n";
+    json << "  \"phases\": [\n";
+
+    for (size_t i = 0; i < summaries.size(); i++) {
+        auto& summary = summaries[i];
+        json << "    { \"name\": \"" << summary.name << "\", \"meanMs\": " << summary.meanMs << ", \"p50Ms\": " << summary.p50Ms << ", \"p99Ms\": " << summary.p99Ms << " }"
+            << (i + 1 < summaries.size() ? "," : "") << "\n";
+    }
+
+    json << "  ],\n";
+    json << "  \"step\": { \"meanMs\": " << stepSummary.meanMs << ", \"p50Ms\": " << stepSummary.p50Ms << ", \"p99Ms\": " << stepSummary.p99Ms << " },\n";
+    json << "  \"agentsUpdatedPerSecond\": " << agentsPerSecond << ",\n";
+    json << "  \"agentLocality\": { \"medianStrideBytes\": " << locality.medianStrideBytes << ", \"samePageRatio\": " << locality.samePageRatio << " },\n";
+
+    if (!activeTileRatios.empty()) {
+        json << "  \"activeTrailTileRatio\": " << mean(activeTileRatios) << ",\n";
+    }
+
+    json << "  \"deviceCommands\": [\n";
+
+    for (size_t i = 0; i < deviceCommandNames.size(); i++) {
+        auto& command = statistics.getDeviceCommandStatistics(deviceCommandNames[i]);
+        json << "    { \"name\": \"" << deviceCommandNames[i] << "\", \"count\": " << command.startToEnd.getCount()
+            << ", \"queuedMeanMs\": " << 1000.0 * command.queuedToSubmit.getMeanSeconds()
+            << ", \"submittedMeanMs\": " << 1000.0 * command.submitToStart.getMeanSeconds()
+            << ", \"runningMeanMs\": " << 1000.0 * command.startToEnd.getMeanSeconds()
+            << ", \"runningP99Ms\": " << 1000.0 * command.startToEnd.getPercentileSeconds(99.0)
+            << ", \"bytes\": " << command.bytes.load() << " }"
+            << (i + 1 < deviceCommandNames.size() ? "," : "") << "\n";
+    }
+
+    json << "  ],\n";
+    json << "  \"trailFormatComparison\": [\n";
+
+    for (size_t i = 0; i < comparisons.size(); i++) {
+        auto& comparison = comparisons[i];
+        json << "    { \"format\": \"" << getTrailFormatName(comparison.format) << "\", \"trailMeanAbsError\": " << comparison.trailMeanAbsError
+            << ", \"trailMaxAbsError\": " << comparison.trailMaxAbsError
+            << ", \"trailTotalRelativeError\": " << comparison.trailTotalRelativeError
+            << ", \"renderPsnrDb\": " << comparison.renderPsnrDb
+            << ", \"agentsOnSameSquareRatio\": " << comparison.agentsOnSameSquareRatio << " }"
+            << (i + 1 < comparisons.size() ? "," : "") << "\n";
+    }
+
+    json << "  ]";
+
+    if (options.compareLocalSize) {
+        json << ",\n  \"localSizeComparison\": { \"trailMeanAbsError\": " << localSizeComparison.trailMeanAbsError
+            << ", \"trailMaxAbsError\": " << localSizeComparison.trailMaxAbsError
+            << ", \"trailTotalRelativeError\": " << localSizeComparison.trailTotalRelativeError
+            << ", \"renderPsnrDb\": " << localSizeComparison.renderPsnrDb
+            << ", \"agentsOnSameSquareRatio\": " << localSizeComparison.agentsOnSameSquareRatio << " }";
+    }
+
+    if (options.compareMultiDevice) {
+        json << ",\n  \"multiDeviceComparison\": { \"trailMeanAbsError\": " << multiDeviceComparison.trailMeanAbsError
+            << ", \"trailMaxAbsError\": " << multiDeviceComparison.trailMaxAbsError
+            << ", \"trailTotalRelativeError\": " << multiDeviceComparison.trailTotalRelativeError
+            << ", \"renderPsnrDb\": " << multiDeviceComparison.renderPsnrDb
+            << ", \"agentsOnSameSquareRatio\": " << multiDeviceComparison.agentsOnSameSquareRatio << " }";
+    }
+
+    if (options.compareHeadings) {
+        json << ",\n  \"headingComparison\": { \"numHeadings\": " << headingComparison.numHeadings;
+
+        for (int i = 0; i < 2; i++) {
+            const auto& run = i == 0 ? headingComparison.continuous : headingComparison.quantized;
+
+            json << ", \"" << (i == 0 ? "continuous" : "quantized") << "\": { \"stepMs\": " << run.stepMs << ", \"trailMean\": " << run.trailMean
+                << ", \"trailStdDev\": " << run.trailStdDev << ", \"coveredRatio\": " << run.coveredRatio << " }";
+        }
+
+        json << ", \"trailHistogramDistance\": " << headingComparison.trailHistogramDistance
+            << ", \"directionHistogramDistance\": " << headingComparison.directionHistogramDistance
+            << ", \"reorientationChiSquarePerDof\": { ";
+
+        // NaN isn't JSON
+        for (int i = 0; i < 2; i++) {
+            const double chiSquarePerDof = headingComparison.reorientationChiSquarePerDof[i];
+
+            json << (i == 0 ? "\"cpu\": " : ", \"opencl\": ");
+
+            if (std::isnan(chiSquarePerDof)) {
+                json << "null";
+            }
+            else {
+                json << chiSquarePerDof;
+            }
+        }
+
+        json << " } }";
+    }
+
+    json << "\n}\n";
+
+    std::cout << "Wrote " << options.jsonPath << std::endl;
+
+    return 0;
+}
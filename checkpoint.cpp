@@ -0,0 +1,202 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+
+#include "checkpoint.h"
+#include "trailformat.h"
+#include "utils.h"
+
+static const char checkpointMagic[8] = { 'S', 'L', 'I', 'M', 'E', 'C', 'P', '\0' };
+// Bump when the layout changes. Older files are rejected rather than misread
+static const uint32_t checkpointVersion = 1;
+static const uint64_t checkpointAlignment = 64;
+
+static uint64_t alignOffset(uint64_t offset) {
+    return (offset + checkpointAlignment - 1) / checkpointAlignment * checkpointAlignment;
+}
+
+static CheckpointHeader makeHeader(const SimulationState& state) {
+    CheckpointHeader header;
+
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, checkpointMagic, sizeof(checkpointMagic));
+    header.version = checkpointVersion;
+    header.headerSize = sizeof(CheckpointHeader);
+    header.width = RunConfiguration::Environment::width;
+    header.height = RunConfiguration::Environment::height;
+    header.trailFormat = static_cast<uint32_t>(state.trailFormat);
+    header.randomSeed = RunConfiguration::Environment::randomSeed;
+    header.step = state.step;
+    header.agentSize = sizeof(Agent);
+    header.numAgents = state.agents.size();
+    header.trailBytes = state.trailMaps[0].size();
+    header.agentsOffset = alignOffset(sizeof(CheckpointHeader));
+    header.agentIdsOffset = alignOffset(header.agentsOffset + header.numAgents * sizeof(Agent));
+    header.trailMapOffsets[0] = alignOffset(header.agentIdsOffset + header.numAgents * sizeof(unsigned int));
+    header.trailMapOffsets[1] = alignOffset(header.trailMapOffsets[0] + header.trailBytes);
+
+    return header;
+}
+
+static bool writeCheckpoint(const SimulationState& state, const std::string& path) {
+    const std::string temporaryPath = Utils::Files::makeTemporaryPath(path);
+    const auto header = makeHeader(state);
+
+    {
+        std::ofstream f(temporaryPath, std::ios::binary | std::ios::trunc);
+
+        auto writeSection = [&f](uint64_t offset, const void* data, uint64_t size) {
+            // Zero padding up to the aligned offset
+            static const char padding[checkpointAlignment] = {};
+            const auto position = static_cast<uint64_t>(f.tellp());
+
+            f.write(padding, static_cast<std::streamsize>(offset - position));
+            f.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+        };
+
+        f.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        writeSection(header.agentsOffset, state.agents.data(), header.numAgents * sizeof(Agent));
+        writeSection(header.agentIdsOffset, state.agentIds.data(), header.numAgents * sizeof(unsigned int));
+
+        for (int i = 0; i < 2; i++) {
+            writeSection(header.trailMapOffsets[i], state.trailMaps[i].data(), header.trailBytes);
+        }
+
+        if (!f) {
+            f.close();
+            std::remove(temporaryPath.c_str());
+            return false;
+        }
+    }
+
+    return Utils::Files::replaceFile(temporaryPath, path);
+}
+
+CheckpointWriter::CheckpointWriter() {
+    lastSaveSucceeded = true;
+}
+
+CheckpointWriter::~CheckpointWriter() {
+    wait();
+}
+
+void CheckpointWriter::save(SlimeMold* slimeMold, const std::string& path) {
+    wait();
+
+    // The snapshot is the only part that has to happen between two steps
+    auto state = std::make_shared<SimulationState>(slimeMold->exportState());
+
+    writerThread = std::thread([this, state, path]() {
+        lastSaveSucceeded = writeCheckpoint(*state, path);
+    });
+}
+
+bool CheckpointWriter::wait() {
+    if (writerThread.joinable()) {
+        writerThread.join();
+    }
+
+    return lastSaveSucceeded;
+}
+
+bool loadCheckpoint(SlimeMold* slimeMold, const std::string& path, std::string& error) {
+    Utils::MappedFile file(path);
+    CheckpointHeader header;
+
+    if (!file.isOpen() || file.size() < sizeof(CheckpointHeader)) {
+        error = "can't read " + path;
+        return false;
+    }
+
+    std::memcpy(&header, file.data(), sizeof(header));
+
+    if (std::memcmp(header.magic, checkpointMagic, sizeof(checkpointMagic)) != 0) {
+        error = path + " is not a checkpoint";
+        return false;
+    }
+
+    if (header.version != checkpointVersion || header.headerSize != sizeof(CheckpointHeader) || header.agentSize != sizeof(Agent)) {
+        error = "checkpoint version " + std::to_string(header.version) + " is not supported, expected " + std::to_string(checkpointVersion);
+        return false;
+    }
+
+    if (header.width != RunConfiguration::Environment::width || header.height != RunConfiguration::Environment::height) {
+        error = "checkpoint is " + std::to_string(header.width) + "x" + std::to_string(header.height) + ", the environment is "
+            + std::to_string(RunConfiguration::Environment::width) + "x" + std::to_string(RunConfiguration::Environment::height);
+        return false;
+    }
+
+    if (header.numAgents != static_cast<uint64_t>(RunConfiguration::Environment::populationSize())) {
+        error = "checkpoint has " + std::to_string(header.numAgents) + " agents, the population is " + std::to_string(RunConfiguration::Environment::populationSize());
+        return false;
+    }
+
+    const auto trailFormat = static_cast<TrailFormat>(header.trailFormat);
+
+    if (header.trailFormat > static_cast<uint32_t>(TrailFormat::Fixed8_8)
+        || header.trailBytes != static_cast<uint64_t>(RunConfiguration::Environment::numPixels()) * getTrailBytesPerPixel(trailFormat)) {
+        error = "checkpoint has an unknown trail map format";
+        return false;
+    }
+
+    struct Section {
+        const char* name;
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    // The sizes can't overflow, numAgents and trailBytes match the configuration
+    const Section sections[] = {
+        { "agents", header.agentsOffset, header.numAgents * sizeof(Agent) },
+        { "agent ids", header.agentIdsOffset, header.numAgents * sizeof(unsigned int) },
+        { "current trail map", header.trailMapOffsets[0], header.trailBytes },
+        { "next trail map", header.trailMapOffsets[1], header.trailBytes }
+    };
+    uint64_t sectionsEnd = sizeof(CheckpointHeader);
+
+    // Nothing past the header is read before every section is known to be inside the mapping. In the order written by
+    //  writeCheckpoint, aligned and without overlaps. The comparisons are arranged so they can't overflow
+    for (auto& section : sections) {
+        if (section.offset > file.size() || section.size > file.size() - section.offset) {
+            error = path + " is truncated: the " + section.name + " section ends past the end of the file";
+            return false;
+        }
+
+        if (section.offset < sectionsEnd || section.offset % checkpointAlignment != 0) {
+            error = "checkpoint is corrupt: the " + std::string(section.name) + " section overlaps the one before it or is misaligned";
+            return false;
+        }
+
+        sectionsEnd = section.offset + section.size;
+    }
+
+    const auto agentIds = reinterpret_cast<const unsigned int*>(file.data() + header.agentIdsOffset);
+    std::vector<bool> idSeen(static_cast<size_t>(header.numAgents), false);
+
+    // The ids index arrays of the backends, so they have to be a permutation
+    for (uint64_t i = 0; i < header.numAgents; i++) {
+        if (agentIds[i] >= header.numAgents || idSeen[agentIds[i]]) {
+            error = "checkpoint has invalid agent ids";
+            return false;
+        }
+
+        idSeen[agentIds[i]] = true;
+    }
+
+    SimulationStateView state;
+
+    state.step = header.step;
+    state.trailFormat = trailFormat;
+    state.numAgents = static_cast<size_t>(header.numAgents);
+    state.agents = reinterpret_cast<const Agent*>(file.data() + header.agentsOffset);
+    state.agentIds = agentIds;
+
+    for (int i = 0; i < 2; i++) {
+        state.trailMaps[i] = file.data() + header.trailMapOffsets[i];
+    }
+
+    slimeMold->importState(state);
+
+    return true;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+#include "slimemold.h"
+
+/*
+Checkpoints hold the whole state of a run (see SimulationState), so a run can be stopped and continued later, or
+several experiments can start from the same warm state.
+
+File layout, native byte order (little endian on every platform this runs on):
+
+    CheckpointHeader
+    agents          numAgents * sizeof(Agent), in memory order
+    agent ids       numAgents * 4 bytes
+    trail map 0     trailBytes, the current map
+    trail map 1     trailBytes
+
+Every section starts at the offset given in the header, aligned to 64 bytes. Files are loaded by mapping them into
+memory, so the backends copy straight from the page cache into their own buffers and nothing is parsed.
+*/
+
+struct CheckpointHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint32_t width;
+    uint32_t height;
+    uint32_t trailFormat;
+    uint32_t randomSeed;
+    uint32_t step;
+    uint32_t agentSize;
+    uint64_t numAgents;
+    uint64_t agentsOffset;
+    uint64_t agentIdsOffset;
+    uint64_t trailMapOffsets[2];
+    uint64_t trailBytes;
+};
+
+static_assert(sizeof(CheckpointHeader) == 88, "CheckpointHeader must have the same layout everywhere");
+
+/// <summary>
+/// Saves checkpoints in the background. save() takes a snapshot of the simulation on the calling thread, which is
+/// a copy in memory, and a thread of its own writes it to disk while the simulation continues. The file is written
+/// under a temporary name and renamed when complete, so a crash never leaves a broken checkpoint behind.
+///
+/// CheckpointWriter checkpointWriter;
+/// checkpointWriter.save(slimeMold, "run.checkpoint");
+/// ...
+/// checkpointWriter.wait();
+/// </summary>
+class CheckpointWriter {
+public:
+    CheckpointWriter();
+    // Waits for the last save
+    ~CheckpointWriter();
+    // Only one save is written at a time. If the previous one isn't done yet, this waits for it first
+    void save(SlimeMold* slimeMold, const std::string& path);
+    // Block until the last save is on disk. Returns false if it failed
+    bool wait();
+private:
+    std::thread writerThread;
+    std::atomic<bool> lastSaveSucceeded;
+};
+
+// Continue slimeMold from the checkpoint at path. The map size and population have to match the run configuration.
+//  The random seed doesn't: with the same seed the run continues exactly as it would have, with another one it forks.
+//  Returns false and describes the reason in error if the checkpoint can't be used.
+bool loadCheckpoint(SlimeMold* slimeMold, const std::string& path, std::string& error);
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+Counter-based random numbers shared by the CPU backend and the OpenCL kernels.
+
+Each number is a pure function of (seed, stream, step, index), computed with the Philox2x32-10 generator from
+"Parallel random numbers: as easy as 1, 2, 3" (Salmon et al. 2011). There is no generator state to share, so any thread
+or work item can draw the numbers for its agent, and a run gives the same result regardless of thread count or device.
+
+The code below is written in the common subset of C++ and OpenCL C. COUNTER_RNG_CODE compiles it for the host and also
+keeps it as the string counterRngSource, which SlimeMoldOpenCl prepends to the kernel source. Keep preprocessor
+directives out of it, they can't be part of a macro argument.
+*/
+
+typedef uint32_t rng_uint;
+typedef uint64_t rng_ulong;
+#define RNG_FN static inline
+
+#define COUNTER_RNG_CODE(...) __VA_ARGS__ \
+    static const char* const counterRngSource = "typedef uint rng_uint;\ntypedef ulong rng_ulong;\n#define RNG_FN static inline\n" #__VA_ARGS__ "\n";
+
+COUNTER_RNG_CODE(
+// Every use of randomness has its own stream, so the numbers drawn for different purposes are independent
+enum RngStream {
+    RNG_STREAM_MOVE_PRIORITY = 0,
+    RNG_STREAM_MOVE_DIRECTION = 1,
+    RNG_STREAM_SENSE = 2,
+    // Start positions of ensemble members. The step is the coordinate: 0 = x, 1 = y, 2 = direction
+    RNG_STREAM_ENSEMBLE_INIT = 3
+};
+
+RNG_FN rng_uint counterRng(rng_uint seed, rng_uint stream, rng_uint step, rng_uint index)
+{
+    rng_uint c0 = index;
+    rng_uint c1 = step;
+    rng_uint key = seed ^ (stream * 0x632BE5ABu);
+
+    for (int i = 0; i < 10; i++) {
+        rng_ulong product = (rng_ulong)0xD256D193u * c0;
+        rng_uint hi = (rng_uint)(product >> 32);
+        rng_uint lo = (rng_uint)product;
+        c0 = hi ^ key ^ c1;
+        c1 = lo;
+        key += 0x9E3779B9u;
+    }
+
+    return c0;
+}
+
+// Uniform in [0, 1). The top 24 bits fill the float mantissa exactly
+RNG_FN float counterRngFloat(rng_uint seed, rng_uint stream, rng_uint step, rng_uint index)
+{
+    return (float)(counterRng(seed, stream, step, index) >> 8) * (1.0f / 16777216.0f);
+}
+
+// Finalizer of MurmurHash3. Every step is invertible, which makes the whole function a bijection
+RNG_FN rng_uint rngBijection(rng_uint v)
+{
+    v ^= v >> 16;
+    v *= 0x85ebca6bu;
+    v ^= v >> 13;
+    v *= 0xc2b2ae35u;
+    v ^= v >> 16;
+
+    return v;
+}
+
+// Priority of an agent when claiming a square during a move. Random per step, but unique among agents, and never 0 so
+//  a claimed square can be told apart from one without claims. The agent that would draw 0 gets the priority of agent
+//  0xffffffff instead, which doesn't exist
+RNG_FN rng_uint counterRngMovePriority(rng_uint seed, rng_uint step, rng_uint agentIdx)
+{
+    rng_uint key = counterRng(seed, RNG_STREAM_MOVE_PRIORITY, step, 0);
+    rng_uint priority = rngBijection(agentIdx ^ key);
+
+    return priority != 0 ? priority : rngBijection(0xffffffffu ^ key);
+}
+)
@@ -0,0 +1,230 @@
+#include <algorithm>
+#include <vector>
+
+#include "diffusioncpu.h"
+#include "simd.h"
+#include "trailformat.h"
+
+// The running sums are recomputed from scratch this often (rows for the column sums, pixels for the horizontal
+//  window) so that rounding errors from adding and subtracting can't build up over a whole row or column
+const int columnSumReseedInterval = 64;
+const int windowSumAnchorInterval = 128;
+
+DiffusionCpu::DiffusionCpu(int tWidth, int tHeight, int tKernelSize, float diffusionRatio, float tDecay, float tMaxChemo, TrailFormat tTrailFormat) {
+    width = tWidth;
+    height = tHeight;
+    kernelSize = tKernelSize;
+    kernelHalf = tKernelSize / 2;
+    weightBlur = diffusionRatio / (kernelSize * kernelSize + 1);
+    weightCurrent = 1.0f - diffusionRatio;
+    decay = tDecay;
+    maxChemo = tMaxChemo;
+    trailFormat = tTrailFormat;
+}
+
+int DiffusionCpu::getPreferredRowsPerChunk() const {
+    return std::max(16, 2 * kernelSize);
+}
+
+int DiffusionCpu::getColumnBlockWidth() const {
+    return windowSumAnchorInterval;
+}
+
+void DiffusionCpu::diffuseRows(const void* source, void* destination, int rowStart, int rowEndExclusive) const {
+    diffuseDecayRenderBlocks(source, destination, nullptr, rowStart, rowEndExclusive, 0, width, nullptr);
+}
+
+void DiffusionCpu::diffuseDecayRenderRows(const void* source, void* destination, unsigned char* render, int rowStart, int rowEndExclusive) const {
+    diffuseDecayRenderBlocks(source, destination, render, rowStart, rowEndExclusive, 0, width, nullptr);
+}
+
+void DiffusionCpu::diffuseDecayRenderBlocks(const void* source, void* destination, unsigned char* render, int rowStart, int rowEndExclusive, int colStart, int colEndExclusive, bool* nonZeroBlocks) const {
+    dispatchTrailFormat(trailFormat, [&](auto codec) {
+        typedef typename decltype(codec)::Storage Storage;
+        processRows<decltype(codec)>(static_cast<const Storage*>(source), static_cast<Storage*>(destination), render, rowStart, rowEndExclusive, colStart, colEndExclusive, nonZeroBlocks);
+    });
+}
+
+template <class Codec>
+void DiffusionCpu::processRows(const typename Codec::Storage* source, typename Codec::Storage* destination, unsigned char* render, int rowStart, int rowEndExclusive, int colStart, int colEndExclusive, bool* nonZeroBlocks) const {
+    // Column sums are padded with zeros on both sides so the horizontal window never needs a bounds check.
+    //  One extra on the left since the window sum is updated with the column that just left it.
+    static thread_local std::vector<float> paddedColumnSums;
+    // One row of the result in float. It is decayed and rendered from here before it's stored in the trail format
+    static thread_local std::vector<float> rowBuffer;
+    const int padLeft = kernelHalf + 1;
+    const int padRight = kernelHalf;
+
+    paddedColumnSums.assign(padLeft + width + padRight, 0.0f);
+    rowBuffer.resize(width);
+
+    float* columnSums = paddedColumnSums.data() + padLeft;
+    // Columns whose sums the blur of [colStart, colEndExclusive) reads. Each column sum only depends on its own column,
+    //  so they come out the same as in a sweep over the whole row
+    const int sumStart = std::max(0, colStart - kernelHalf - 1);
+    const int sumEndExclusive = std::min(width, colEndExclusive + kernelHalf);
+    int rowSeeded = -1;
+
+    if (nonZeroBlocks != nullptr) {
+        std::fill(nonZeroBlocks, nonZeroBlocks + (colEndExclusive - colStart + windowSumAnchorInterval - 1) / windowSumAnchorInterval, false);
+    }
+
+    for (int row = rowStart; row < rowEndExclusive; row++) {
+        if (rowSeeded == -1 || row - rowSeeded == columnSumReseedInterval) {
+            std::fill(columnSums + sumStart, columnSums + sumEndExclusive, 0.0f);
+
+            for (int rowWindow = std::max(0, row - kernelHalf); rowWindow <= std::min(height - 1, row + kernelHalf); rowWindow++) {
+                addRow<Codec>(columnSums, source + rowWindow * width, sumStart, sumEndExclusive);
+            }
+
+            rowSeeded = row;
+        }
+        else {
+            const int rowEntering = row + kernelHalf;
+            const int rowLeaving = row - kernelHalf - 1;
+
+            if (rowEntering < height) {
+                addRow<Codec>(columnSums, source + rowEntering * width, sumStart, sumEndExclusive);
+            }
+
+            if (rowLeaving >= 0) {
+                subtractRow<Codec>(columnSums, source + rowLeaving * width, sumStart, sumEndExclusive);
+            }
+        }
+
+        blurRow<Codec>(columnSums, source + row * width, rowBuffer.data(), colStart, colEndExclusive);
+
+        if (render != nullptr) {
+            decayRenderRow(rowBuffer.data(), render + row * width, colStart, colEndExclusive);
+        }
+
+        if (nonZeroBlocks != nullptr) {
+            for (int blockStart = colStart; blockStart < colEndExclusive; blockStart += windowSumAnchorInterval) {
+                bool& nonZero = nonZeroBlocks[(blockStart - colStart) / windowSumAnchorInterval];
+                const bool nonZeroRow = storeRow<Codec>(rowBuffer.data(), destination + row * width, blockStart, std::min(colEndExclusive, blockStart + windowSumAnchorInterval));
+
+                nonZero = nonZero || nonZeroRow;
+            }
+        }
+        else {
+            storeRow<Codec>(rowBuffer.data(), destination + row * width, colStart, colEndExclusive);
+        }
+    }
+}
+
+template <class Codec>
+void DiffusionCpu::addRow(float* columnSums, const typename Codec::Storage* row, int xStart, int xEndExclusive) const {
+    int x = xStart;
+
+    for (; x + Simd::width <= xEndExclusive; x += Simd::width) {
+        Simd::store(columnSums + x, Simd::add(Simd::load(columnSums + x), Codec::load(row + x)));
+    }
+
+    for (; x < xEndExclusive; x++) {
+        columnSums[x] += Codec::decode(row[x]);
+    }
+}
+
+template <class Codec>
+void DiffusionCpu::subtractRow(float* columnSums, const typename Codec::Storage* row, int xStart, int xEndExclusive) const {
+    int x = xStart;
+
+    for (; x + Simd::width <= xEndExclusive; x += Simd::width) {
+        Simd::store(columnSums + x, Simd::sub(Simd::load(columnSums + x), Codec::load(row + x)));
+    }
+
+    for (; x < xEndExclusive; x++) {
+        columnSums[x] -= Codec::decode(row[x]);
+    }
+}
+
+template <class Codec>
+void DiffusionCpu::blurRow(const float* columnSums, const typename Codec::Storage* source, float* destination, int xStart, int xEndExclusive) const {
+    const Simd::Float vWeightBlur = Simd::set1(weightBlur);
+    const Simd::Float vWeightCurrent = Simd::set1(weightCurrent);
+
+    // Window sum of the pixel before x. columnSums is padded, so this is valid for x = 0 as well
+    auto exactWindowSum = [this, columnSums](int x) -> float {
+        float windowSum = 0.0f;
+
+        for (int xd = x - 1 - kernelHalf; xd <= x - 1 + kernelHalf; xd++) {
+            windowSum += columnSums[xd];
+        }
+
+        return windowSum;
+    };
+
+    // The window sum is anchored at the same columns whatever the range, so a block is computed the same way in a
+    //  partial row as in a whole one
+    for (int blockStart = xStart; blockStart < xEndExclusive; blockStart += windowSumAnchorInterval) {
+        const int blockEndExclusive = std::min(xEndExclusive, blockStart + windowSumAnchorInterval);
+        int x = blockStart;
+        Simd::Float windowSums = Simd::set1(exactWindowSum(x));
+
+        // Moving the window one step adds the column entering it and subtracts the one leaving it. For a whole
+        //  vector of pixels that is a prefix sum of those differences on top of the previous window sum.
+        for (; x + Simd::width <= blockEndExclusive; x += Simd::width) {
+            const Simd::Float differences = Simd::sub(Simd::load(columnSums + x + kernelHalf), Simd::load(columnSums + x - kernelHalf - 1));
+            const Simd::Float sums = Simd::add(Simd::prefixSum(differences), Simd::broadcastLast(windowSums));
+            const Simd::Float newVal = Simd::add(Simd::mul(vWeightBlur, sums), Simd::mul(vWeightCurrent, Codec::load(source + x)));
+
+            Simd::store(destination + x, newVal);
+            windowSums = sums;
+        }
+
+        if (x < blockEndExclusive) {
+            float windowSum = exactWindowSum(x);
+
+            for (; x < blockEndExclusive; x++) {
+                windowSum += columnSums[x + kernelHalf] - columnSums[x - kernelHalf - 1];
+                destination[x] = weightBlur * windowSum + weightCurrent * Codec::decode(source[x]);
+            }
+        }
+    }
+}
+
+template <class Codec>
+bool DiffusionCpu::storeRow(const float* row, typename Codec::Storage* destination, int xStart, int xEndExclusive) const {
+    // The running sums can leave tiny negative values where the map is empty, so both signs count
+    const Simd::Float vZero = Simd::set1(0.0f);
+    Simd::Float rowMin = vZero;
+    Simd::Float rowMax = vZero;
+    bool nonZeroTail = false;
+    int x = xStart;
+
+    for (; x + Simd::width <= xEndExclusive; x += Simd::width) {
+        const Simd::Float value = Simd::load(row + x);
+
+        Codec::store(destination + x, value);
+        rowMin = Simd::min(rowMin, value);
+        rowMax = Simd::max(rowMax, value);
+    }
+
+    for (; x < xEndExclusive; x++) {
+        destination[x] = Codec::encode(row[x]);
+        nonZeroTail = nonZeroTail || row[x] != 0.0f;
+    }
+
+    return Simd::maskBits(Simd::cmpLt(rowMin, vZero)) != 0 || Simd::maskBits(Simd::cmpGt(rowMax, vZero)) != 0 || nonZeroTail;
+}
+
+void DiffusionCpu::decayRenderRow(float* trail, unsigned char* render, int xStart, int xEndExclusive) const {
+    const Simd::Float vDecay = Simd::set1(decay);
+    const Simd::Float vMin = Simd::set1(0.0f);
+    const Simd::Float vMax = Simd::set1(maxChemo);
+    int x = xStart;
+
+    for (; x + Simd::width <= xEndExclusive; x += Simd::width) {
+        const Simd::Float chemo = Simd::min(vMax, Simd::max(vMin, Simd::sub(Simd::load(trail + x), vDecay)));
+
+        Simd::store(trail + x, chemo);
+        Simd::storeBytes(render + x, chemo);
+    }
+
+    for (; x < xEndExclusive; x++) {
+        const float chemo = std::min(maxChemo, std::max(0.0f, trail[x] - decay));
+
+        trail[x] = chemo;
+        render[x] = static_cast<unsigned char>(chemo);
+    }
+}
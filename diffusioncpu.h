@@ -0,0 +1,67 @@
+#pragma once
+
+#include "slimemold.h"
+
+/// <summary>
+/// Box blur used for the diffusion step of the CPU backend. For every pixel the result is
+///
+///     ratio * (sum of the kernelSize x kernelSize neighbourhood) / (kernelSize * kernelSize + 1) + (1 - ratio) * pixel
+///
+/// where pixels outside the map count as zero. This is the same normalisation the OpenCL kernel uses.
+///
+/// The blur is separable and computed with running sums, so the cost per pixel does not depend on the kernel size:
+///  a column sum per x is slid down the rows (add the row entering the window, subtract the one leaving it) and the
+///  horizontal window over the column sums is a prefix sum of their differences. Rows are processed in order, which
+///  keeps all accesses sequential. The borders are handled by zero padding and per-row checks, never in the inner
+///  loops. All inner loops run on Simd::Float.
+///
+/// diffuseDecayRenderRows fuses the following decay and render steps into the same sweep: each output row is decayed,
+/// clamped and converted to render bytes while it is still in L1, instead of in two more passes over the whole map.
+///
+/// diffuseDecayRenderBlocks computes a range of column blocks only, e.g. to skip parts of the map that are known to be
+/// empty, and reports which blocks came out non-zero. Column sums depend only on their own column and the window sum
+/// is anchored at the start of every block of getColumnBlockWidth() columns, so a block gets exactly the values a sweep
+/// over the whole row would give it.
+///
+/// The maps are stored in the given TrailFormat. Rows are decoded to float on load and the result is only rounded to
+/// the storage format when it is written, so the blur itself always runs in float.
+/// </summary>
+class DiffusionCpu {
+public:
+    DiffusionCpu(int width, int height, int kernelSize, float diffusionRatio, float decay, float maxChemo, TrailFormat trailFormat);
+    // Diffuse rows [rowStart, rowEndExclusive) from source into destination. Different row ranges can run in parallel.
+    //  Both maps hold width * height pixels in the trail format given to the constructor.
+    void diffuseRows(const void* source, void* destination, int rowStart, int rowEndExclusive) const;
+    // Same as diffuseRows, followed by decay and clamping of destination and conversion of the result into render
+    void diffuseDecayRenderRows(const void* source, void* destination, unsigned char* render, int rowStart, int rowEndExclusive) const;
+    // Same as diffuseDecayRenderRows (render = nullptr: diffuseRows) for the columns [colStart, colEndExclusive) only.
+    //  colStart has to be a multiple of getColumnBlockWidth(). nonZeroBlocks gets a flag per column block in the range,
+    //  set if any pixel of the result in that block is non-zero
+    void diffuseDecayRenderBlocks(const void* source, void* destination, unsigned char* render, int rowStart, int rowEndExclusive, int colStart, int colEndExclusive, bool* nonZeroBlocks) const;
+    int getColumnBlockWidth() const;
+    // Smallest row range worth handing to a thread. Each range has to seed its column sums with kernelSize rows.
+    int getPreferredRowsPerChunk() const;
+private:
+    // render = nullptr skips the decay and render part, nonZeroBlocks = nullptr the flags
+    template <class Codec>
+    void processRows(const typename Codec::Storage* source, typename Codec::Storage* destination, unsigned char* render, int rowStart, int rowEndExclusive, int colStart, int colEndExclusive, bool* nonZeroBlocks) const;
+    template <class Codec>
+    void addRow(float* columnSums, const typename Codec::Storage* row, int xStart, int xEndExclusive) const;
+    template <class Codec>
+    void subtractRow(float* columnSums, const typename Codec::Storage* row, int xStart, int xEndExclusive) const;
+    template <class Codec>
+    void blurRow(const float* columnSums, const typename Codec::Storage* source, float* destination, int xStart, int xEndExclusive) const;
+    // Returns whether any pixel is non-zero
+    template <class Codec>
+    bool storeRow(const float* row, typename Codec::Storage* destination, int xStart, int xEndExclusive) const;
+    void decayRenderRow(float* trail, unsigned char* render, int xStart, int xEndExclusive) const;
+    int width;
+    int height;
+    int kernelSize;
+    int kernelHalf;
+    float weightBlur;
+    float weightCurrent;
+    float decay;
+    float maxChemo;
+    TrailFormat trailFormat;
+};
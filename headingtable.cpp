@@ -0,0 +1,81 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+#include "headingtable.h"
+#include "utils.h"
+
+HeadingTable::HeadingTable(int tNumHeadings) {
+    if (tNumHeadings <= 0) {
+        throw std::runtime_error("A heading table needs at least one heading");
+    }
+
+    numHeadings = tNumHeadings;
+    sensorHeadings = toWholeHeadings(RunConfiguration::Agent::sensorAngle, "sensorAngle");
+    rotationHeadings = toWholeHeadings(RunConfiguration::Agent::rotationAngle, "rotationAngle");
+
+    for (int heading = 0; heading < numHeadings; heading++) {
+        // In double, so every entry is the correctly rounded float
+        const double angle = 2.0 * Utils::PI * heading / numHeadings;
+
+        sensorX.push_back(static_cast<float>(RunConfiguration::Agent::sensorOffset * std::cos(angle)));
+        sensorY.push_back(static_cast<float>(RunConfiguration::Agent::sensorOffset * std::sin(angle)));
+        stepX.push_back(static_cast<float>(RunConfiguration::Agent::stepSize * std::cos(angle)));
+        stepY.push_back(static_cast<float>(RunConfiguration::Agent::stepSize * std::sin(angle)));
+    }
+}
+
+int HeadingTable::toWholeHeadings(float angle, const char* name) const {
+    const double headings = angle * numHeadings / (2.0 * Utils::PI);
+    const double rounded = std::round(headings);
+
+    // The angles are floats, so allow for their rounding
+    if (std::abs(headings - rounded) > 1e-4) {
+        throw std::runtime_error(std::string("Agent::") + name + " is not a whole number of headings with " + std::to_string(numHeadings) + " headings");
+    }
+
+    const int wrapped = static_cast<int>(rounded) % numHeadings;
+
+    return wrapped < 0 ? wrapped + numHeadings : wrapped;
+}
+
+int HeadingTable::getNumHeadings() const {
+    return numHeadings;
+}
+
+int HeadingTable::getSensorHeadings() const {
+    return sensorHeadings;
+}
+
+int HeadingTable::getRotationHeadings() const {
+    return rotationHeadings;
+}
+
+int HeadingTable::toHeading(float direction) const {
+    // Continuous directions keep growing as agents turn, so wrap before converting to int
+    const int heading = static_cast<int>(std::fmod(std::round(direction * numHeadings / (2.0 * Utils::PI)), static_cast<double>(numHeadings)));
+
+    return heading < 0 ? heading + numHeadings : heading;
+}
+
+float HeadingTable::toDirection(int heading) const {
+    return static_cast<float>(2.0 * Utils::PI * heading / numHeadings);
+}
+
+int HeadingTable::randomHeading(float u) const {
+    // u * numHeadings can round up to numHeadings for u just below 1
+    return std::min(numHeadings - 1, static_cast<int>(u * numHeadings));
+}
+
+void HeadingTable::toHeadings(Agent* agents, size_t numAgents) const {
+    for (size_t i = 0; i < numAgents; i++) {
+        agents[i].direction = static_cast<float>(toHeading(agents[i].direction));
+    }
+}
+
+void HeadingTable::toDirections(Agent* agents, size_t numAgents) const {
+    for (size_t i = 0; i < numAgents; i++) {
+        agents[i].direction = toDirection(static_cast<int>(agents[i].direction));
+    }
+}
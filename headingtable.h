@@ -0,0 +1,44 @@
+#pragma once
+
+#include <vector>
+
+#include "slimemold.h"
+
+/// <summary>
+/// Quantized agent directions. With numHeadings headings, heading h points at h * 2 pi / numHeadings radians, and
+/// agents store the heading number instead of an angle. The offsets of the sensors and of a step are the same for
+/// every agent with the same heading, so they are computed once here and looked up instead of calling sin and cos
+/// four times per agent and step. The tables are a few hundred bytes and stay in L1 (in constant memory on the device).
+///
+/// RunConfiguration::Agent::sensorAngle and rotationAngle have to be whole numbers of headings, so sensing and turning
+/// never leave the table. New random directions are drawn uniformly from all headings.
+/// </summary>
+class HeadingTable {
+public:
+    // Throws if the agent angles aren't whole numbers of headings
+    HeadingTable(int tNumHeadings);
+    int getNumHeadings() const;
+    // RunConfiguration::Agent::sensorAngle and rotationAngle in headings
+    int getSensorHeadings() const;
+    int getRotationHeadings() const;
+    // Nearest heading to a direction in radians, in [0, numHeadings)
+    int toHeading(float direction) const;
+    // In radians, in [0, 2 pi)
+    float toDirection(int heading) const;
+    // Heading for a uniform random number u in [0, 1)
+    int randomHeading(float u) const;
+    // Directions of agents from radians to heading numbers stored as floats, and back
+    void toHeadings(Agent* agents, size_t numAgents) const;
+    void toDirections(Agent* agents, size_t numAgents) const;
+    // Per heading: offset of the forward sensor from the agent, and of the square a move goes to
+    std::vector<float> sensorX;
+    std::vector<float> sensorY;
+    std::vector<float> stepX;
+    std::vector<float> stepY;
+private:
+    // Angle in headings. Throws if it isn't a whole number of them
+    int toWholeHeadings(float angle, const char* name) const;
+    int numHeadings;
+    int sensorHeadings;
+    int rotationHeadings;
+};
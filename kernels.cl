@@ -1,77 +1,158 @@
-kernel void validChemo(global RunConfigurationCl* config, float* chemo)
+R"CLC(
+// This file is embedded in the executable: slimemoldopencl.cpp includes it as a raw string literal, hence the first
+//  and last line. MSVC limits a single string literal to about 16K characters, so if this file grows past that, split
+//  it between two kernels: end the literal with )CLC and a double quote, and start the next one with R, a double quote
+//  and CLC(, all on a line of its own like the splits below.
+
+// counterRng* functions and the RNG_STREAM_* constants come from counterrng.h, which is prepended to this source.
+//  The CFG_* values are not defined here: SlimeMoldOpenCl builds this source with the run configuration as -D options
+//  (see RunConfigurationCl::getBuildOptions), so they are compile-time constants and the loops over the kernel and
+//  sensor widths can be unrolled.
+
+// Trail map storage, see trailformat.h. Values are always computed in float; TRAIL_LOAD and TRAIL_STORE convert from and
+//  to the storage format, with the same rounding and clamping as the CPU codecs.
+#define TRAIL_FORMAT_FLOAT32 0
+#define TRAIL_FORMAT_FLOAT16 1
+#define TRAIL_FORMAT_FIXED8_8 2
+
+#if CFG_TRAIL_FORMAT == TRAIL_FORMAT_FLOAT16
+// Pointers to half don't need cl_khr_fp16, only arithmetic on half does
+typedef half trail_t;
+#define TRAIL_LOAD(trailMap, idx) vload_half((idx), (trailMap))
+#define TRAIL_STORE(trailMap, idx, value) vstore_half_rte(fmin((value), 255.875f), (idx), (trailMap))
+#elif CFG_TRAIL_FORMAT == TRAIL_FORMAT_FIXED8_8
+typedef ushort trail_t;
+#define TRAIL_LOAD(trailMap, idx) ((float)(trailMap)[idx] * (1.0f / 256.0f))
+#define TRAIL_STORE(trailMap, idx, value) ((trailMap)[idx] = convert_ushort_sat_rte((value) * 256.0f))
+#else
+typedef float trail_t;
+#define TRAIL_LOAD(trailMap, idx) ((trailMap)[idx])
+#define TRAIL_STORE(trailMap, idx, value) ((trailMap)[idx] = (value))
+#endif
+
+#define ENV_NUM_PIXELS (CFG_ENV_WIDTH * CFG_ENV_HEIGHT)
+
+#ifdef CFG_SPARSE_TILE_SIZE
+#define SPARSE_TILES_X ((CFG_ENV_WIDTH + CFG_SPARSE_TILE_SIZE - 1) / CFG_SPARSE_TILE_SIZE)
+#define SPARSE_TILES_Y ((CFG_ENV_HEIGHT + CFG_SPARSE_TILE_SIZE - 1) / CFG_SPARSE_TILE_SIZE)
+#define SPARSE_TILE_INDEX(col, row) ((col) / CFG_SPARSE_TILE_SIZE + (row) / CFG_SPARSE_TILE_SIZE * SPARSE_TILES_X)
+// Tiles around a tile that chemo can diffuse in from in one step
+#define SPARSE_TILE_REACH ((CFG_ENV_DIFFUSION_KERNEL_SIZE / 2 + CFG_SPARSE_TILE_SIZE - 1) / CFG_SPARSE_TILE_SIZE)
+#endif
+
+// With CFG_NUM_HEADINGS, directions are heading numbers rather than radians (see HeadingTable), and desiredMoves, sense
+//  and senseSummedArea take the heading table as their last argument: the step of each heading in .xy, the offset of
+//  its forward sensor in .zw. CFG_SENSOR_HEADINGS and CFG_ROTATION_HEADINGS are the agent angles in headings
+#ifdef CFG_NUM_HEADINGS
+#define WRAP_DIRECTION(direction) ((direction) < 0 ? (direction) + CFG_NUM_HEADINGS : ((direction) >= CFG_NUM_HEADINGS ? (direction) - CFG_NUM_HEADINGS : (direction)))
+#define RANDOM_DIRECTION(u) ((float)min((int)((u) * CFG_NUM_HEADINGS), CFG_NUM_HEADINGS - 1))
+#define AGENT_ROTATION ((float)CFG_ROTATION_HEADINGS)
+#else
+#define WRAP_DIRECTION(direction) (direction)
+#define RANDOM_DIRECTION(u) (2.0f * M_PI_F * (u))
+#define AGENT_ROTATION CFG_AGENT_ROTATION_ANGLE
+#endif
+
+// The kernels prefixed with ensemble run all members of a SlimeMoldEnsemble in one launch. Member m has trail maps and
+//  claims at m * ENV_NUM_PIXELS and agents at m * population, the population being the first global size of the
+//  agent kernels. They share their code with the single simulation kernels below, which pass the CFG_* values where
+//  the ensemble kernels pass the parameters of the member. Member offsets are size_t, since all members together can
+//  have more squares than fit in a uint.
+
+static inline void validChemo(float* chemo)
 {
-    float maxTotalChemo = config[0].agentMaxTotalChemo;
-    clamp(*chemo, 0.0f, maxTotalChemo);
+    *chemo = clamp(*chemo, 0.0f, CFG_AGENT_MAX_TOTAL_CHEMO);
 }
 
-kernel void measureChemoAroundPosition(global RunConfigurationCl* config, float* trailMap, int x, int y, int kernelSize, float* totalChemo, int* numMeasuredSquares) 
+// kernelSize is a compile-time constant at every call site, so the loops unroll into straight-line code
+static inline void measureChemoAroundPosition(global const trail_t* trailMap, int x, int y, const int kernelSize, float* totalChemo, int* numMeasuredSquares)
 {
-    int windowWidth = config[0].envWidth;
-    int windowHeight = config[0].envHeight;
-
     *totalChemo = 0.0f;
     *numMeasuredSquares = 0;
 
-    for (int xd = x - kernelSize / 2; xd <= x + kernelSize / 2; xd++) {
-        if (xd >= 0 && xd < windowWidth) {
-            for (int yd = y - kernelSize / 2; yd <= y + kernelSize / 2; yd++) {
-                if (yd >= 0 && yd < windowHeight) {
-                    int idxSrc = xd + windowWidth * yd;
-                    *numMeasuredSquares = *numMeasuredSquares + 1;
-                    *totalChemo += trailMap[idxSrc];
-                }
+    #pragma unroll
+    for (int xOffset = -kernelSize / 2; xOffset <= kernelSize / 2; xOffset++) {
+        int xd = x + xOffset;
+
+        #pragma unroll
+        for (int yOffset = -kernelSize / 2; yOffset <= kernelSize / 2; yOffset++) {
+            int yd = y + yOffset;
+
+            if (xd >= 0 && xd < CFG_ENV_WIDTH && yd >= 0 && yd < CFG_ENV_HEIGHT) {
+                int idxSrc = xd + CFG_ENV_WIDTH * yd;
+                *numMeasuredSquares = *numMeasuredSquares + 1;
+                *totalChemo += TRAIL_LOAD(trailMap, idxSrc);
             }
         }
     }
 }
 
-kernel void diffuse(global RunConfigurationCl* config, global float* trailMapSource, global float* trailMapDestination)
+// New value of a square from the sum of the chemo around it and its current value
+static inline float diffusedValue(float chemo, float center)
 {
-    size_t col = get_global_id(0);
-    size_t row = get_global_id(1);
-    int windowWidth = config[0].envWidth;
-    int windowHeight = config[0].envHeight;
-    int kernelSize = config[0].envDiffusionKernelSize;
-    size_t idxDest = col + row * windowWidth;
-    float diffuseRate = config[0].envDiffusionRatio;
+    //  Why does this look "better" if we use numSquares+1 instead of numSquares?
+
+    // TODO: Check with the paper. Is there diffuseRate vs decayRate, are they both there?
+
+    float blurredVal = chemo / (CFG_ENV_DIFFUSION_KERNEL_SIZE * CFG_ENV_DIFFUSION_KERNEL_SIZE + 1);
+
+    return CFG_ENV_DIFFUSION_RATIO * blurredVal + (1 - CFG_ENV_DIFFUSION_RATIO) * center;
+}
+
+// Returns the new value of the square
+static inline float diffuseSquare(global const trail_t* trailMapSource, global trail_t* trailMapDestination, size_t col, size_t row)
+{
+    size_t idxDest = col + row * CFG_ENV_WIDTH;
 
     float chemo = 0.0f;
     int numSquares = 0;
 
-    measureChemoAroundPosition(config, trailMapSource, col, row, kernelSize, &chemo, &numSquares);
+    measureChemoAroundPosition(trailMapSource, col, row, CFG_ENV_DIFFUSION_KERNEL_SIZE, &chemo, &numSquares);
 
-    //  Why does this look "better" if we use numSquares+1 instead of numSquares?
+    float newVal = diffusedValue(chemo, TRAIL_LOAD(trailMapSource, idxDest));
 
-    // TODO: Check with the paper. Is there diffuseRate vs decayRate, are they both there?
+    TRAIL_STORE(trailMapDestination, idxDest, newVal);
 
-    float blurredVal =  chemo / (kernelSize * kernelSize+ 1);
-    float newVal = diffuseRate * blurredVal + (1 - diffuseRate) * trailMapSource[idxDest];
+    return newVal;
+}
 
-    trailMapDestination[idxDest] = newVal;
+kernel void diffuse(global const trail_t* trailMapSource, global trail_t* trailMapDestination)
+{
+    diffuseSquare(trailMapSource, trailMapDestination, get_global_id(0), get_global_id(1));
+}
+
+// The member is the third dimension
+kernel void ensembleDiffuse(global const trail_t* trailMapSource, global trail_t* trailMapDestination)
+{
+    size_t offset = get_global_id(2) * ENV_NUM_PIXELS;
 
+    diffuseSquare(trailMapSource + offset, trailMapDestination + offset, get_global_id(0), get_global_id(1));
 }
 
-kernel void decay(global RunConfigurationCl* config, global float* trailMap)
+// Same for every square, so it also runs the trail maps of all ensemble members in one go
+kernel void decay(global trail_t* trailMap)
 {
     size_t idx = get_global_id(0);
-    float decay = config[0].envDiffusionDecay;
 
-    float chemo = trailMap[idx] - decay;
-    validChemo(config, &chemo);
-    trailMap[idx] = chemo;
+    float chemo = TRAIL_LOAD(trailMap, idx) - CFG_ENV_DIFFUSION_DECAY;
+    validChemo(&chemo);
+    TRAIL_STORE(trailMap, idx, chemo);
 }
 
-kernel void desiredMoves(global RunConfigurationCl* config, global Agent* agents, global Agent* agentsNewPos, global int* desiredDestinationIndices)
+static inline float2 directionStep(float direction)
 {
-    size_t idx = get_global_id(0);
-    int width = config[0].envWidth;
-    int height = config[0].envHeight;
-    int stepSize = config[0].agentStepSize;
+    return (float2)(cos(direction), sin(direction)) * CFG_AGENT_STEP_SIZE;
+}
+
+static inline void desiredMove(global const Agent* agents, size_t idx, uint agentId, float2 stepVector, global Agent* agentsNewPos, global int* desiredDestinationIndices, global uint* squareClaims, uint seed, uint step)
+{
+    int width = CFG_ENV_WIDTH;
+    int height = CFG_ENV_HEIGHT;
 
     // Calculate new desired position
     Agent agent = agents[idx];
-    float newX = agent.x + cos(agent.direction) * stepSize;
-    float newY = agent.y + sin(agent.direction) * stepSize;
+    float newX = agent.x + stepVector.x;
+    float newY = agent.y + stepVector.y;
     int newXSquare = newX;
     int newYSquare = newY;
 
@@ -82,6 +163,8 @@ kernel void desiredMoves(global RunConfigurationCl* config, global Agent* agents
         agentsNewPos[idx].x = newX;
         agentsNewPos[idx].y = newY;
         desiredDestinationIndices[idx] = desiredDestinationIdx;
+        // Highest priority wins the square. Claims are cleared before this kernel runs
+        atomic_max(&squareClaims[desiredDestinationIdx], counterRngMovePriority(seed, step, agentId));
     }
     else {
         desiredDestinationIndices[idx] = -1;
@@ -89,73 +172,677 @@ kernel void desiredMoves(global RunConfigurationCl* config, global Agent* agents
 
 }
 
-kernel void move(global RunConfigurationCl* config, global float* trailMap, global Agent* agents, global Agent* agentsNewPos, global int* desiredDestinationIndices, global float* newDirections)
+#ifdef CFG_NUM_HEADINGS
+kernel void desiredMoves(global Agent* agents, global const uint* agentIds, global Agent* agentsNewPos, global int* desiredDestinationIndices, global uint* squareClaims, uint step, constant float4* headings)
+{
+    size_t idx = get_global_id(0);
+
+    desiredMove(agents, idx, agentIds[idx], headings[(int)agents[idx].direction].xy, agentsNewPos, desiredDestinationIndices, squareClaims, CFG_RANDOM_SEED, step);
+}
+#else
+kernel void desiredMoves(global Agent* agents, global const uint* agentIds, global Agent* agentsNewPos, global int* desiredDestinationIndices, global uint* squareClaims, uint step)
 {
     size_t idx = get_global_id(0);
-    int chemoDeposition = config[0].agentChemoDeposition;
 
+    desiredMove(agents, idx, agentIds[idx], directionStep(agents[idx].direction), agentsNewPos, desiredDestinationIndices, squareClaims, CFG_RANDOM_SEED, step);
+}
+#endif
+
+// Ensemble agents are never sorted, so the id of an agent is its index within the member
+// Uniformly random positions and directions, drawn from the seed of the member
+kernel void ensembleInitAgents(global Agent* agents, global const EnsembleMember* members)
+{
+    uint agentId = get_global_id(0);
+    size_t member = get_global_id(1);
+    size_t idx = member * get_global_size(0) + agentId;
+    uint seed = members[member].randomSeed;
+
+    agents[idx].x = CFG_ENV_WIDTH * counterRngFloat(seed, RNG_STREAM_ENSEMBLE_INIT, 0, agentId);
+    agents[idx].y = CFG_ENV_HEIGHT * counterRngFloat(seed, RNG_STREAM_ENSEMBLE_INIT, 1, agentId);
+    agents[idx].direction = 2.0f * M_PI_F * counterRngFloat(seed, RNG_STREAM_ENSEMBLE_INIT, 2, agentId);
+}
+
+kernel void ensembleDesiredMoves(global const Agent* agents, global Agent* agentsNewPos, global int* desiredDestinationIndices, global uint* squareClaims, global const EnsembleMember* members, uint step)
+{
+    uint agentId = get_global_id(0);
+    size_t member = get_global_id(1);
+    size_t idx = member * get_global_size(0) + agentId;
+
+    desiredMove(agents, idx, agentId, directionStep(agents[idx].direction), agentsNewPos, desiredDestinationIndices, squareClaims + member * ENV_NUM_PIXELS, members[member].randomSeed, step);
+}
+
+// Returns whether the agent moved (and deposited)
+static inline bool moveAgent(global trail_t* trailMap, global Agent* agents, size_t idx, uint agentId, global const Agent* agentsNewPos, global const int* desiredDestinationIndices, global const uint* squareClaims, uint seed, float chemoDeposition, uint step)
+{
     int desiredDestinationIdx = desiredDestinationIndices[idx];
 
-    if(desiredDestinationIdx == -1) {
-        // -1 means we could not move. Update agent direction to new random direction, sent from host
-        agents[idx].direction = newDirections[idx];
+    if(desiredDestinationIdx == -1 || squareClaims[desiredDestinationIdx] != counterRngMovePriority(seed, step, agentId)) {
+        // -1 means we could not move, otherwise another agent had a higher claim on the square. Update agent direction to new random direction
+        agents[idx].direction = RANDOM_DIRECTION(counterRngFloat(seed, RNG_STREAM_MOVE_DIRECTION, step, agentId));
+
+        return false;
     }
     else {
         // We can move! We've already calculated the move, so just copy it.
         agents[idx].x = agentsNewPos[idx].x;
         agents[idx].y = agentsNewPos[idx].y;
-        int x = agents[idx].x;
-        int y = agents[idx].y;
-        int width = config[0].envWidth;
-        int trailIdx = x + width * y;
-        float chemo = trailMap[desiredDestinationIdx] + (float)chemoDeposition;
-        validChemo(config, &chemo);
-        trailMap[desiredDestinationIdx] = chemo;
+#ifndef CFG_DEPOSIT_CLAIMED_SQUARES
+        float chemo = TRAIL_LOAD(trailMap, desiredDestinationIdx) + chemoDeposition;
+        validChemo(&chemo);
+        TRAIL_STORE(trailMap, desiredDestinationIdx, chemo);
+#endif
+
+        return true;
+    }
+}
+
+// With CFG_SPARSE_TILE_SIZE, also marks the tiles deposited on as active (see diffuseSparse)
+#ifdef CFG_SPARSE_TILE_SIZE
+kernel void move(global trail_t* trailMap, global Agent* agents, global const uint* agentIds, global Agent* agentsNewPos, global int* desiredDestinationIndices, global uint* squareClaims, uint step, global uint* activeTiles)
+#else
+kernel void move(global trail_t* trailMap, global Agent* agents, global const uint* agentIds, global Agent* agentsNewPos, global int* desiredDestinationIndices, global uint* squareClaims, uint step)
+#endif
+{
+    size_t idx = get_global_id(0);
+    bool moved = moveAgent(trailMap, agents, idx, agentIds[idx], agentsNewPos, desiredDestinationIndices, squareClaims, CFG_RANDOM_SEED, (float)CFG_AGENT_CHEMO_DEPOSITION, step);
+
+#ifdef CFG_SPARSE_TILE_SIZE
+    if (moved) {
+        int destinationIdx = desiredDestinationIndices[idx];
+
+        // Every depositing agent writes the same value, so the races between them don't matter
+        activeTiles[SPARSE_TILE_INDEX(destinationIdx % CFG_ENV_WIDTH, destinationIdx / CFG_ENV_WIDTH)] = 1;
     }
+#endif
+}
+
+kernel void ensembleMove(global trail_t* trailMaps, global Agent* agents, global const Agent* agentsNewPos, global const int* desiredDestinationIndices, global const uint* squareClaims, global const EnsembleMember* members, uint step)
+{
+    uint agentId = get_global_id(0);
+    size_t member = get_global_id(1);
+    size_t idx = member * get_global_size(0) + agentId;
+    size_t offset = member * ENV_NUM_PIXELS;
+
+    moveAgent(trailMaps + offset, agents, idx, agentId, agentsNewPos, desiredDestinationIndices, squareClaims + offset, members[member].randomSeed, members[member].chemoDeposition, step);
+}
+
+// Used instead of the deposit in move when CFG_DEPOSIT_CLAIMED_SQUARES is defined. Every claimed square has exactly one
+//  winner, which always moves there, so depositing on all claimed squares gives the same trail map without knowing
+//  which agent won. That lets SlimeMoldMultiDevice deposit on the device owning the square, wherever the agent is.
+//  Priorities are never 0, so 0 is a square without claims
+kernel void depositClaimed(global trail_t* trailMap, global const uint* squareClaims)
+{
+    size_t idx = get_global_id(0);
+
+    if (squareClaims[idx] != 0) {
+        float chemo = TRAIL_LOAD(trailMap, idx) + (float)CFG_AGENT_CHEMO_DEPOSITION;
+        validChemo(&chemo);
+        TRAIL_STORE(trailMap, idx, chemo);
+    }
+}
+
+)CLC" R"CLC(
+static inline void sensorPosition(global const Agent* agents, size_t agentIdx, float sensorOffset, float rotationOffset, int* x, int* y)
+{
+    *x = agents[agentIdx].x + sensorOffset * cos(agents[agentIdx].direction + rotationOffset);
+    *y = agents[agentIdx].y + sensorOffset * sin(agents[agentIdx].direction + rotationOffset);
 }
 
-kernel void senseAtRotation(global RunConfigurationCl* config, global float* trailMap, global Agent* agents, int agentIdx, float rotationOffset, float* res)
+static inline void senseAtRotation(global const trail_t* trailMap, global Agent* agents, size_t agentIdx, float sensorOffset, float rotationOffset, float* res)
 {
-    int sensorOffset = config[0].agentSensorOffset;
-    int width = config[0].envWidth;
-    int height = config[0].envHeight;
-    int sensorWidth = config[0].agentSensorWidth;
+    int x, y;
 
-    int x = agents[agentIdx].x + sensorOffset * cos(agents[agentIdx].direction + rotationOffset);
-    int y = agents[agentIdx].y + sensorOffset * sin(agents[agentIdx].direction + rotationOffset);
+    sensorPosition(agents, agentIdx, sensorOffset, rotationOffset, &x, &y);
 
     float chemo;
     int numSquares;
 
-    measureChemoAroundPosition(config, trailMap, x, y, sensorWidth, &chemo, &numSquares);
+    measureChemoAroundPosition(trailMap, x, y, CFG_AGENT_SENSOR_WIDTH, &chemo, &numSquares);
 
-    // Check if position is valid
-    int idx = x + y * width;
     *res = chemo;
 }
 
-kernel void sense(global RunConfigurationCl* config, global float* trailMap, global Agent* agents, global float* randomValues)
+// Turn towards the strongest of the three sensor readings
+static inline void turnAgent(global Agent* agents, size_t idx, uint agentId, float senseLeft, float senseForward, float senseRight, float rotationAngle, uint seed, uint step)
 {
-    size_t idx = get_global_id(0);
-    float sensorAngle = config[0].agentSensorAngle;
-    float senseLeft, senseRight, senseForward;
-    float rotationAngle = config[0].agentRotationAngle;
-    
-    senseAtRotation(config, trailMap, agents, idx, -sensorAngle, &senseLeft);
-    senseAtRotation(config, trailMap, agents, idx, sensorAngle, &senseRight);
-    senseAtRotation(config, trailMap, agents, idx, 0, &senseForward);
+    float rotation;
 
     if (senseForward > senseLeft && senseForward > senseRight) {
         // Do nothing
+        return;
     }
     else if (senseForward < senseLeft && senseForward < senseRight) {
         // Rotate in random direction
-        agents[idx].direction += (randomValues[idx] > 0.5) ? -rotationAngle : rotationAngle;
+        float u = counterRngFloat(seed, RNG_STREAM_SENSE, step, agentId);
+        rotation = (u > 0.5) ? -rotationAngle : rotationAngle;
     }
     else if (senseLeft < senseRight) {
-        agents[idx].direction += rotationAngle;
+        rotation = rotationAngle;
     }
     else {
-        agents[idx].direction -= rotationAngle;
+        rotation = -rotationAngle;
+    }
+
+    agents[idx].direction = WRAP_DIRECTION(agents[idx].direction + rotation);
+}
+
+static inline void senseAgent(global const trail_t* trailMap, global Agent* agents, size_t idx, uint agentId, float sensorAngle, float rotationAngle, float sensorOffset, uint seed, uint step)
+{
+    float senseLeft, senseRight, senseForward;
+
+    senseAtRotation(trailMap, agents, idx, sensorOffset, -sensorAngle, &senseLeft);
+    senseAtRotation(trailMap, agents, idx, sensorOffset, sensorAngle, &senseRight);
+    senseAtRotation(trailMap, agents, idx, sensorOffset, 0, &senseForward);
+
+    turnAgent(agents, idx, agentId, senseLeft, senseForward, senseRight, rotationAngle, seed, step);
+}
+
+#ifdef CFG_NUM_HEADINGS
+// Left, right and forward sensor of an agent, from the heading table
+static inline void headingSensorPositions(global const Agent* agents, size_t idx, constant float4* headings, int* x, int* y)
+{
+    int heading = (int)agents[idx].direction;
+    int sensorHeadings[3] = { heading - CFG_SENSOR_HEADINGS, heading + CFG_SENSOR_HEADINGS, heading };
+
+    for (int i = 0; i < 3; i++) {
+        float4 entry = headings[WRAP_DIRECTION(sensorHeadings[i])];
+
+        x[i] = agents[idx].x + entry.z;
+        y[i] = agents[idx].y + entry.w;
+    }
+}
+
+kernel void sense(global const trail_t* trailMap, global Agent* agents, global const uint* agentIds, uint step, constant float4* headings)
+{
+    size_t idx = get_global_id(0);
+    int x[3], y[3];
+    float senses[3];
+    int numSquares;
+
+    headingSensorPositions(agents, idx, headings, x, y);
+
+    for (int i = 0; i < 3; i++) {
+        measureChemoAroundPosition(trailMap, x[i], y[i], CFG_AGENT_SENSOR_WIDTH, &senses[i], &numSquares);
+    }
+
+    turnAgent(agents, idx, agentIds[idx], senses[0], senses[2], senses[1], AGENT_ROTATION, CFG_RANDOM_SEED, step);
+}
+#else
+kernel void sense(global const trail_t* trailMap, global Agent* agents, global const uint* agentIds, uint step)
+{
+    size_t idx = get_global_id(0);
+
+    senseAgent(trailMap, agents, idx, agentIds[idx], CFG_AGENT_SENSOR_ANGLE, CFG_AGENT_ROTATION_ANGLE, (float)CFG_AGENT_SENSOR_OFFSET, CFG_RANDOM_SEED, step);
+}
+#endif
+
+kernel void ensembleSense(global const trail_t* trailMaps, global Agent* agents, global const EnsembleMember* members, uint step)
+{
+    uint agentId = get_global_id(0);
+    size_t member = get_global_id(1);
+    size_t idx = member * get_global_size(0) + agentId;
+    EnsembleMember parameters = members[member];
+
+    senseAgent(trailMaps + member * ENV_NUM_PIXELS, agents, idx, agentId, parameters.sensorAngle, parameters.rotationAngle, parameters.sensorOffset, parameters.randomSeed, step);
+}
+
+// Trail map to 8-bit render image. Values are truncated like static_cast<unsigned char> on the host, after clamping.
+//  Also used for all ensemble members at once
+kernel void render(global const trail_t* trailMap, global uchar* renderImage)
+{
+    size_t idx = get_global_id(0);
+
+    renderImage[idx] = convert_uchar_sat_rtz(TRAIL_LOAD(trailMap, idx));
+}
+)CLC" R"CLC(
+#ifdef CFG_SPARSE_TILE_SIZE
+// Sparse trail maps (RunConfiguration::Hardware::sparseTrailMap). The map is cut into tiles of CFG_SPARSE_TILE_SIZE
+//  squares with a flag each: a tile without its flag is all zero, a flagged one may hold chemo. These kernels run one
+//  work-group per tile, with a global size rounded up to whole tiles, and skip the tiles that can't hold chemo. Every
+//  work-item of a group reads the same flags, so the early exits and barriers are the same for the whole group.
+
+kernel void diffuseSparse(global const trail_t* trailMapSource, global trail_t* trailMapDestination, global const uint* activeTilesSource, global uint* activeTilesDestination)
+{
+    size_t col = get_global_id(0);
+    size_t row = get_global_id(1);
+    int tileX = get_group_id(0);
+    int tileY = get_group_id(1);
+    bool inside = col < CFG_ENV_WIDTH && row < CFG_ENV_HEIGHT;
+    bool first = get_local_id(0) == 0 && get_local_id(1) == 0;
+    bool reached = false;
+    local int nonZero;
+
+    for (int y = max(0, tileY - SPARSE_TILE_REACH); y <= min(SPARSE_TILES_Y - 1, tileY + SPARSE_TILE_REACH); y++) {
+        for (int x = max(0, tileX - SPARSE_TILE_REACH); x <= min(SPARSE_TILES_X - 1, tileX + SPARSE_TILE_REACH); x++) {
+            reached = reached || activeTilesSource[x + y * SPARSE_TILES_X] != 0;
+        }
+    }
+
+    if (reached) {
+        if (first) {
+            nonZero = 0;
+        }
+
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        if (inside && diffuseSquare(trailMapSource, trailMapDestination, col, row) != 0.0f) {
+            atomic_or(&nonZero, 1);
+        }
+
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        if (first) {
+            activeTilesDestination[tileX + tileY * SPARSE_TILES_X] = nonZero;
+        }
+    }
+    else if (activeTilesDestination[tileX + tileY * SPARSE_TILES_X] != 0) {
+        // Nothing can reach the tile, but it still holds the map of the step before
+        if (inside) {
+            TRAIL_STORE(trailMapDestination, col + row * CFG_ENV_WIDTH, 0.0f);
+        }
+
+        // All work-items have read the flag
+        barrier(CLK_GLOBAL_MEM_FENCE);
+
+        if (first) {
+            activeTilesDestination[tileX + tileY * SPARSE_TILES_X] = 0;
+        }
+    }
+}
+
+kernel void decaySparse(global trail_t* trailMap, global uint* activeTiles)
+{
+    size_t col = get_global_id(0);
+    size_t row = get_global_id(1);
+    size_t idxTile = get_group_id(0) + get_group_id(1) * SPARSE_TILES_X;
+    bool first = get_local_id(0) == 0 && get_local_id(1) == 0;
+    local int nonZero;
+
+    if (activeTiles[idxTile] == 0) {
+        return;
     }
-}
\ No newline at end of file
+
+    if (first) {
+        nonZero = 0;
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if (col < CFG_ENV_WIDTH && row < CFG_ENV_HEIGHT) {
+        size_t idx = col + row * CFG_ENV_WIDTH;
+        float chemo = TRAIL_LOAD(trailMap, idx) - CFG_ENV_DIFFUSION_DECAY;
+
+        validChemo(&chemo);
+        TRAIL_STORE(trailMap, idx, chemo);
+
+        if (chemo > 0.0f) {
+            atomic_or(&nonZero, 1);
+        }
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if (first) {
+        activeTiles[idxTile] = nonZero;
+    }
+}
+
+// renderTiles flags the tiles of renderImage that may be non-zero, so empty tiles are only cleared once
+kernel void renderSparse(global const trail_t* trailMap, global uchar* renderImage, global const uint* activeTiles, global uint* renderTiles)
+{
+    size_t col = get_global_id(0);
+    size_t row = get_global_id(1);
+    size_t idxTile = get_group_id(0) + get_group_id(1) * SPARSE_TILES_X;
+    uint active = activeTiles[idxTile];
+
+    if (active == 0 && renderTiles[idxTile] == 0) {
+        return;
+    }
+
+    if (col < CFG_ENV_WIDTH && row < CFG_ENV_HEIGHT) {
+        size_t idx = col + row * CFG_ENV_WIDTH;
+
+        renderImage[idx] = active != 0 ? convert_uchar_sat_rtz(TRAIL_LOAD(trailMap, idx)) : 0;
+    }
+
+    // All work-items have read the flag
+    barrier(CLK_GLOBAL_MEM_FENCE);
+
+    if (get_local_id(0) == 0 && get_local_id(1) == 0) {
+        renderTiles[idxTile] = active;
+    }
+}
+#endif
+
+// Interleave the bits of x and y: ... y1 x1 y0 x0
+static inline uint mortonKey(uint x, uint y)
+{
+    x &= 0xffff;
+    x = (x | (x << 8)) & 0x00ff00ff;
+    x = (x | (x << 4)) & 0x0f0f0f0f;
+    x = (x | (x << 2)) & 0x33333333;
+    x = (x | (x << 1)) & 0x55555555;
+    y &= 0xffff;
+    y = (y | (y << 8)) & 0x00ff00ff;
+    y = (y | (y << 4)) & 0x0f0f0f0f;
+    y = (y | (y << 2)) & 0x33333333;
+    y = (y | (y << 1)) & 0x55555555;
+
+    return x | (y << 1);
+}
+
+// Sort keys for reordering the agents along a Z-order curve, plus the identity permutation to sort along with them
+kernel void mortonKeys(global const Agent* agents, global uint* keys, global uint* order)
+{
+    size_t idx = get_global_id(0);
+    int x = clamp((int)agents[idx].x, 0, CFG_ENV_WIDTH - 1);
+    int y = clamp((int)agents[idx].y, 0, CFG_ENV_HEIGHT - 1);
+
+    keys[idx] = mortonKey(x, y);
+    order[idx] = idx;
+}
+
+// Sort keys for handing agents to the strip their row belongs to. Strip i has rows [stripRows[i], stripRows[i + 1])
+kernel void stripKeys(global const Agent* agents, global const int* stripRows, int numStrips, global uint* keys, global uint* order)
+{
+    size_t idx = get_global_id(0);
+    int y = clamp((int)agents[idx].y, 0, CFG_ENV_HEIGHT - 1);
+    uint strip = 0;
+
+    while (strip + 1 < numStrips && y >= stripRows[strip + 1]) {
+        strip++;
+    }
+
+    keys[idx] = strip;
+    order[idx] = idx;
+}
+
+// Summed-area table of the trail map, as SummedAreaTable on the host: (CFG_ENV_WIDTH + 1) x (CFG_ENV_HEIGHT + 1)
+//  entries in 64-bit fixed point, with a first row and column the host fills with zeros once. satRows scans every row,
+//  one work-item per row, then satColumns every column, one work-item per column so neighbours read neighbouring entries
+#define SAT_FRACTION_BITS 24
+#define SAT_STRIDE (CFG_ENV_WIDTH + 1)
+
+kernel void satRows(global const trail_t* trailMap, global long* table)
+{
+    size_t row = get_global_id(0);
+    global long* destination = table + (row + 1) * SAT_STRIDE + 1;
+    long sum = 0;
+
+    for (int x = 0; x < CFG_ENV_WIDTH; x++) {
+        sum += (long)(TRAIL_LOAD(trailMap, row * CFG_ENV_WIDTH + x) * (float)(1 << SAT_FRACTION_BITS));
+        destination[x] = sum;
+    }
+}
+
+kernel void satColumns(global long* table)
+{
+    size_t col = get_global_id(0) + 1;
+    long sum = 0;
+
+    for (int row = 1; row <= CFG_ENV_HEIGHT; row++) {
+        sum += table[row * SAT_STRIDE + col];
+        table[row * SAT_STRIDE + col] = sum;
+    }
+}
+
+// Sum over [xStart, xEndExclusive) x [yStart, yEndExclusive). Pixels outside the map count as zero
+static inline float satBoxSum(global const long* table, int xStart, int yStart, int xEndExclusive, int yEndExclusive)
+{
+    int x0 = clamp(xStart, 0, CFG_ENV_WIDTH);
+    int y0 = clamp(yStart, 0, CFG_ENV_HEIGHT);
+    int x1 = clamp(xEndExclusive, 0, CFG_ENV_WIDTH);
+    int y1 = clamp(yEndExclusive, 0, CFG_ENV_HEIGHT);
+
+    if (x1 <= x0 || y1 <= y0) {
+        return 0.0f;
+    }
+
+    long sum = table[y1 * SAT_STRIDE + x1] - table[y0 * SAT_STRIDE + x1] - table[y1 * SAT_STRIDE + x0] + table[y0 * SAT_STRIDE + x0];
+
+    return (float)sum * (1.0f / (1 << SAT_FRACTION_BITS));
+}
+
+// As sense, but each sensor is four lookups in the summed-area table
+#ifdef CFG_NUM_HEADINGS
+kernel void senseSummedArea(global const long* table, global Agent* agents, global const uint* agentIds, uint step, constant float4* headings)
+#else
+kernel void senseSummedArea(global const long* table, global Agent* agents, global const uint* agentIds, uint step)
+#endif
+{
+    size_t idx = get_global_id(0);
+    const int kernelHalf = CFG_AGENT_SENSOR_WIDTH / 2;
+    int x[3], y[3];
+    float senses[3];
+
+#ifdef CFG_NUM_HEADINGS
+    headingSensorPositions(agents, idx, headings, x, y);
+#else
+    float rotationOffsets[3] = { -CFG_AGENT_SENSOR_ANGLE, CFG_AGENT_SENSOR_ANGLE, 0 };
+
+    for (int i = 0; i < 3; i++) {
+        sensorPosition(agents, idx, (float)CFG_AGENT_SENSOR_OFFSET, rotationOffsets[i], &x[i], &y[i]);
+    }
+#endif
+
+    for (int i = 0; i < 3; i++) {
+        senses[i] = satBoxSum(table, x[i] - kernelHalf, y[i] - kernelHalf, x[i] + kernelHalf + 1, y[i] + kernelHalf + 1);
+    }
+
+    turnAgent(agents, idx, agentIds[idx], senses[0], senses[2], senses[1], AGENT_ROTATION, CFG_RANDOM_SEED, step);
+}
+)CLC" R"CLC(
+#ifdef CFG_LOCAL_SIZE_X
+// Tiled kernels, used instead of diffuse and sense when SlimeMoldOpenCl has a work-group size of CFG_LOCAL_SIZE_X x
+//  CFG_LOCAL_SIZE_Y for them (see SlimeMoldOpenCl::setLocalWorkGroupSize). A work-group first copies the part of the
+//  trail map it reads into local memory, so every square is read from global memory once per group instead of once per
+//  neighbour or sensor. They add up the same squares in the same order as diffuse and sense, so the results are the same.
+#define LOCAL_GROUP_SIZE (CFG_LOCAL_SIZE_X * CFG_LOCAL_SIZE_Y)
+
+#if CFG_TRAIL_FORMAT == TRAIL_FORMAT_FLOAT16
+#define TRAIL_LOAD4(trailMap, idx) vload_half4(0, (trailMap) + (idx))
+#define TRAIL_STORE4(trailMap, idx, value) vstore_half4_rte(fmin((value), 255.875f), 0, (trailMap) + (idx))
+#elif CFG_TRAIL_FORMAT == TRAIL_FORMAT_FIXED8_8
+#define TRAIL_LOAD4(trailMap, idx) (convert_float4(vload4(0, (trailMap) + (idx))) * (1.0f / 256.0f))
+#define TRAIL_STORE4(trailMap, idx, value) vstore4(convert_ushort4_sat_rte((value) * 256.0f), 0, (trailMap) + (idx))
+#else
+#define TRAIL_LOAD4(trailMap, idx) vload4(0, (trailMap) + (idx))
+#define TRAIL_STORE4(trailMap, idx, value) vstore4((value), 0, (trailMap) + (idx))
+#endif
+
+// Every work-item of diffuseLocal writes four squares next to each other, so a group covers 4 * CFG_LOCAL_SIZE_X
+//  columns and CFG_LOCAL_SIZE_Y rows. The tile is staged in float4 chunks, with the halo left and right rounded up to
+//  whole chunks so all chunks start at a multiple of four columns
+#define DIFFUSE_HALF (CFG_ENV_DIFFUSION_KERNEL_SIZE / 2)
+#define DIFFUSE_HALO_CHUNKS ((DIFFUSE_HALF + 3) / 4)
+#define DIFFUSE_TILE_CHUNKS (CFG_LOCAL_SIZE_X + 2 * DIFFUSE_HALO_CHUNKS)
+#define DIFFUSE_TILE_ROWS (CFG_LOCAL_SIZE_Y + 2 * DIFFUSE_HALF)
+
+kernel __attribute__((reqd_work_group_size(CFG_LOCAL_SIZE_X, CFG_LOCAL_SIZE_Y, 1)))
+void diffuseLocal(global const trail_t* trailMapSource, global trail_t* trailMapDestination)
+{
+    local float4 tile[DIFFUSE_TILE_ROWS][DIFFUSE_TILE_CHUNKS];
+    int localX = get_local_id(0);
+    int localY = get_local_id(1);
+    // Map position of the first square of the tile, halo included
+    int tileCol = (int)get_group_id(0) * CFG_LOCAL_SIZE_X * 4 - DIFFUSE_HALO_CHUNKS * 4;
+    int tileRow = (int)get_group_id(1) * CFG_LOCAL_SIZE_Y - DIFFUSE_HALF;
+
+    // Neighbouring work-items load neighbouring chunks, so the loads of a row are coalesced
+    for (int i = localX + localY * CFG_LOCAL_SIZE_X; i < DIFFUSE_TILE_ROWS * DIFFUSE_TILE_CHUNKS; i += LOCAL_GROUP_SIZE) {
+        int row = tileRow + i / DIFFUSE_TILE_CHUNKS;
+        int col = tileCol + i % DIFFUSE_TILE_CHUNKS * 4;
+        float4 chemo = (float4)(0.0f);
+
+        if (row >= 0 && row < CFG_ENV_HEIGHT) {
+            if (col >= 0 && col + 4 <= CFG_ENV_WIDTH) {
+                chemo = TRAIL_LOAD4(trailMapSource, col + row * CFG_ENV_WIDTH);
+            }
+            else {
+                // Squares outside the map are zero, which adds the same as measureChemoAroundPosition leaving them out
+                float squares[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+                for (int j = 0; j < 4; j++) {
+                    if (col + j >= 0 && col + j < CFG_ENV_WIDTH) {
+                        squares[j] = TRAIL_LOAD(trailMapSource, col + j + row * CFG_ENV_WIDTH);
+                    }
+                }
+
+                chemo = vload4(0, squares);
+            }
+        }
+
+        tile[i / DIFFUSE_TILE_CHUNKS][i % DIFFUSE_TILE_CHUNKS] = chemo;
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    local const float* tileSquares = (local const float*)tile;
+    const int tileWidth = DIFFUSE_TILE_CHUNKS * 4;
+    int col = get_global_id(0) * 4;
+    int row = get_global_id(1);
+    float newValues[4];
+
+    for (int j = 0; j < 4; j++) {
+        // Position of the square in the tile
+        int x = DIFFUSE_HALO_CHUNKS * 4 + localX * 4 + j;
+        int y = DIFFUSE_HALF + localY;
+        float chemo = 0.0f;
+
+        // In the order of measureChemoAroundPosition, so the sum is rounded the same
+        #pragma unroll
+        for (int xOffset = -DIFFUSE_HALF; xOffset <= DIFFUSE_HALF; xOffset++) {
+            #pragma unroll
+            for (int yOffset = -DIFFUSE_HALF; yOffset <= DIFFUSE_HALF; yOffset++) {
+                chemo += tileSquares[x + xOffset + (y + yOffset) * tileWidth];
+            }
+        }
+
+        newValues[j] = diffusedValue(chemo, tileSquares[x + y * tileWidth]);
+    }
+
+    if (row < CFG_ENV_HEIGHT) {
+        if (col + 4 <= CFG_ENV_WIDTH) {
+            TRAIL_STORE4(trailMapDestination, col + row * CFG_ENV_WIDTH, vload4(0, newValues));
+        }
+        else {
+            for (int j = 0; j < 4 && col + j < CFG_ENV_WIDTH; j++) {
+                TRAIL_STORE(trailMapDestination, col + j + row * CFG_ENV_WIDTH, newValues[j]);
+            }
+        }
+    }
+}
+
+// Squares senseLocal can stage, 16 KiB. The agents are sorted along a Z-order curve, so the sensors of a work-group
+//  normally cover a small part of the map. Groups whose sensors are spread wider, e.g. before the first sort, read
+//  global memory like sense
+#define SENSE_LOCAL_CAPACITY 4096
+
+// measureChemoAroundPosition on the box of the map staged by senseLocal. Every square of the map a sensor can reach is
+//  in the box
+static inline float measureChemoStaged(local const float* box, int boxX, int boxY, int boxWidth, int x, int y)
+{
+    float totalChemo = 0.0f;
+
+    #pragma unroll
+    for (int xOffset = -CFG_AGENT_SENSOR_WIDTH / 2; xOffset <= CFG_AGENT_SENSOR_WIDTH / 2; xOffset++) {
+        int xd = x + xOffset;
+
+        #pragma unroll
+        for (int yOffset = -CFG_AGENT_SENSOR_WIDTH / 2; yOffset <= CFG_AGENT_SENSOR_WIDTH / 2; yOffset++) {
+            int yd = y + yOffset;
+
+            if (xd >= 0 && xd < CFG_ENV_WIDTH && yd >= 0 && yd < CFG_ENV_HEIGHT) {
+                totalChemo += box[xd - boxX + (yd - boxY) * boxWidth];
+            }
+        }
+    }
+
+    return totalChemo;
+}
+
+// One-dimensional work-groups of LOCAL_GROUP_SIZE agents. The global size is rounded up to whole groups, the work-items
+//  past numAgents only help staging
+#ifdef CFG_NUM_HEADINGS
+kernel __attribute__((reqd_work_group_size(LOCAL_GROUP_SIZE, 1, 1)))
+void senseLocal(global const trail_t* trailMap, global Agent* agents, global const uint* agentIds, uint step, uint numAgents, constant float4* headings)
+#else
+kernel __attribute__((reqd_work_group_size(LOCAL_GROUP_SIZE, 1, 1)))
+void senseLocal(global const trail_t* trailMap, global Agent* agents, global const uint* agentIds, uint step, uint numAgents)
+#endif
+{
+    local float box[SENSE_LOCAL_CAPACITY];
+    // Smallest and largest column and row the sensors of the group reach
+    local int bounds[4];
+    size_t idx = get_global_id(0);
+    int localIdx = get_local_id(0);
+    bool isAgent = idx < numAgents;
+    const int kernelHalf = CFG_AGENT_SENSOR_WIDTH / 2;
+    int x[3], y[3];
+    float senses[3];
+
+    if (localIdx == 0) {
+        bounds[0] = INT_MAX;
+        bounds[1] = INT_MAX;
+        bounds[2] = INT_MIN;
+        bounds[3] = INT_MIN;
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if (isAgent) {
+#ifdef CFG_NUM_HEADINGS
+        headingSensorPositions(agents, idx, headings, x, y);
+#else
+        float rotationOffsets[3] = { -CFG_AGENT_SENSOR_ANGLE, CFG_AGENT_SENSOR_ANGLE, 0 };
+
+        for (int i = 0; i < 3; i++) {
+            sensorPosition(agents, idx, (float)CFG_AGENT_SENSOR_OFFSET, rotationOffsets[i], &x[i], &y[i]);
+        }
+#endif
+
+        for (int i = 0; i < 3; i++) {
+            atomic_min(&bounds[0], x[i] - kernelHalf);
+            atomic_min(&bounds[1], y[i] - kernelHalf);
+            atomic_max(&bounds[2], x[i] + kernelHalf);
+            atomic_max(&bounds[3], y[i] + kernelHalf);
+        }
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // The part of the map inside the bounds. Empty if every sensor is off the map
+    int boxX = max(bounds[0], 0);
+    int boxY = max(bounds[1], 0);
+    int boxWidth = max(min(bounds[2], CFG_ENV_WIDTH - 1) - boxX + 1, 0);
+    int boxHeight = max(min(bounds[3], CFG_ENV_HEIGHT - 1) - boxY + 1, 0);
+    // The same for the whole group, so all of it takes the barrier or none of it
+    bool staged = boxWidth * boxHeight <= SENSE_LOCAL_CAPACITY;
+
+    if (staged) {
+        for (int i = localIdx; i < boxWidth * boxHeight; i += LOCAL_GROUP_SIZE) {
+            box[i] = TRAIL_LOAD(trailMap, boxX + i % boxWidth + (boxY + i / boxWidth) * CFG_ENV_WIDTH);
+        }
+
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if (!isAgent) {
+        return;
+    }
+
+    for (int i = 0; i < 3; i++) {
+        if (staged) {
+            senses[i] = measureChemoStaged(box, boxX, boxY, boxWidth, x[i], y[i]);
+        }
+        else {
+            int numSquares;
+
+            measureChemoAroundPosition(trailMap, x[i], y[i], CFG_AGENT_SENSOR_WIDTH, &senses[i], &numSquares);
+        }
+    }
+
+    turnAgent(agents, idx, agentIds[idx], senses[0], senses[2], senses[1], AGENT_ROTATION, CFG_RANDOM_SEED, step);
+}
+#endif
+)CLC"
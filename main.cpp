@@ -1,58 +1,211 @@
+#include <algorithm>
 #include <vector>
+#include <atomic>
 #include <chrono>
+#include <iostream>
+#include <sstream>
+#include <thread>
 #include <opencv2/opencv.hpp>
 
+#include "checkpoint.h"
 #include "slimemoldcpu.h"
+#include "slimemoldmultidevice.h"
 #include "slimemoldopencl.h"
+#include "slimemoldtiled.h"
 #include "runstatistics.h"
+#include "triplebuffer.h"
 #include "videorecorder.h"
 
-int main()
-{
-    const std::string windowId = "SomeID";
-    auto done = false;
+const std::string windowId = "SomeID";
+
+// Returns true when the window asks to quit
+bool showFrame(const unsigned char* frame) {
     int height = RunConfiguration::Environment::height;
     int width = RunConfiguration::Environment::width;
+    // The image is just a wrapper over the trail data
+    cv::Mat imgTrail = cv::Mat(height, width, CV_8UC1, const_cast<unsigned char*>(frame));
+
+    cv::imshow(windowId, imgTrail);
+
+    auto kc = cv::waitKey(1);
+
+    return kc == 27;
+}
+
+// Where the simulation is saved to while running. nullptr when not in use
+struct RunOutputs {
+    VideoRecorder* videoRecorder;
+    CheckpointWriter* checkpointWriter;
+};
+
+// Queue the current frame every frameSaveInterval steps and save a checkpoint every saveInterval steps. Both are
+//  written in the background
+void saveOutputs(const RunOutputs& outputs, SlimeMold* slimeMold) {
+    // checkpointWriter is only created when saveInterval > 0. This just keeps the modulo below clear of a zero
+    const unsigned int checkpointInterval = RunConfiguration::Checkpoint::saveInterval > 0 ? RunConfiguration::Checkpoint::saveInterval : 1;
+
+    if (outputs.videoRecorder != nullptr && slimeMold->getStep() % RunConfiguration::Recording::frameSaveInterval == 0) {
+        int height = RunConfiguration::Environment::height;
+        int width = RunConfiguration::Environment::width;
+
+        outputs.videoRecorder->writeFrame(cv::Mat(height, width, CV_8UC1, slimeMold->getDataTrailRender()));
+    }
+
+    if (outputs.checkpointWriter != nullptr && slimeMold->getStep() % checkpointInterval == 0) {
+        outputs.checkpointWriter->save(slimeMold, RunConfiguration::Checkpoint::savePath());
+    }
+}
+
+// One step per displayed frame
+void runLockstep(SlimeMold* slimeMold, RunStatistics& stats, const RunOutputs& outputs) {
+    auto done = false;
+
+    while (!done) {
+        slimeMold->run();
+
+        // The buffer can change between steps
+        done = showFrame(slimeMold->getDataTrailRender());
+        saveOutputs(outputs, slimeMold);
+
+        stats.update();
+
+        cv::setWindowTitle(windowId, stats.getStatusString());
+    }
+}
+
+// The simulation runs on its own thread and hands finished frames to this one through a triple buffer, so neither
+//  waits for the other (unless stepsPerFrame asks the simulation to)
+void runDecoupled(SlimeMold* slimeMold, RunStatistics& simulationStats, const RunOutputs& outputs) {
+    const int stepsPerFrame = RunConfiguration::Hardware::stepsPerFrame;
+    const size_t numPixels = RunConfiguration::Environment::numPixels();
+    TripleBuffer<std::vector<unsigned char>> frames(std::vector<unsigned char>(numPixels, 0));
+    RunStatistics displayStats;
+    std::atomic<bool> done(false);
+
+    std::thread simulationThread([&]() {
+        int stepsSincePublish = 0;
+
+        while (!done.load()) {
+            if (stepsPerFrame > 0 && stepsSincePublish >= stepsPerFrame) {
+                // Wait for the window to take the last frame before simulating the next one
+                if (frames.hasUnreadValue()) {
+                    std::this_thread::sleep_for(std::chrono::microseconds(200));
+                    continue;
+                }
+
+                stepsSincePublish = 0;
+            }
+
+            slimeMold->run();
+            simulationStats.update();
+            saveOutputs(outputs, slimeMold);
+            stepsSincePublish++;
+
+            if (stepsPerFrame == 0 || stepsSincePublish == stepsPerFrame) {
+                const auto render = slimeMold->getDataTrailRender();
+                auto& frame = frames.getWriteBuffer();
+
+                std::copy(render, render + numPixels, frame.begin());
+                frames.publish();
+            }
+        }
+    });
+
+    while (!done.load()) {
+        if (frames.update()) {
+            displayStats.update();
+        }
+
+        // Show the current frame even when there is no new one, so the window stays responsive
+        if (showFrame(frames.getReadBuffer().data())) {
+            done = true;
+        }
+
+        std::stringstream title;
+
+        title << "Steps: " << simulationStats.getSteps() << " Steps/s: " << simulationStats.getFps() << " Display FPS: " << displayStats.getFps();
+        cv::setWindowTitle(windowId, title.str());
+    }
+
+    simulationThread.join();
+}
+
+int main()
+{
     RunStatistics stats;
     SlimeMold* slimeMold;
 
-    if (RunConfiguration::Hardware::onlyCpu) {
+    if (RunConfiguration::Hardware::onlyCpu && RunConfiguration::Hardware::tiledCpu) {
+        slimeMold = new SlimeMoldTiled();
+    }
+    else if (RunConfiguration::Hardware::onlyCpu) {
         slimeMold = new SlimeMoldCpu();
     }
+    else if (RunConfiguration::MultiDevice::enabled) {
+        slimeMold = new SlimeMoldMultiDevice();
+    }
     else {
         slimeMold = new SlimeMoldOpenCl();
     }
 
-    // The image is just a wrapper over the trail data
-    cv::Mat imgTrail = cv::Mat(height, width, CV_8UC1, slimeMold->getDataTrailRender());
+    if (RunConfiguration::Hardware::instrumentation) {
+        slimeMold->setStatistics(&stats);
+    }
+
+    if (std::string(RunConfiguration::Checkpoint::loadPath()) != "") {
+        std::string error;
+
+        if (!loadCheckpoint(slimeMold, RunConfiguration::Checkpoint::loadPath(), error)) {
+            std::cout << "Can't load checkpoint: " << error << std::endl;
+            delete slimeMold;
+            return 1;
+        }
+    }
 
     cv::namedWindow(windowId);
 
-    //VideoRecorder videoRecorder("running.mp4", 30, RunConfiguration::Environment::width, RunConfiguration::Environment::height, 2);
-    //// Save every nth frame
-    //int frameSaveFrequency = 25;
+    RunOutputs outputs = { nullptr, nullptr };
 
-    while (!done) {
-        slimeMold->run();
+    if (RunConfiguration::Checkpoint::saveInterval > 0) {
+        outputs.checkpointWriter = new CheckpointWriter();
+    }
+
+    if (RunConfiguration::Recording::enabled) {
+        // Encoding happens on the recorder's own thread, so recording doesn't slow the simulation down
+        outputs.videoRecorder = new VideoRecorder(RunConfiguration::Recording::fileName(), RunConfiguration::Recording::fps, RunConfiguration::Environment::width,
+            RunConfiguration::Environment::height, RunConfiguration::Recording::lengthS, RunConfiguration::Recording::format, RunConfiguration::Recording::queueCapacity,
+            RunConfiguration::Recording::backPressure);
+    }
 
-        cv::imshow(windowId, imgTrail);
+    if (RunConfiguration::Hardware::decoupledDisplay) {
+        runDecoupled(slimeMold, stats, outputs);
+    }
+    else {
+        runLockstep(slimeMold, stats, outputs);
+    }
 
-        auto kc = cv::waitKey(1);
+    if (outputs.videoRecorder != nullptr) {
+        std::cout << "Video frames dropped: " << outputs.videoRecorder->getNumDroppedFrames() << ", max queue depth: " << outputs.videoRecorder->getMaxQueueDepth() << std::endl;
+        // Writes the frames still in the queue
+        delete outputs.videoRecorder;
+    }
 
-        //if (stats.getSteps() % frameSaveFrequency == 0) {
-        //    videoRecorder.writeFrame(imgTrail);
-        //}
+    if (outputs.checkpointWriter != nullptr) {
+        outputs.checkpointWriter->save(slimeMold, RunConfiguration::Checkpoint::savePath());
 
-        if (kc == 27) {
-            done = true;
+        if (!outputs.checkpointWriter->wait()) {
+            std::cout << "Can't save checkpoint " << RunConfiguration::Checkpoint::savePath() << std::endl;
         }
 
-        stats.update();
+        delete outputs.checkpointWriter;
+    }
 
-        cv::setWindowTitle(windowId, stats.getStatusString());
+    if (RunConfiguration::Hardware::instrumentation) {
+        slimeMold->finish();
+        std::cout << stats.getInstrumentationReport();
     }
 
     delete slimeMold;
 
     return 0;
-}
\ No newline at end of file
+}
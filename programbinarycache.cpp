@@ -0,0 +1,114 @@
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+#include "programbinarycache.h"
+#include "utils.h"
+
+// Bump to throw away all existing entries, e.g. if the file layout changes
+const char* const programBinaryCacheVersion = "slimemold-program-binary-1";
+
+ProgramBinaryCache::ProgramBinaryCache(const std::string& tDirectory) {
+    directory = tDirectory;
+
+    if (!directory.empty() && !Utils::Files::createDirectory(directory)) {
+        std::cout << "Kernel binary cache disabled: can't create " << directory << std::endl;
+        directory.clear();
+    }
+}
+
+compute::program ProgramBinaryCache::build(const std::string& source, const std::string& options, const compute::context& ctx) {
+    if (directory.empty()) {
+        return compute::program::build_with_source(source, ctx, options);
+    }
+
+    const auto key = getKey(source, options, ctx.get_device());
+    std::stringstream path;
+
+    path << directory << "/" << std::hex << std::setw(16) << std::setfill('0') << hash(key) << ".bin";
+
+    try {
+        return loadBinary(path.str(), key, options, ctx);
+    }
+    catch (const std::exception&) {
+        // Missing, stale or rejected by the driver. Build from source below
+    }
+
+    auto program = compute::program::build_with_source(source, ctx, options);
+
+    storeBinary(path.str(), key, program);
+
+    return program;
+}
+
+std::string ProgramBinaryCache::getKey(const std::string& source, const std::string& options, const compute::device& device) {
+    std::stringstream key;
+
+    key << programBinaryCacheVersion << "\n";
+    key << getDeviceKey(device);
+    key << options << "\n";
+    key << std::hex << hash(source) << "\n";
+
+    return key.str();
+}
+
+std::string ProgramBinaryCache::getDeviceKey(const compute::device& device) {
+    std::stringstream key;
+
+    key << device.platform().name() << "\n";
+    key << device.platform().version() << "\n";
+    key << device.name() << "\n";
+    key << device.vendor() << "\n";
+    key << device.version() << "\n";
+    key << device.driver_version() << "\n";
+
+    return key.str();
+}
+
+unsigned long long ProgramBinaryCache::hash(const std::string& s) {
+    unsigned long long h = 14695981039346656037ULL;
+
+    for (auto c : s) {
+        h ^= static_cast<unsigned char>(c);
+        h *= 1099511628211ULL;
+    }
+
+    return h;
+}
+
+compute::program ProgramBinaryCache::loadBinary(const std::string& path, const std::string& key, const std::string& options, const compute::context& ctx) {
+    std::vector<unsigned char> content;
+
+    // Layout: the key, a zero byte and then the binary
+    if (!Utils::Files::readBinaryFile(path, content) || content.size() <= key.size() + 1
+        || std::memcmp(content.data(), key.data(), key.size()) != 0 || content[key.size()] != 0) {
+        throw std::runtime_error("No matching program binary in " + path);
+    }
+
+    const size_t binaryOffset = key.size() + 1;
+    auto program = compute::program::create_with_binary(content.data() + binaryOffset, content.size() - binaryOffset, ctx);
+
+    program.build(options);
+
+    return program;
+}
+
+void ProgramBinaryCache::storeBinary(const std::string& path, const std::string& key, const compute::program& program) {
+    const auto binary = program.binary();
+
+    if (binary.empty()) {
+        return;
+    }
+
+    std::vector<unsigned char> content(key.begin(), key.end());
+
+    content.push_back(0);
+    content.insert(content.end(), binary.begin(), binary.end());
+
+    if (!Utils::Files::writeBinaryFile(path, content)) {
+        std::cout << "Could not write kernel binary cache entry " << path << std::endl;
+    }
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#define CL_TARGET_OPENCL_VERSION 220
+
+#include <string>
+
+#include <boost/compute.hpp>
+
+namespace compute = boost::compute;
+
+/// <summary>
+/// Keeps built OpenCL programs on disk, so the kernels are only compiled the first time a program is run on a device.
+/// Each file is keyed by a hash of the source, the build options and the device, driver and platform versions, so a
+/// driver update or a changed kernel gives a new entry instead of a stale binary.
+///
+/// The cache never makes a build fail: an entry that can't be read, doesn't match its key or is rejected by the driver
+/// is ignored and the program is built from source as usual. An empty directory turns the cache off.
+/// </summary>
+class ProgramBinaryCache {
+public:
+    ProgramBinaryCache(const std::string& tDirectory);
+    compute::program build(const std::string& source, const std::string& options, const compute::context& ctx);
+    // Platform, device and driver, one per line. Anything built for or measured on the device depends on these
+    static std::string getDeviceKey(const compute::device& device);
+    // 64-bit FNV-1a
+    static unsigned long long hash(const std::string& s);
+private:
+    // Everything the binary depends on, as one string. Stored in the file next to the binary to rule out hash collisions
+    static std::string getKey(const std::string& source, const std::string& options, const compute::device& device);
+    compute::program loadBinary(const std::string& path, const std::string& key, const std::string& options, const compute::context& ctx);
+    void storeBinary(const std::string& path, const std::string& key, const compute::program& program);
+    std::string directory;
+};
@@ -1,3 +1,8 @@
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+
 #include "runstatistics.h"
 
 RunStatistics::RunStatistics() {
@@ -5,6 +10,10 @@ RunStatistics::RunStatistics() {
     numSteps = 0;
     framesSinceLastUpdate = 0;
     fps = 0.0f;
+
+    for (auto phase : { SimulationPhase::Diffusion, SimulationPhase::Decay, SimulationPhase::Move, SimulationPhase::Sense, SimulationPhase::Render, SimulationPhase::DiffuseDecayRender, SimulationPhase::SortAgents }) {
+        phaseHistograms[phase].reset(new DurationHistogram());
+    }
 }
 
 void RunStatistics::update() {
@@ -31,3 +40,201 @@ std::string RunStatistics::getStatusString() const {
     //return std::to_string(numSteps);
     return "Steps: " + std::to_string(numSteps) + " FPS: " + std::to_string(fps);
 }
+
+
+DurationHistogram::DurationHistogram() {
+    reset();
+}
+
+int DurationHistogram::bucketIndex(unsigned long long ns) {
+    if (ns < numSubBuckets) {
+        return static_cast<int>(ns);
+    }
+
+    int log2 = numSubBucketsLog2;
+
+    while (log2 < 63 && (ns >> (log2 + 1)) != 0) {
+        log2++;
+    }
+
+    // The bits right below the highest one select the sub-bucket
+    const int subBucket = static_cast<int>((ns >> (log2 - numSubBucketsLog2)) & (numSubBuckets - 1));
+    const int idx = (log2 - numSubBucketsLog2 + 1) * numSubBuckets + subBucket;
+
+    return idx < numBuckets ? idx : numBuckets - 1;
+}
+
+unsigned long long DurationHistogram::bucketUpperBoundNs(int idx) {
+    if (idx < numSubBuckets) {
+        return idx + 1;
+    }
+
+    const int shift = idx / numSubBuckets - 1;
+    const unsigned long long subBucket = idx % numSubBuckets;
+
+    return (numSubBuckets + subBucket + 1) << shift;
+}
+
+void DurationHistogram::record(double seconds) {
+    recordNs(static_cast<unsigned long long>(seconds > 0.0 ? seconds * 1e9 : 0.0));
+}
+
+void DurationHistogram::recordNs(unsigned long long ns) {
+    buckets[bucketIndex(ns)].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    sumNs.fetch_add(ns, std::memory_order_relaxed);
+
+    auto currentMax = maxNs.load(std::memory_order_relaxed);
+
+    while (ns > currentMax && !maxNs.compare_exchange_weak(currentMax, ns, std::memory_order_relaxed)) {
+    }
+}
+
+void DurationHistogram::reset() {
+    for (auto& bucket : buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+
+    count.store(0, std::memory_order_relaxed);
+    sumNs.store(0, std::memory_order_relaxed);
+    maxNs.store(0, std::memory_order_relaxed);
+}
+
+unsigned long long DurationHistogram::getCount() const {
+    return count.load(std::memory_order_relaxed);
+}
+
+double DurationHistogram::getMeanSeconds() const {
+    const auto n = getCount();
+
+    return n > 0 ? 1e-9 * sumNs.load(std::memory_order_relaxed) / n : 0.0;
+}
+
+double DurationHistogram::getMaxSeconds() const {
+    return 1e-9 * maxNs.load(std::memory_order_relaxed);
+}
+
+double DurationHistogram::getPercentileSeconds(double p) const {
+    unsigned long long total = 0;
+
+    for (auto& bucket : buckets) {
+        total += bucket.load(std::memory_order_relaxed);
+    }
+
+    if (total == 0) {
+        return 0.0;
+    }
+
+    // Nearest rank
+    auto rank = static_cast<unsigned long long>(std::ceil(p / 100.0 * total));
+    rank = std::max(1ULL, std::min(total, rank));
+    unsigned long long seen = 0;
+
+    for (int i = 0; i < numBuckets; i++) {
+        seen += buckets[i].load(std::memory_order_relaxed);
+
+        if (seen >= rank) {
+            return 1e-9 * std::min(bucketUpperBoundNs(i), maxNs.load(std::memory_order_relaxed));
+        }
+    }
+
+    return getMaxSeconds();
+}
+
+ScopedPhaseTimer::ScopedPhaseTimer(DurationHistogram* tHistogram) {
+    histogram = tHistogram;
+
+    if (histogram != nullptr) {
+        start = std::chrono::steady_clock::now();
+    }
+}
+
+ScopedPhaseTimer::~ScopedPhaseTimer() {
+    if (histogram != nullptr) {
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        histogram->recordNs(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    }
+}
+
+DurationHistogram& RunStatistics::getPhaseHistogram(SimulationPhase phase) {
+    // All phases are created up front, so this never modifies the map and needs no lock
+    return *phaseHistograms.at(phase);
+}
+
+DeviceCommandStatistics& RunStatistics::getDeviceCommandStatistics(const std::string& name) {
+    std::lock_guard<std::mutex> lock(deviceCommandsMutex);
+    auto& entry = deviceCommands[name];
+
+    if (!entry) {
+        entry.reset(new DeviceCommandStatistics());
+    }
+
+    return *entry;
+}
+
+std::vector<std::string> RunStatistics::getDeviceCommandNames() const {
+    std::lock_guard<std::mutex> lock(deviceCommandsMutex);
+    std::vector<std::string> names;
+
+    for (auto& entry : deviceCommands) {
+        names.push_back(entry.first);
+    }
+
+    return names;
+}
+
+void RunStatistics::resetInstrumentation() {
+    for (auto& entry : phaseHistograms) {
+        entry.second->reset();
+    }
+
+    std::lock_guard<std::mutex> lock(deviceCommandsMutex);
+
+    for (auto& entry : deviceCommands) {
+        entry.second->queuedToSubmit.reset();
+        entry.second->submitToStart.reset();
+        entry.second->startToEnd.reset();
+        entry.second->bytes.store(0, std::memory_order_relaxed);
+    }
+}
+
+std::string RunStatistics::getInstrumentationReport() const {
+    std::stringstream ss;
+    auto addRow = [&ss](const std::string& name, const DurationHistogram& histogram) {
+        ss << std::left << std::setw(28) << name << std::right << std::setw(10) << histogram.getCount()
+            << std::setw(12) << 1000.0 * histogram.getMeanSeconds()
+            << std::setw(12) << 1000.0 * histogram.getPercentileSeconds(50.0)
+            << std::setw(12) << 1000.0 * histogram.getPercentileSeconds(99.0) << "\n";
+    };
+
+    ss << std::fixed << std::setprecision(3);
+    ss << std::left << std::setw(28) << "host phase" << std::right << std::setw(10) << "count" << std::setw(12) << "mean ms" << std::setw(12) << "p50 ms" << std::setw(12) << "p99 ms" << "\n";
+
+    for (auto& entry : phaseHistograms) {
+        if (entry.second->getCount() > 0) {
+            addRow(SlimeMold::getPhaseName(entry.first), *entry.second);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(deviceCommandsMutex);
+
+    if (!deviceCommands.empty()) {
+        ss << std::left << std::setw(28) << "device command" << std::right << std::setw(10) << "count" << std::setw(12) << "mean ms" << std::setw(12) << "p50 ms" << std::setw(12) << "p99 ms" << "\n";
+
+        for (auto& entry : deviceCommands) {
+            addRow(entry.first + " (queued)", entry.second->queuedToSubmit);
+            addRow(entry.first + " (submitted)", entry.second->submitToStart);
+            addRow(entry.first + " (running)", entry.second->startToEnd);
+
+            const auto bytes = entry.second->bytes.load(std::memory_order_relaxed);
+
+            if (bytes > 0) {
+                const double seconds = entry.second->startToEnd.getMeanSeconds() * entry.second->startToEnd.getCount();
+                ss << std::left << std::setw(28) << (entry.first + " (transfer)") << std::right << std::setw(10) << bytes / (1024 * 1024) << " MiB, "
+                    << std::setprecision(2) << (seconds > 0.0 ? bytes / seconds / 1e9 : 0.0) << " GB/s" << std::setprecision(3) << "\n";
+            }
+        }
+    }
+
+    return ss.str();
+}
@@ -1,7 +1,66 @@
 #pragma once
 
+#include <atomic>
 #include <string>
 #include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "slimemold.h"
+
+/// <summary>
+/// Histogram of durations that can be recorded from any thread without locks. Durations are kept in nanoseconds in
+/// log-linear buckets: every power of two is split into numSubBuckets equal buckets, so a percentile is off by at
+/// most 1 / numSubBuckets (12.5%) of its value. Count, sum and max are exact.
+/// </summary>
+class DurationHistogram {
+public:
+    DurationHistogram();
+    void record(double seconds);
+    void recordNs(unsigned long long ns);
+    void reset();
+    unsigned long long getCount() const;
+    double getMeanSeconds() const;
+    double getMaxSeconds() const;
+    // Upper bound of the bucket holding the p:th percentile, p in [0, 100]
+    double getPercentileSeconds(double p) const;
+private:
+    static const int numSubBucketsLog2 = 3;
+    static const int numSubBuckets = 1 << numSubBucketsLog2;
+    // Enough for durations up to 2^48 ns, about three days. Longer ones end up in the last bucket
+    static const int numBuckets = (48 - numSubBucketsLog2 + 1) * numSubBuckets;
+    static int bucketIndex(unsigned long long ns);
+    static unsigned long long bucketUpperBoundNs(int idx);
+    std::atomic<unsigned long long> buckets[numBuckets];
+    std::atomic<unsigned long long> count;
+    std::atomic<unsigned long long> sumNs;
+    std::atomic<unsigned long long> maxNs;
+};
+
+// Timing of one kind of device command (a kernel or a copy), from OpenCL event profiling
+struct DeviceCommandStatistics {
+    // Waiting in the host queue, from enqueue until the driver hands it to the device
+    DurationHistogram queuedToSubmit;
+    // Waiting on the device
+    DurationHistogram submitToStart;
+    // Execution
+    DurationHistogram startToEnd;
+    // Bytes copied between host and device. Zero for kernels
+    std::atomic<unsigned long long> bytes;
+    DeviceCommandStatistics() : bytes(0) {}
+};
+
+// Measures the time until it goes out of scope. histogram = nullptr disables it
+class ScopedPhaseTimer {
+public:
+    ScopedPhaseTimer(DurationHistogram* tHistogram);
+    ~ScopedPhaseTimer();
+private:
+    DurationHistogram* histogram;
+    std::chrono::steady_clock::time_point start;
+};
 
 class RunStatistics {
 public:
@@ -16,10 +75,24 @@ public:
     // Update this to return a proper report
     std::string getStatusString() const;
 
+    // Instrumentation. Only recorded into when the object has been handed to SlimeMold::setStatistics. The histograms
+    //  are safe to record into from any thread.
+    DurationHistogram& getPhaseHistogram(SimulationPhase phase);
+    // Created on first use. The reference stays valid for the lifetime of this object
+    DeviceCommandStatistics& getDeviceCommandStatistics(const std::string& name);
+    std::vector<std::string> getDeviceCommandNames() const;
+    // Table of all phases and device commands that have been recorded
+    std::string getInstrumentationReport() const;
+    void resetInstrumentation();
+
 private:
-    int numSteps;
+    // update() is called from one thread, but steps and FPS can be read from any
+    std::atomic<int> numSteps;
     const float updateFpsIntervalS = 0.5f;
     int framesSinceLastUpdate;
     std::chrono::time_point<std::chrono::system_clock> lastUpdate;
-    float fps;
-};
\ No newline at end of file
+    std::atomic<float> fps;
+    std::map<SimulationPhase, std::unique_ptr<DurationHistogram>> phaseHistograms;
+    std::map<std::string, std::unique_ptr<DeviceCommandStatistics>> deviceCommands;
+    mutable std::mutex deviceCommandsMutex;
+};
@@ -0,0 +1,321 @@
+#pragma once
+
+// Thin wrapper over the widest float vector the build targets, so the CPU kernels can be written once.
+//  AVX2 when compiling with /arch:AVX2 (or -mavx2), SSE on any other x86/x64 build, plain floats otherwise.
+#if defined(__AVX2__)
+#define SLIMEMOLD_SIMD_AVX2
+#include <immintrin.h>
+// Half float conversion instructions. MSVC has no separate switch for them, every AVX2 CPU supports them
+#if defined(__F16C__) || defined(_MSC_VER)
+#define SLIMEMOLD_SIMD_F16C
+#endif
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SLIMEMOLD_SIMD_SSE
+#include <emmintrin.h>
+#endif
+
+#include <cstdint>
+#include <cstring>
+
+namespace Simd {
+    // IEEE 754 half float conversions for one value, rounding to nearest even. After "Half to float done quick"
+    //  (F. Giesen)
+    inline float halfToFloat(unsigned short h) {
+        const uint32_t shiftedExponent = 0x7c00u << 13;
+        uint32_t bits = (h & 0x7fffu) << 13;
+        const uint32_t exponent = bits & shiftedExponent;
+        float f;
+
+        bits += (127 - 15) << 23;
+
+        if (exponent == shiftedExponent) {
+            // Inf or NaN
+            bits += (128 - 16) << 23;
+            std::memcpy(&f, &bits, sizeof(f));
+        }
+        else if (exponent == 0) {
+            // Zero or subnormal: let the FPU renormalize
+            const uint32_t magicBits = 113u << 23;
+            float magic;
+            bits += 1u << 23;
+            std::memcpy(&f, &bits, sizeof(f));
+            std::memcpy(&magic, &magicBits, sizeof(magic));
+            f -= magic;
+        }
+        else {
+            std::memcpy(&f, &bits, sizeof(f));
+        }
+
+        uint32_t signedBits;
+        std::memcpy(&signedBits, &f, sizeof(f));
+        signedBits |= static_cast<uint32_t>(h & 0x8000u) << 16;
+        std::memcpy(&f, &signedBits, sizeof(f));
+
+        return f;
+    }
+
+    inline unsigned short floatToHalf(float value) {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        const uint32_t sign = bits & 0x80000000u;
+        unsigned short h;
+
+        bits ^= sign;
+
+        if (bits >= (127u + 16) << 23) {
+            // Too large for a half: Inf, or NaN stays NaN
+            h = (bits > 255u << 23) ? 0x7e00 : 0x7c00;
+        }
+        else if (bits < 113u << 23) {
+            // Zero or subnormal. Adding the magic number does the rounding
+            const uint32_t magicBits = ((127 - 15) + (23 - 10) + 1) << 23;
+            float f, magic;
+            std::memcpy(&f, &bits, sizeof(f));
+            std::memcpy(&magic, &magicBits, sizeof(magic));
+            f += magic;
+            std::memcpy(&bits, &f, sizeof(bits));
+            h = static_cast<unsigned short>(bits - magicBits);
+        }
+        else {
+            const uint32_t mantissaOdd = (bits >> 13) & 1;
+            bits += (static_cast<uint32_t>(15 - 127) << 23) + 0xfff;
+            bits += mantissaOdd;
+            h = static_cast<unsigned short>(bits >> 13);
+        }
+
+        return static_cast<unsigned short>(h | (sign >> 16));
+    }
+
+#if defined(SLIMEMOLD_SIMD_AVX2)
+    typedef __m256 Float;
+    const int width = 8;
+    inline const char* name() { return "AVX2"; }
+    inline Float load(const float* p) { return _mm256_loadu_ps(p); }
+    inline void store(float* p, Float v) { _mm256_storeu_ps(p, v); }
+    inline Float set1(float v) { return _mm256_set1_ps(v); }
+    inline Float add(Float a, Float b) { return _mm256_add_ps(a, b); }
+    inline Float sub(Float a, Float b) { return _mm256_sub_ps(a, b); }
+    inline Float mul(Float a, Float b) { return _mm256_mul_ps(a, b); }
+    inline Float min(Float a, Float b) { return _mm256_min_ps(a, b); }
+    inline Float max(Float a, Float b) { return _mm256_max_ps(a, b); }
+    // Inclusive prefix sum over the lanes: { a, a+b, a+b+c, ... }
+    inline Float prefixSum(Float v) {
+        v = _mm256_add_ps(v, _mm256_castsi256_ps(_mm256_slli_si256(_mm256_castps_si256(v), 4)));
+        v = _mm256_add_ps(v, _mm256_castsi256_ps(_mm256_slli_si256(_mm256_castps_si256(v), 8)));
+        // Each 128-bit half now holds its own prefix. Carry the total of the low half into the high half
+        Float carry = _mm256_permute2f128_ps(v, v, 0x08);
+        carry = _mm256_shuffle_ps(carry, carry, _MM_SHUFFLE(3, 3, 3, 3));
+        return _mm256_add_ps(v, carry);
+    }
+    // Copy the last lane into all lanes
+    inline Float broadcastLast(Float v) {
+        Float high = _mm256_permute2f128_ps(v, v, 0x11);
+        return _mm256_shuffle_ps(high, high, _MM_SHUFFLE(3, 3, 3, 3));
+    }
+    // Truncate to integers and store as bytes. Values are expected to be in [0, 256)
+    inline void storeBytes(unsigned char* p, Float v) {
+        __m256i i32 = _mm256_cvttps_epi32(v);
+        __m128i i16 = _mm_packus_epi32(_mm256_castsi256_si128(i32), _mm256_extracti128_si256(i32, 1));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(p), _mm_packus_epi16(i16, i16));
+    }
+    typedef __m256i Int;
+    typedef __m256 Mask;
+    inline Int truncToInt(Float v) { return _mm256_cvttps_epi32(v); }
+    inline Float toFloat(Int v) { return _mm256_cvtepi32_ps(v); }
+    inline void storeInt(int* p, Int v) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+    // Lanes where (v & bit) != 0
+    inline Mask testBit(Int v, int bit) {
+        const __m256i vBit = _mm256_set1_epi32(bit);
+        return _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(v, vBit), vBit));
+    }
+    inline Mask cmpLt(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    inline Mask cmpGt(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+    inline Mask cmpGe(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+    inline Mask maskAnd(Mask a, Mask b) { return _mm256_and_ps(a, b); }
+    // One bit per lane, lane 0 in bit 0
+    inline int maskBits(Mask m) { return _mm256_movemask_ps(m); }
+    // a where mask is set, b elsewhere
+    inline Float select(Mask m, Float a, Float b) { return _mm256_blendv_ps(b, a, m); }
+    // base[idx] where mask is set, 0 elsewhere. Masked lanes are not read
+    inline Float gather(const float* base, Int idx, Mask m) { return _mm256_mask_i32gather_ps(_mm256_setzero_ps(), base, idx, m, 4); }
+    // Unsigned 16-bit integers to float
+    inline Float loadU16(const unsigned short* p) { return _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)))); }
+    // Truncate to unsigned 16-bit integers. Values are expected to be in [0, 65536)
+    inline void storeU16(unsigned short* p, Float v) {
+        __m256i i32 = _mm256_cvttps_epi32(v);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(p), _mm_packus_epi32(_mm256_castsi256_si128(i32), _mm256_extracti128_si256(i32, 1)));
+    }
+    // base[idx] as 32-bit integers where mask is set, 0 elsewhere. Reads 4 bytes per element, so base needs one
+    //  element of padding after the last one that can be read.
+    inline Int gatherU16(const unsigned short* base, Int idx, Mask m) {
+        const __m256i words = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), reinterpret_cast<const int*>(base), idx, _mm256_castps_si256(m), 2);
+        return _mm256_and_si256(words, _mm256_set1_epi32(0xffff));
+    }
+#if defined(SLIMEMOLD_SIMD_F16C)
+    inline Float loadHalf(const unsigned short* p) { return _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))); }
+    inline void storeHalf(unsigned short* p, Float v) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), _mm256_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT)); }
+    // Half floats in the low 16 bits of each lane
+    inline Float halfBitsToFloat(Int bits) { return _mm256_cvtph_ps(_mm_packus_epi32(_mm256_castsi256_si128(bits), _mm256_extracti128_si256(bits, 1))); }
+#endif
+#elif defined(SLIMEMOLD_SIMD_SSE)
+    typedef __m128 Float;
+    const int width = 4;
+    inline const char* name() { return "SSE"; }
+    inline Float load(const float* p) { return _mm_loadu_ps(p); }
+    inline void store(float* p, Float v) { _mm_storeu_ps(p, v); }
+    inline Float set1(float v) { return _mm_set1_ps(v); }
+    inline Float add(Float a, Float b) { return _mm_add_ps(a, b); }
+    inline Float sub(Float a, Float b) { return _mm_sub_ps(a, b); }
+    inline Float mul(Float a, Float b) { return _mm_mul_ps(a, b); }
+    inline Float min(Float a, Float b) { return _mm_min_ps(a, b); }
+    inline Float max(Float a, Float b) { return _mm_max_ps(a, b); }
+    inline Float prefixSum(Float v) {
+        v = _mm_add_ps(v, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(v), 4)));
+        return _mm_add_ps(v, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(v), 8)));
+    }
+    inline Float broadcastLast(Float v) { return _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3)); }
+    inline void storeBytes(unsigned char* p, Float v) {
+        __m128i i32 = _mm_cvttps_epi32(v);
+        __m128i i16 = _mm_packs_epi32(i32, i32);
+        int bytes = _mm_cvtsi128_si32(_mm_packus_epi16(i16, i16));
+        std::memcpy(p, &bytes, sizeof(bytes));
+    }
+    typedef __m128i Int;
+    typedef __m128 Mask;
+    inline Int truncToInt(Float v) { return _mm_cvttps_epi32(v); }
+    inline Float toFloat(Int v) { return _mm_cvtepi32_ps(v); }
+    inline void storeInt(int* p, Int v) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v); }
+    inline Mask testBit(Int v, int bit) {
+        const __m128i vBit = _mm_set1_epi32(bit);
+        return _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(v, vBit), vBit));
+    }
+    inline Mask cmpLt(Float a, Float b) { return _mm_cmplt_ps(a, b); }
+    inline Mask cmpGt(Float a, Float b) { return _mm_cmpgt_ps(a, b); }
+    inline Mask cmpGe(Float a, Float b) { return _mm_cmpge_ps(a, b); }
+    inline Mask maskAnd(Mask a, Mask b) { return _mm_and_ps(a, b); }
+    inline int maskBits(Mask m) { return _mm_movemask_ps(m); }
+    // SSE2 has no blend instruction
+    inline Float select(Mask m, Float a, Float b) { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+    // No gather instruction either
+    inline Float gather(const float* base, Int idx, Mask m) {
+        alignas(16) int indices[4];
+        alignas(16) float values[4];
+        const int bits = maskBits(m);
+        storeInt(indices, idx);
+        for (int lane = 0; lane < 4; lane++) {
+            values[lane] = (bits & (1 << lane)) ? base[indices[lane]] : 0.0f;
+        }
+        return _mm_load_ps(values);
+    }
+    inline Float loadU16(const unsigned short* p) {
+        return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)), _mm_setzero_si128()));
+    }
+    // SSE2 can only pack to signed 16 bits, so shift the range down by 32768 and back up again
+    inline void storeU16(unsigned short* p, Float v) {
+        const __m128i shifted = _mm_sub_epi32(_mm_cvttps_epi32(v), _mm_set1_epi32(32768));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(p), _mm_add_epi16(_mm_packs_epi32(shifted, shifted), _mm_set1_epi16(-32768)));
+    }
+    inline Int gatherU16(const unsigned short* base, Int idx, Mask m) {
+        alignas(16) int indices[4];
+        alignas(16) int values[4];
+        const int bits = maskBits(m);
+        storeInt(indices, idx);
+        for (int lane = 0; lane < 4; lane++) {
+            values[lane] = (bits & (1 << lane)) ? base[indices[lane]] : 0;
+        }
+        return _mm_load_si128(reinterpret_cast<const __m128i*>(values));
+    }
+#else
+    typedef float Float;
+    const int width = 1;
+    inline const char* name() { return "Scalar"; }
+    inline Float load(const float* p) { return *p; }
+    inline void store(float* p, Float v) { *p = v; }
+    inline Float set1(float v) { return v; }
+    inline Float add(Float a, Float b) { return a + b; }
+    inline Float sub(Float a, Float b) { return a - b; }
+    inline Float mul(Float a, Float b) { return a * b; }
+    inline Float min(Float a, Float b) { return a < b ? a : b; }
+    inline Float max(Float a, Float b) { return a > b ? a : b; }
+    inline Float prefixSum(Float v) { return v; }
+    inline Float broadcastLast(Float v) { return v; }
+    inline void storeBytes(unsigned char* p, Float v) { *p = static_cast<unsigned char>(v); }
+    typedef int Int;
+    typedef bool Mask;
+    inline Int truncToInt(Float v) { return static_cast<int>(v); }
+    inline Float toFloat(Int v) { return static_cast<float>(v); }
+    inline void storeInt(int* p, Int v) { *p = v; }
+    inline Mask testBit(Int v, int bit) { return (v & bit) != 0; }
+    inline Mask cmpLt(Float a, Float b) { return a < b; }
+    inline Mask cmpGt(Float a, Float b) { return a > b; }
+    inline Mask cmpGe(Float a, Float b) { return a >= b; }
+    inline Mask maskAnd(Mask a, Mask b) { return a && b; }
+    inline int maskBits(Mask m) { return m ? 1 : 0; }
+    inline Float select(Mask m, Float a, Float b) { return m ? a : b; }
+    inline Float gather(const float* base, Int idx, Mask m) { return m ? base[idx] : 0.0f; }
+    inline Float loadU16(const unsigned short* p) { return static_cast<float>(*p); }
+    inline void storeU16(unsigned short* p, Float v) { *p = static_cast<unsigned short>(v); }
+    inline Int gatherU16(const unsigned short* base, Int idx, Mask m) { return m ? base[idx] : 0; }
+#endif
+
+#if !defined(SLIMEMOLD_SIMD_F16C)
+    // Without conversion instructions, one lane at a time
+    inline Float loadHalf(const unsigned short* p) {
+        float values[width];
+        for (int lane = 0; lane < width; lane++) {
+            values[lane] = halfToFloat(p[lane]);
+        }
+        return load(values);
+    }
+    inline void storeHalf(unsigned short* p, Float v) {
+        float values[width];
+        store(values, v);
+        for (int lane = 0; lane < width; lane++) {
+            p[lane] = floatToHalf(values[lane]);
+        }
+    }
+    inline Float halfBitsToFloat(Int bits) {
+        int words[width];
+        float values[width];
+        storeInt(words, bits);
+        for (int lane = 0; lane < width; lane++) {
+            values[lane] = halfToFloat(static_cast<unsigned short>(words[lane]));
+        }
+        return load(values);
+    }
+#endif
+
+    // Largest integer not greater than v. Only valid for |v| < 2^31
+    inline Float floor(Float v) {
+        const Float truncated = toFloat(truncToInt(v));
+        return select(cmpGt(truncated, v), sub(truncated, set1(1.0f)), truncated);
+    }
+
+    // Sine and cosine at once. The argument is reduced to [-pi/4, pi/4] with a three-part pi/2 (Cody-Waite) and
+    //  evaluated with the minimax polynomials of the Cephes sinf/cosf. Within a few ulp of std::sin/std::cos for the
+    //  angles the agents use, but not bit-identical to them.
+    inline void sincos(Float x, Float& s, Float& c) {
+        const Float quadrantF = floor(add(mul(x, set1(0.636619772f)), set1(0.5f)));
+        const Int quadrant = truncToInt(quadrantF);
+        Float r = sub(x, mul(quadrantF, set1(1.5703125f)));
+        r = sub(r, mul(quadrantF, set1(4.83751297e-4f)));
+        r = sub(r, mul(quadrantF, set1(7.54978995e-8f)));
+        const Float r2 = mul(r, r);
+
+        Float sr = add(mul(r2, set1(-1.9515295891e-4f)), set1(8.3321608736e-3f));
+        sr = add(mul(sr, r2), set1(-1.6666654611e-1f));
+        sr = add(mul(mul(sr, r2), r), r);
+
+        Float cr = add(mul(r2, set1(2.443315711809948e-5f)), set1(-1.388731625493765e-3f));
+        cr = add(mul(cr, r2), set1(4.166664568298827e-2f));
+        cr = add(sub(mul(mul(cr, r2), r2), mul(r2, set1(0.5f))), set1(1.0f));
+
+        // Odd quadrants swap sine and cosine. Sine is negative in quadrants 2 and 3, cosine in 1 and 2
+        const Mask swap = testBit(quadrant, 1);
+        const Float sinAbs = select(swap, cr, sr);
+        const Float cosAbs = select(swap, sr, cr);
+        const Float zero = set1(0.0f);
+        s = select(testBit(quadrant, 2), sub(zero, sinAbs), sinAbs);
+        c = select(testBit(truncToInt(add(quadrantF, set1(1.0f))), 2), sub(zero, cosAbs), cosAbs);
+    }
+}
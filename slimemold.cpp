@@ -1,5 +1,6 @@
 #include <vector>
 
+#include "runstatistics.h"
 #include "slimemold.h"
 #include "utils.h"
 
@@ -8,11 +9,19 @@ SlimeMold::SlimeMold() {
     const int imgHeight = RunConfiguration::Environment::height;
     dataTrailRender = new unsigned char[imgWidth * imgHeight];
     random = new Utils::Random();
+    threadPool = new ThreadPool(RunConfiguration::Hardware::numThreads);
+    fusedPipeline = false;
+    step = 0;
+    statistics = nullptr;
+    agentSortInterval = RunConfiguration::Hardware::agentSortInterval;
+    summedAreaSensing = RunConfiguration::Hardware::summedAreaSensingMinWidth > 0
+        && RunConfiguration::Agent::sensorWidth >= RunConfiguration::Hardware::summedAreaSensingMinWidth;
 }
 
 SlimeMold::~SlimeMold() {
     delete[] dataTrailRender;
     delete random;
+    delete threadPool;
 }
 
 std::vector<Agent> SlimeMold::initAgents() {
@@ -53,26 +62,132 @@ std::vector<Agent> SlimeMold::initAgents() {
 }
 
 void SlimeMold::run() {
-    diffusion();
-    swapBuffers();
-    decay();
-    move();
-    sense();
-    makeRenderImage();
+    for (auto phase : getStepPhases()) {
+        runPhase(phase);
+    }
+
+    completeStep();
+}
+
+std::vector<SimulationPhase> SlimeMold::getStepPhases() const {
+    std::vector<SimulationPhase> phases;
+
+    if (agentSortInterval > 0 && step % agentSortInterval == 0) {
+        phases.push_back(SimulationPhase::SortAgents);
+    }
+
+    if (fusedPipeline) {
+        phases.insert(phases.end(), { SimulationPhase::DiffuseDecayRender, SimulationPhase::Move, SimulationPhase::Sense });
+    }
+    else {
+        phases.insert(phases.end(), { SimulationPhase::Diffusion, SimulationPhase::Decay, SimulationPhase::Move, SimulationPhase::Sense, SimulationPhase::Render });
+    }
+
+    return phases;
+}
+
+void SlimeMold::runPhase(SimulationPhase phase) {
+    ScopedPhaseTimer timer(statistics != nullptr ? &statistics->getPhaseHistogram(phase) : nullptr);
+
+    switch (phase) {
+    case SimulationPhase::Diffusion:
+        diffusion();
+        swapBuffers();
+        break;
+    case SimulationPhase::Decay:
+        decay();
+        break;
+    case SimulationPhase::Move:
+        move();
+        break;
+    case SimulationPhase::Sense:
+        sense();
+        break;
+    case SimulationPhase::Render:
+        makeRenderImage();
+        break;
+    case SimulationPhase::DiffuseDecayRender:
+        diffuseDecayRender();
+        break;
+    case SimulationPhase::SortAgents:
+        sortAgents();
+        break;
+    }
+}
+
+void SlimeMold::completeStep() {
+    step++;
+}
+
+void SlimeMold::finish() {
+}
+
+void SlimeMold::setStatistics(RunStatistics* tStatistics) {
+    statistics = tStatistics;
+}
+
+void SlimeMold::setAgentSortInterval(int interval) {
+    agentSortInterval = interval;
+}
+
+void SlimeMold::setSummedAreaSensing(bool enabled) {
+    summedAreaSensing = enabled;
+}
+
+int SlimeMold::getNumActiveTrailTiles() {
+    return 0;
+}
+
+int SlimeMold::getNumTrailTiles() const {
+    return 0;
 }
 
-std::vector<int> SlimeMold::getAgentMoveOrder() {
-    std::vector<int> agentMoveOrder(RunConfiguration::Environment::populationSize(), 0);
+bool SlimeMold::getSummedAreaSensing() const {
+    return false;
+}
+
+int SlimeMold::getNumHeadings() const {
+    return 0;
+}
 
-    for (int i = 0; i < RunConfiguration::Environment::populationSize(); i++) {
-        agentMoveOrder[i] = i;
+std::string SlimeMold::getDeviceName() const {
+    return "CPU";
+}
+
+const char* SlimeMold::getPhaseName(SimulationPhase phase) {
+    switch (phase) {
+    case SimulationPhase::Diffusion:
+        return "diffusion";
+    case SimulationPhase::Decay:
+        return "decay";
+    case SimulationPhase::Move:
+        return "move";
+    case SimulationPhase::Sense:
+        return "sense";
+    case SimulationPhase::Render:
+        return "render";
+    case SimulationPhase::DiffuseDecayRender:
+        return "diffuseDecayRender";
+    case SimulationPhase::SortAgents:
+        return "sortAgents";
     }
 
-    // The first agent that moves into a position is the only one that can stay there.
-    //  To avoid bias, randomize move order at each step.
-    random->shuffleVector<int>(agentMoveOrder);
+    return "unknown";
+}
+
+int SlimeMold::getNumThreads() const {
+    return threadPool->getNumThreads();
+}
 
-    return agentMoveOrder;
+unsigned int SlimeMold::getStep() const {
+    return step;
+}
+
+void SlimeMold::diffuseDecayRender() {
+    diffusion();
+    swapBuffers();
+    decay();
+    makeRenderImage();
 }
 
 unsigned char* SlimeMold::getDataTrailRender() {
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <string>
+#include <vector>
+
+#include "threadpool.h"
 #include "utils.h"
 
 /*
@@ -16,10 +20,88 @@ enum class AgentInitPattern {
     Tree
 
 };
+
+// How the trail maps are stored. The reduced formats halve the memory traffic of every phase (see trailformat.h)
+enum class TrailFormat {
+    Float32,
+    // IEEE half float. 11 significant bits, so steps of 0.125 between 128 and 256
+    Float16,
+    // Unsigned fixed point with 8 integer and 8 fraction bits. Steps of 1/256 over the whole range
+    Fixed8_8
+};
+
+// Output of VideoRecorder
+enum class VideoFormat {
+    // Encoded by OpenCV with the codec it picks for the file extension
+    Encoded,
+    // Frames back to back, one byte per pixel, no header
+    Raw,
+    // YUV4MPEG2 with only the luma plane, readable by ffmpeg and most players
+    Y4m
+};
+
+// What VideoRecorder does with a frame when its queue is full
+enum class VideoBackPressure {
+    // Wait until the encoder has written a frame
+    Block,
+    // Drop the new frame and count it
+    Drop
+};
+
 struct RunConfiguration {
     struct Hardware {
         // True = CPU, false = OpenCL
         static const bool onlyCpu = false;
+        // Number of threads in the worker pool used by the parallel phases. 0 = std::thread::hardware_concurrency()
+        static const int numThreads = 0;
+        // Number of elements (pixels, rows or agents) handed out per work chunk. 0 = pick automatically
+        static const int grainSize = 0;
+        // Run diffusion, decay and rendering as one sweep over the trail map on the CPU backend. false = run them as
+        //  separate phases, which is easier to verify against the OpenCL backend
+        static const bool fusedCpuPipeline = true;
+        // Record phase and device command timings (see RunStatistics) and print them when the program exits
+        static const bool instrumentation = false;
+        // Built OpenCL programs are kept here so later runs can skip compiling the kernels. "" = don't cache
+        static const char* kernelCacheDirectory() { return "kernelcache"; }
+        // Sort the agents along a Z-order curve every this many steps, so agents that are next to each other in memory
+        //  also sense and deposit next to each other. Random numbers are drawn per agent id, so this doesn't change
+        //  the result of a run. 0 = never
+        static const int agentSortInterval = 64;
+        // Run the simulation on a thread of its own, so it isn't held back by the window. false = one step per frame
+        static const bool decoupledDisplay = false;
+        // Steps simulated per displayed frame when decoupledDisplay is set. The simulation waits for the window to
+        //  pick up each frame. 0 = simulate as fast as possible and show the latest frame whenever the window is ready
+        static const int stepsPerFrame = 4;
+        // Storage format of the trail maps on both backends. Computation is always done in float
+        static const TrailFormat trailFormat = TrailFormat::Float32;
+        // With onlyCpu, split the map into tiles with their own trail maps and agents (see SlimeMoldTiled). For maps
+        //  too large for SlimeMoldCpu, and faster for maps that don't fit in the cache. Trail maps are float32
+        static const bool tiledCpu = false;
+        // Width and height of a tile in squares. Edge tiles can be smaller
+        static const int tileSize = 256;
+        // Keep track of which tiles of the trail map can hold chemo and skip the others in diffusion, decay and
+        //  rendering, so a step costs less while the agents only cover part of the map. SlimeMoldCpu and
+        //  SlimeMoldOpenCl. The result is the same either way, apart from float rounding with a single CPU thread
+        static const bool sparseTrailMap = false;
+        // Sense through a summed-area table of the trail map, built once per step, when Agent::sensorWidth is at least
+        //  this. A sensor then costs four lookups instead of sensorWidth^2. SlimeMoldCpu and SlimeMoldOpenCl. The
+        //  table sums in fixed point, so a sensor can differ from the direct sum in the last bits. 0 = never
+        static const int summedAreaSensingMinWidth = 7;
+        // Quantize agent directions to this many headings, so sensing and moving look up precomputed offsets instead
+        //  of calling sin and cos (see HeadingTable). Agent::sensorAngle and rotationAngle have to be whole numbers of
+        //  headings, e.g. 16 for the default angles. SlimeMoldCpu and SlimeMoldOpenCl. 0 = continuous directions
+        static const int numHeadings = 0;
+        // Work-group size of the OpenCL diffusion and sense kernels that stage the squares they read in local memory
+        //  (diffuseLocal and senseLocal in kernels.cl). Each work-item of diffuseLocal writes four squares in a row,
+        //  senseLocal runs width * height agents per group. 0 = pick per device (see SlimeMoldOpenCl), -1 = read
+        //  global memory directly, with the work-group size left to the driver. benchmark --compare-local-size checks
+        //  the tiled kernels against the plain ones on a device, so they stay off until then
+        static const int localWorkGroupWidth = -1;
+        static const int localWorkGroupHeight = -1;
+        // Without onlyCpu, time the candidate work-group sizes and kernel variants of every OpenCL launch on the first
+        //  run on a device and map size, and keep the fastest in a profile in kernelCacheDirectory that later runs
+        //  read instead (see SlimeMoldOpenCl::tuneWorkGroups). Overrides localWorkGroupWidth and localWorkGroupHeight
+        static const bool tuneWorkGroups = false;
     };
     struct Environment {
         static const int width = 1920;
@@ -31,6 +113,8 @@ struct RunConfiguration {
         static const int populationSize() { return static_cast<int>(width * height * populationSizeRatio); }
         static const int numPixels() { return width * height; }
         static const AgentInitPattern initPattern = AgentInitPattern::Random;
+        // Seed of the counter-based random numbers used while running (see counterrng.h)
+        static const unsigned int randomSeed = 1;
     private:
         static constexpr float populationSizeRatio = 0.15f;
     };
@@ -44,31 +128,162 @@ struct RunConfiguration {
         static constexpr float pRandomChangeDirection = 0.0f;
         static constexpr float maxTotalChemo = 255.999f;
     };
+    struct Recording {
+        // Record the simulation to a video file (see VideoRecorder)
+        static const bool enabled = false;
+        static const char* fileName() { return "running.mp4"; }
+        static const VideoFormat format = VideoFormat::Encoded;
+        static constexpr double fps = 30.0;
+        static constexpr double lengthS = 2.0;
+        // Save every nth step
+        static const int frameSaveInterval = 25;
+        // Frames that can wait for the encoder before backPressure kicks in
+        static const int queueCapacity = 8;
+        static const VideoBackPressure backPressure = VideoBackPressure::Drop;
+    };
+    struct Checkpoint {
+        // Continue from this checkpoint instead of starting over (see checkpoint.h). "" = start over
+        static const char* loadPath() { return ""; }
+        static const char* savePath() { return "slimemold.checkpoint"; }
+        // Save a checkpoint every this many steps and when the program exits, in the background. 0 = never
+        static const int saveInterval = 0;
+    };
+    struct MultiDevice {
+        // Without onlyCpu, run on every matching OpenCL device at once, each simulating a strip of rows of the map
+        //  (see SlimeMoldMultiDevice). false = only the default device
+        static const bool enabled = false;
+        // Only devices whose name contains this. "" = all devices of all platforms
+        static const char* deviceFilter() { return ""; }
+        // Split each CPU device into one sub-device per NUMA node, so each node gets a strip of its own
+        static const bool splitCpuDevicesByNuma = false;
+        // Agents that wandered into another strip are handed over to its device every this many steps
+        static const int migrationInterval = 8;
+        // Move the strip borders every this many steps, based on the measured time of each device. 0 = fixed strips
+        static const int rebalanceInterval = 32;
+    };
+};
+
+// The parts of a simulation step, in the order SlimeMold::run executes them
+enum class SimulationPhase {
+    Diffusion,
+    Decay,
+    Move,
+    Sense,
+    Render,
+    // Diffusion, Decay and Render in one sweep, when the backend supports it
+    DiffuseDecayRender,
+    // Reorder the agents in memory by position. Every agentSortInterval steps, before the other phases
+    SortAgents
 };
 
+class RunStatistics;
+
 struct Agent {
     float x;
     float y;
     float direction; // Radians
 };
 
+// Agent parameters of one simulation of a SlimeMoldEnsemble. Everything else is shared by all members and comes from
+//  RunConfiguration
+struct EnsembleMember {
+    float sensorAngle;
+    float rotationAngle;
+    float sensorOffset;
+    float chemoDeposition;
+    // Members with the same parameters and different seeds are independent runs
+    unsigned int randomSeed;
+};
+
+// Everything needed to continue a run (see checkpoint.h). Random numbers are a function of seed, step and agent id, so
+//  the step is all there is of the random state. Agents and ids are in memory order, the trail maps are raw
+//  trailFormat pixels: current first, then the one the next diffusion writes to.
+struct SimulationState {
+    unsigned int step;
+    TrailFormat trailFormat;
+    std::vector<Agent> agents;
+    std::vector<unsigned int> agentIds;
+    std::vector<unsigned char> trailMaps[2];
+};
+
+// The same, pointing into memory owned by someone else, e.g. a mapped checkpoint file
+struct SimulationStateView {
+    unsigned int step;
+    TrailFormat trailFormat;
+    size_t numAgents;
+    const Agent* agents;
+    const unsigned int* agentIds;
+    const unsigned char* trailMaps[2];
+};
+
 class SlimeMold {
 public:
     SlimeMold();
-    ~SlimeMold();
+    virtual ~SlimeMold();
     virtual void diffusion() = 0;
     virtual void decay() = 0;
     virtual void move() = 0;
     virtual void sense() = 0;
     virtual void makeRenderImage() = 0;
     virtual void swapBuffers() = 0;
+    // Diffusion, buffer swap, decay and rendering in one go. Only called when fusedPipeline is set. Deposits made by
+    //  move() afterwards have to be written to the render image as well.
+    virtual void diffuseDecayRender();
+    virtual void sortAgents() = 0;
     std::vector<Agent> initAgents();
+    // Copy of the current agents, in the same order as initAgents created them
+    virtual std::vector<Agent> exportAgents() = 0;
+    // Index in exportAgents() of the agent at each position in memory. Changes when agents are sorted
+    virtual std::vector<unsigned int> exportAgentOrder() = 0;
+    // Copy of the current trail map, decoded to float whatever the storage format
+    virtual std::vector<float> exportTrailMap() = 0;
+    // Snapshot of the whole state. Waits for work in flight
+    virtual SimulationState exportState() = 0;
+    // Continue from state. The number of agents has to match the population, trail maps in another format are
+    //  converted
+    virtual void importState(const SimulationStateView& state) = 0;
     void run();
-    unsigned char* getDataTrailRender();
+    // run() split up, so each phase can be timed on its own: run each phase of getStepPhases() and then completeStep()
+    std::vector<SimulationPhase> getStepPhases() const;
+    void runPhase(SimulationPhase phase);
+    void completeStep();
+    // Block until all work issued so far is done. Needed before reading a clock, since OpenCL calls return early
+    virtual void finish();
+    virtual std::string getDeviceName() const;
+    static const char* getPhaseName(SimulationPhase phase);
+    int getNumThreads() const;
+    unsigned int getStep() const;
+    // The latest rendered frame. Backends that read frames back asynchronously may return a different buffer after
+    //  each step, so fetch the pointer again for every frame
+    virtual unsigned char* getDataTrailRender();
+    // Record the time of each phase (and on OpenCL, of each device command) into statistics. nullptr turns it off,
+    //  which is the default and costs a single branch per phase.
+    virtual void setStatistics(RunStatistics* tStatistics);
+    // Overrides RunConfiguration::Hardware::agentSortInterval
+    void setAgentSortInterval(int interval);
+    // Overrides the choice made from RunConfiguration::Hardware::summedAreaSensingMinWidth. Backends without a
+    //  summed-area table ignore it
+    void setSummedAreaSensing(bool enabled);
+    // Tiles of the trail map that may hold chemo, out of getNumTrailTiles(), with sparse trail maps. 0 on backends
+    //  that don't track them
+    virtual int getNumActiveTrailTiles();
+    virtual int getNumTrailTiles() const;
+    // Whether sense() goes through a summed-area table. False on backends without one
+    virtual bool getSummedAreaSensing() const;
+    // Headings agent directions are quantized to. 0 = continuous, as on backends without quantized directions
+    virtual int getNumHeadings() const;
 protected:
     unsigned char* dataTrailRender;
-    // Agent move will be blocked if there's another agent at the desired position. To Avoid bias, we'll
-    //  randomize the order of which the agents move every step
-    std::vector<int> getAgentMoveOrder();
+    // Set by backends that implement diffuseDecayRender
+    bool fusedPipeline;
+    // Number of completed calls to run(). Used to derive per-step random numbers
+    unsigned int step;
     Utils::Random* random;
+    // Shared by all parallel phases of the backend. Kept alive for the whole run so no threads are created per step
+    ThreadPool* threadPool;
+    // Not owned
+    RunStatistics* statistics;
+    int agentSortInterval;
+    // Sense through a summed-area table instead of summing each sensor
+    bool summedAreaSensing;
 };
\ No newline at end of file
@@ -1,27 +1,65 @@
+#include <algorithm>
 #include <cmath>
+#include <stdexcept>
 
+#include "counterrng.h"
 #include "slimemoldcpu.h"
 #include "utils.h"
 
-int xyToSlimeArrayIdx(float x, float y) {
-    return static_cast<int>(x) + static_cast<int>(y) * RunConfiguration::Environment::width;
-}
-
 int xyToSlimeArrayIdx(int x, int y) {
     return x + y * RunConfiguration::Environment::width;
 }
 
-bool coordValid(int x, int y) {
-    return (x >= 0 && x < RunConfiguration::Environment::width&& y >= 0 && y < RunConfiguration::Environment::height);
-}
-
-SlimeMoldCpu::SlimeMoldCpu() : SlimeMold() {
+SlimeMoldCpu::SlimeMoldCpu(TrailFormat tTrailFormat, bool tSparseTrailMap, int tNumHeadings) : SlimeMold(),
+    diffusionEngine(RunConfiguration::Environment::width, RunConfiguration::Environment::height, RunConfiguration::Environment::diffusionKernelSize, RunConfiguration::Environment::diffusionRatio,
+        RunConfiguration::Environment::diffusionDecay, RunConfiguration::Agent::maxTotalChemo, tTrailFormat) {
     const int numPixels = RunConfiguration::Environment::numPixels();
+    const int trailBytes = numPixels * getTrailBytesPerPixel(tTrailFormat) + trailPaddingBytes;
+
+    // The vectorised sense and move compute trail indices in float, which is exact up to 2^24. SlimeMoldTiled has no
+    //  such limit
+    if (numPixels > (1 << 24)) {
+        throw std::runtime_error("Trail map too large for SlimeMoldCpu, use SlimeMoldTiled");
+    }
+
+    trailFormat = tTrailFormat;
+    // All formats store 0.0 as zero bits
+    dataTrailCurrent = new unsigned char[trailBytes]();
+    dataTrailNext = new unsigned char[trailBytes]();
+    agents.assign(initAgents());
 
-    dataTrailCurrent = new float[numPixels]();
-    dataTrailNext = new float[numPixels]();
-    squareTaken = std::vector<bool>(numPixels);
-    agents = initAgents();
+    if (tNumHeadings > 0) {
+        headingTable = std::unique_ptr<HeadingTable>(new HeadingTable(tNumHeadings));
+        quantizeDirections();
+    }
+
+    squareClaims = std::unique_ptr<std::atomic<unsigned long long>[]>(new std::atomic<unsigned long long>[numPixels]);
+    clearSquareClaims();
+    claimEpoch = 0;
+    desiredX = std::vector<float>(agents.paddedSize());
+    desiredY = std::vector<float>(agents.paddedSize());
+    desiredDestinationIndices = std::vector<int>(agents.paddedSize());
+    fusedPipeline = RunConfiguration::Hardware::fusedCpuPipeline;
+
+    const int kernelHalf = RunConfiguration::Environment::diffusionKernelSize / 2;
+
+    sparseTrailMap = tSparseTrailMap;
+    tileColumns = diffusionEngine.getColumnBlockWidth();
+    tileRows = getDiffusionRowsPerChunk();
+    numTilesX = (RunConfiguration::Environment::width + tileColumns - 1) / tileColumns;
+    numTilesY = (RunConfiguration::Environment::height + tileRows - 1) / tileRows;
+    tileReachX = (kernelHalf + tileColumns - 1) / tileColumns;
+    tileReachY = (kernelHalf + tileRows - 1) / tileRows;
+
+    if (sparseTrailMap) {
+        activeTilesCurrent = std::unique_ptr<std::atomic<unsigned char>[]>(new std::atomic<unsigned char>[numTilesX * numTilesY]);
+        activeTilesNext = std::unique_ptr<std::atomic<unsigned char>[]>(new std::atomic<unsigned char>[numTilesX * numTilesY]);
+        renderTiles = std::unique_ptr<std::atomic<unsigned char>[]>(new std::atomic<unsigned char>[numTilesX * numTilesY]);
+        setAllTiles(activeTilesCurrent.get(), 0);
+        setAllTiles(activeTilesNext.get(), 0);
+        // The render image starts out uninitialised
+        setAllTiles(renderTiles.get(), 1);
+    }
 }
 
 SlimeMoldCpu::~SlimeMoldCpu() {
@@ -29,27 +67,176 @@ SlimeMoldCpu::~SlimeMoldCpu() {
     delete[] dataTrailNext;
 }
 
+int SlimeMoldCpu::getDiffusionRowsPerChunk() const {
+    return RunConfiguration::Hardware::grainSize > 0 ? RunConfiguration::Hardware::grainSize : diffusionEngine.getPreferredRowsPerChunk();
+}
+
 void SlimeMoldCpu::diffusion() {
-    const auto cols = RunConfiguration::Environment::width;
     const auto rows = RunConfiguration::Environment::height;
-    const int kernelSize = RunConfiguration::Environment::diffusionKernelSize;
-    const float diffuseRate = RunConfiguration::Environment::diffusionRatio;
-
-    auto fn = [this, kernelSize, rows, diffuseRate](int colStart, int colEndExclusive) -> void {
-        for (int col = colStart; col < colEndExclusive; col++) {
-            for (int row = 0; row < rows; row++) {
-                auto idxDest = xyToSlimeArrayIdx(col, row);
-                float totalChemo;
-                int numMeasuredSquares;
-                measureChemoAroundPosition(col, row, kernelSize, totalChemo, numMeasuredSquares);
-                float blurredVal = totalChemo / (kernelSize * kernelSize + 1);
-                float newVal = diffuseRate * blurredVal + (1 - diffuseRate) * dataTrailCurrent[idxDest];
-                dataTrailNext[idxDest] = newVal;
+    const auto grainSize = getDiffusionRowsPerChunk();
+
+    if (sparseTrailMap) {
+        diffuseTiles(nullptr);
+        return;
+    }
+
+    auto fn = [this](int rowStart, int rowEndExclusive) -> void {
+        diffusionEngine.diffuseRows(dataTrailCurrent, dataTrailNext, rowStart, rowEndExclusive);
+    };
+
+    threadPool->parallelFor(fn, 0, rows, grainSize);
+}
+
+void SlimeMoldCpu::diffuseDecayRender() {
+    const auto rows = RunConfiguration::Environment::height;
+    const auto grainSize = getDiffusionRowsPerChunk();
+
+    if (sparseTrailMap) {
+        diffuseTiles(dataTrailRender);
+        swapBuffers();
+        return;
+    }
+
+    auto fn = [this](int rowStart, int rowEndExclusive) -> void {
+        diffusionEngine.diffuseDecayRenderRows(dataTrailCurrent, dataTrailNext, dataTrailRender, rowStart, rowEndExclusive);
+    };
+
+    threadPool->parallelFor(fn, 0, rows, grainSize);
+    swapBuffers();
+}
+
+void SlimeMoldCpu::diffuseTiles(unsigned char* render) {
+    const int width = RunConfiguration::Environment::width;
+    const int height = RunConfiguration::Environment::height;
+
+    // One row of tiles per chunk, which is one chunk of the dense sweep. Neighbouring tiles that need diffusing are
+    //  diffused together, since rows of a single tile are too short to stream through memory efficiently
+    auto fn = [this, render, width, height](int tileYStart, int tileYEndExclusive) -> void {
+        std::unique_ptr<bool[]> nonZeroTiles(new bool[numTilesX]);
+
+        for (int tileY = tileYStart; tileY < tileYEndExclusive; tileY++) {
+            const int rowStart = tileY * tileRows;
+            const int rowEndExclusive = std::min(height, rowStart + tileRows);
+            int tileX = 0;
+
+            while (tileX < numTilesX) {
+                int tileXEndExclusive = tileX;
+
+                while (tileXEndExclusive < numTilesX && isTileReached(tileXEndExclusive, tileY)) {
+                    tileXEndExclusive++;
+                }
+
+                if (tileXEndExclusive > tileX) {
+                    diffusionEngine.diffuseDecayRenderBlocks(dataTrailCurrent, dataTrailNext, render, rowStart, rowEndExclusive,
+                        tileX * tileColumns, std::min(width, tileXEndExclusive * tileColumns), nonZeroTiles.get());
+
+                    for (int i = tileX; i < tileXEndExclusive; i++) {
+                        activeTilesNext[i + tileY * numTilesX].store(nonZeroTiles[i - tileX], std::memory_order_relaxed);
+
+                        if (render != nullptr) {
+                            renderTiles[i + tileY * numTilesX].store(nonZeroTiles[i - tileX], std::memory_order_relaxed);
+                        }
+                    }
+
+                    tileX = tileXEndExclusive;
+                    continue;
+                }
+
+                // No chemo can reach the tile, so it is zero after this step. It only needs clearing if it still holds
+                //  the map of the step before
+                const int idxTile = tileX + tileY * numTilesX;
+                const int colStart = tileX * tileColumns;
+                const int colEndExclusive = std::min(width, colStart + tileColumns);
+
+                if (activeTilesNext[idxTile].load(std::memory_order_relaxed)) {
+                    zeroTrailTile(dataTrailNext, tileX, tileY);
+                    activeTilesNext[idxTile].store(0, std::memory_order_relaxed);
+                }
+
+                if (render != nullptr && renderTiles[idxTile].load(std::memory_order_relaxed)) {
+                    for (int row = rowStart; row < rowEndExclusive; row++) {
+                        std::fill(render + row * width + colStart, render + row * width + colEndExclusive, 0);
+                    }
+
+                    renderTiles[idxTile].store(0, std::memory_order_relaxed);
+                }
+
+                tileX++;
             }
         }
     };
 
-    Utils::runThreaded(fn, 0, cols);
+    threadPool->parallelFor(fn, 0, numTilesY, 1);
+}
+
+bool SlimeMoldCpu::isTileReached(int tileX, int tileY) const {
+    const int tileYEnd = std::min(numTilesY - 1, tileY + tileReachY);
+    const int tileXEnd = std::min(numTilesX - 1, tileX + tileReachX);
+
+    for (int y = std::max(0, tileY - tileReachY); y <= tileYEnd; y++) {
+        for (int x = std::max(0, tileX - tileReachX); x <= tileXEnd; x++) {
+            if (activeTilesCurrent[x + y * numTilesX].load(std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+void SlimeMoldCpu::zeroTrailTile(unsigned char* trail, int tileX, int tileY) {
+    const int width = RunConfiguration::Environment::width;
+    const int bytesPerPixel = getTrailBytesPerPixel(trailFormat);
+    const int rowStart = tileY * tileRows;
+    const int rowEndExclusive = std::min(RunConfiguration::Environment::height, rowStart + tileRows);
+    const int colStart = tileX * tileColumns;
+    const int colEndExclusive = std::min(width, colStart + tileColumns);
+
+    // All formats store 0.0 as zero bits
+    for (int row = rowStart; row < rowEndExclusive; row++) {
+        std::fill(trail + (row * width + colStart) * bytesPerPixel, trail + (row * width + colEndExclusive) * bytesPerPixel, 0);
+    }
+}
+
+void SlimeMoldCpu::markTile(std::atomic<unsigned char>* tiles, int x, int y) {
+    auto& tile = tiles[x / tileColumns + (y / tileRows) * numTilesX];
+
+    // Most deposits land on tiles that are active already. Only loading keeps the cache line shared between threads
+    if (tile.load(std::memory_order_relaxed) == 0) {
+        tile.store(1, std::memory_order_relaxed);
+    }
+}
+
+void SlimeMoldCpu::setAllTiles(std::atomic<unsigned char>* tiles, unsigned char value) {
+    for (int i = 0; i < numTilesX * numTilesY; i++) {
+        tiles[i].store(value, std::memory_order_relaxed);
+    }
+}
+
+int SlimeMoldCpu::getNumActiveTrailTiles() {
+    if (!sparseTrailMap) {
+        return 0;
+    }
+
+    int numActive = 0;
+
+    for (int i = 0; i < numTilesX * numTilesY; i++) {
+        numActive += activeTilesCurrent[i].load(std::memory_order_relaxed) != 0;
+    }
+
+    return numActive;
+}
+
+int SlimeMoldCpu::getNumTrailTiles() const {
+    return sparseTrailMap ? numTilesX * numTilesY : 0;
+}
+
+bool SlimeMoldCpu::getSummedAreaSensing() const {
+    return summedAreaSensing;
+}
+
+int SlimeMoldCpu::getNumHeadings() const {
+    return headingTable ? headingTable->getNumHeadings() : 0;
 }
 
 float SlimeMoldCpu::validChemo(float v) {
@@ -58,127 +245,531 @@ float SlimeMoldCpu::validChemo(float v) {
 
 void SlimeMoldCpu::decay() {
     const auto numIndices = RunConfiguration::Environment::width * RunConfiguration::Environment::height;
+
+    dispatchTrailFormat(trailFormat, [&](auto codec) {
+        typedef decltype(codec) Codec;
+        auto trail = reinterpret_cast<typename Codec::Storage*>(dataTrailCurrent);
+
+        if (sparseTrailMap) {
+            // Row by row through each row of tiles, so the active parts of a row are read in one go
+            auto fn = [this, trail](int tileYStart, int tileYEndExclusive) -> void {
+                const int width = RunConfiguration::Environment::width;
+                std::unique_ptr<bool[]> nonZeroTiles(new bool[numTilesX]);
+
+                for (int tileY = tileYStart; tileY < tileYEndExclusive; tileY++) {
+                    const int rowEndExclusive = std::min(RunConfiguration::Environment::height, (tileY + 1) * tileRows);
+                    auto activeTiles = activeTilesCurrent.get() + tileY * numTilesX;
+
+                    std::fill(nonZeroTiles.get(), nonZeroTiles.get() + numTilesX, false);
+
+                    for (int row = tileY * tileRows; row < rowEndExclusive; row++) {
+                        for (int tileX = 0; tileX < numTilesX; tileX++) {
+                            if (activeTiles[tileX].load(std::memory_order_relaxed)) {
+                                const int colStart = tileX * tileColumns;
+                                const int colEndExclusive = std::min(width, colStart + tileColumns);
+                                const bool nonZero = decayPixels<Codec>(trail, row * width + colStart, row * width + colEndExclusive);
+
+                                nonZeroTiles[tileX] = nonZeroTiles[tileX] || nonZero;
+                            }
+                        }
+                    }
+
+                    for (int tileX = 0; tileX < numTilesX; tileX++) {
+                        if (activeTiles[tileX].load(std::memory_order_relaxed)) {
+                            activeTiles[tileX].store(nonZeroTiles[tileX], std::memory_order_relaxed);
+                        }
+                    }
+                }
+            };
+
+            threadPool->parallelFor(fn, 0, numTilesY, 1);
+        }
+        else {
+            auto fn = [this, trail](int idxStart, int idxEndExclusive) -> void {
+                decayPixels<Codec>(trail, idxStart, idxEndExclusive);
+            };
+
+            threadPool->parallelFor(fn, 0, numIndices, RunConfiguration::Hardware::grainSize);
+        }
+    });
+}
+
+template <class Codec>
+bool SlimeMoldCpu::decayPixels(typename Codec::Storage* trail, int idxStart, int idxEndExclusive) {
     const auto decay = RunConfiguration::Environment::diffusionDecay;
+    const Simd::Float vDecay = Simd::set1(decay);
+    const Simd::Float vMin = Simd::set1(0.0f);
+    const Simd::Float vMax = Simd::set1(RunConfiguration::Agent::maxTotalChemo);
+    Simd::Float maxChemo = vMin;
+    float maxChemoTail = 0.0f;
+    int i = idxStart;
+
+    for (; i + Simd::width <= idxEndExclusive; i += Simd::width) {
+        const Simd::Float chemo = Simd::min(vMax, Simd::max(vMin, Simd::sub(Codec::load(trail + i), vDecay)));
+
+        Codec::store(trail + i, chemo);
+        maxChemo = Simd::max(maxChemo, chemo);
+    }
+
+    for (; i < idxEndExclusive; i++) {
+        const float chemo = validChemo(Codec::decode(trail[i]) - decay);
 
-    for (int i = 0; i < numIndices; i++) {
-        dataTrailCurrent[i] = validChemo(dataTrailCurrent[i] - decay);
+        trail[i] = Codec::encode(chemo);
+        maxChemoTail = std::max(maxChemoTail, chemo);
     }
+
+    return Simd::maskBits(Simd::cmpGt(maxChemo, vMin)) != 0 || maxChemoTail > 0.0f;
 }
 
-void SlimeMoldCpu::move() {
-    auto moveOrder = getAgentMoveOrder();
-    auto stepSize = RunConfiguration::Agent::stepSize;
-    auto width = RunConfiguration::Environment::width;
-    auto height = RunConfiguration::Environment::height;
-    auto numPixels = RunConfiguration::Environment::numPixels();
+void SlimeMoldCpu::clearSquareClaims() {
+    const int numPixels = RunConfiguration::Environment::numPixels();
 
     for (int i = 0; i < numPixels; i++) {
-        squareTaken[i] = false;
+        squareClaims[i].store(0, std::memory_order_relaxed);
     }
+}
 
-    std::fill(squareTaken.begin(), squareTaken.end(), false);
+unsigned long long SlimeMoldCpu::agentClaim(int agentIdx) const {
+    // Agent moves used to be resolved one by one in a shuffled order, first come first served. Instead every agent
+    //  gets a random priority each step and the highest priority wins. Priorities are unique within a step.
+    const unsigned int priority = counterRngMovePriority(RunConfiguration::Environment::randomSeed, step, agents.id[agentIdx]);
 
-    for (int i = 0; i < agents.size(); i++) {
-        auto& agent = agents[moveOrder[i]];
-        auto newX = agent.x + std::cos(agent.direction) * stepSize;
-        auto newY = agent.y + std::sin(agent.direction) * stepSize;
-        auto newXSquare = static_cast<int>(newX);
-        auto newYSquare = static_cast<int>(newY);
-        auto trailIdx = newXSquare + newYSquare * width;
-        if (newX >= 0
-            && newX < width
-            && newY >= 0
-            && newY < height
-            && !squareTaken[trailIdx]
-            ) {
-            agent.x = newX;
-            agent.y = newY;
-            deposit(newXSquare, newYSquare);
-            squareTaken[trailIdx] = true;
-        }
-        else {
-            agent.direction = random->randomDirection();
-        }
+    return (static_cast<unsigned long long>(claimEpoch) << 32) | priority;
+}
+
+int SlimeMoldCpu::getAgentBlockGrainSize() const {
+    return RunConfiguration::Hardware::grainSize > 0 ? std::max(1, RunConfiguration::Hardware::grainSize / Simd::width) : 0;
+}
+
+void SlimeMoldCpu::desiredMovesBlock(int agentIdx) {
+    const Simd::Float vStepSize = Simd::set1(static_cast<float>(RunConfiguration::Agent::stepSize));
+    const Simd::Float vWidth = Simd::set1(static_cast<float>(RunConfiguration::Environment::width));
+    const Simd::Float vHeight = Simd::set1(static_cast<float>(RunConfiguration::Environment::height));
+    const Simd::Float vZero = Simd::set1(0.0f);
+    const Simd::Float direction = Simd::load(agents.direction + agentIdx);
+    Simd::Float stepX, stepY;
+
+    if (headingTable) {
+        const Simd::Int heading = Simd::truncToInt(direction);
+        const Simd::Mask all = Simd::cmpGe(direction, vZero);
+
+        stepX = Simd::gather(headingTable->stepX.data(), heading, all);
+        stepY = Simd::gather(headingTable->stepY.data(), heading, all);
+    }
+    else {
+        Simd::Float sinDirection, cosDirection;
+
+        Simd::sincos(direction, sinDirection, cosDirection);
+        stepX = Simd::mul(cosDirection, vStepSize);
+        stepY = Simd::mul(sinDirection, vStepSize);
+    }
+
+    const Simd::Float newX = Simd::add(Simd::load(agents.x + agentIdx), stepX);
+    const Simd::Float newY = Simd::add(Simd::load(agents.y + agentIdx), stepY);
+    const Simd::Mask valid = Simd::maskAnd(Simd::maskAnd(Simd::cmpGe(newX, vZero), Simd::cmpLt(newX, vWidth)),
+        Simd::maskAnd(Simd::cmpGe(newY, vZero), Simd::cmpLt(newY, vHeight)));
+    // Both coordinates are non-negative where valid, so truncating them gives the square they are in
+    const Simd::Float trailIdx = Simd::add(Simd::mul(Simd::toFloat(Simd::truncToInt(newY)), vWidth), Simd::toFloat(Simd::truncToInt(newX)));
+
+    Simd::store(&desiredX[agentIdx], newX);
+    Simd::store(&desiredY[agentIdx], newY);
+    Simd::storeInt(&desiredDestinationIndices[agentIdx], Simd::truncToInt(Simd::select(valid, trailIdx, Simd::set1(-1.0f))));
+}
+
+void SlimeMoldCpu::move() {
+    const auto numAgents = agents.size();
+    const auto numBlocks = agents.paddedSize() / Simd::width;
+
+    if (++claimEpoch == 0) {
+        clearSquareClaims();
+        claimEpoch = 1;
     }
+
+    // 1. Calculate the desired position of all agents (vectorised) and claim the destination squares (one by one)
+    auto fnClaim = [this, numAgents](int blockStart, int blockEnd) {
+        for (int block = blockStart; block < blockEnd; block++) {
+            const int agentIdxStart = block * Simd::width;
+            const int agentIdxEnd = std::min(numAgents, agentIdxStart + Simd::width);
+
+            desiredMovesBlock(agentIdxStart);
+
+            for (int i = agentIdxStart; i < agentIdxEnd; i++) {
+                const auto trailIdx = desiredDestinationIndices[i];
+
+                if (trailIdx != -1) {
+                    const auto claim = agentClaim(i);
+                    auto& squareClaim = squareClaims[trailIdx];
+                    auto currentClaim = squareClaim.load(std::memory_order_relaxed);
+
+                    while (currentClaim < claim && !squareClaim.compare_exchange_weak(currentClaim, claim, std::memory_order_relaxed)) {
+                    }
+                }
+            }
+        }
+    };
+
+    // 2. Agents holding the highest claim move and deposit, the rest turn in a random direction. There is only one
+    //  winner per square, so the deposits never touch the same pixel from two threads.
+    threadPool->parallelFor(fnClaim, 0, numBlocks, getAgentBlockGrainSize());
+
+    dispatchTrailFormat(trailFormat, [&](auto codec) {
+        typedef decltype(codec) Codec;
+
+        auto fnMove = [this](int agentIdxStart, int agentIdxEnd) {
+            for (int i = agentIdxStart; i < agentIdxEnd; i++) {
+                const auto trailIdx = desiredDestinationIndices[i];
+
+                if (trailIdx != -1 && squareClaims[trailIdx].load(std::memory_order_relaxed) == agentClaim(i)) {
+                    agents.x[i] = desiredX[i];
+                    agents.y[i] = desiredY[i];
+                    deposit<Codec>(static_cast<int>(agents.x[i]), static_cast<int>(agents.y[i]));
+                }
+                else {
+                    const auto u = counterRngFloat(RunConfiguration::Environment::randomSeed, RNG_STREAM_MOVE_DIRECTION, step, agents.id[i]);
+                    agents.direction[i] = headingTable ? static_cast<float>(headingTable->randomHeading(u)) : 2.0f * static_cast<float>(Utils::PI) * u;
+                }
+            }
+        };
+
+        threadPool->parallelFor(fnMove, 0, numAgents, RunConfiguration::Hardware::grainSize);
+    });
 }
 
+template <class Codec>
 void SlimeMoldCpu::deposit(int x, int y) {
     auto chemoDeposition = RunConfiguration::Agent::chemoDeposition;
     auto idx = xyToSlimeArrayIdx(x, y);
+    auto trail = reinterpret_cast<typename Codec::Storage*>(dataTrailCurrent);
+
+    trail[idx] = Codec::encode(validChemo(Codec::decode(trail[idx]) + chemoDeposition));
+
+    if (sparseTrailMap) {
+        markTile(activeTilesCurrent.get(), x, y);
+    }
+
+    if (fusedPipeline) {
+        // The render image was made before the move, so it needs the deposit as well
+        dataTrailRender[idx] = static_cast<unsigned char>(Codec::decode(trail[idx]));
+
+        if (sparseTrailMap) {
+            markTile(renderTiles.get(), x, y);
+        }
+    }
+}
+
+void SlimeMoldCpu::sortAgents() {
+    agents.sortByMortonOrder(*threadPool, RunConfiguration::Environment::width, RunConfiguration::Environment::height);
+}
+
+std::vector<Agent> SlimeMoldCpu::exportAgents() {
+    auto exported = agents.toAgents();
+
+    if (headingTable) {
+        headingTable->toDirections(exported.data(), exported.size());
+    }
+
+    return exported;
+}
+
+std::vector<unsigned int> SlimeMoldCpu::exportAgentOrder() {
+    return agents.getIds();
+}
+
+std::vector<float> SlimeMoldCpu::exportTrailMap() {
+    std::vector<float> trailMap(RunConfiguration::Environment::numPixels());
+
+    dispatchTrailFormat(trailFormat, [&](auto codec) {
+        typedef decltype(codec) Codec;
+        auto trail = reinterpret_cast<const typename Codec::Storage*>(dataTrailCurrent);
+
+        for (size_t i = 0; i < trailMap.size(); i++) {
+            trailMap[i] = Codec::decode(trail[i]);
+        }
+    });
+
+    return trailMap;
+}
+
+SimulationState SlimeMoldCpu::exportState() {
+    const size_t trailBytes = RunConfiguration::Environment::numPixels() * getTrailBytesPerPixel(trailFormat);
+    const int numAgents = agents.size();
+    SimulationState state;
+
+    state.step = step;
+    state.trailFormat = trailFormat;
+    state.agents.resize(numAgents);
+    state.agentIds.assign(agents.id, agents.id + numAgents);
+
+    for (int i = 0; i < numAgents; i++) {
+        // Checkpoints store radians, so they can be continued with continuous directions or any number of headings
+        const float direction = headingTable ? headingTable->toDirection(static_cast<int>(agents.direction[i])) : agents.direction[i];
+
+        state.agents[i] = { agents.x[i], agents.y[i], direction };
+    }
+
+    state.trailMaps[0].assign(dataTrailCurrent, dataTrailCurrent + trailBytes);
+    state.trailMaps[1].assign(dataTrailNext, dataTrailNext + trailBytes);
+
+    return state;
+}
+
+void SlimeMoldCpu::importState(const SimulationStateView& state) {
+    const int numPixels = RunConfiguration::Environment::numPixels();
+
+    step = state.step;
+    agents.assign(state.agents, state.agentIds, static_cast<int>(state.numAgents));
+
+    if (headingTable) {
+        quantizeDirections();
+    }
+
+    convertTrailMap(state.trailMaps[0], state.trailFormat, dataTrailCurrent, trailFormat, numPixels);
+    convertTrailMap(state.trailMaps[1], state.trailFormat, dataTrailNext, trailFormat, numPixels);
+
+    if (sparseTrailMap) {
+        // Found again by the first decay, diffusion and render
+        setAllTiles(activeTilesCurrent.get(), 1);
+        setAllTiles(activeTilesNext.get(), 1);
+        setAllTiles(renderTiles.get(), 1);
+    }
+
+    // Claims of the old run could collide with the epochs of this one
+    clearSquareClaims();
+    claimEpoch = 0;
 
-    dataTrailCurrent[idx] = validChemo(dataTrailCurrent[idx] + chemoDeposition);
+    // The fused pipeline renders before moving, so the image has to be up to date when the next step starts
+    makeRenderImage();
 }
 
 void SlimeMoldCpu::swapBuffers() {
     std::swap(dataTrailCurrent, dataTrailNext);
+    std::swap(activeTilesCurrent, activeTilesNext);
 }
 
 void SlimeMoldCpu::sense() {
-    auto rotationAngle = RunConfiguration::Agent::rotationAngle;
-    auto sensorAngle = RunConfiguration::Agent::sensorAngle;
-
-    auto fn = [this, rotationAngle, sensorAngle](int agentIdxStart, int agentIdxEnd) {
-        for (int i = agentIdxStart; i < agentIdxEnd; i++) {
-            auto& agent = agents[i];
-            auto senseLeft = senseAtRotation(agent, -sensorAngle);
-            auto senseForward = senseAtRotation(agent, 0.0f);
-            auto senseRight = senseAtRotation(agent, sensorAngle);
-
-            if (senseForward > senseLeft && senseForward > senseRight) {
-                // Do nothing
-            }
-            else if (senseForward < senseLeft && senseForward < senseRight) {
-                // Rotate in random direction
-                agent.direction += (random->randFloat() > 0.5) ? -rotationAngle : rotationAngle;
-            }
-            else if (senseLeft < senseRight) {
-                agent.direction += rotationAngle;
+    const auto numBlocks = agents.paddedSize() / Simd::width;
+
+    if (summedAreaSensing) {
+        if (!summedAreaTable) {
+            summedAreaTable = std::unique_ptr<SummedAreaTable>(new SummedAreaTable(RunConfiguration::Environment::width, RunConfiguration::Environment::height));
+        }
+
+        summedAreaTable->build(dataTrailCurrent, trailFormat, *threadPool);
+    }
+
+    // Whole blocks only, so every agent goes through the same vector code whatever the thread count. Padding agents
+    //  are sensed and turned as well, which is harmless.
+    dispatchTrailFormat(trailFormat, [&](auto codec) {
+        typedef decltype(codec) Codec;
+
+        auto fn = [this](int blockStart, int blockEnd) {
+            for (int block = blockStart; block < blockEnd; block++) {
+                senseBlock<Codec>(block * Simd::width);
             }
-            else {
-                agent.direction -= rotationAngle;
+        };
+
+        threadPool->parallelFor(fn, 0, numBlocks, getAgentBlockGrainSize());
+    });
+}
+
+template <class Codec>
+void SlimeMoldCpu::senseBlock(int agentIdx) {
+    // In headings with quantized directions
+    const float rotationAngle = headingTable ? static_cast<float>(headingTable->getRotationHeadings()) : RunConfiguration::Agent::rotationAngle;
+    const Simd::Float x = Simd::load(agents.x + agentIdx);
+    const Simd::Float y = Simd::load(agents.y + agentIdx);
+    const Simd::Float direction = Simd::load(agents.direction + agentIdx);
+    Simd::Float senseLeft, senseForward, senseRight;
+
+    if (headingTable) {
+        const Simd::Float vSensorHeadings = Simd::set1(static_cast<float>(headingTable->getSensorHeadings()));
+
+        senseLeft = senseAtHeading<Codec>(x, y, wrapHeading(Simd::sub(direction, vSensorHeadings)));
+        senseForward = senseAtHeading<Codec>(x, y, direction);
+        senseRight = senseAtHeading<Codec>(x, y, wrapHeading(Simd::add(direction, vSensorHeadings)));
+    }
+    else {
+        const Simd::Float vSensorAngle = Simd::set1(RunConfiguration::Agent::sensorAngle);
+
+        senseLeft = senseAtRotation<Codec>(x, y, Simd::sub(direction, vSensorAngle));
+        senseForward = senseAtRotation<Codec>(x, y, direction);
+        senseRight = senseAtRotation<Codec>(x, y, Simd::add(direction, vSensorAngle));
+    }
+
+    const Simd::Mask forwardHighest = Simd::maskAnd(Simd::cmpGt(senseForward, senseLeft), Simd::cmpGt(senseForward, senseRight));
+    const Simd::Mask forwardLowest = Simd::maskAnd(Simd::cmpLt(senseForward, senseLeft), Simd::cmpLt(senseForward, senseRight));
+    Simd::Float rotation = Simd::select(Simd::cmpLt(senseLeft, senseRight), Simd::set1(rotationAngle), Simd::set1(-rotationAngle));
+    const int randomLanes = Simd::maskBits(forwardLowest);
+
+    if (randomLanes != 0) {
+        // Rotate in random direction. Rare enough to draw the numbers one lane at a time
+        float rotations[Simd::width];
+
+        Simd::store(rotations, rotation);
+
+        for (int lane = 0; lane < Simd::width; lane++) {
+            if (randomLanes & (1 << lane)) {
+                const auto u = counterRngFloat(RunConfiguration::Environment::randomSeed, RNG_STREAM_SENSE, step, agents.id[agentIdx + lane]);
+                rotations[lane] = (u > 0.5) ? -rotationAngle : rotationAngle;
             }
         }
-    };
 
-    Utils::runThreaded(fn, 0, static_cast<int>(agents.size()));
+        rotation = Simd::load(rotations);
+    }
+
+    rotation = Simd::select(forwardHighest, Simd::set1(0.0f), rotation);
+    Simd::store(agents.direction + agentIdx, headingTable ? wrapHeading(Simd::add(direction, rotation)) : Simd::add(direction, rotation));
 }
 
-float SlimeMoldCpu::senseAtRotation(Agent& agent, float rotationOffset) {
-    auto x = static_cast<int>(agent.x + RunConfiguration::Agent::sensorOffset * std::cos(agent.direction + rotationOffset));
-    auto y = static_cast<int>(agent.y + RunConfiguration::Agent::sensorOffset * std::sin(agent.direction + rotationOffset));
-    auto sensorWidth = RunConfiguration::Agent::sensorWidth;
+template <class Codec>
+Simd::Float SlimeMoldCpu::senseAtRotation(Simd::Float x, Simd::Float y, Simd::Float direction) const {
+    const Simd::Float vSensorOffset = Simd::set1(static_cast<float>(RunConfiguration::Agent::sensorOffset));
+    Simd::Float sinDirection, cosDirection;
 
-    float totalChemo;
-    int numSquares;
-    measureChemoAroundPosition(x, y, sensorWidth, totalChemo, numSquares);
+    Simd::sincos(direction, sinDirection, cosDirection);
 
-    return totalChemo;
+    const Simd::Int sensorX = Simd::truncToInt(Simd::add(x, Simd::mul(vSensorOffset, cosDirection)));
+    const Simd::Int sensorY = Simd::truncToInt(Simd::add(y, Simd::mul(vSensorOffset, sinDirection)));
+
+    return measureSensor<Codec>(sensorX, sensorY);
 }
 
-void SlimeMoldCpu::measureChemoAroundPosition(int x, int y, int kernelSize, float& totalChemo, int& numMeasuresSquares) {
-    totalChemo = 0.0f;
-    numMeasuresSquares = 0;
+template <class Codec>
+Simd::Float SlimeMoldCpu::senseAtHeading(Simd::Float x, Simd::Float y, Simd::Float heading) const {
+    const Simd::Int idx = Simd::truncToInt(heading);
+    const Simd::Mask all = Simd::cmpGe(heading, Simd::set1(0.0f));
+    const Simd::Int sensorX = Simd::truncToInt(Simd::add(x, Simd::gather(headingTable->sensorX.data(), idx, all)));
+    const Simd::Int sensorY = Simd::truncToInt(Simd::add(y, Simd::gather(headingTable->sensorY.data(), idx, all)));
 
-    for (int xd = x - kernelSize / 2; xd <= x + kernelSize / 2; xd++) {
-        for (int yd = y - kernelSize / 2; yd <= y + kernelSize / 2; yd++) {
-            if (coordValid(xd, yd)) {
-                auto idxSrc = xyToSlimeArrayIdx(xd, yd);
-                numMeasuresSquares++;
-                totalChemo += dataTrailCurrent[idxSrc];
-            }
+    return measureSensor<Codec>(sensorX, sensorY);
+}
+
+template <class Codec>
+Simd::Float SlimeMoldCpu::measureSensor(Simd::Int x, Simd::Int y) const {
+    if (summedAreaSensing) {
+        return measureChemoSummedArea(x, y);
+    }
+
+    return measureChemoAroundPosition<Codec>(x, y, RunConfiguration::Agent::sensorWidth);
+}
+
+Simd::Float SlimeMoldCpu::wrapHeading(Simd::Float heading) const {
+    const Simd::Float vNumHeadings = Simd::set1(static_cast<float>(headingTable->getNumHeadings()));
+    const Simd::Float wrappedUp = Simd::select(Simd::cmpLt(heading, Simd::set1(0.0f)), Simd::add(heading, vNumHeadings), heading);
+
+    return Simd::select(Simd::cmpGe(wrappedUp, vNumHeadings), Simd::sub(wrappedUp, vNumHeadings), wrappedUp);
+}
+
+void SlimeMoldCpu::quantizeDirections() {
+    for (int i = 0; i < agents.size(); i++) {
+        agents.direction[i] = static_cast<float>(headingTable->toHeading(agents.direction[i]));
+    }
+}
+
+Simd::Float SlimeMoldCpu::measureChemoSummedArea(Simd::Int x, Simd::Int y) const {
+    // The same box as measureChemoAroundPosition, also for even widths
+    const int kernelHalf = RunConfiguration::Agent::sensorWidth / 2;
+    int sensorX[Simd::width];
+    int sensorY[Simd::width];
+    float totalChemo[Simd::width];
+
+    Simd::storeInt(sensorX, x);
+    Simd::storeInt(sensorY, y);
+
+    // There are no 64-bit gathers in Simd, and four lookups per lane are cheap anyway
+    for (int lane = 0; lane < Simd::width; lane++) {
+        totalChemo[lane] = summedAreaTable->boxSum(sensorX[lane] - kernelHalf, sensorY[lane] - kernelHalf, sensorX[lane] + kernelHalf + 1, sensorY[lane] + kernelHalf + 1);
+    }
+
+    return Simd::load(totalChemo);
+}
+
+template <class Codec>
+Simd::Float SlimeMoldCpu::measureChemoAroundPosition(Simd::Int x, Simd::Int y, int kernelSize) const {
+    const Simd::Float vWidth = Simd::set1(static_cast<float>(RunConfiguration::Environment::width));
+    const Simd::Float vHeight = Simd::set1(static_cast<float>(RunConfiguration::Environment::height));
+    const Simd::Float vZero = Simd::set1(0.0f);
+    const Simd::Float centerX = Simd::toFloat(x);
+    const Simd::Float centerY = Simd::toFloat(y);
+    const auto trail = reinterpret_cast<const typename Codec::Storage*>(dataTrailCurrent);
+    Simd::Float totalChemo = vZero;
+
+    for (int xOffset = -kernelSize / 2; xOffset <= kernelSize / 2; xOffset++) {
+        const Simd::Float xd = Simd::add(centerX, Simd::set1(static_cast<float>(xOffset)));
+        const Simd::Mask xValid = Simd::maskAnd(Simd::cmpGe(xd, vZero), Simd::cmpLt(xd, vWidth));
+
+        for (int yOffset = -kernelSize / 2; yOffset <= kernelSize / 2; yOffset++) {
+            const Simd::Float yd = Simd::add(centerY, Simd::set1(static_cast<float>(yOffset)));
+            const Simd::Mask valid = Simd::maskAnd(xValid, Simd::maskAnd(Simd::cmpGe(yd, vZero), Simd::cmpLt(yd, vHeight)));
+            const Simd::Int idxSrc = Simd::truncToInt(Simd::add(Simd::mul(yd, vWidth), xd));
+
+            // Squares outside the map are masked out of the gather and count as zero
+            totalChemo = Simd::add(totalChemo, Codec::gather(trail, idxSrc, valid));
         }
     }
+
+    return totalChemo;
 }
 
 void SlimeMoldCpu::makeRenderImage() {
-    int cols = RunConfiguration::Environment::width;
-    int rows = RunConfiguration::Environment::height;
+    const auto numPixels = RunConfiguration::Environment::numPixels();
+
+    dispatchTrailFormat(trailFormat, [&](auto codec) {
+        typedef decltype(codec) Codec;
+        auto trail = reinterpret_cast<const typename Codec::Storage*>(dataTrailCurrent);
+
+        if (sparseTrailMap) {
+            // Active tiles are rendered and the others cleared, unless they were rendered empty before. Row by row
+            //  through each row of tiles as in decay
+            auto fn = [this, trail](int tileYStart, int tileYEndExclusive) -> void {
+                const int width = RunConfiguration::Environment::width;
+
+                for (int tileY = tileYStart; tileY < tileYEndExclusive; tileY++) {
+                    const int rowEndExclusive = std::min(RunConfiguration::Environment::height, (tileY + 1) * tileRows);
+                    auto activeTiles = activeTilesCurrent.get() + tileY * numTilesX;
+                    auto renderedTiles = renderTiles.get() + tileY * numTilesX;
+
+                    for (int row = tileY * tileRows; row < rowEndExclusive; row++) {
+                        for (int tileX = 0; tileX < numTilesX; tileX++) {
+                            const int idxStart = row * width + tileX * tileColumns;
+                            const int idxEndExclusive = row * width + std::min(width, (tileX + 1) * tileColumns);
+
+                            if (activeTiles[tileX].load(std::memory_order_relaxed)) {
+                                renderPixels<Codec>(trail, idxStart, idxEndExclusive);
+                            }
+                            else if (renderedTiles[tileX].load(std::memory_order_relaxed)) {
+                                std::fill(dataTrailRender + idxStart, dataTrailRender + idxEndExclusive, 0);
+                            }
+                        }
+                    }
+
+                    for (int tileX = 0; tileX < numTilesX; tileX++) {
+                        renderedTiles[tileX].store(activeTiles[tileX].load(std::memory_order_relaxed), std::memory_order_relaxed);
+                    }
+                }
+            };
+
+            threadPool->parallelFor(fn, 0, numTilesY, 1);
+        }
+        else {
+            auto fn = [this, trail](int idxStart, int idxEndExclusive) -> void {
+                renderPixels<Codec>(trail, idxStart, idxEndExclusive);
+            };
 
-    for (auto col = 0; col < cols; col++) {
-        for (auto row = 0; row < rows; row++) {
-            auto idx = xyToSlimeArrayIdx(col, row);
-            dataTrailRender[idx] = static_cast<unsigned char>(dataTrailCurrent[idx]);
+            threadPool->parallelFor(fn, 0, numPixels, RunConfiguration::Hardware::grainSize);
         }
+    });
+}
+
+template <class Codec>
+void SlimeMoldCpu::renderPixels(const typename Codec::Storage* trail, int idxStart, int idxEndExclusive) {
+    int i = idxStart;
+
+    for (; i + Simd::width <= idxEndExclusive; i += Simd::width) {
+        Simd::storeBytes(dataTrailRender + i, Codec::load(trail + i));
     }
 
+    for (; i < idxEndExclusive; i++) {
+        dataTrailRender[i] = static_cast<unsigned char>(Codec::decode(trail[i]));
+    }
 }
@@ -1,12 +1,21 @@
 #pragma once
 
+#include <atomic>
+#include <memory>
 #include <vector>
 
+#include "agentstore.h"
+#include "diffusioncpu.h"
+#include "headingtable.h"
+#include "simd.h"
 #include "slimemold.h"
+#include "summedareatable.h"
+#include "trailformat.h"
 
 class SlimeMoldCpu : public SlimeMold {
 public:
-    SlimeMoldCpu();
+    SlimeMoldCpu(TrailFormat tTrailFormat = RunConfiguration::Hardware::trailFormat, bool tSparseTrailMap = RunConfiguration::Hardware::sparseTrailMap,
+        int tNumHeadings = RunConfiguration::Hardware::numHeadings);
     ~SlimeMoldCpu();
     void diffusion();
     void decay();
@@ -14,14 +23,97 @@ public:
     void swapBuffers();
     void sense();
     void makeRenderImage();
+    void diffuseDecayRender();
+    void sortAgents();
+    std::vector<Agent> exportAgents();
+    std::vector<unsigned int> exportAgentOrder();
+    std::vector<float> exportTrailMap();
+    SimulationState exportState();
+    void importState(const SimulationStateView& state);
+    int getNumActiveTrailTiles();
+    int getNumTrailTiles() const;
+    bool getSummedAreaSensing() const;
+    int getNumHeadings() const;
 private:
-    float* dataTrailCurrent;
-    float* dataTrailNext;
-    std::vector<bool> squareTaken;
-    std::vector<Agent> agents;
-    float senseAtRotation(Agent& agent, float rotationOffset);
-    void measureChemoAroundPosition(int x, int y, int kernelSize, float& totalChemo, int& numMeasuresSquares);
+    TrailFormat trailFormat;
+    // Trail maps in trailFormat, followed by trailPaddingBytes for the 16-bit gathers
+    unsigned char* dataTrailCurrent;
+    unsigned char* dataTrailNext;
+    AgentStore agents;
+    // Move resolution. Every agent claims its destination square with (claimEpoch << 32 | priority) and the highest
+    //  claim wins. The epoch grows every step, so claims from earlier steps always lose and the grid never needs clearing.
+    std::unique_ptr<std::atomic<unsigned long long>[]> squareClaims;
+    unsigned int claimEpoch;
+    // Desired position of each agent. Padded like agents
+    std::vector<float> desiredX;
+    std::vector<float> desiredY;
+    // Index of the square each agent wants to move to, -1 if it would leave the environment
+    std::vector<int> desiredDestinationIndices;
+    void clearSquareClaims();
+    unsigned long long agentClaim(int agentIdx) const;
+    DiffusionCpu diffusionEngine;
+    // Grain size of the agent phases in blocks of Simd::width agents
+    int getAgentBlockGrainSize() const;
+    // Sense and rotate the Simd::width agents starting at agentIdx
+    template <class Codec>
+    void senseBlock(int agentIdx);
+    // Desired position and destination square of the Simd::width agents starting at agentIdx
+    void desiredMovesBlock(int agentIdx);
+    template <class Codec>
+    Simd::Float senseAtRotation(Simd::Float x, Simd::Float y, Simd::Float direction) const;
+    // Same with quantized directions
+    template <class Codec>
+    Simd::Float senseAtHeading(Simd::Float x, Simd::Float y, Simd::Float heading) const;
+    // Chemo around the sensors at x, y, summed directly or from summedAreaTable
+    template <class Codec>
+    Simd::Float measureSensor(Simd::Int x, Simd::Int y) const;
+    template <class Codec>
+    Simd::Float measureChemoAroundPosition(Simd::Int x, Simd::Int y, int kernelSize) const;
+    // Same as measureChemoAroundPosition with the sensor width, from summedAreaTable
+    Simd::Float measureChemoSummedArea(Simd::Int x, Simd::Int y) const;
+    // Of dataTrailCurrent, rebuilt at the start of sense() when summedAreaSensing is set. Created on first use
+    std::unique_ptr<SummedAreaTable> summedAreaTable;
+    // Quantized directions (RunConfiguration::Hardware::numHeadings). agents.direction then holds heading numbers,
+    //  which are whole floats, instead of radians. Agents are converted to and from radians when imported and exported.
+    //  Null = continuous directions
+    std::unique_ptr<HeadingTable> headingTable;
+    // Heading numbers in [-numHeadings, 2 * numHeadings) back into [0, numHeadings)
+    Simd::Float wrapHeading(Simd::Float heading) const;
+    // agents.direction from radians to heading numbers, after assigning agents
+    void quantizeDirections();
+    template <class Codec>
     void deposit(int x, int y);
     float validChemo(float v);
+    // Decay pixels [idxStart, idxEndExclusive). Returns whether any of them is still above zero
+    template <class Codec>
+    bool decayPixels(typename Codec::Storage* trail, int idxStart, int idxEndExclusive);
+    template <class Codec>
+    void renderPixels(const typename Codec::Storage* trail, int idxStart, int idxEndExclusive);
+    int getDiffusionRowsPerChunk() const;
+    // Sparse trail map (RunConfiguration::Hardware::sparseTrailMap). The map is cut into tiles one column block of the
+    //  diffusion wide and one diffusion chunk high, so a tile is diffused exactly as in a sweep over the whole map. A
+    //  tile without its flag is all zero; a flagged one may hold chemo. Flags are set by deposits and by diffusion,
+    //  and cleared when diffusion or decay leave a tile empty.
+    bool sparseTrailMap;
+    int tileColumns;
+    int tileRows;
+    int numTilesX;
+    int numTilesY;
+    // Tiles around a tile that chemo can diffuse in from in one step
+    int tileReachX;
+    int tileReachY;
+    // Flags of dataTrailCurrent and dataTrailNext, swapped along with them
+    std::unique_ptr<std::atomic<unsigned char>[]> activeTilesCurrent;
+    std::unique_ptr<std::atomic<unsigned char>[]> activeTilesNext;
+    // Tiles of dataTrailRender that may be non-zero
+    std::unique_ptr<std::atomic<unsigned char>[]> renderTiles;
+    // Whether any tile within reach of the given one is active in dataTrailCurrent
+    bool isTileReached(int tileX, int tileY) const;
+    void markTile(std::atomic<unsigned char>* tiles, int x, int y);
+    void setAllTiles(std::atomic<unsigned char>* tiles, unsigned char value);
+    // Diffusion over the tiles within reach of an active one, zeroing the tiles that just became empty. With render,
+    //  decay and render as well (diffuseDecayRender)
+    void diffuseTiles(unsigned char* render);
+    void zeroTrailTile(unsigned char* trail, int tileX, int tileY);
 };
 
@@ -0,0 +1,237 @@
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+#include "slimemoldensemble.h"
+#include "trailformat.h"
+
+SlimeMoldEnsemble::SlimeMoldEnsemble(const std::vector<EnsembleMember>& tMembers, TrailFormat tTrailFormat) : members(tMembers),
+    trailFormat(tTrailFormat), binaryCache(RunConfiguration::Hardware::kernelCacheDirectory()) {
+    const size_t numMembers = members.size();
+    const size_t numPixels = RunConfiguration::Environment::numPixels();
+    const size_t numAgents = RunConfiguration::Environment::populationSize();
+    const size_t trailBytes = numMembers * numPixels * getTrailBytesPerPixel(trailFormat);
+    // All formats store 0.0 as zero bits
+    const unsigned char zero = 0;
+    RunConfigurationCl config;
+
+    if (members.empty()) {
+        throw std::runtime_error("An ensemble needs at least one member");
+    }
+
+    device = compute::system::default_device();
+    std::cout << "Using device: " << device.name() << std::endl;
+
+    // The members share their buffers, so the largest one has to fit in a single allocation
+    if (std::max(trailBytes, numMembers * numAgents * sizeof(Agent)) > device.max_memory_alloc_size()) {
+        throw std::runtime_error("Too many ensemble members for one buffer on " + device.name());
+    }
+
+    ctx = compute::context(device);
+    queue = compute::command_queue(ctx, device);
+
+    config.trailFormat = trailFormat;
+
+    const compute::program program = binaryCache.build(getKernelSource(), config.getBuildOptions(), ctx);
+
+    std::vector<std::string> kernelNames = {
+        "ensembleDiffuse",
+        "decay",
+        "ensembleInitAgents",
+        "ensembleDesiredMoves",
+        "ensembleMove",
+        "ensembleSense",
+        "render"
+    };
+
+    for (auto& kernelName : kernelNames) {
+        kernels[kernelName] = compute::kernel(program, kernelName);
+    }
+
+    for (int i = 0; i < 2; i++) {
+        dDataTrails.push_back(compute::buffer(ctx, trailBytes));
+        queue.enqueue_fill_buffer(dDataTrails.back(), &zero, sizeof(zero), 0, trailBytes);
+    }
+
+    dMembers = compute::vector<EnsembleMember>(numMembers, ctx);
+    dAgents = compute::vector<Agent>(numMembers * numAgents, ctx);
+    dAgentDesired = compute::vector<Agent>(numMembers * numAgents, ctx);
+    dDesiredDestinationIndices = compute::vector<int>(numMembers * numAgents, ctx);
+    dSquareClaims = compute::vector<unsigned int>(numMembers * numPixels, ctx);
+    dRender = compute::vector<unsigned char>(numMembers * numPixels, ctx);
+    hRender = std::vector<unsigned char>(numMembers * numPixels);
+    renderReadEvents = std::vector<compute::event>(numMembers);
+
+    compute::copy(members.begin(), members.end(), dMembers.begin(), queue);
+
+    compute::kernel& kernelInitAgents = kernels["ensembleInitAgents"];
+    size_t globalWorkSize[] = { numAgents, numMembers };
+
+    kernelInitAgents.set_arg(0, dAgents.get_buffer());
+    kernelInitAgents.set_arg(1, dMembers.get_buffer());
+    queue.enqueue_nd_range_kernel(kernelInitAgents, 2, nullptr, &globalWorkSize[0], nullptr);
+
+    idxDataTrailInUse = 0;
+    idxDataTrailBuffer = 1;
+    step = 0;
+}
+
+SlimeMoldEnsemble::~SlimeMoldEnsemble() {
+    queue.finish();
+}
+
+EnsembleMember SlimeMoldEnsemble::getConfiguredMember() {
+    EnsembleMember member;
+
+    member.sensorAngle = RunConfiguration::Agent::sensorAngle;
+    member.rotationAngle = RunConfiguration::Agent::rotationAngle;
+    member.sensorOffset = static_cast<float>(RunConfiguration::Agent::sensorOffset);
+    member.chemoDeposition = static_cast<float>(RunConfiguration::Agent::chemoDeposition);
+    member.randomSeed = RunConfiguration::Environment::randomSeed;
+
+    return member;
+}
+
+void SlimeMoldEnsemble::run() {
+    // Same phases in the same order as SlimeMold::run
+    diffusion();
+    std::swap(idxDataTrailBuffer, idxDataTrailInUse);
+    decay();
+    move();
+    sense();
+    step++;
+}
+
+void SlimeMoldEnsemble::diffusion() {
+    compute::kernel& kernelDiffuse = kernels["ensembleDiffuse"];
+    size_t globalWorkSize[] = { RunConfiguration::Environment::width, RunConfiguration::Environment::height, members.size() };
+
+    kernelDiffuse.set_arg(0, dDataTrails[idxDataTrailInUse]);
+    kernelDiffuse.set_arg(1, dDataTrails[idxDataTrailBuffer]);
+    queue.enqueue_nd_range_kernel(kernelDiffuse, 3, nullptr, &globalWorkSize[0], nullptr);
+}
+
+void SlimeMoldEnsemble::decay() {
+    compute::kernel& kernelDecay = kernels["decay"];
+
+    kernelDecay.set_arg(0, dDataTrails[idxDataTrailInUse]);
+    queue.enqueue_1d_range_kernel(kernelDecay, 0, members.size() * RunConfiguration::Environment::numPixels(), 0);
+}
+
+void SlimeMoldEnsemble::move() {
+    compute::kernel& kernelDesiredMove = kernels["ensembleDesiredMoves"];
+    compute::kernel& kernelMove = kernels["ensembleMove"];
+    size_t globalWorkSize[] = { static_cast<size_t>(RunConfiguration::Environment::populationSize()), members.size() };
+    const unsigned int noClaim = 0;
+
+    // Claims and moves as on SlimeMoldOpenCl, each member on its own squares
+    queue.enqueue_fill_buffer(dSquareClaims.get_buffer(), &noClaim, sizeof(noClaim), 0, dSquareClaims.size() * sizeof(unsigned int));
+
+    kernelDesiredMove.set_arg(0, dAgents.get_buffer());
+    kernelDesiredMove.set_arg(1, dAgentDesired.get_buffer());
+    kernelDesiredMove.set_arg(2, dDesiredDestinationIndices.get_buffer());
+    kernelDesiredMove.set_arg(3, dSquareClaims.get_buffer());
+    kernelDesiredMove.set_arg(4, dMembers.get_buffer());
+    kernelDesiredMove.set_arg(5, step);
+    queue.enqueue_nd_range_kernel(kernelDesiredMove, 2, nullptr, &globalWorkSize[0], nullptr);
+
+    kernelMove.set_arg(0, dDataTrails[idxDataTrailInUse]);
+    kernelMove.set_arg(1, dAgents.get_buffer());
+    kernelMove.set_arg(2, dAgentDesired.get_buffer());
+    kernelMove.set_arg(3, dDesiredDestinationIndices.get_buffer());
+    kernelMove.set_arg(4, dSquareClaims.get_buffer());
+    kernelMove.set_arg(5, dMembers.get_buffer());
+    kernelMove.set_arg(6, step);
+    queue.enqueue_nd_range_kernel(kernelMove, 2, nullptr, &globalWorkSize[0], nullptr);
+}
+
+void SlimeMoldEnsemble::sense() {
+    compute::kernel& kernelSense = kernels["ensembleSense"];
+    size_t globalWorkSize[] = { static_cast<size_t>(RunConfiguration::Environment::populationSize()), members.size() };
+
+    kernelSense.set_arg(0, dDataTrails[idxDataTrailInUse]);
+    kernelSense.set_arg(1, dAgents.get_buffer());
+    kernelSense.set_arg(2, dMembers.get_buffer());
+    kernelSense.set_arg(3, step);
+    queue.enqueue_nd_range_kernel(kernelSense, 2, nullptr, &globalWorkSize[0], nullptr);
+}
+
+void SlimeMoldEnsemble::makeRenderImages() {
+    const size_t numPixels = RunConfiguration::Environment::numPixels();
+    compute::kernel& kernelRender = kernels["render"];
+
+    // Images still being copied would be overwritten
+    for (auto& event : renderReadEvents) {
+        if (event.get() != nullptr) {
+            event.wait();
+        }
+    }
+
+    kernelRender.set_arg(0, dDataTrails[idxDataTrailInUse]);
+    kernelRender.set_arg(1, dRender.get_buffer());
+    queue.enqueue_1d_range_kernel(kernelRender, 0, members.size() * numPixels, 0);
+
+    // One copy per member, so each member's image can be used as soon as its own copy is done
+    for (size_t i = 0; i < members.size(); i++) {
+        renderReadEvents[i] = queue.enqueue_read_buffer_async(dRender.get_buffer(), i * numPixels, numPixels, hRender.data() + i * numPixels);
+    }
+
+    queue.flush();
+}
+
+void SlimeMoldEnsemble::checkMember(int idxMember) const {
+    if (idxMember < 0 || static_cast<size_t>(idxMember) >= members.size()) {
+        throw std::runtime_error("No ensemble member " + std::to_string(idxMember) + ", there are " + std::to_string(members.size()));
+    }
+}
+
+const unsigned char* SlimeMoldEnsemble::getRenderImage(int idxMember) {
+    checkMember(idxMember);
+
+    if (renderReadEvents[idxMember].get() != nullptr) {
+        renderReadEvents[idxMember].wait();
+    }
+
+    return hRender.data() + static_cast<size_t>(idxMember) * RunConfiguration::Environment::numPixels();
+}
+
+std::vector<float> SlimeMoldEnsemble::exportTrailMap(int idxMember) {
+    const size_t numPixels = RunConfiguration::Environment::numPixels();
+    const size_t memberBytes = numPixels * getTrailBytesPerPixel(trailFormat);
+    std::vector<unsigned char> trailBytes(memberBytes);
+    std::vector<float> trailMap(numPixels);
+
+    checkMember(idxMember);
+    queue.enqueue_read_buffer(dDataTrails[idxDataTrailInUse], idxMember * memberBytes, memberBytes, trailBytes.data());
+    convertTrailMap(trailBytes.data(), trailFormat, trailMap.data(), TrailFormat::Float32, numPixels);
+
+    return trailMap;
+}
+
+std::vector<Agent> SlimeMoldEnsemble::exportAgents(int idxMember) {
+    const size_t numAgents = RunConfiguration::Environment::populationSize();
+    std::vector<Agent> agents(numAgents);
+
+    checkMember(idxMember);
+
+    // Never sorted, so already in the order of the agent ids
+    compute::copy(dAgents.begin() + idxMember * numAgents, dAgents.begin() + (idxMember + 1) * numAgents, agents.begin(), queue);
+
+    return agents;
+}
+
+void SlimeMoldEnsemble::finish() {
+    queue.finish();
+}
+
+std::string SlimeMoldEnsemble::getDeviceName() const {
+    return device.name();
+}
+
+int SlimeMoldEnsemble::getNumMembers() const {
+    return static_cast<int>(members.size());
+}
+
+unsigned int SlimeMoldEnsemble::getStep() const {
+    return step;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#define CL_TARGET_OPENCL_VERSION 220
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/compute.hpp>
+
+#include "programbinarycache.h"
+#include "slimemold.h"
+#include "slimemoldopencl.h"
+
+namespace compute = boost::compute;
+
+/// <summary>
+/// Many independent simulations on one OpenCL device, for parameter sweeps. The members share the map size, the
+/// population and everything else in RunConfiguration except the parameters in EnsembleMember. Their trail maps,
+/// agents and claims are stored one after another in shared buffers, and each phase is a single kernel launch over all
+/// members, which look up their parameters by member number. So however many members there are, there is one context,
+/// one program build and one launch per phase.
+///
+/// Every member starts from a uniformly random population drawn from its seed. Agents are never sorted.
+/// </summary>
+class SlimeMoldEnsemble {
+public:
+    SlimeMoldEnsemble(const std::vector<EnsembleMember>& tMembers, TrailFormat tTrailFormat = RunConfiguration::Hardware::trailFormat);
+    ~SlimeMoldEnsemble();
+    // One step of every member
+    void run();
+    // Render every member and start copying the images to the host, one copy per member
+    void makeRenderImages();
+    // Image of a member from the last makeRenderImages. Only waits for the copy of that member, so the first members
+    //  can be processed while the others are still on their way. These throw if there is no member idxMember
+    const unsigned char* getRenderImage(int idxMember);
+    std::vector<float> exportTrailMap(int idxMember);
+    std::vector<Agent> exportAgents(int idxMember);
+    void finish();
+    std::string getDeviceName() const;
+    int getNumMembers() const;
+    unsigned int getStep() const;
+    // The parameters of RunConfiguration::Agent, as a member
+    static EnsembleMember getConfiguredMember();
+private:
+    void checkMember(int idxMember) const;
+    void diffusion();
+    void decay();
+    void move();
+    void sense();
+    std::vector<EnsembleMember> members;
+    TrailFormat trailFormat;
+    compute::device device;
+    compute::context ctx;
+    compute::command_queue queue;
+    std::map<std::string, compute::kernel> kernels;
+    ProgramBinaryCache binaryCache;
+    // Both trail maps of all members, in trailFormat
+    std::vector<compute::buffer> dDataTrails;
+    compute::vector<EnsembleMember> dMembers;
+    compute::vector<Agent> dAgents;
+    compute::vector<Agent> dAgentDesired;
+    compute::vector<int> dDesiredDestinationIndices;
+    compute::vector<unsigned int> dSquareClaims;
+    compute::vector<unsigned char> dRender;
+    std::vector<unsigned char> hRender;
+    std::vector<compute::event> renderReadEvents;
+    int idxDataTrailInUse;
+    int idxDataTrailBuffer;
+    unsigned int step;
+};
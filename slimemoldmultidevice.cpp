@@ -0,0 +1,676 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <numeric>
+
+#include "slimemoldmultidevice.h"
+#include "trailformat.h"
+
+SlimeMoldMultiDevice::SlimeMoldMultiDevice(TrailFormat tTrailFormat) : SlimeMold(), trailFormat(tTrailFormat),
+    binaryCache(RunConfiguration::Hardware::kernelCacheDirectory()) {
+    const int height = RunConfiguration::Environment::height;
+    const int kernelHalf = RunConfiguration::Environment::diffusionKernelSize / 2;
+    const int migrationInterval = RunConfiguration::MultiDevice::migrationInterval > 0 ? RunConfiguration::MultiDevice::migrationInterval : 1;
+    // How far an agent can get into the next strip before it's handed over, plus how far it senses from there
+    const int agentReach = RunConfiguration::Agent::stepSize * migrationInterval + RunConfiguration::Agent::sensorOffset + RunConfiguration::Agent::sensorWidth / 2;
+
+    // One more for sensor positions that round up to the next row
+    haloRows = std::max(kernelHalf, agentReach) + 1;
+
+    auto deviceList = findDevices();
+    // A strip is at least two halos high, so a halo never reaches past the neighbouring strips
+    const size_t maxDevices = std::max(1, height / (2 * haloRows));
+
+    if (deviceList.size() > maxDevices) {
+        std::cout << "Map too small for " << deviceList.size() << " devices, using " << maxDevices << std::endl;
+        deviceList.resize(maxDevices);
+    }
+
+    const int numDevices = static_cast<int>(deviceList.size());
+
+    for (int i = 0; i <= numDevices; i++) {
+        stripRows.push_back(height * i / numDevices);
+    }
+
+    idxDataTrailInUse = 0;
+    idxDataTrailBuffer = 1;
+
+    for (auto& device : deviceList) {
+        std::cout << "Using device: " << device.name() << std::endl;
+        devices.push_back(std::unique_ptr<Device>(new Device()));
+        devices.back()->device = device;
+        loadDevice(*devices.back());
+    }
+
+    const auto agents = initAgents();
+
+    distributeAgents(agents.data(), nullptr, agents.size());
+}
+
+SlimeMoldMultiDevice::~SlimeMoldMultiDevice() {
+    finish();
+}
+
+std::vector<compute::device> SlimeMoldMultiDevice::findDevices() {
+    const std::string filter = RunConfiguration::MultiDevice::deviceFilter();
+    std::vector<compute::device> deviceList;
+
+    for (const auto& platform : compute::system::platforms()) {
+        for (const auto& device : platform.devices()) {
+            if (!filter.empty() && device.name().find(filter) == std::string::npos) {
+                continue;
+            }
+
+            if (RunConfiguration::MultiDevice::splitCpuDevicesByNuma && (device.type() & CL_DEVICE_TYPE_CPU) != 0) {
+                try {
+                    const auto subDevices = device.partition_by_affinity_domain(CL_DEVICE_AFFINITY_DOMAIN_NUMA);
+
+                    if (!subDevices.empty()) {
+                        deviceList.insert(deviceList.end(), subDevices.begin(), subDevices.end());
+                        continue;
+                    }
+                }
+                catch (const compute::opencl_error&) {
+                    // The driver can't partition this device, so it's used as a whole
+                }
+            }
+
+            deviceList.push_back(device);
+        }
+    }
+
+    if (deviceList.empty()) {
+        deviceList.push_back(compute::system::default_device());
+    }
+
+    return deviceList;
+}
+
+void SlimeMoldMultiDevice::loadDevice(Device& device) {
+    const size_t numPixels = RunConfiguration::Environment::numPixels();
+    const size_t numAgentsMax = RunConfiguration::Environment::populationSize();
+    const size_t trailBytes = numPixels * getTrailBytesPerPixel(trailFormat);
+    // All formats store 0.0 as zero bits
+    const unsigned char zero = 0;
+    RunConfigurationCl config;
+
+    device.ctx = compute::context(device.device);
+    // Profiling is always on, since the kernel times decide the strip heights
+    device.queue = compute::command_queue(device.ctx, device.device, compute::command_queue::enable_profiling);
+
+    config.trailFormat = trailFormat;
+
+    const compute::program program = binaryCache.build(getKernelSource(), config.getBuildOptions() + " -DCFG_DEPOSIT_CLAIMED_SQUARES", device.ctx);
+
+    std::vector<std::string> kernelNames = {
+        "diffuse",
+        "decay",
+        "move",
+        "desiredMoves",
+        "depositClaimed",
+        "sense",
+        "render",
+        "mortonKeys",
+        "stripKeys"
+    };
+
+    for (auto& kernelName : kernelNames) {
+        device.kernels[kernelName] = compute::kernel(program, kernelName);
+    }
+
+    for (int i = 0; i < 2; i++) {
+        device.dDataTrails.push_back(compute::buffer(device.ctx, trailBytes));
+        device.queue.enqueue_fill_buffer(device.dDataTrails.back(), &zero, sizeof(zero), 0, trailBytes);
+    }
+
+    device.numAgents = 0;
+    device.dAgents = compute::vector<Agent>(numAgentsMax, device.ctx);
+    device.dAgentIds = compute::vector<unsigned int>(numAgentsMax, device.ctx);
+    device.dAgentDesired = compute::vector<Agent>(numAgentsMax, device.ctx);
+    device.dDesiredDestinationIndices = compute::vector<int>(numAgentsMax, device.ctx);
+    device.dSquareClaims = compute::vector<unsigned int>(numPixels, device.ctx);
+    device.dSortKeys = compute::vector<unsigned int>(numAgentsMax, device.ctx);
+    device.dSortOrder = compute::vector<unsigned int>(numAgentsMax, device.ctx);
+    device.dAgentsSorted = compute::vector<Agent>(numAgentsMax, device.ctx);
+    device.dAgentIdsSorted = compute::vector<unsigned int>(numAgentsMax, device.ctx);
+    device.dStripRows = compute::vector<int>(stripRows.size(), device.ctx);
+    device.dRender = compute::vector<unsigned char>(numPixels, device.ctx);
+}
+
+void SlimeMoldMultiDevice::distributeAgents(const Agent* agents, const unsigned int* agentIds, size_t numAgents) {
+    const int numDevices = getNumDevices();
+    std::vector<std::vector<Agent>> stripAgents(numDevices);
+    std::vector<std::vector<unsigned int>> stripAgentIds(numDevices);
+
+    for (size_t i = 0; i < numAgents; i++) {
+        const int row = std::min(std::max(static_cast<int>(agents[i].y), 0), RunConfiguration::Environment::height - 1);
+        const int idxDevice = static_cast<int>(std::upper_bound(stripRows.begin() + 1, stripRows.end(), row) - stripRows.begin()) - 1;
+
+        stripAgents[idxDevice].push_back(agents[i]);
+        stripAgentIds[idxDevice].push_back(agentIds != nullptr ? agentIds[i] : static_cast<unsigned int>(i));
+    }
+
+    for (int i = 0; i < numDevices; i++) {
+        auto& device = *devices[i];
+
+        device.numAgents = static_cast<int>(stripAgents[i].size());
+        compute::copy(stripAgents[i].begin(), stripAgents[i].end(), device.dAgents.begin(), device.queue);
+        compute::copy(stripAgentIds[i].begin(), stripAgentIds[i].end(), device.dAgentIds.begin(), device.queue);
+    }
+}
+
+int SlimeMoldMultiDevice::getNumDevices() const {
+    return static_cast<int>(devices.size());
+}
+
+std::vector<int> SlimeMoldMultiDevice::getStripRows() const {
+    return stripRows;
+}
+
+int SlimeMoldMultiDevice::getStripStart(int idxDevice) const {
+    return stripRows[idxDevice];
+}
+
+int SlimeMoldMultiDevice::getStripEnd(int idxDevice) const {
+    return stripRows[idxDevice + 1];
+}
+
+void SlimeMoldMultiDevice::enqueueKernel(Device& device, compute::kernel& kernel, size_t globalOffset, size_t globalSize) {
+    if (globalSize == 0) {
+        return;
+    }
+
+    const auto event = device.queue.enqueue_1d_range_kernel(kernel, globalOffset, globalSize, 0);
+
+    if (RunConfiguration::MultiDevice::rebalanceInterval > 0) {
+        device.kernelEvents.push_back(event);
+    }
+}
+
+void SlimeMoldMultiDevice::flush() {
+    for (auto& device : devices) {
+        device->queue.flush();
+    }
+}
+
+void SlimeMoldMultiDevice::diffusion() {
+    for (int i = 0; i < getNumDevices(); i++) {
+        auto& device = *devices[i];
+        compute::kernel& kernelDiffuse = device.kernels["diffuse"];
+        size_t globalWorkOffset[] = { 0, static_cast<size_t>(getStripStart(i)) };
+        size_t globalWorkSize[] = { RunConfiguration::Environment::width, static_cast<size_t>(getStripEnd(i) - getStripStart(i)) };
+
+        kernelDiffuse.set_arg(0, device.dDataTrails[idxDataTrailInUse]);
+        kernelDiffuse.set_arg(1, device.dDataTrails[idxDataTrailBuffer]);
+
+        const auto event = device.queue.enqueue_nd_range_kernel(kernelDiffuse, 2, &globalWorkOffset[0], &globalWorkSize[0], nullptr);
+
+        if (RunConfiguration::MultiDevice::rebalanceInterval > 0) {
+            device.kernelEvents.push_back(event);
+        }
+    }
+}
+
+void SlimeMoldMultiDevice::decay() {
+    const size_t width = RunConfiguration::Environment::width;
+
+    for (int i = 0; i < getNumDevices(); i++) {
+        auto& device = *devices[i];
+        compute::kernel& kernelDecay = device.kernels["decay"];
+
+        kernelDecay.set_arg(0, device.dDataTrails[idxDataTrailInUse]);
+        enqueueKernel(device, kernelDecay, getStripStart(i) * width, (getStripEnd(i) - getStripStart(i)) * width);
+    }
+}
+
+void SlimeMoldMultiDevice::move() {
+    const size_t width = RunConfiguration::Environment::width;
+    const int migrationInterval = RunConfiguration::MultiDevice::migrationInterval > 0 ? RunConfiguration::MultiDevice::migrationInterval : 1;
+    const int rebalanceInterval = RunConfiguration::MultiDevice::rebalanceInterval;
+    const unsigned int noClaim = 0;
+
+    // 1. Desired moves and claims, as on SlimeMoldOpenCl
+    for (auto& devicePtr : devices) {
+        auto& device = *devicePtr;
+        compute::kernel& kernelDesiredMove = device.kernels["desiredMoves"];
+
+        device.queue.enqueue_fill_buffer(device.dSquareClaims.get_buffer(), &noClaim, sizeof(noClaim), 0, device.dSquareClaims.size() * sizeof(unsigned int));
+        kernelDesiredMove.set_arg(0, device.dAgents.get_buffer());
+        kernelDesiredMove.set_arg(1, device.dAgentIds.get_buffer());
+        kernelDesiredMove.set_arg(2, device.dAgentDesired.get_buffer());
+        kernelDesiredMove.set_arg(3, device.dDesiredDestinationIndices.get_buffer());
+        kernelDesiredMove.set_arg(4, device.dSquareClaims.get_buffer());
+        kernelDesiredMove.set_arg(5, step);
+        enqueueKernel(device, kernelDesiredMove, 0, device.numAgents);
+    }
+
+    // 2. Both devices at a border see all claims on the squares around it
+    mergeClaims();
+
+    // 3. Winners move, and each device deposits on the claimed squares of its strip
+    for (int i = 0; i < getNumDevices(); i++) {
+        auto& device = *devices[i];
+        compute::kernel& kernelMove = device.kernels["move"];
+        compute::kernel& kernelDeposit = device.kernels["depositClaimed"];
+
+        kernelMove.set_arg(0, device.dDataTrails[idxDataTrailInUse]);
+        kernelMove.set_arg(1, device.dAgents.get_buffer());
+        kernelMove.set_arg(2, device.dAgentIds.get_buffer());
+        kernelMove.set_arg(3, device.dAgentDesired.get_buffer());
+        kernelMove.set_arg(4, device.dDesiredDestinationIndices.get_buffer());
+        kernelMove.set_arg(5, device.dSquareClaims.get_buffer());
+        kernelMove.set_arg(6, step);
+        enqueueKernel(device, kernelMove, 0, device.numAgents);
+
+        kernelDeposit.set_arg(0, device.dDataTrails[idxDataTrailInUse]);
+        kernelDeposit.set_arg(1, device.dSquareClaims.get_buffer());
+        enqueueKernel(device, kernelDeposit, getStripStart(i) * width, (getStripEnd(i) - getStripStart(i)) * width);
+    }
+
+    // 4. The strips are final for this step. The halos are needed by the sense below and the diffusion of the next step
+    exchangeHalos();
+
+    if (rebalanceInterval > 0 && (step + 1) % rebalanceInterval == 0) {
+        rebalance();
+    }
+    else if ((step + 1) % migrationInterval == 0) {
+        migrateAgents();
+    }
+}
+
+void SlimeMoldMultiDevice::mergeClaims() {
+    const int width = RunConfiguration::Environment::width;
+    const int height = RunConfiguration::Environment::height;
+
+    flush();
+
+    for (int i = 1; i < getNumDevices(); i++) {
+        auto& deviceAbove = *devices[i - 1];
+        auto& deviceBelow = *devices[i];
+        const int rowStart = std::max(0, getStripStart(i) - haloRows);
+        const int rowEnd = std::min(height, getStripStart(i) + haloRows);
+        const size_t numSquares = static_cast<size_t>(rowEnd - rowStart) * width;
+        const size_t offset = static_cast<size_t>(rowStart) * width * sizeof(unsigned int);
+        std::vector<unsigned int> claimsAbove(numSquares);
+        std::vector<unsigned int> claimsBelow(numSquares);
+
+        deviceAbove.queue.enqueue_read_buffer(deviceAbove.dSquareClaims.get_buffer(), offset, numSquares * sizeof(unsigned int), claimsAbove.data());
+        deviceBelow.queue.enqueue_read_buffer(deviceBelow.dSquareClaims.get_buffer(), offset, numSquares * sizeof(unsigned int), claimsBelow.data());
+
+        for (size_t j = 0; j < numSquares; j++) {
+            claimsAbove[j] = std::max(claimsAbove[j], claimsBelow[j]);
+        }
+
+        deviceAbove.queue.enqueue_write_buffer(deviceAbove.dSquareClaims.get_buffer(), offset, numSquares * sizeof(unsigned int), claimsAbove.data());
+        deviceBelow.queue.enqueue_write_buffer(deviceBelow.dSquareClaims.get_buffer(), offset, numSquares * sizeof(unsigned int), claimsAbove.data());
+    }
+}
+
+void SlimeMoldMultiDevice::copyTrailRows(int idxDeviceFrom, int idxDeviceTo, int idxDataTrail, int rowStart, int rowEndExclusive) {
+    if (rowEndExclusive <= rowStart) {
+        return;
+    }
+
+    const size_t rowBytes = RunConfiguration::Environment::width * getTrailBytesPerPixel(trailFormat);
+    const size_t offset = rowStart * rowBytes;
+    auto& deviceFrom = *devices[idxDeviceFrom];
+    auto& deviceTo = *devices[idxDeviceTo];
+    std::vector<unsigned char> rows((rowEndExclusive - rowStart) * rowBytes);
+
+    deviceFrom.queue.enqueue_read_buffer(deviceFrom.dDataTrails[idxDataTrail], offset, rows.size(), rows.data());
+    deviceTo.queue.enqueue_write_buffer(deviceTo.dDataTrails[idxDataTrail], offset, rows.size(), rows.data());
+}
+
+void SlimeMoldMultiDevice::exchangeHalos() {
+    const int height = RunConfiguration::Environment::height;
+    const int numDevices = getNumDevices();
+
+    flush();
+
+    for (int i = 0; i < numDevices; i++) {
+        if (i > 0) {
+            copyTrailRows(i - 1, i, idxDataTrailInUse, std::max(0, getStripStart(i) - haloRows), getStripStart(i));
+        }
+
+        if (i + 1 < numDevices) {
+            copyTrailRows(i + 1, i, idxDataTrailInUse, getStripEnd(i), std::min(height, getStripEnd(i) + haloRows));
+        }
+    }
+}
+
+void SlimeMoldMultiDevice::migrateAgents() {
+    const int numDevices = getNumDevices();
+    std::vector<std::vector<Agent>> incomingAgents(numDevices);
+    std::vector<std::vector<unsigned int>> incomingAgentIds(numDevices);
+    std::vector<int> stayingStart(numDevices, 0);
+    std::vector<int> stayingEnd(numDevices, 0);
+
+    // 1. Sort the agents of each device by the strip they are in and take out the ones that left
+    for (int i = 0; i < numDevices; i++) {
+        auto& device = *devices[i];
+        const int numAgents = device.numAgents;
+        compute::kernel& kernelStripKeys = device.kernels["stripKeys"];
+
+        if (numAgents == 0) {
+            continue;
+        }
+
+        compute::copy(stripRows.begin(), stripRows.end(), device.dStripRows.begin(), device.queue);
+        kernelStripKeys.set_arg(0, device.dAgents.get_buffer());
+        kernelStripKeys.set_arg(1, device.dStripRows.get_buffer());
+        kernelStripKeys.set_arg(2, numDevices);
+        kernelStripKeys.set_arg(3, device.dSortKeys.get_buffer());
+        kernelStripKeys.set_arg(4, device.dSortOrder.get_buffer());
+        enqueueKernel(device, kernelStripKeys, 0, numAgents);
+
+        compute::sort_by_key(device.dSortKeys.begin(), device.dSortKeys.begin() + numAgents, device.dSortOrder.begin(), device.queue);
+        compute::gather(device.dSortOrder.begin(), device.dSortOrder.begin() + numAgents, device.dAgents.begin(), device.dAgentsSorted.begin(), device.queue);
+        compute::gather(device.dSortOrder.begin(), device.dSortOrder.begin() + numAgents, device.dAgentIds.begin(), device.dAgentIdsSorted.begin(), device.queue);
+        device.dAgents.swap(device.dAgentsSorted);
+        device.dAgentIds.swap(device.dAgentIdsSorted);
+
+        std::vector<unsigned int> keys(numAgents);
+
+        compute::copy(device.dSortKeys.begin(), device.dSortKeys.begin() + numAgents, keys.begin(), device.queue);
+
+        for (int j = 0; j < numDevices; j++) {
+            const int first = static_cast<int>(std::lower_bound(keys.begin(), keys.end(), static_cast<unsigned int>(j)) - keys.begin());
+            const int last = static_cast<int>(std::upper_bound(keys.begin(), keys.end(), static_cast<unsigned int>(j)) - keys.begin());
+
+            if (j == i) {
+                stayingStart[i] = first;
+                stayingEnd[i] = last;
+            }
+            else if (last > first) {
+                const size_t numIncoming = incomingAgents[j].size();
+
+                incomingAgents[j].resize(numIncoming + last - first);
+                incomingAgentIds[j].resize(numIncoming + last - first);
+                compute::copy(device.dAgents.begin() + first, device.dAgents.begin() + last, incomingAgents[j].begin() + numIncoming, device.queue);
+                compute::copy(device.dAgentIds.begin() + first, device.dAgentIds.begin() + last, incomingAgentIds[j].begin() + numIncoming, device.queue);
+            }
+        }
+    }
+
+    // 2. The agents that stayed go to the front, the ones that arrived behind them
+    for (int i = 0; i < numDevices; i++) {
+        auto& device = *devices[i];
+        const int numStaying = stayingEnd[i] - stayingStart[i];
+
+        if (stayingStart[i] > 0 && numStaying > 0) {
+            compute::copy(device.dAgents.begin() + stayingStart[i], device.dAgents.begin() + stayingEnd[i], device.dAgentsSorted.begin(), device.queue);
+            compute::copy(device.dAgentIds.begin() + stayingStart[i], device.dAgentIds.begin() + stayingEnd[i], device.dAgentIdsSorted.begin(), device.queue);
+            device.dAgents.swap(device.dAgentsSorted);
+            device.dAgentIds.swap(device.dAgentIdsSorted);
+        }
+
+        compute::copy(incomingAgents[i].begin(), incomingAgents[i].end(), device.dAgents.begin() + numStaying, device.queue);
+        compute::copy(incomingAgentIds[i].begin(), incomingAgentIds[i].end(), device.dAgentIds.begin() + numStaying, device.queue);
+        device.numAgents = numStaying + static_cast<int>(incomingAgents[i].size());
+    }
+}
+
+void SlimeMoldMultiDevice::rebalance() {
+    const int height = RunConfiguration::Environment::height;
+    const int numDevices = getNumDevices();
+    std::vector<double> rowsPerSecond(numDevices, 0.0);
+    double totalRowsPerSecond = 0.0;
+    bool measured = true;
+
+    for (int i = 0; i < numDevices; i++) {
+        auto& device = *devices[i];
+        double busySeconds = 0.0;
+
+        for (auto& event : device.kernelEvents) {
+            event.wait();
+
+            const auto start = event.get_profiling_info<cl_ulong>(compute::event::profiling_command_start);
+            const auto end = event.get_profiling_info<cl_ulong>(compute::event::profiling_command_end);
+
+            // Some drivers don't fill in every timestamp
+            busySeconds += end > start ? 1e-9 * (end - start) : 0.0;
+        }
+
+        device.kernelEvents.clear();
+        measured = measured && busySeconds > 0.0;
+        rowsPerSecond[i] = busySeconds > 0.0 ? (getStripEnd(i) - getStripStart(i)) / busySeconds : 0.0;
+        totalRowsPerSecond += rowsPerSecond[i];
+    }
+
+    if (numDevices > 1 && measured) {
+        const int minRows = 2 * haloRows;
+        std::vector<int> newStripRows(stripRows.size());
+        double rowEnd = 0.0;
+
+        newStripRows[0] = 0;
+        newStripRows[numDevices] = height;
+
+        // Halfway to the rows each device would get at its measured speed, so one noisy interval doesn't throw the
+        //  borders around
+        for (int i = 0; i + 1 < numDevices; i++) {
+            const double rowsTarget = height * rowsPerSecond[i] / totalRowsPerSecond;
+
+            rowEnd += 0.5 * ((getStripEnd(i) - getStripStart(i)) + rowsTarget);
+            newStripRows[i + 1] = static_cast<int>(std::lround(rowEnd));
+        }
+
+        for (int i = 1; i < numDevices; i++) {
+            newStripRows[i] = std::max(newStripRows[i], newStripRows[i - 1] + minRows);
+        }
+
+        for (int i = numDevices - 1; i > 0; i--) {
+            newStripRows[i] = std::min(newStripRows[i], newStripRows[i + 1] - minRows);
+        }
+
+        // Rows that change device take the current trail map with them. The other map is written by the next
+        //  diffusion before it's read
+        flush();
+
+        for (int i = 0; i < numDevices; i++) {
+            for (int j = 0; j < numDevices; j++) {
+                if (j != i) {
+                    copyTrailRows(j, i, idxDataTrailInUse, std::max(newStripRows[i], getStripStart(j)), std::min(newStripRows[i + 1], getStripEnd(j)));
+                }
+            }
+        }
+
+        stripRows = newStripRows;
+        exchangeHalos();
+    }
+
+    migrateAgents();
+}
+
+void SlimeMoldMultiDevice::sense() {
+    for (auto& devicePtr : devices) {
+        auto& device = *devicePtr;
+        compute::kernel& kernelSense = device.kernels["sense"];
+
+        kernelSense.set_arg(0, device.dDataTrails[idxDataTrailInUse]);
+        kernelSense.set_arg(1, device.dAgents.get_buffer());
+        kernelSense.set_arg(2, device.dAgentIds.get_buffer());
+        kernelSense.set_arg(3, step);
+        enqueueKernel(device, kernelSense, 0, device.numAgents);
+    }
+}
+
+void SlimeMoldMultiDevice::makeRenderImage() {
+    const size_t width = RunConfiguration::Environment::width;
+
+    // Each device renders its strip and copies it straight into its rows of dataTrailRender
+    for (int i = 0; i < getNumDevices(); i++) {
+        auto& device = *devices[i];
+        compute::kernel& kernelRender = device.kernels["render"];
+        const size_t offset = getStripStart(i) * width;
+        const size_t numPixels = (getStripEnd(i) - getStripStart(i)) * width;
+
+        kernelRender.set_arg(0, device.dDataTrails[idxDataTrailInUse]);
+        kernelRender.set_arg(1, device.dRender.get_buffer());
+        enqueueKernel(device, kernelRender, offset, numPixels);
+        device.renderReadEvent = device.queue.enqueue_read_buffer_async(device.dRender.get_buffer(), offset, numPixels, dataTrailRender + offset);
+    }
+
+    flush();
+}
+
+unsigned char* SlimeMoldMultiDevice::getDataTrailRender() {
+    for (auto& device : devices) {
+        if (device->renderReadEvent.get() != nullptr) {
+            device->renderReadEvent.wait();
+        }
+    }
+
+    return dataTrailRender;
+}
+
+void SlimeMoldMultiDevice::sortAgents() {
+    for (auto& devicePtr : devices) {
+        auto& device = *devicePtr;
+        const int numAgents = device.numAgents;
+        compute::kernel& kernelMortonKeys = device.kernels["mortonKeys"];
+
+        if (numAgents == 0) {
+            continue;
+        }
+
+        kernelMortonKeys.set_arg(0, device.dAgents.get_buffer());
+        kernelMortonKeys.set_arg(1, device.dSortKeys.get_buffer());
+        kernelMortonKeys.set_arg(2, device.dSortOrder.get_buffer());
+        enqueueKernel(device, kernelMortonKeys, 0, numAgents);
+
+        compute::sort_by_key(device.dSortKeys.begin(), device.dSortKeys.begin() + numAgents, device.dSortOrder.begin(), device.queue);
+        compute::gather(device.dSortOrder.begin(), device.dSortOrder.begin() + numAgents, device.dAgents.begin(), device.dAgentsSorted.begin(), device.queue);
+        compute::gather(device.dSortOrder.begin(), device.dSortOrder.begin() + numAgents, device.dAgentIds.begin(), device.dAgentIdsSorted.begin(), device.queue);
+        device.dAgents.swap(device.dAgentsSorted);
+        device.dAgentIds.swap(device.dAgentIdsSorted);
+    }
+}
+
+void SlimeMoldMultiDevice::swapBuffers() {
+    std::swap(idxDataTrailBuffer, idxDataTrailInUse);
+}
+
+void SlimeMoldMultiDevice::finish() {
+    for (auto& device : devices) {
+        device->queue.finish();
+    }
+}
+
+std::string SlimeMoldMultiDevice::getDeviceName() const {
+    std::string name;
+
+    for (const auto& device : devices) {
+        name += (name.empty() ? "" : ", ") + device->device.name();
+    }
+
+    return name;
+}
+
+std::vector<Agent> SlimeMoldMultiDevice::exportAgents() {
+    const auto state = exportState();
+    std::vector<Agent> agents(state.agents.size());
+
+    for (size_t i = 0; i < state.agents.size(); i++) {
+        agents[state.agentIds[i]] = state.agents[i];
+    }
+
+    return agents;
+}
+
+std::vector<unsigned int> SlimeMoldMultiDevice::exportAgentOrder() {
+    // Memory order is device by device
+    std::vector<unsigned int> order;
+
+    for (auto& devicePtr : devices) {
+        auto& device = *devicePtr;
+        const size_t numAgentsBefore = order.size();
+
+        order.resize(numAgentsBefore + device.numAgents);
+        compute::copy(device.dAgentIds.begin(), device.dAgentIds.begin() + device.numAgents, order.begin() + numAgentsBefore, device.queue);
+    }
+
+    return order;
+}
+
+std::vector<float> SlimeMoldMultiDevice::exportTrailMap() {
+    const size_t numPixels = RunConfiguration::Environment::numPixels();
+    const size_t rowBytes = RunConfiguration::Environment::width * getTrailBytesPerPixel(trailFormat);
+    std::vector<unsigned char> trailBytes(numPixels * getTrailBytesPerPixel(trailFormat));
+    std::vector<float> trailMap(numPixels);
+
+    for (int i = 0; i < getNumDevices(); i++) {
+        auto& device = *devices[i];
+        const size_t offset = getStripStart(i) * rowBytes;
+
+        device.queue.enqueue_read_buffer(device.dDataTrails[idxDataTrailInUse], offset, (getStripEnd(i) - getStripStart(i)) * rowBytes, trailBytes.data() + offset);
+    }
+
+    convertTrailMap(trailBytes.data(), trailFormat, trailMap.data(), TrailFormat::Float32, numPixels);
+
+    return trailMap;
+}
+
+SimulationState SlimeMoldMultiDevice::exportState() {
+    const size_t rowBytes = RunConfiguration::Environment::width * getTrailBytesPerPixel(trailFormat);
+    const size_t trailBytes = RunConfiguration::Environment::numPixels() * getTrailBytesPerPixel(trailFormat);
+    const int idxDataTrails[] = { idxDataTrailInUse, idxDataTrailBuffer };
+    SimulationState state;
+
+    state.step = step;
+    state.trailFormat = trailFormat;
+    state.trailMaps[0].resize(trailBytes);
+    state.trailMaps[1].resize(trailBytes);
+
+    // Each device has the agents and trail map rows of its strip. The copies are queued behind all work in flight
+    for (int i = 0; i < getNumDevices(); i++) {
+        auto& device = *devices[i];
+        const size_t numAgentsBefore = state.agents.size();
+        const size_t offset = getStripStart(i) * rowBytes;
+
+        state.agents.resize(numAgentsBefore + device.numAgents);
+        state.agentIds.resize(numAgentsBefore + device.numAgents);
+        compute::copy(device.dAgents.begin(), device.dAgents.begin() + device.numAgents, state.agents.begin() + numAgentsBefore, device.queue);
+        compute::copy(device.dAgentIds.begin(), device.dAgentIds.begin() + device.numAgents, state.agentIds.begin() + numAgentsBefore, device.queue);
+
+        for (int j = 0; j < 2; j++) {
+            device.queue.enqueue_read_buffer(device.dDataTrails[idxDataTrails[j]], offset, (getStripEnd(i) - getStripStart(i)) * rowBytes, state.trailMaps[j].data() + offset);
+        }
+    }
+
+    return state;
+}
+
+void SlimeMoldMultiDevice::importState(const SimulationStateView& state) {
+    const size_t numPixels = RunConfiguration::Environment::numPixels();
+    const size_t trailBytes = numPixels * getTrailBytesPerPixel(trailFormat);
+    const int idxDataTrails[] = { idxDataTrailInUse, idxDataTrailBuffer };
+    std::vector<unsigned char> converted;
+
+    step = state.step;
+    finish();
+
+    // The whole map goes to every device, which brings the halos up to date as well
+    for (int i = 0; i < 2; i++) {
+        const unsigned char* trailMap = state.trailMaps[i];
+
+        if (state.trailFormat != trailFormat) {
+            converted.resize(trailBytes);
+            convertTrailMap(trailMap, state.trailFormat, converted.data(), trailFormat, numPixels);
+            trailMap = converted.data();
+        }
+
+        for (auto& device : devices) {
+            device->queue.enqueue_write_buffer(device->dDataTrails[idxDataTrails[i]], 0, trailBytes, trailMap);
+        }
+    }
+
+    distributeAgents(state.agents, state.agentIds, state.numAgents);
+
+    // The step times of the old state say nothing about the new one
+    for (auto& device : devices) {
+        device->kernelEvents.clear();
+    }
+
+    makeRenderImage();
+    finish();
+}
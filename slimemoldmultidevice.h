@@ -0,0 +1,116 @@
+#pragma once
+
+#define CL_TARGET_OPENCL_VERSION 220
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/compute.hpp>
+
+#include "programbinarycache.h"
+#include "slimemold.h"
+#include "slimemoldopencl.h"
+
+namespace compute = boost::compute;
+
+/// <summary>
+/// OpenCL backend running on several devices at once: every device of every platform matching
+/// RunConfiguration::MultiDevice::deviceFilter, optionally with CPU devices split into one sub-device per NUMA node.
+/// Each device has a context, queue and program of its own and simulates a strip of rows of the map, with the agents
+/// in it. The kernels are those of SlimeMoldOpenCl, launched with a global offset so they only touch the rows of the
+/// strip. The buffers have the size of the whole map, so the kernels index them as usual.
+///
+/// Around each strip is a halo of haloRows rows, copied from the neighbouring devices once per step after the move.
+/// Agents are only handed to the device owning their row every migrationInterval steps, so an agent can wander up to
+/// migrationInterval steps into a neighbouring strip. The halo is wide enough for such an agent to sense and claim
+/// squares, and for the diffusion kernel.
+///
+/// Claims on squares near a strip border can come from two devices, so the claims in the halos are merged (highest
+/// wins) before the move. The move kernel then doesn't deposit (CFG_DEPOSIT_CLAIMED_SQUARES); instead the device
+/// owning a square deposits on it when it was claimed, since every claim has a winner. So a square only ever gets
+/// its deposit from its own device, wherever the agent that moved there is stored.
+///
+/// The strip borders are moved every rebalanceInterval steps, giving each device rows in proportion to the rows per
+/// second it managed since the last rebalance, measured with event profiling.
+/// </summary>
+class SlimeMoldMultiDevice : public SlimeMold {
+public:
+    SlimeMoldMultiDevice(TrailFormat tTrailFormat = RunConfiguration::Hardware::trailFormat);
+    ~SlimeMoldMultiDevice();
+    void diffusion();
+    void decay();
+    void move();
+    void sense();
+    void makeRenderImage();
+    void swapBuffers();
+    void finish();
+    std::string getDeviceName() const;
+    // Waits for the rows of all devices to arrive
+    unsigned char* getDataTrailRender();
+    void sortAgents();
+    std::vector<Agent> exportAgents();
+    std::vector<unsigned int> exportAgentOrder();
+    std::vector<float> exportTrailMap();
+    SimulationState exportState();
+    void importState(const SimulationStateView& state);
+    int getNumDevices() const;
+    // First row of the strip of each device, followed by the height of the map
+    std::vector<int> getStripRows() const;
+private:
+    struct Device {
+        compute::device device;
+        compute::context ctx;
+        compute::command_queue queue;
+        std::map<std::string, compute::kernel> kernels;
+        // Both trail maps, in trailFormat. Only the strip and its halo are up to date
+        std::vector<compute::buffer> dDataTrails;
+        // Room for the whole population. The first numAgents are in use
+        int numAgents;
+        compute::vector<Agent> dAgents;
+        compute::vector<unsigned int> dAgentIds;
+        compute::vector<Agent> dAgentDesired;
+        compute::vector<int> dDesiredDestinationIndices;
+        compute::vector<unsigned int> dSquareClaims;
+        // Scratch space of sortAgents and migrateAgents
+        compute::vector<unsigned int> dSortKeys;
+        compute::vector<unsigned int> dSortOrder;
+        compute::vector<Agent> dAgentsSorted;
+        compute::vector<unsigned int> dAgentIdsSorted;
+        compute::vector<int> dStripRows;
+        compute::vector<unsigned char> dRender;
+        // Copy of the rendered strip into dataTrailRender
+        compute::event renderReadEvent;
+        // Kernels since the last rebalance, to measure how long the device was busy
+        std::vector<compute::event> kernelEvents;
+    };
+    // Every device matching the configuration
+    static std::vector<compute::device> findDevices();
+    void loadDevice(Device& device);
+    void enqueueKernel(Device& device, compute::kernel& kernel, size_t globalOffset, size_t globalSize);
+    // Submit the queued commands of all devices, so they run while the host blocks on one of them
+    void flush();
+    int getStripStart(int idxDevice) const;
+    int getStripEnd(int idxDevice) const;
+    // Copy rows [rowStart, rowEndExclusive) of trail map idxDataTrail from one device to another, through the host
+    void copyTrailRows(int idxDeviceFrom, int idxDeviceTo, int idxDataTrail, int rowStart, int rowEndExclusive);
+    // Highest claim of both devices on the squares around each strip border
+    void mergeClaims();
+    // Fill the halo of every strip from its neighbours
+    void exchangeHalos();
+    // Hand every agent to the device owning its row
+    void migrateAgents();
+    // Move the strip borders according to the measured device times. Migrates the agents
+    void rebalance();
+    // Give each device the agents in its strip, as in exportState
+    void distributeAgents(const Agent* agents, const unsigned int* agentIds, size_t numAgents);
+    std::vector<std::unique_ptr<Device>> devices;
+    // getStripStart / getStripEnd
+    std::vector<int> stripRows;
+    int haloRows;
+    TrailFormat trailFormat;
+    ProgramBinaryCache binaryCache;
+    int idxDataTrailInUse;
+    int idxDataTrailBuffer;
+};
@@ -1,6 +1,67 @@
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+#include "runstatistics.h"
 #include "slimemoldopencl.h"
+#include "trailformat.h"
+
+// Tracked events are normally collected as they complete. If the device falls this far behind, wait for it instead of
+//  keeping ever more events alive
+const size_t maxPendingEvents = 1024;
+// Number of specialised program variants to keep around
+const size_t programCacheCapacity = 16;
+
+// The kernels are compiled into the executable, so it doesn't matter which directory it is started from
+static const char* const kernelsSource =
+#include "kernels.cl"
+;
 
-SlimeMoldOpenCl::SlimeMoldOpenCl() : SlimeMold() {
+std::string RunConfigurationCl::getBuildOptions() const {
+    std::stringstream ss;
+
+    // Nine significant digits are enough to give back exactly the same float
+    ss << std::scientific << std::setprecision(8);
+    ss << "-DCFG_ENV_WIDTH=" << envWidth;
+    ss << " -DCFG_ENV_HEIGHT=" << envHeight;
+    ss << " -DCFG_ENV_DIFFUSION_KERNEL_SIZE=" << envDiffusionKernelSize;
+    ss << " -DCFG_ENV_DIFFUSION_DECAY=" << envDiffusionDecay << "f";
+    ss << " -DCFG_ENV_DIFFUSION_RATIO=" << envDiffusionRatio << "f";
+    ss << " -DCFG_AGENT_SENSOR_ANGLE=" << agentSensorAngle << "f";
+    ss << " -DCFG_AGENT_ROTATION_ANGLE=" << agentRotationAngle << "f";
+    ss << " -DCFG_AGENT_SENSOR_OFFSET=" << agentSensorOffset;
+    ss << " -DCFG_AGENT_SENSOR_WIDTH=" << agentSensorWidth;
+    ss << " -DCFG_AGENT_STEP_SIZE=" << agentStepSize;
+    ss << " -DCFG_AGENT_CHEMO_DEPOSITION=" << agentChemoDeposition;
+    ss << " -DCFG_AGENT_MAX_TOTAL_CHEMO=" << agentMaxTotalChemo << "f";
+    ss << " -DCFG_RANDOM_SEED=" << randomSeed << "u";
+    ss << " -DCFG_TRAIL_FORMAT=" << static_cast<int>(trailFormat);
+
+    if (hwSparseTileSize > 0) {
+        ss << " -DCFG_SPARSE_TILE_SIZE=" << hwSparseTileSize;
+    }
+
+    if (agentNumHeadings > 0) {
+        const HeadingTable headingTable(agentNumHeadings);
+
+        ss << " -DCFG_NUM_HEADINGS=" << agentNumHeadings;
+        ss << " -DCFG_SENSOR_HEADINGS=" << headingTable.getSensorHeadings();
+        ss << " -DCFG_ROTATION_HEADINGS=" << headingTable.getRotationHeadings();
+    }
+
+    if (hwLocalSizeX > 0 && hwLocalSizeY > 0) {
+        ss << " -DCFG_LOCAL_SIZE_X=" << hwLocalSizeX;
+        ss << " -DCFG_LOCAL_SIZE_Y=" << hwLocalSizeY;
+    }
+
+    return ss.str();
+}
+
+SlimeMoldOpenCl::SlimeMoldOpenCl(TrailFormat tTrailFormat, bool tSparseTrailMap, int tNumHeadings) : SlimeMold(), trailFormat(tTrailFormat), sparseTrailMap(tSparseTrailMap), programCache(programCacheCapacity),
+    binaryCache(RunConfiguration::Hardware::kernelCacheDirectory()) {
     compute::device gpu = compute::system::default_device();
 
     std::cout << "Using device: " << gpu.name() << std::endl;
@@ -8,14 +69,34 @@ SlimeMoldOpenCl::SlimeMoldOpenCl() : SlimeMold() {
     ctx = compute::context(gpu);
     queue = compute::command_queue(ctx, gpu);
 
-    loadKernels();
-    loadConfig();
+    if (tNumHeadings > 0) {
+        headingTable = std::unique_ptr<HeadingTable>(new HeadingTable(tNumHeadings));
+    }
+
+    int width, height;
+
+    chooseLocalWorkGroupSize(gpu, &width, &height);
+    useLocalWorkGroupSize(width, height);
+    loadKernels(RunConfigurationCl());
     loadVariables();
+
+    if (RunConfiguration::Hardware::tuneWorkGroups) {
+        tuneWorkGroups();
+    }
+}
+
+SlimeMoldOpenCl::~SlimeMoldOpenCl() {
+    queue.finish();
+
+    for (int i = 0; i < numRenderSlots; i++) {
+        queue.enqueue_unmap_buffer(hRenderPinned[i], hRenderSlots[i]);
+    }
+
+    queue.finish();
 }
 
-void addCustomTypes(std::string& source) {
-    source = compute::type_definition<Agent>() + "\n" + source;
-    source = compute::type_definition<RunConfigurationCl>() + "\n" + source;
+std::string getKernelSource() {
+    return std::string(counterRngSource) + "\n" + compute::type_definition<Agent>() + "\n" + compute::type_definition<EnsembleMember>() + "\n" + kernelsSource;
 }
 
 void SlimeMoldOpenCl::loadVariables() {
@@ -28,21 +109,48 @@ void SlimeMoldOpenCl::loadVariables() {
 
 void SlimeMoldOpenCl::loadHostMemory() {
     int numPixels = RunConfiguration::Environment::numPixels();
-    int numAgents = RunConfiguration::Environment::populationSize();
 
-    hTakenMap = std::vector<unsigned char>(numPixels);
-    hDesiredDestinationIdx = std::vector<int>(numAgents);
-    hNewDirection = std::vector<float>(numAgents);
-    hDataTrailCurrent = std::vector<float>(numPixels);
+    hDataTrailCurrent = std::vector<unsigned char>(numPixels * getTrailBytesPerPixel(trailFormat));
+    loadRenderBuffers();
+}
+
+void SlimeMoldOpenCl::loadRenderBuffers() {
+    const size_t numPixels = RunConfiguration::Environment::numPixels();
+
+    dRender = compute::vector<unsigned char>(numPixels, ctx);
+
+    for (int i = 0; i < numRenderSlots; i++) {
+        hRenderPinned[i] = compute::buffer(ctx, numPixels, compute::buffer::read_write | compute::buffer::alloc_host_ptr);
+        hRenderSlots[i] = static_cast<unsigned char*>(queue.enqueue_map_buffer(hRenderPinned[i], CL_MAP_READ | CL_MAP_WRITE, 0, numPixels));
+        std::fill(hRenderSlots[i], hRenderSlots[i] + numPixels, 0);
+    }
+
+    idxRenderSlotNext = 0;
+    idxRenderSlotDisplayed = numRenderSlots - 1;
 }
 
 void SlimeMoldOpenCl::loadDeviceMemoryTrailMaps() {
-    int numPixels = RunConfiguration::Environment::numPixels();
+    const size_t numBytes = RunConfiguration::Environment::numPixels() * getTrailBytesPerPixel(trailFormat);
+    // All formats store 0.0 as zero bits
+    const unsigned char zero = 0;
 
     for (int i = 0; i < 2; i++) {
-        dDataTrails.push_back(compute::vector<float>(numPixels, ctx));
-        int idx = static_cast<int>(dDataTrails.size() - 1);
-        compute::fill(dDataTrails[idx].begin(), dDataTrails[idx].end(), 0.0f, queue);
+        dDataTrails.push_back(compute::buffer(ctx, numBytes));
+        queue.enqueue_fill_buffer(dDataTrails.back(), &zero, sizeof(zero), 0, numBytes);
+    }
+
+    if (sparseTrailMap) {
+        const unsigned int inactive = 0;
+        // The render image starts out uninitialised
+        const unsigned int rendered = 1;
+
+        for (int i = 0; i < 2; i++) {
+            dActiveTiles.push_back(compute::vector<unsigned int>(getNumTrailTiles(), ctx));
+            queue.enqueue_fill_buffer(dActiveTiles.back().get_buffer(), &inactive, sizeof(inactive), 0, dActiveTiles.back().size() * sizeof(unsigned int));
+        }
+
+        dRenderTiles = compute::vector<unsigned int>(getNumTrailTiles(), ctx);
+        queue.enqueue_fill_buffer(dRenderTiles.get_buffer(), &rendered, sizeof(rendered), 0, dRenderTiles.size() * sizeof(unsigned int));
     }
 }
 
@@ -53,180 +161,920 @@ void SlimeMoldOpenCl::loadDeviceMemory() {
     loadDeviceMemoryTrailMaps();
     
     dDesiredDestinationIndices = compute::vector<int>(numAgents, ctx);
-    dNewDirection = compute::vector<float>(numAgents, ctx);
+    dSquareClaims = compute::vector<unsigned int>(numPixels, ctx);
     dAgentDesired = compute::vector<Agent>(numAgents, ctx);
-    dRandomValues = compute::vector<float>(numAgents, ctx);
 
     loadAgents();
 }
-void SlimeMoldOpenCl::loadConfig() {
-    RunConfigurationCl hostConfig;
-    std::vector<RunConfigurationCl> hostConfigs(1);
-
-    hostConfigs[0] = hostConfig;
+void SlimeMoldOpenCl::loadAgents() {
+    auto cpuAgents = initAgents();
 
-    dConfig = compute::vector<RunConfigurationCl>(1, ctx);
+    if (headingTable) {
+        std::vector<float> headings;
 
-    compute::copy(hostConfigs.begin(), hostConfigs.end(), dConfig.begin(), queue);
-}
+        for (int i = 0; i < headingTable->getNumHeadings(); i++) {
+            headings.insert(headings.end(), { headingTable->stepX[i], headingTable->stepY[i], headingTable->sensorX[i], headingTable->sensorY[i] });
+        }
 
-void SlimeMoldOpenCl::loadAgents() {
-    auto cpuAgents = initAgents();
+        dHeadings = compute::vector<float>(headings.size(), ctx);
+        compute::copy(headings.begin(), headings.end(), dHeadings.begin(), queue);
+        headingTable->toHeadings(cpuAgents.data(), cpuAgents.size());
+    }
     
     dAgents = compute::vector<Agent>(cpuAgents.size(), ctx);
 
     compute::copy(cpuAgents.begin(), cpuAgents.end(), dAgents.begin(), queue);
+
+    dAgentIds = compute::vector<unsigned int>(cpuAgents.size(), ctx);
+    compute::iota(dAgentIds.begin(), dAgentIds.end(), 0u, queue);
 }
 
-void SlimeMoldOpenCl::loadKernels() {
-    auto kernelSource = Utils::Files::readAllFile("kernels.cl");
-    
-    addCustomTypes(kernelSource);
+void SlimeMoldOpenCl::loadKernels(const RunConfigurationCl& config) {
+    const std::string kernelSource = getKernelSource();
+    const RunConfigurationCl buildConfig = getBuildConfiguration(config);
+
+    configuration = config;
 
-    compute::program program = compute::program::build_with_source(kernelSource, ctx);
+    // The configuration is part of the build options, which are part of the cache keys
+    const auto options = buildConfig.getBuildOptions();
+    auto cachedProgram = programCache.get("kernels.cl", options);
+
+    if (!cachedProgram) {
+        cachedProgram = binaryCache.build(kernelSource, options, ctx);
+        programCache.insert("kernels.cl", options, *cachedProgram);
+    }
+
+    compute::program program = *cachedProgram;
 
     std::vector<std::string> kernelNames = {
         "diffuse",
         "decay",
         "move",
         "desiredMoves",
-        "sense"
+        "sense",
+        "render",
+        "mortonKeys",
+        "satRows",
+        "satColumns",
+        "senseSummedArea"
     };
 
+    if (sparseTrailMap) {
+        kernelNames.insert(kernelNames.end(), { "diffuseSparse", "decaySparse", "renderSparse" });
+    }
+
+    if (localWorkGroupWidth > 0) {
+        kernelNames.insert(kernelNames.end(), { "diffuseLocal", "senseLocal" });
+    }
+
     for (auto& kernelName : kernelNames) {
         kernels[kernelName] = compute::kernel(program, kernelName);
     }
 }
 
+RunConfigurationCl SlimeMoldOpenCl::getBuildConfiguration(const RunConfigurationCl& config) const {
+    RunConfigurationCl buildConfig = config;
+
+    // The buffers are allocated for one trail format, and the tile flags for one tile size
+    buildConfig.trailFormat = trailFormat;
+    buildConfig.hwSparseTileSize = sparseTrailMap ? sparseTileSize : 0;
+    buildConfig.agentNumHeadings = headingTable ? headingTable->getNumHeadings() : 0;
+    buildConfig.hwLocalSizeX = localWorkGroupWidth;
+    buildConfig.hwLocalSizeY = localWorkGroupHeight;
+
+    return buildConfig;
+}
+
+void SlimeMoldOpenCl::setConfiguration(const RunConfigurationCl& config) {
+    // Kernels still in flight keep their program alive, so there is no need to wait for them
+    loadKernels(config);
+}
+
+void SlimeMoldOpenCl::setLocalWorkGroupSize(int width, int height) {
+    const bool tiled = width > 0 && height > 0;
+
+    if (tiled && !canRunLocalWorkGroupSize(queue.get_device(), width, height)) {
+        throw std::runtime_error(getDeviceName() + " can't run work-groups of " + std::to_string(width) + "x" + std::to_string(height));
+    }
+
+    useLocalWorkGroupSize(tiled ? width : 0, tiled ? height : 0);
+    loadKernels(configuration);
+}
+
+void SlimeMoldOpenCl::useLocalWorkGroupSize(int width, int height) {
+    const WorkGroupChoice choice = { width > 0, { static_cast<size_t>(width), static_cast<size_t>(height) }, 0.0 };
+
+    localWorkGroupWidth = width;
+    localWorkGroupHeight = height;
+    workGroupChoices["diffuse"] = choice;
+    workGroupChoices["sense"] = choice;
+}
+
+int SlimeMoldOpenCl::getLocalWorkGroupWidth() const {
+    return localWorkGroupWidth;
+}
+
+int SlimeMoldOpenCl::getLocalWorkGroupHeight() const {
+    return localWorkGroupHeight;
+}
+
+void SlimeMoldOpenCl::chooseLocalWorkGroupSize(const compute::device& device, int* width, int* height) {
+    const int configWidth = RunConfiguration::Hardware::localWorkGroupWidth;
+    const int configHeight = RunConfiguration::Hardware::localWorkGroupHeight;
+
+    *width = 0;
+    *height = 0;
+
+    if (configWidth > 0 && configHeight > 0) {
+        if (!canRunLocalWorkGroupSize(device, configWidth, configHeight)) {
+            throw std::runtime_error(device.name() + " can't run work-groups of " + std::to_string(configWidth) + "x" + std::to_string(configHeight)
+                + " (RunConfiguration::Hardware::localWorkGroupWidth and localWorkGroupHeight)");
+        }
+
+        *width = configWidth;
+        *height = configHeight;
+        return;
+    }
+
+    if (configWidth < 0 || configHeight < 0 || device.get_info<cl_device_local_mem_type>(CL_DEVICE_LOCAL_MEM_TYPE) != CL_LOCAL) {
+        return;
+    }
+
+    // 16 work-items write 64 squares of a row, a few whole cache lines
+    const int candidateWidth = 16;
+
+    for (int candidateHeight = 16; candidateHeight > 0; candidateHeight /= 2) {
+        if (canRunLocalWorkGroupSize(device, candidateWidth, candidateHeight)) {
+            *width = candidateWidth;
+            *height = candidateHeight;
+            return;
+        }
+    }
+}
+
+bool SlimeMoldOpenCl::canRunLocalWorkGroupSize(const compute::device& device, int width, int height) {
+    const auto maxWorkItemSizes = device.get_info<std::vector<size_t>>(CL_DEVICE_MAX_WORK_ITEM_SIZES);
+    const size_t groupSize = static_cast<size_t>(width) * height;
+    // The float4 tile of diffuseLocal, with its halo rounded up to whole float4 left and right
+    const int kernelHalf = RunConfiguration::Environment::diffusionKernelSize / 2;
+    const size_t diffuseBytes = static_cast<size_t>(height + 2 * kernelHalf) * (width + 2 * ((kernelHalf + 3) / 4)) * 4 * sizeof(float);
+    // SENSE_LOCAL_CAPACITY squares and the bounds of senseLocal
+    const size_t senseBytes = 4096 * sizeof(float) + 4 * sizeof(int);
+
+    // senseLocal runs the same number of work-items in one dimension
+    return groupSize <= device.max_work_group_size() && maxWorkItemSizes.size() >= 2 && groupSize <= maxWorkItemSizes[0]
+        && static_cast<size_t>(height) <= maxWorkItemSizes[1] && std::max(diffuseBytes, senseBytes) <= device.local_memory_size();
+}
+
+void SlimeMoldOpenCl::getSparseWorkSize(size_t* globalWorkSize) const {
+    globalWorkSize[0] = (RunConfiguration::Environment::width + sparseTileSize - 1) / sparseTileSize * sparseTileSize;
+    globalWorkSize[1] = (RunConfiguration::Environment::height + sparseTileSize - 1) / sparseTileSize * sparseTileSize;
+}
+
 void SlimeMoldOpenCl::diffusion() {
 
     int numPixels = RunConfiguration::Environment::numPixels();
     compute::kernel& kernelDiffuse = kernels["diffuse"];
     size_t globalWorkSize[] = { RunConfiguration::Environment::width, RunConfiguration::Environment::height };
 
-    kernelDiffuse.set_arg(0, dConfig.get_buffer());
-    kernelDiffuse.set_arg(1, dDataTrails[idxDataTrailInUse].get_buffer());
-    kernelDiffuse.set_arg(2, dDataTrails[idxDataTrailBuffer].get_buffer());
+    if (sparseTrailMap) {
+        compute::kernel& kernelDiffuseSparse = kernels["diffuseSparse"];
+        const size_t localWorkSize[] = { sparseTileSize, sparseTileSize };
+
+        getSparseWorkSize(globalWorkSize);
+        kernelDiffuseSparse.set_arg(0, dDataTrails[idxDataTrailInUse]);
+        kernelDiffuseSparse.set_arg(1, dDataTrails[idxDataTrailBuffer]);
+        kernelDiffuseSparse.set_arg(2, dActiveTiles[idxDataTrailInUse].get_buffer());
+        kernelDiffuseSparse.set_arg(3, dActiveTiles[idxDataTrailBuffer].get_buffer());
+        trackEvent("diffuse", queue.enqueue_nd_range_kernel(kernelDiffuseSparse, 2, nullptr, &globalWorkSize[0], &localWorkSize[0]));
+        return;
+    }
+
+    const WorkGroupChoice& choice = workGroupChoices["diffuse"];
+
+    if (choice.tiled) {
+        compute::kernel& kernelDiffuseLocal = kernels["diffuseLocal"];
+        const size_t localWorkSize[] = { static_cast<size_t>(localWorkGroupWidth), static_cast<size_t>(localWorkGroupHeight) };
+        // Every work-item writes four squares of a row
+        const size_t groupColumns = 4 * localWorkSize[0];
 
-    queue.enqueue_nd_range_kernel(kernelDiffuse, 2, nullptr, &globalWorkSize[0], nullptr);
+        globalWorkSize[0] = (globalWorkSize[0] + groupColumns - 1) / groupColumns * localWorkSize[0];
+        globalWorkSize[1] = (globalWorkSize[1] + localWorkSize[1] - 1) / localWorkSize[1] * localWorkSize[1];
+        kernelDiffuseLocal.set_arg(0, dDataTrails[idxDataTrailInUse]);
+        kernelDiffuseLocal.set_arg(1, dDataTrails[idxDataTrailBuffer]);
+        trackEvent("diffuse", queue.enqueue_nd_range_kernel(kernelDiffuseLocal, 2, nullptr, &globalWorkSize[0], &localWorkSize[0]));
+        return;
+    }
+
+    kernelDiffuse.set_arg(0, dDataTrails[idxDataTrailInUse]);
+    kernelDiffuse.set_arg(1, dDataTrails[idxDataTrailBuffer]);
+
+    trackEvent("diffuse", queue.enqueue_nd_range_kernel(kernelDiffuse, 2, nullptr, &globalWorkSize[0], choice.localSize[0] > 0 ? &choice.localSize[0] : nullptr));
 }
 
 void SlimeMoldOpenCl::decay() {
     int numPixels = RunConfiguration::Environment::numPixels();
     compute::kernel& kernelDecay = kernels["decay"];
 
-    kernelDecay.set_arg(0, dConfig.get_buffer());
-    kernelDecay.set_arg(1, dDataTrails[idxDataTrailInUse].get_buffer());
-    queue.enqueue_1d_range_kernel(kernelDecay, 0, numPixels, 0);
-}
-
-void SlimeMoldOpenCl::moveCoordinate() {
-    int numAgents = RunConfiguration::Environment::populationSize();
-    auto agentMoveOrder = getAgentMoveOrder();
-
-    // Read desired position of all agents
-    std::vector<int> hDesiredDestinationIndices(numAgents);
-    compute::copy(dDesiredDestinationIndices.begin(), dDesiredDestinationIndices.end(), hDesiredDestinationIndices.begin(), queue);
-
-    std::fill(hTakenMap.begin(), hTakenMap.end(), 0);
+    if (sparseTrailMap) {
+        compute::kernel& kernelDecaySparse = kernels["decaySparse"];
+        const size_t localWorkSize[] = { sparseTileSize, sparseTileSize };
+        size_t globalWorkSize[2];
 
-    for (int agentIdx = 0; agentIdx < numAgents; agentIdx++) {
-        // We want to randomize the order in which we move agents. An agent will be blocked from moving to a square 
-        //  if another agent is there already, so randomizing the order is used to avoid bias.
-        auto idx = agentMoveOrder[agentIdx];
-        int desiredPos = hDesiredDestinationIndices[idx];
-        bool isOutOfBounds = (desiredPos == -1);
-        if (isOutOfBounds) {
-            hNewDirection[idx] = random->randomDirection();
-        }
-        else if (hTakenMap[desiredPos] == 0) {
-            // Square is available, so agent will move as desired
-            hTakenMap[desiredPos] = 1;
-        }
-        else {
-            // Position already taken
-            hNewDirection[idx] = random->randomDirection();
-            // Tell the GPU that the agent can not move
-            hDesiredDestinationIndices[idx] = -1;
-        }
+        getSparseWorkSize(globalWorkSize);
+        kernelDecaySparse.set_arg(0, dDataTrails[idxDataTrailInUse]);
+        kernelDecaySparse.set_arg(1, dActiveTiles[idxDataTrailInUse].get_buffer());
+        trackEvent("decay", queue.enqueue_nd_range_kernel(kernelDecaySparse, 2, nullptr, &globalWorkSize[0], &localWorkSize[0]));
+        return;
     }
 
-    compute::copy(hNewDirection.begin(), hNewDirection.end(), dNewDirection.begin(), queue);
-    compute::copy(hDesiredDestinationIndices.begin(), hDesiredDestinationIndices.end(), dDesiredDestinationIndices.begin(), queue);
+    kernelDecay.set_arg(0, dDataTrails[idxDataTrailInUse]);
+    trackEvent("decay", queue.enqueue_1d_range_kernel(kernelDecay, 0, numPixels, workGroupChoices["decay"].localSize[0]));
 }
 
 void SlimeMoldOpenCl::moveDesiredMoves() {
     int numAgents = RunConfiguration::Environment::populationSize();
     compute::kernel& kernelDesiredMove = kernels["desiredMoves"];
 
-    // Calculate desired next position of all agents
+    // Calculate desired next position of all agents and claim the destination squares
+    const unsigned int noClaim = 0;
+    trackEvent("clearSquareClaims", queue.enqueue_fill_buffer(dSquareClaims.get_buffer(), &noClaim, sizeof(noClaim), 0, dSquareClaims.size() * sizeof(unsigned int)));
 
-    kernelDesiredMove.set_arg(0, dConfig.get_buffer());
-    kernelDesiredMove.set_arg(1, dAgents.get_buffer());
+    kernelDesiredMove.set_arg(0, dAgents.get_buffer());
+    kernelDesiredMove.set_arg(1, dAgentIds.get_buffer());
     kernelDesiredMove.set_arg(2, dAgentDesired.get_buffer());
     kernelDesiredMove.set_arg(3, dDesiredDestinationIndices.get_buffer());
-    queue.enqueue_1d_range_kernel(kernelDesiredMove, 0, numAgents, 0);
+    kernelDesiredMove.set_arg(4, dSquareClaims.get_buffer());
+    kernelDesiredMove.set_arg(5, step);
+
+    if (headingTable) {
+        kernelDesiredMove.set_arg(6, dHeadings.get_buffer());
+    }
+
+    trackEvent("desiredMoves", queue.enqueue_1d_range_kernel(kernelDesiredMove, 0, numAgents, workGroupChoices["desiredMoves"].localSize[0]));
 }
 
 void SlimeMoldOpenCl::moveActualMove() {
     int numAgents = RunConfiguration::Environment::populationSize();
     compute::kernel& kernelMove = kernels["move"];
     
-    kernelMove.set_arg(0, dConfig.get_buffer());
-    kernelMove.set_arg(1, dDataTrails[idxDataTrailInUse].get_buffer());
-    kernelMove.set_arg(2, dAgents.get_buffer());
+    kernelMove.set_arg(0, dDataTrails[idxDataTrailInUse]);
+    kernelMove.set_arg(1, dAgents.get_buffer());
+    kernelMove.set_arg(2, dAgentIds.get_buffer());
     kernelMove.set_arg(3, dAgentDesired.get_buffer());
     kernelMove.set_arg(4, dDesiredDestinationIndices.get_buffer());
-    kernelMove.set_arg(5, dNewDirection.get_buffer());
+    kernelMove.set_arg(5, dSquareClaims.get_buffer());
+    kernelMove.set_arg(6, step);
+
+    if (sparseTrailMap) {
+        kernelMove.set_arg(7, dActiveTiles[idxDataTrailInUse].get_buffer());
+    }
 
-    queue.enqueue_1d_range_kernel(kernelMove, 0, numAgents, 0);
+    trackEvent("move", queue.enqueue_1d_range_kernel(kernelMove, 0, numAgents, workGroupChoices["move"].localSize[0]));
 }
 
 void SlimeMoldOpenCl::move() {
     //  1. (GPU) Calculate desired indices. This functions takes a result vector of size numAgents, where the value is set to its desired move idx.
-    //      Keep a buffer on the gpu with desired newx/newy as float values. This will make it more efficient, not rounding all values on CPU
-    //  2. (CPU) Coordinate movements (synchronous)
-    //  3. (GPU) Make actual movement, based on coordination made on CPU
+    //      Keep a buffer on the gpu with desired newx/newy as float values. Each agent claims its desired square with a random priority.
+    //  2. (GPU) Make actual movement. The agent with the highest claim on a square moves there, the others get a new random direction.
+    //  Everything stays on the device, so there is no synchronization with the host.
 
     moveDesiredMoves();
-    moveCoordinate();
     moveActualMove();
 }
 
+void SlimeMoldOpenCl::readTrailMap() {
+    // Blocking, and only used outside the step loop
+    const size_t numBytes = hDataTrailCurrent.size();
+
+    trackEvent("readTrail", queue.enqueue_read_buffer(dDataTrails[idxDataTrailInUse], 0, numBytes, hDataTrailCurrent.data()), numBytes);
+}
+
 void SlimeMoldOpenCl::makeRenderImage() {
-    int numPixels = RunConfiguration::Environment::numPixels();
+    const size_t numPixels = RunConfiguration::Environment::numPixels();
+    compute::kernel& kernelRender = kernels["render"];
+    const int idxSlot = idxRenderSlotNext;
 
-    compute::copy(dDataTrails[idxDataTrailInUse].begin(), dDataTrails[idxDataTrailInUse].end(), hDataTrailCurrent.begin(), queue);
+    if (sparseTrailMap) {
+        compute::kernel& kernelRenderSparse = kernels["renderSparse"];
+        const size_t localWorkSize[] = { sparseTileSize, sparseTileSize };
+        size_t globalWorkSize[2];
 
-    auto fn = [this](int idxStart, int idxEndExclusive) -> void {
-        for (int i = idxStart; i < idxEndExclusive; i++) {
-            dataTrailRender[i] = static_cast<unsigned char>(Utils::Math::clamp<float>(0.0f, 255.0f, hDataTrailCurrent[i]));
-        }
-    };
+        getSparseWorkSize(globalWorkSize);
+        kernelRenderSparse.set_arg(0, dDataTrails[idxDataTrailInUse]);
+        kernelRenderSparse.set_arg(1, dRender.get_buffer());
+        kernelRenderSparse.set_arg(2, dActiveTiles[idxDataTrailInUse].get_buffer());
+        kernelRenderSparse.set_arg(3, dRenderTiles.get_buffer());
+        trackEvent("render", queue.enqueue_nd_range_kernel(kernelRenderSparse, 2, nullptr, &globalWorkSize[0], &localWorkSize[0]));
+    }
+    else {
+        kernelRender.set_arg(0, dDataTrails[idxDataTrailInUse]);
+        kernelRender.set_arg(1, dRender.get_buffer());
+        trackEvent("render", queue.enqueue_1d_range_kernel(kernelRender, 0, numPixels, 0));
+    }
+
+    // Nothing waits for the copy here. It's queued behind the render kernel, and the next step's kernels are queued
+    //  behind it, so dRender can't be overwritten before it's copied
+    renderReadEvents[idxSlot] = queue.enqueue_read_buffer_async(dRender.get_buffer(), 0, numPixels, hRenderSlots[idxSlot]);
+    trackEvent("readRender", renderReadEvents[idxSlot], numPixels);
+    idxRenderSlotNext = (idxSlot + 1) % numRenderSlots;
+
+    // Show the frame of the previous step. Its copy was queued a whole step ago, so it's normally done by now
+    const int idxSlotPrevious = (idxSlot + numRenderSlots - 1) % numRenderSlots;
 
-    Utils::runThreaded(fn, 0, numPixels);
+    if (renderReadEvents[idxSlotPrevious].get() != nullptr) {
+        renderReadEvents[idxSlotPrevious].wait();
+        idxRenderSlotDisplayed = idxSlotPrevious;
+    }
+}
+
+unsigned char* SlimeMoldOpenCl::getDataTrailRender() {
+    return hRenderSlots[idxRenderSlotDisplayed];
 }
 
 void SlimeMoldOpenCl::sense() {
     int numAgents = RunConfiguration::Environment::populationSize();
     compute::kernel& kernelSense = kernels["sense"];
-    std::vector<float> hRandomValues(numAgents);
 
-    // TODO: Move to GPU, use a hash function such as www.cs.ubc.ca/~rbridson/docs/schechter-sca08-turbulence.pdf
-    for (auto& f : hRandomValues) {
-        f = random->randFloat();
+    if (summedAreaSensing) {
+        senseSummedArea();
+        return;
+    }
+
+    const WorkGroupChoice& choice = workGroupChoices["sense"];
+
+    if (choice.tiled) {
+        senseLocal();
+        return;
+    }
+
+    // Random rotations are drawn on the device from counterrng.h, nothing is uploaded
+    kernelSense.set_arg(0, dDataTrails[idxDataTrailInUse]);
+    kernelSense.set_arg(1, dAgents.get_buffer());
+    kernelSense.set_arg(2, dAgentIds.get_buffer());
+    kernelSense.set_arg(3, step);
+
+    if (headingTable) {
+        kernelSense.set_arg(4, dHeadings.get_buffer());
+    }
+
+    trackEvent("sense", queue.enqueue_1d_range_kernel(kernelSense, 0, numAgents, choice.localSize[0]));
+}
+
+void SlimeMoldOpenCl::senseLocal() {
+    const unsigned int numAgents = RunConfiguration::Environment::populationSize();
+    const size_t groupSize = static_cast<size_t>(localWorkGroupWidth) * localWorkGroupHeight;
+    // The work-items past the last agent only help staging
+    const size_t globalWorkSize = (numAgents + groupSize - 1) / groupSize * groupSize;
+    compute::kernel& kernelSense = kernels["senseLocal"];
+
+    kernelSense.set_arg(0, dDataTrails[idxDataTrailInUse]);
+    kernelSense.set_arg(1, dAgents.get_buffer());
+    kernelSense.set_arg(2, dAgentIds.get_buffer());
+    kernelSense.set_arg(3, step);
+    kernelSense.set_arg(4, numAgents);
+
+    if (headingTable) {
+        kernelSense.set_arg(5, dHeadings.get_buffer());
+    }
+
+    trackEvent("sense", queue.enqueue_1d_range_kernel(kernelSense, 0, globalWorkSize, groupSize));
+}
+
+void SlimeMoldOpenCl::senseSummedArea() {
+    int numAgents = RunConfiguration::Environment::populationSize();
+    const size_t tableBytes = static_cast<size_t>(RunConfiguration::Environment::width + 1) * (RunConfiguration::Environment::height + 1) * sizeof(cl_long);
+    compute::kernel& kernelSatRows = kernels["satRows"];
+    compute::kernel& kernelSatColumns = kernels["satColumns"];
+    compute::kernel& kernelSense = kernels["senseSummedArea"];
+
+    // The kernels never write the first row and column, which stay zero
+    if (dSummedAreaTable.size() != tableBytes) {
+        const cl_long zero = 0;
+
+        dSummedAreaTable = compute::buffer(ctx, tableBytes);
+        queue.enqueue_fill_buffer(dSummedAreaTable, &zero, sizeof(zero), 0, tableBytes);
+    }
+
+    kernelSatRows.set_arg(0, dDataTrails[idxDataTrailInUse]);
+    kernelSatRows.set_arg(1, dSummedAreaTable);
+    trackEvent("satRows", queue.enqueue_1d_range_kernel(kernelSatRows, 0, RunConfiguration::Environment::height, 0));
+
+    kernelSatColumns.set_arg(0, dSummedAreaTable);
+    trackEvent("satColumns", queue.enqueue_1d_range_kernel(kernelSatColumns, 0, RunConfiguration::Environment::width, 0));
+
+    kernelSense.set_arg(0, dSummedAreaTable);
+    kernelSense.set_arg(1, dAgents.get_buffer());
+    kernelSense.set_arg(2, dAgentIds.get_buffer());
+    kernelSense.set_arg(3, step);
+
+    if (headingTable) {
+        kernelSense.set_arg(4, dHeadings.get_buffer());
+    }
+
+    // The tiled variant has no summed-area version
+    const WorkGroupChoice& choice = workGroupChoices["sense"];
+
+    trackEvent("senseSummedArea", queue.enqueue_1d_range_kernel(kernelSense, 0, numAgents, choice.tiled ? 0 : choice.localSize[0]));
+}
+
+void SlimeMoldOpenCl::sortAgents() {
+    const auto numAgents = dAgents.size();
+    compute::kernel& kernelMortonKeys = kernels["mortonKeys"];
+
+    if (dSortKeys.size() != numAgents) {
+        dSortKeys = compute::vector<unsigned int>(numAgents, ctx);
+        dSortOrder = compute::vector<unsigned int>(numAgents, ctx);
+        dAgentsSorted = compute::vector<Agent>(numAgents, ctx);
+        dAgentIdsSorted = compute::vector<unsigned int>(numAgents, ctx);
+    }
+
+    kernelMortonKeys.set_arg(0, dAgents.get_buffer());
+    kernelMortonKeys.set_arg(1, dSortKeys.get_buffer());
+    kernelMortonKeys.set_arg(2, dSortOrder.get_buffer());
+    trackEvent("mortonKeys", queue.enqueue_1d_range_kernel(kernelMortonKeys, 0, numAgents, 0));
+
+    // Radix sort on the device for unsigned keys. Not stable, which is fine: agents on the same square can go in any order
+    compute::sort_by_key(dSortKeys.begin(), dSortKeys.end(), dSortOrder.begin(), queue);
+    compute::gather(dSortOrder.begin(), dSortOrder.end(), dAgents.begin(), dAgentsSorted.begin(), queue);
+    compute::gather(dSortOrder.begin(), dSortOrder.end(), dAgentIds.begin(), dAgentIdsSorted.begin(), queue);
+
+    dAgents.swap(dAgentsSorted);
+    dAgentIds.swap(dAgentIdsSorted);
+}
+
+std::vector<Agent> SlimeMoldOpenCl::exportAgents() {
+    std::vector<Agent> sortedAgents(dAgents.size());
+    std::vector<Agent> hostAgents(dAgents.size());
+    const auto order = exportAgentOrder();
+
+    compute::copy(dAgents.begin(), dAgents.end(), sortedAgents.begin(), queue);
+
+    for (size_t i = 0; i < order.size(); i++) {
+        hostAgents[order[i]] = sortedAgents[i];
+    }
+
+    if (headingTable) {
+        headingTable->toDirections(hostAgents.data(), hostAgents.size());
+    }
+
+    return hostAgents;
+}
+
+std::vector<unsigned int> SlimeMoldOpenCl::exportAgentOrder() {
+    std::vector<unsigned int> order(dAgentIds.size());
+
+    compute::copy(dAgentIds.begin(), dAgentIds.end(), order.begin(), queue);
+
+    return order;
+}
+
+std::vector<float> SlimeMoldOpenCl::exportTrailMap() {
+    std::vector<float> trailMap(RunConfiguration::Environment::numPixels());
+
+    readTrailMap();
+
+    dispatchTrailFormat(trailFormat, [&](auto codec) {
+        typedef decltype(codec) Codec;
+        auto trail = reinterpret_cast<const typename Codec::Storage*>(hDataTrailCurrent.data());
+
+        for (size_t i = 0; i < trailMap.size(); i++) {
+            trailMap[i] = Codec::decode(trail[i]);
+        }
+    });
+
+    return trailMap;
+}
+
+SimulationState SlimeMoldOpenCl::exportState() {
+    const size_t trailBytes = RunConfiguration::Environment::numPixels() * getTrailBytesPerPixel(trailFormat);
+    SimulationState state;
+
+    state.step = step;
+    state.trailFormat = trailFormat;
+    state.agents.resize(dAgents.size());
+    state.agentIds.resize(dAgentIds.size());
+    state.trailMaps[0].resize(trailBytes);
+    state.trailMaps[1].resize(trailBytes);
+
+    // The copies are queued behind all work in flight, so they see the state after it
+    compute::copy(dAgents.begin(), dAgents.end(), state.agents.begin(), queue);
+    compute::copy(dAgentIds.begin(), dAgentIds.end(), state.agentIds.begin(), queue);
+    queue.enqueue_read_buffer(dDataTrails[idxDataTrailInUse], 0, trailBytes, state.trailMaps[0].data());
+    queue.enqueue_read_buffer(dDataTrails[idxDataTrailBuffer], 0, trailBytes, state.trailMaps[1].data());
+
+    // Checkpoints store radians, so they can be continued with continuous directions or any number of headings
+    if (headingTable) {
+        headingTable->toDirections(state.agents.data(), state.agents.size());
+    }
+
+    return state;
+}
+
+void SlimeMoldOpenCl::importState(const SimulationStateView& state) {
+    const size_t numPixels = RunConfiguration::Environment::numPixels();
+    const size_t trailBytes = numPixels * getTrailBytesPerPixel(trailFormat);
+    const int idxDataTrails[] = { idxDataTrailInUse, idxDataTrailBuffer };
+    std::vector<unsigned char> converted;
+
+    step = state.step;
+
+    // Blocking writes, straight from the caller's memory unless the directions need converting
+    if (headingTable) {
+        std::vector<Agent> quantized(state.agents, state.agents + state.numAgents);
+
+        headingTable->toHeadings(quantized.data(), quantized.size());
+        queue.enqueue_write_buffer(dAgents.get_buffer(), 0, state.numAgents * sizeof(Agent), quantized.data());
+    }
+    else {
+        queue.enqueue_write_buffer(dAgents.get_buffer(), 0, state.numAgents * sizeof(Agent), state.agents);
+    }
+
+    queue.enqueue_write_buffer(dAgentIds.get_buffer(), 0, state.numAgents * sizeof(unsigned int), state.agentIds);
+
+    for (int i = 0; i < 2; i++) {
+        const unsigned char* trailMap = state.trailMaps[i];
+
+        if (state.trailFormat != trailFormat) {
+            converted.resize(trailBytes);
+            convertTrailMap(trailMap, state.trailFormat, converted.data(), trailFormat, numPixels);
+            trailMap = converted.data();
+        }
+
+        queue.enqueue_write_buffer(dDataTrails[idxDataTrails[i]], 0, trailBytes, trailMap);
+    }
+
+    if (sparseTrailMap) {
+        // Found again by the first decay, diffusion and render
+        const unsigned int active = 1;
+
+        for (auto& activeTiles : dActiveTiles) {
+            queue.enqueue_fill_buffer(activeTiles.get_buffer(), &active, sizeof(active), 0, activeTiles.size() * sizeof(unsigned int));
+        }
+
+        queue.enqueue_fill_buffer(dRenderTiles.get_buffer(), &active, sizeof(active), 0, dRenderTiles.size() * sizeof(unsigned int));
+    }
+
+    makeRenderImage();
+    finish();
+}
+
+void SlimeMoldOpenCl::finish() {
+    queue.finish();
+    collectEvents(true);
+
+    // All copies are done, so the latest frame can be shown
+    const int idxSlotLatest = (idxRenderSlotNext + numRenderSlots - 1) % numRenderSlots;
+
+    if (renderReadEvents[idxSlotLatest].get() != nullptr) {
+        idxRenderSlotDisplayed = idxSlotLatest;
+    }
+}
+
+void SlimeMoldOpenCl::setStatistics(RunStatistics* tStatistics) {
+    // Profiling can only be turned on when a queue is created. Buffers and kernels belong to the context, so the
+    //  queue can be replaced once everything on it is done.
+    finish();
+    SlimeMold::setStatistics(tStatistics);
+
+    cl_command_queue_properties properties = (statistics != nullptr) ? compute::command_queue::enable_profiling : 0;
+
+    queue = compute::command_queue(ctx, queue.get_device(), properties);
+}
+
+void SlimeMoldOpenCl::trackEvent(const char* name, const compute::event& event, unsigned long long bytes) {
+    if (statistics == nullptr) {
+        return;
     }
 
-    compute::copy(hRandomValues.begin(), hRandomValues.end(), dRandomValues.begin(), queue);
+    pendingEvents.push_back({ name, bytes, event });
 
-    kernelSense.set_arg(0, dConfig.get_buffer());
-    kernelSense.set_arg(1, dDataTrails[idxDataTrailInUse].get_buffer());
-    kernelSense.set_arg(2, dAgents.get_buffer());
-    kernelSense.set_arg(3, dRandomValues.get_buffer());
+    if (pendingEvents.size() > maxPendingEvents) {
+        pendingEvents.front().event.wait();
+    }
 
-    queue.enqueue_1d_range_kernel(kernelSense, 0, numAgents, 0);
+    collectEvents(false);
+}
+
+void SlimeMoldOpenCl::collectEvents(bool wait) {
+    // The queue is in order, so events complete front to back
+    while (!pendingEvents.empty()) {
+        auto& pending = pendingEvents.front();
+
+        if (wait) {
+            pending.event.wait();
+        }
+        else if (pending.event.get_status() != CL_COMPLETE) {
+            break;
+        }
+
+        if (statistics != nullptr) {
+            auto& commandStatistics = statistics->getDeviceCommandStatistics(pending.name);
+            const auto queued = pending.event.get_profiling_info<cl_ulong>(compute::event::profiling_command_queued);
+            const auto submit = pending.event.get_profiling_info<cl_ulong>(compute::event::profiling_command_submit);
+            const auto start = pending.event.get_profiling_info<cl_ulong>(compute::event::profiling_command_start);
+            const auto end = pending.event.get_profiling_info<cl_ulong>(compute::event::profiling_command_end);
+
+            // Some drivers don't fill in every timestamp, don't let that wrap around
+            auto interval = [](cl_ulong from, cl_ulong to) -> unsigned long long { return to > from ? to - from : 0; };
+
+            commandStatistics.queuedToSubmit.recordNs(interval(queued, submit));
+            commandStatistics.submitToStart.recordNs(interval(submit, start));
+            commandStatistics.startToEnd.recordNs(interval(start, end));
+            commandStatistics.bytes.fetch_add(pending.bytes, std::memory_order_relaxed);
+        }
+
+        pendingEvents.pop_front();
+    }
+}
+
+std::string SlimeMoldOpenCl::getDeviceName() const {
+    return queue.get_device().name();
 }
 
 void SlimeMoldOpenCl::swapBuffers() {
     std::swap(idxDataTrailBuffer, idxDataTrailInUse);
+}
+
+int SlimeMoldOpenCl::getNumActiveTrailTiles() {
+    if (!sparseTrailMap) {
+        return 0;
+    }
+
+    std::vector<unsigned int> activeTiles(dActiveTiles[idxDataTrailInUse].size());
+
+    compute::copy(dActiveTiles[idxDataTrailInUse].begin(), dActiveTiles[idxDataTrailInUse].end(), activeTiles.begin(), queue);
+
+    return static_cast<int>(std::count_if(activeTiles.begin(), activeTiles.end(), [](unsigned int active) { return active != 0; }));
+}
+
+int SlimeMoldOpenCl::getNumTrailTiles() const {
+    const int numTilesX = (RunConfiguration::Environment::width + sparseTileSize - 1) / sparseTileSize;
+    const int numTilesY = (RunConfiguration::Environment::height + sparseTileSize - 1) / sparseTileSize;
+
+    return sparseTrailMap ? numTilesX * numTilesY : 0;
+}
+
+bool SlimeMoldOpenCl::getSummedAreaSensing() const {
+    return summedAreaSensing;
+}
+
+int SlimeMoldOpenCl::getNumHeadings() const {
+    return headingTable ? headingTable->getNumHeadings() : 0;
+}
+
+std::map<std::string, WorkGroupChoice> SlimeMoldOpenCl::getWorkGroupChoices() const {
+    return workGroupChoices;
+}
+
+bool SlimeMoldOpenCl::getTiledWorkGroupSize(const std::map<std::string, WorkGroupChoice>& choices, int* width, int* height) {
+    *width = 0;
+    *height = 0;
+
+    // All tiled launches have the work-group size the program is built with
+    for (auto& entry : choices) {
+        const int entryWidth = static_cast<int>(entry.second.localSize[0]);
+        const int entryHeight = static_cast<int>(entry.second.localSize[1]);
+
+        if (!entry.second.tiled) {
+            continue;
+        }
+
+        if (*width > 0 && (entryWidth != *width || entryHeight != *height)) {
+            return false;
+        }
+
+        *width = entryWidth;
+        *height = entryHeight;
+    }
+
+    return true;
+}
+
+void SlimeMoldOpenCl::applyWorkGroupChoices(const std::map<std::string, WorkGroupChoice>& choices) {
+    int width, height;
+
+    if (!getTiledWorkGroupSize(choices, &width, &height)) {
+        throw std::runtime_error("The tiled launches have different work-group sizes, but the program is built for one");
+    }
+
+    useLocalWorkGroupSize(width, height);
+    workGroupChoices = choices;
+    loadKernels(configuration);
+}
+
+std::string SlimeMoldOpenCl::getWorkGroupProfileKey() const {
+    RunConfigurationCl buildConfig = getBuildConfiguration(configuration);
+    std::stringstream key;
+
+    // The tiled work-group size is one of the things being tuned
+    buildConfig.hwLocalSizeX = 0;
+    buildConfig.hwLocalSizeY = 0;
+
+    key << ProgramBinaryCache::getDeviceKey(queue.get_device());
+    key << buildConfig.getBuildOptions() << "\n";
+    key << "population " << RunConfiguration::Environment::populationSize() << ", summed-area sensing " << summedAreaSensing << "\n";
+
+    return key.str();
+}
+
+double SlimeMoldOpenCl::timePhase(void (SlimeMoldOpenCl::*phase)()) {
+    const int numRuns = 5;
+
+    try {
+        (this->*phase)();
+        finish();
+
+        const auto start = std::chrono::steady_clock::now();
+
+        for (int i = 0; i < numRuns; i++) {
+            (this->*phase)();
+        }
+
+        finish();
+
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / numRuns;
+    }
+    catch (const std::exception&) {
+        return std::numeric_limits<double>::infinity();
+    }
+}
+
+void SlimeMoldOpenCl::tuneWorkGroups(bool retune) {
+    struct Launch {
+        const char* name;
+        void (SlimeMoldOpenCl::*phase)();
+        // Global work size. Local sizes that don't divide it are skipped, since the plain kernels have no bounds checks
+        size_t globalSize[2];
+        bool canTile;
+    };
+
+    const compute::device device = queue.get_device();
+    const size_t width = RunConfiguration::Environment::width;
+    const size_t height = RunConfiguration::Environment::height;
+    const size_t numAgents = RunConfiguration::Environment::populationSize();
+    const auto state = exportState();
+    std::vector<Launch> launches;
+
+    // The sparse kernels run one work-group per tile of the map, so their size is fixed
+    if (!sparseTrailMap) {
+        launches.push_back({ "diffuse", &SlimeMoldOpenCl::diffusion, { width, height }, true });
+        launches.push_back({ "decay", &SlimeMoldOpenCl::decay, { width * height, 1 }, false });
+    }
+
+    // move needs the claims of desiredMoves, which are timed first
+    launches.push_back({ "desiredMoves", &SlimeMoldOpenCl::moveDesiredMoves, { numAgents, 1 }, false });
+    launches.push_back({ "move", &SlimeMoldOpenCl::moveActualMove, { numAgents, 1 }, false });
+    launches.push_back({ "sense", &SlimeMoldOpenCl::sense, { numAgents, 1 }, !summedAreaSensing });
+
+    auto canRunPlain = [&](const Launch& launch, const size_t localSize[2]) {
+        return localSize[0] == 0 || (localSize[1] > 0 && localSize[0] * localSize[1] <= device.max_work_group_size()
+            && launch.globalSize[0] % localSize[0] == 0 && launch.globalSize[1] % localSize[1] == 0);
+    };
+
+    // A profile is only used if it has every launch, and each of them can run on this device at its size
+    auto isValidChoice = [&](const std::string& name, const WorkGroupChoice& choice) {
+        for (auto& launch : launches) {
+            if (name != launch.name) {
+                continue;
+            }
+
+            if (choice.tiled) {
+                return launch.canTile && canRunLocalWorkGroupSize(device, static_cast<int>(choice.localSize[0]), static_cast<int>(choice.localSize[1]));
+            }
+
+            const size_t localSize[2] = { choice.localSize[0], launch.globalSize[1] > 1 ? choice.localSize[1] : 1 };
+
+            return canRunPlain(launch, localSize);
+        }
+
+        return false;
+    };
+
+    WorkGroupProfile profile(RunConfiguration::Hardware::kernelCacheDirectory(), getWorkGroupProfileKey());
+    int tiledWidth, tiledHeight;
+
+    // Otherwise the profile is tuned afresh and overwritten
+    if (!retune && profile.load(isValidChoice) && profile.choices.size() == launches.size()
+        && getTiledWorkGroupSize(profile.choices, &tiledWidth, &tiledHeight)) {
+        applyWorkGroupChoices(profile.choices);
+        std::cout << "Work-group sizes from " << profile.getPath() << std::endl;
+        return;
+    }
+
+    std::cout << "Tuning work-group sizes on " << getDeviceName() << std::endl;
+
+    // 0 = the driver's choice. diffuse is the only 2-dimensional launch
+    const size_t candidates1d[][2] = { { 0, 1 }, { 32, 1 }, { 64, 1 }, { 128, 1 }, { 256, 1 }, { 512, 1 } };
+    const size_t candidates2d[][2] = { { 0, 0 }, { 8, 8 }, { 16, 4 }, { 16, 8 }, { 16, 16 }, { 32, 4 }, { 32, 8 }, { 64, 4 } };
+    std::map<std::string, WorkGroupChoice> best;
+
+    useLocalWorkGroupSize(0, 0);
+    loadKernels(configuration);
+
+    for (auto& launch : launches) {
+        const bool is2d = launch.globalSize[1] > 1;
+        const size_t numCandidates = is2d ? sizeof(candidates2d) / sizeof(candidates2d[0]) : sizeof(candidates1d) / sizeof(candidates1d[0]);
+
+        for (size_t i = 0; i < numCandidates; i++) {
+            const size_t* localSize = is2d ? candidates2d[i] : candidates1d[i];
+            WorkGroupChoice candidate = { false, { localSize[0], is2d ? localSize[1] : 0 }, 0.0 };
+
+            if (!canRunPlain(launch, localSize)) {
+                continue;
+            }
+
+            workGroupChoices[launch.name] = candidate;
+            candidate.ms = 1000.0 * timePhase(launch.phase);
+
+            if (best.count(launch.name) == 0 || candidate.ms < best[launch.name].ms) {
+                best[launch.name] = candidate;
+            }
+        }
+
+        workGroupChoices[launch.name] = best[launch.name];
+    }
+
+    // The tiled kernels share one work-group size, which is built into the program. So every size is a build of its
+    //  own, and it is chosen for diffuse and sense together: each size gives a combination where every launch that
+    //  can be tiled takes the tiled kernel or its plain winner, whichever is faster, and the fastest combination wins
+    const int tiledSizes[][2] = { { 8, 8 }, { 16, 4 }, { 16, 8 }, { 16, 16 }, { 32, 8 } };
+    const auto plainBest = best;
+    double bestCombinationMs = 0.0;
+    int numTiledLaunches = 0;
+
+    for (auto& launch : launches) {
+        if (launch.canTile) {
+            bestCombinationMs += plainBest.at(launch.name).ms;
+            numTiledLaunches++;
+        }
+    }
+
+    for (auto& tiledSize : tiledSizes) {
+        if (numTiledLaunches == 0 || !canRunLocalWorkGroupSize(device, tiledSize[0], tiledSize[1])) {
+            continue;
+        }
+
+        try {
+            useLocalWorkGroupSize(tiledSize[0], tiledSize[1]);
+            loadKernels(configuration);
+        }
+        catch (const std::exception&) {
+            // The kernels don't build for this size, e.g. too many work-items for their registers
+            continue;
+        }
+
+        auto combination = plainBest;
+        double combinationMs = 0.0;
+
+        for (auto& launch : launches) {
+            if (!launch.canTile) {
+                continue;
+            }
+
+            WorkGroupChoice candidate = { true, { static_cast<size_t>(tiledSize[0]), static_cast<size_t>(tiledSize[1]) }, 0.0 };
+
+            workGroupChoices = plainBest;
+            workGroupChoices[launch.name] = candidate;
+            candidate.ms = 1000.0 * timePhase(launch.phase);
+
+            if (candidate.ms < plainBest.at(launch.name).ms) {
+                combination[launch.name] = candidate;
+            }
+
+            combinationMs += combination[launch.name].ms;
+        }
+
+        // Replaces all tiled entries at once, so they never come from different sizes
+        if (combinationMs < bestCombinationMs) {
+            bestCombinationMs = combinationMs;
+            best = combination;
+        }
+    }
+
+    applyWorkGroupChoices(best);
+
+    // The phases ran on the state, so put it back
+    SimulationStateView view;
+
+    view.step = state.step;
+    view.trailFormat = state.trailFormat;
+    view.numAgents = state.agents.size();
+    view.agents = state.agents.data();
+    view.agentIds = state.agentIds.data();
+
+    for (int i = 0; i < 2; i++) {
+        view.trailMaps[i] = state.trailMaps[i].data();
+    }
+
+    importState(view);
+
+    profile.choices = workGroupChoices;
+
+    if (profile.save()) {
+        std::cout << "Saved work-group sizes to " << profile.getPath() << std::endl;
+    }
+    else {
+        std::cout << "Can't save work-group sizes to " << profile.getPath() << std::endl;
+    }
 }
\ No newline at end of file
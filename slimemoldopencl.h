@@ -2,14 +2,22 @@
 
 #define CL_TARGET_OPENCL_VERSION 220
 
+#include <deque>
+#include <memory>
+
 #include <boost/compute.hpp>
 
+#include "counterrng.h"
+#include "headingtable.h"
+#include "programbinarycache.h"
 #include "slimemold.h"
+#include "workgroupprofile.h"
 
 namespace compute = boost::compute;
 
-// Since we made our main configuration structure static, we need to make a copy to be able to put it on the device.
-//  We could of course force the configuration to be generated, but we'll stick with this for now.
+// Since we made our main configuration structure static, we need to make a copy to be able to hand it to the device.
+//  The values are compiled into the kernels as CFG_* defines (see getBuildOptions), so they are constants there
+//  instead of loads from a configuration buffer.
 struct RunConfigurationCl {
     RunConfigurationCl() :
         hwOnlyCpu(RunConfiguration::Hardware::onlyCpu),
@@ -26,7 +34,13 @@ struct RunConfigurationCl {
         agentStepSize(RunConfiguration::Agent::stepSize),
         agentChemoDeposition(RunConfiguration::Agent::chemoDeposition),
         agentpRandomChangeDirection(RunConfiguration::Agent::pRandomChangeDirection),
-        agentMaxTotalChemo(RunConfiguration::Agent::maxTotalChemo) {}
+        agentMaxTotalChemo(RunConfiguration::Agent::maxTotalChemo),
+        randomSeed(RunConfiguration::Environment::randomSeed),
+        trailFormat(RunConfiguration::Hardware::trailFormat),
+        hwSparseTileSize(0),
+        agentNumHeadings(0),
+        hwLocalSizeX(0),
+        hwLocalSizeY(0) {}
     // Hardware
     int hwOnlyCpu;
     // Environment
@@ -45,53 +59,191 @@ struct RunConfigurationCl {
     unsigned int agentChemoDeposition;
     float agentpRandomChangeDirection;
     float agentMaxTotalChemo;
+    unsigned int randomSeed;
+    TrailFormat trailFormat;
+    // Width and height of the tiles of a sparse trail map, which adds the *Sparse kernels. 0 = dense trail map
+    int hwSparseTileSize;
+    // Quantized directions (see HeadingTable), which adds the heading table argument to desiredMoves, sense and
+    //  senseSummedArea. 0 = continuous directions
+    int agentNumHeadings;
+    // Work-group size of the tiled kernels diffuseLocal and senseLocal, which are only built with both set. 0 = without
+    //  them
+    int hwLocalSizeX;
+    int hwLocalSizeY;
+    // "-DCFG_ENV_WIDTH=1920 -DCFG_ENV_HEIGHT=1080 ..." for all values used by kernels.cl
+    std::string getBuildOptions() const;
 };
 
 // Make the Agent struct usable in OpenCL. Rename it to AgentCL so we can easily identify it
 BOOST_COMPUTE_ADAPT_STRUCT(Agent, Agent, (x, y, direction))
-// NB Make sure to list all the members! Otherwise there will be a compile-time error C2338
-BOOST_COMPUTE_ADAPT_STRUCT(RunConfigurationCl, RunConfigurationCl, (hwOnlyCpu, envWidth, envHeight, envDiffusionKernelSize, envDiffusionDecay, envDiffusionRatio, envPopulationSize, agentSensorAngle, agentRotationAngle, agentSensorOffset, agentSensorWidth, agentStepSize, agentChemoDeposition, agentpRandomChangeDirection, agentMaxTotalChemo))
+BOOST_COMPUTE_ADAPT_STRUCT(EnsembleMember, EnsembleMember, (sensorAngle, rotationAngle, sensorOffset, chemoDeposition, randomSeed))
+
+// kernels.cl with the counter-based RNG and the Agent and EnsembleMember types prepended, ready to build with RunConfigurationCl options
+std::string getKernelSource();
 
 class SlimeMoldOpenCl : public SlimeMold {
 public:
-    SlimeMoldOpenCl();
+    SlimeMoldOpenCl(TrailFormat tTrailFormat = RunConfiguration::Hardware::trailFormat, bool tSparseTrailMap = RunConfiguration::Hardware::sparseTrailMap,
+        int tNumHeadings = RunConfiguration::Hardware::numHeadings);
+    ~SlimeMoldOpenCl();
     void diffusion();
     void decay();
     void move();
     void sense();
     void makeRenderImage();
     void swapBuffers();
+    void finish();
+    std::string getDeviceName() const;
+    // Frames are one step behind: the frame of the previous step, while the device works on the current one. After
+    //  finish() it's the latest frame.
+    unsigned char* getDataTrailRender();
+    void sortAgents();
+    std::vector<Agent> exportAgents();
+    std::vector<unsigned int> exportAgentOrder();
+    std::vector<float> exportTrailMap();
+    SimulationState exportState();
+    void importState(const SimulationStateView& state);
+    void setStatistics(RunStatistics* tStatistics);
+    // Switch to kernels specialised for config. Programs are cached per configuration, so switching back and forth
+    //  only builds each variant once. The size of the map and the population have to stay the same, since the
+    //  buffers are not reallocated. For the same reason the trail format given to the constructor is always used,
+    //  and so are the choice of a sparse trail map and the number of headings.
+    void setConfiguration(const RunConfigurationCl& config);
+    // Reads the tile flags back, so it waits for the work in flight
+    int getNumActiveTrailTiles();
+    int getNumTrailTiles() const;
+    bool getSummedAreaSensing() const;
+    int getNumHeadings() const;
+    // Run diffusion and sense with the tiled kernels diffuseLocal and senseLocal, in work-groups of width x height,
+    //  instead of leaving the work-group size to the driver. 0 x 0 = don't use them. Overrides the choice made from
+    //  RunConfiguration::Hardware::localWorkGroupWidth and localWorkGroupHeight. Throws if the device can't run
+    //  work-groups of that size
+    void setLocalWorkGroupSize(int width, int height);
+    // 0 when the tiled kernels aren't used
+    int getLocalWorkGroupWidth() const;
+    int getLocalWorkGroupHeight() const;
+    // Time the candidate local work sizes and kernel variants of the diffuse, decay, desiredMoves, move and sense
+    //  launches, and use the fastest of each. The result is saved as a WorkGroupProfile in
+    //  RunConfiguration::Hardware::kernelCacheDirectory, which later calls for the same device and configuration load
+    //  instead of tuning again, unless retune is set. Tuning runs the phases over and over, and puts the state back
+    //  afterwards
+    void tuneWorkGroups(bool retune = false);
+    // How each launch is run, by the names tuneWorkGroups uses
+    std::map<std::string, WorkGroupChoice> getWorkGroupChoices() const;
 
 private:
-    void loadKernels();
+    // sense() through a summed-area table (RunConfiguration::Hardware::summedAreaSensingMinWidth)
+    void senseSummedArea();
+    // sense() with the tiled kernel senseLocal
+    void senseLocal();
+    // Profiling information of a command can only be read once the command has completed, so the events are kept
+    //  until then
+    struct PendingEvent {
+        const char* name;
+        unsigned long long bytes;
+        compute::event event;
+    };
+    void loadKernels(const RunConfigurationCl& config);
+    // Configuration the kernels were last built with, so they can be rebuilt for another work-group size
+    RunConfigurationCl configuration;
+    // config with the trail format, sparse tiles, headings and tiled work-group size of this object, which can't be
+    //  configured
+    RunConfigurationCl getBuildConfiguration(const RunConfigurationCl& config) const;
+    // Local work size and kernel variant of each launch. The tiled ones use localWorkGroupWidth x localWorkGroupHeight
+    std::map<std::string, WorkGroupChoice> workGroupChoices;
+    // Set the work-group size of the tiled kernels, and use them for diffuse and sense. 0 x 0 = use the plain kernels,
+    //  with the work-group size left to the driver. The kernels have to be loaded again afterwards
+    void useLocalWorkGroupSize(int width, int height);
+    // The work-group size of the tiled launches of choices, 0 x 0 without any. False if they don't all have the same
+    static bool getTiledWorkGroupSize(const std::map<std::string, WorkGroupChoice>& choices, int* width, int* height);
+    // Use choices and load the kernels they need. Throws if the tiled launches have different work-group sizes
+    void applyWorkGroupChoices(const std::map<std::string, WorkGroupChoice>& choices);
+    // Everything the timings of tuneWorkGroups depend on: device, driver, build options and population
+    std::string getWorkGroupProfileKey() const;
+    // Mean time of phase in seconds, over a few runs after one to warm up. Infinite if it fails, e.g. because the
+    //  device rejects the local work size
+    double timePhase(void (SlimeMoldOpenCl::*phase)());
+    // Work-group size of the tiled kernels, 0 x 0 = without them
+    int localWorkGroupWidth;
+    int localWorkGroupHeight;
+    // RunConfiguration::Hardware::localWorkGroupWidth and localWorkGroupHeight for device. With 0 x 0 there, the
+    //  tiled kernels are used on devices with dedicated local memory, in the largest groups of up to 16 x 16 the
+    //  device can run. On devices that keep local memory in global memory, as most CPU runtimes do, staging is just
+    //  an extra copy, so they read global memory directly. Throws if the device can't run the size given there
+    static void chooseLocalWorkGroupSize(const compute::device& device, int* width, int* height);
+    // Whether device has the work-items and local memory for the tiled kernels in work-groups of width x height
+    static bool canRunLocalWorkGroupSize(const compute::device& device, int width, int height);
     void loadAgents();
-    void loadConfig();
     void loadDeviceMemory();
     void loadHostMemory();
     void loadVariables();
     void loadDeviceMemoryTrailMaps();
-    // Whether a move is valid or not depends on if another agent is moving into that square.
-    //  So we need a function to synchronize movement when we have the desired movements of each agent
-    void moveCoordinate();
+    void loadRenderBuffers();
+    // Whether a move is valid or not depends on if another agent is moving into that square. Agents claim their
+    //  desired square with a random priority in moveDesiredMoves and the highest claim gets to move in moveActualMove.
     void moveDesiredMoves();
     void moveActualMove();
+    // Keep the event of a command for profiling. Does nothing unless statistics are enabled
+    void trackEvent(const char* name, const compute::event& event, unsigned long long bytes = 0);
+    // Record the profiling information of completed events. wait = true blocks until all tracked events are complete
+    void collectEvents(bool wait);
     std::map<std::string, compute::kernel> kernels;
     compute::context ctx;
     compute::command_queue queue;
-    std::vector<compute::vector<float>> dDataTrails;
+    TrailFormat trailFormat;
+    // Raw trail maps in trailFormat
+    std::vector<compute::buffer> dDataTrails;
     compute::vector<Agent> dAgents;
+    // Index in initAgents() of each agent. Random numbers are drawn by id, so sorting the agents doesn't change them
+    compute::vector<unsigned int> dAgentIds;
+    // Scratch space of sortAgents
+    compute::vector<unsigned int> dSortKeys;
+    compute::vector<unsigned int> dSortOrder;
+    compute::vector<Agent> dAgentsSorted;
+    compute::vector<unsigned int> dAgentIdsSorted;
+    // Summed-area table of the trail map for senseSummedArea, (width + 1) x (height + 1) fixed-point sums. Allocated on
+    //  first use
+    compute::buffer dSummedAreaTable;
+    // Quantized directions (RunConfiguration::Hardware::numHeadings). The agents on the device then hold heading
+    //  numbers instead of radians, and are converted when imported and exported. Null = continuous directions
+    std::unique_ptr<HeadingTable> headingTable;
+    // headingTable for the kernels: step x, step y, sensor x, sensor y per heading
+    compute::vector<float> dHeadings;
     // Desired position of agents
     compute::vector<Agent> dAgentDesired;
     compute::vector<int> dDesiredDestinationIndices;
-    compute::vector<float> dNewDirection;
-    // User to make random rotation when sensing
-    compute::vector<float> dRandomValues;
-    // TODO: Added as a vector here, since we know how to work with that. How do we create a custom type compute variable, not using a vector?
-    compute::vector<RunConfigurationCl> dConfig;
-    std::vector<unsigned char> hTakenMap;
-    std::vector<int> hDesiredDestinationIdx;
-    std::vector<float> hDataTrailCurrent;
-    // New random directions, sent to device
-    std::vector<float> hNewDirection;
+    // Highest priority claiming each square during the current move. Cleared every step
+    compute::vector<unsigned int> dSquareClaims;
+    // Sparse trail map (see the *Sparse kernels). The tiles are also the work-groups of those kernels
+    static const int sparseTileSize = 16;
+    bool sparseTrailMap;
+    // Tiles of each trail map in dDataTrails that may hold chemo
+    std::vector<compute::vector<unsigned int>> dActiveTiles;
+    // Tiles of dRender that may be non-zero
+    compute::vector<unsigned int> dRenderTiles;
+    // Global work size of the sparse kernels: the map rounded up to whole tiles
+    void getSparseWorkSize(size_t* globalWorkSize) const;
+    // Built programs, keyed by their build options
+    compute::program_cache programCache;
+    // Built programs from earlier runs
+    ProgramBinaryCache binaryCache;
+    // Host copy of the current trail map, still in trailFormat. Only used by exportTrailMap
+    std::vector<unsigned char> hDataTrailCurrent;
+    // Copy the current trail map into hDataTrailCurrent
+    void readTrailMap();
+    // Rendering is converted to bytes on the device and read back without blocking, into one of two slots of pinned
+    //  host memory. The host shows the frame in one slot while the next frame is copied into the other.
+    static const int numRenderSlots = 2;
+    compute::vector<unsigned char> dRender;
+    // Allocated by the driver (CL_MEM_ALLOC_HOST_PTR) and mapped for the lifetime of this object, so copies into
+    //  them can use DMA
+    compute::buffer hRenderPinned[numRenderSlots];
+    unsigned char* hRenderSlots[numRenderSlots];
+    // Completion of the copy into each slot
+    compute::event renderReadEvents[numRenderSlots];
+    // Slot the next frame goes to, and the slot getDataTrailRender returns
+    int idxRenderSlotNext;
+    int idxRenderSlotDisplayed;
     int idxDataTrailInUse, idxDataTrailBuffer;
+    std::deque<PendingEvent> pendingEvents;
 };
\ No newline at end of file
@@ -0,0 +1,690 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#include "counterrng.h"
+#include "slimemoldtiled.h"
+#include "trailformat.h"
+#include "utils.h"
+
+SlimeMoldTiled::Tile::Tile(int tOriginX, int tOriginY, int tWidth, int tHeight, int haloWidth) :
+    diffusionEngine(tWidth + 2 * haloWidth, tHeight + 2 * haloWidth, RunConfiguration::Environment::diffusionKernelSize, RunConfiguration::Environment::diffusionRatio,
+        RunConfiguration::Environment::diffusionDecay, RunConfiguration::Agent::maxTotalChemo, TrailFormat::Float32) {
+    const size_t trailSize = static_cast<size_t>(tWidth + 2 * haloWidth) * (tHeight + 2 * haloWidth);
+
+    originX = tOriginX;
+    originY = tOriginY;
+    width = tWidth;
+    height = tHeight;
+    stride = tWidth + 2 * haloWidth;
+    trailMaps[0] = std::vector<float>(trailSize, 0.0f);
+    trailMaps[1] = std::vector<float>(trailSize, 0.0f);
+    idxTrailCurrent = 0;
+    numAgents = 0;
+    squareClaims = std::unique_ptr<std::atomic<unsigned long long>[]>(new std::atomic<unsigned long long>[trailSize]);
+}
+
+float* SlimeMoldTiled::Tile::trailCurrent() {
+    return trailMaps[idxTrailCurrent].data();
+}
+
+float* SlimeMoldTiled::Tile::trailNext() {
+    return trailMaps[1 - idxTrailCurrent].data();
+}
+
+SlimeMoldTiled::SlimeMoldTiled(int tTileSize) : SlimeMold() {
+    const int width = RunConfiguration::Environment::width;
+    const int height = RunConfiguration::Environment::height;
+    const int kernelHalf = RunConfiguration::Environment::diffusionKernelSize / 2;
+    // One more than the sensors reach, since a sensor position that rounds up can land on the next square
+    const int sensorReach = RunConfiguration::Agent::sensorOffset + RunConfiguration::Agent::sensorWidth / 2 + 1;
+
+    tileSize = tTileSize;
+    haloWidth = kernelHalf > sensorReach ? kernelHalf : sensorReach;
+
+    // Halos and migrating agents only ever reach the neighbouring tiles
+    if (tileSize < haloWidth || tileSize <= RunConfiguration::Agent::stepSize) {
+        throw std::runtime_error("Tile size " + std::to_string(tileSize) + " is smaller than the halo width " + std::to_string(haloWidth));
+    }
+
+    numTilesX = (width + tileSize - 1) / tileSize;
+    numTilesY = (height + tileSize - 1) / tileSize;
+    tiles.reserve(static_cast<size_t>(numTilesX) * numTilesY);
+
+    for (int tileY = 0; tileY < numTilesY; tileY++) {
+        for (int tileX = 0; tileX < numTilesX; tileX++) {
+            const int originX = tileX * tileSize;
+            const int originY = tileY * tileSize;
+
+            tiles.emplace_back(originX, originY, std::min(tileSize, width - originX), std::min(tileSize, height - originY), haloWidth);
+        }
+    }
+
+    const auto agents = initAgents();
+
+    assignAgents(agents.data(), nullptr, agents.size());
+    clearSquareClaims();
+    claimEpoch = 0;
+    fusedPipeline = RunConfiguration::Hardware::fusedCpuPipeline;
+}
+
+int SlimeMoldTiled::getNumTiles() const {
+    return static_cast<int>(tiles.size());
+}
+
+int SlimeMoldTiled::getHaloWidth() const {
+    return haloWidth;
+}
+
+int SlimeMoldTiled::tileIndexAt(int x, int y) const {
+    return (y / tileSize) * numTilesX + x / tileSize;
+}
+
+int SlimeMoldTiled::trailIndex(const Tile& tile, int x, int y) const {
+    return (y - tile.originY + haloWidth) * tile.stride + (x - tile.originX + haloWidth);
+}
+
+template <class Fn>
+void SlimeMoldTiled::forEachTile(Fn fn) {
+    auto fnTiles = [this, &fn](int idxStart, int idxEndExclusive) {
+        for (int i = idxStart; i < idxEndExclusive; i++) {
+            fn(tiles[i]);
+        }
+    };
+
+    // A tile is plenty of work on its own, so hand them out one at a time
+    threadPool->parallelFor(fnTiles, 0, static_cast<int>(tiles.size()), 1);
+}
+
+void SlimeMoldTiled::assignAgents(const Agent* agents, const unsigned int* agentIds, size_t numAgents) {
+    const int width = RunConfiguration::Environment::width;
+    const int height = RunConfiguration::Environment::height;
+
+    for (auto& tile : tiles) {
+        tile.numAgents = 0;
+        tile.x.clear();
+        tile.y.clear();
+        tile.direction.clear();
+        tile.id.clear();
+    }
+
+    for (size_t i = 0; i < numAgents; i++) {
+        const auto& agent = agents[i];
+        const int squareX = Utils::Math::clamp<int>(0, width - 1, static_cast<int>(agent.x));
+        const int squareY = Utils::Math::clamp<int>(0, height - 1, static_cast<int>(agent.y));
+        auto& tile = tiles[tileIndexAt(squareX, squareY)];
+
+        tile.x.push_back(agent.x);
+        tile.y.push_back(agent.y);
+        tile.direction.push_back(agent.direction);
+        tile.id.push_back(agentIds != nullptr ? agentIds[i] : static_cast<unsigned int>(i));
+        tile.numAgents++;
+    }
+
+    for (auto& tile : tiles) {
+        padAgents(tile);
+    }
+}
+
+void SlimeMoldTiled::padAgents(Tile& tile) {
+    const size_t numAgents = tile.numAgents;
+    const size_t numAgentsPadded = (numAgents + Simd::width - 1) / Simd::width * Simd::width;
+
+    // Padding agents sit on the tile origin, so the squares they sense are within the halo
+    tile.x.resize(numAgents);
+    tile.y.resize(numAgents);
+    tile.direction.resize(numAgents);
+    tile.id.resize(numAgents);
+    tile.x.resize(numAgentsPadded, static_cast<float>(tile.originX));
+    tile.y.resize(numAgentsPadded, static_cast<float>(tile.originY));
+    tile.direction.resize(numAgentsPadded, 0.0f);
+    tile.id.resize(numAgentsPadded, 0);
+    tile.desiredX.resize(numAgentsPadded);
+    tile.desiredY.resize(numAgentsPadded);
+    tile.desiredTile.resize(numAgentsPadded);
+    tile.desiredSquare.resize(numAgentsPadded);
+}
+
+void SlimeMoldTiled::clearSquareClaims() {
+    for (auto& tile : tiles) {
+        const size_t numSquares = tile.trailMaps[0].size();
+
+        for (size_t i = 0; i < numSquares; i++) {
+            tile.squareClaims[i].store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+unsigned long long SlimeMoldTiled::agentClaim(unsigned int agentId) const {
+    // Same priorities as SlimeMoldCpu
+    const unsigned int priority = counterRngMovePriority(RunConfiguration::Environment::randomSeed, step, agentId);
+
+    return (static_cast<unsigned long long>(claimEpoch) << 32) | priority;
+}
+
+void SlimeMoldTiled::diffuseTile(Tile& tile) {
+    // Only the interior rows. The halo rows are refreshed from the neighbours after the move
+    tile.diffusionEngine.diffuseRows(tile.trailCurrent(), tile.trailNext(), haloWidth, haloWidth + tile.height);
+}
+
+void SlimeMoldTiled::diffusion() {
+    forEachTile([this](Tile& tile) {
+        diffuseTile(tile);
+    });
+}
+
+void SlimeMoldTiled::swapBuffers() {
+    for (auto& tile : tiles) {
+        tile.idxTrailCurrent = 1 - tile.idxTrailCurrent;
+    }
+}
+
+void SlimeMoldTiled::diffuseDecayRender() {
+    const int width = RunConfiguration::Environment::width;
+
+    forEachTile([this, width](Tile& tile) {
+        // The render image of the padded tile. Only the interior is copied to dataTrailRender
+        thread_local std::vector<unsigned char> renderTile;
+
+        renderTile.resize(tile.trailMaps[0].size());
+        tile.diffusionEngine.diffuseDecayRenderRows(tile.trailCurrent(), tile.trailNext(), renderTile.data(), haloWidth, haloWidth + tile.height);
+
+        for (int row = 0; row < tile.height; row++) {
+            const auto source = renderTile.data() + static_cast<size_t>(row + haloWidth) * tile.stride + haloWidth;
+
+            std::memcpy(dataTrailRender + static_cast<size_t>(tile.originY + row) * width + tile.originX, source, tile.width);
+        }
+    });
+
+    swapBuffers();
+}
+
+void SlimeMoldTiled::decayRenderTile(Tile& tile, bool decay, bool render) {
+    const int width = RunConfiguration::Environment::width;
+    const float chemoDecay = RunConfiguration::Environment::diffusionDecay;
+    const float maxChemo = RunConfiguration::Agent::maxTotalChemo;
+    const Simd::Float vDecay = Simd::set1(chemoDecay);
+    const Simd::Float vMin = Simd::set1(0.0f);
+    const Simd::Float vMax = Simd::set1(maxChemo);
+
+    for (int row = 0; row < tile.height; row++) {
+        float* trail = tile.trailCurrent() + trailIndex(tile, tile.originX, tile.originY + row);
+        unsigned char* renderRow = dataTrailRender + static_cast<size_t>(tile.originY + row) * width + tile.originX;
+        int x = 0;
+
+        for (; x + Simd::width <= tile.width; x += Simd::width) {
+            Simd::Float chemo = Simd::load(trail + x);
+
+            if (decay) {
+                chemo = Simd::min(vMax, Simd::max(vMin, Simd::sub(chemo, vDecay)));
+                Simd::store(trail + x, chemo);
+            }
+
+            if (render) {
+                Simd::storeBytes(renderRow + x, chemo);
+            }
+        }
+
+        for (; x < tile.width; x++) {
+            if (decay) {
+                trail[x] = Utils::Math::clamp<float>(0.0f, maxChemo, trail[x] - chemoDecay);
+            }
+
+            if (render) {
+                renderRow[x] = static_cast<unsigned char>(trail[x]);
+            }
+        }
+    }
+}
+
+void SlimeMoldTiled::decay() {
+    forEachTile([this](Tile& tile) {
+        decayRenderTile(tile, true, false);
+    });
+}
+
+void SlimeMoldTiled::makeRenderImage() {
+    forEachTile([this](Tile& tile) {
+        decayRenderTile(tile, false, true);
+    });
+}
+
+void SlimeMoldTiled::exchangeHalo(Tile& tile) {
+    const int width = RunConfiguration::Environment::width;
+    const int height = RunConfiguration::Environment::height;
+    float* trail = tile.trailCurrent();
+
+    // Copy world squares [xStart, xEndExclusive) of row y from the tiles that own them. Zero outside the world
+    auto copySpan = [&](int y, int xStart, int xEndExclusive) {
+        float* destination = trail + trailIndex(tile, xStart, y);
+        int x = xStart;
+
+        while (x < xEndExclusive) {
+            if (y < 0 || y >= height || x < 0 || x >= width) {
+                const int xEndOutside = (y < 0 || y >= height || x >= width) ? xEndExclusive : std::min(0, xEndExclusive);
+
+                std::fill(destination, destination + (xEndOutside - x), 0.0f);
+                destination += xEndOutside - x;
+                x = xEndOutside;
+            }
+            else {
+                auto& source = tiles[tileIndexAt(x, y)];
+                const int xEndSource = std::min(xEndExclusive, source.originX + source.width);
+
+                std::memcpy(destination, source.trailCurrent() + trailIndex(source, x, y), (xEndSource - x) * sizeof(float));
+                destination += xEndSource - x;
+                x = xEndSource;
+            }
+        }
+    };
+
+    const int xStart = tile.originX - haloWidth;
+    const int xEndExclusive = tile.originX + tile.width + haloWidth;
+
+    for (int y = tile.originY - haloWidth; y < tile.originY; y++) {
+        copySpan(y, xStart, xEndExclusive);
+    }
+
+    for (int y = tile.originY; y < tile.originY + tile.height; y++) {
+        copySpan(y, xStart, tile.originX);
+        copySpan(y, tile.originX + tile.width, xEndExclusive);
+    }
+
+    for (int y = tile.originY + tile.height; y < tile.originY + tile.height + haloWidth; y++) {
+        copySpan(y, xStart, xEndExclusive);
+    }
+}
+
+void SlimeMoldTiled::desiredMovesTile(Tile& tile) {
+    const int width = RunConfiguration::Environment::width;
+    const int height = RunConfiguration::Environment::height;
+    const Simd::Float vStepSize = Simd::set1(static_cast<float>(RunConfiguration::Agent::stepSize));
+    const Simd::Float vWidth = Simd::set1(static_cast<float>(width));
+    const Simd::Float vHeight = Simd::set1(static_cast<float>(height));
+    const Simd::Float vZero = Simd::set1(0.0f);
+
+    for (int agentIdx = 0; agentIdx < tile.numAgents; agentIdx += Simd::width) {
+        const int agentIdxEnd = std::min(tile.numAgents, agentIdx + Simd::width);
+        Simd::Float sinDirection, cosDirection;
+
+        Simd::sincos(Simd::load(&tile.direction[agentIdx]), sinDirection, cosDirection);
+
+        const Simd::Float newX = Simd::add(Simd::load(&tile.x[agentIdx]), Simd::mul(cosDirection, vStepSize));
+        const Simd::Float newY = Simd::add(Simd::load(&tile.y[agentIdx]), Simd::mul(sinDirection, vStepSize));
+        const int validLanes = Simd::maskBits(Simd::maskAnd(Simd::maskAnd(Simd::cmpGe(newX, vZero), Simd::cmpLt(newX, vWidth)),
+            Simd::maskAnd(Simd::cmpGe(newY, vZero), Simd::cmpLt(newY, vHeight))));
+
+        Simd::store(&tile.desiredX[agentIdx], newX);
+        Simd::store(&tile.desiredY[agentIdx], newY);
+
+        // The destination can be on another tile, so the claims are made one by one
+        for (int i = agentIdx; i < agentIdxEnd; i++) {
+            if ((validLanes & (1 << (i - agentIdx))) == 0) {
+                tile.desiredTile[i] = -1;
+                continue;
+            }
+
+            // Both coordinates are non-negative, so truncating them gives the square they are in
+            const int squareX = static_cast<int>(tile.desiredX[i]);
+            const int squareY = static_cast<int>(tile.desiredY[i]);
+            const int idxTile = tileIndexAt(squareX, squareY);
+            const int square = trailIndex(tiles[idxTile], squareX, squareY);
+            const auto claim = agentClaim(tile.id[i]);
+            auto& squareClaim = tiles[idxTile].squareClaims[square];
+            auto currentClaim = squareClaim.load(std::memory_order_relaxed);
+
+            tile.desiredTile[i] = idxTile;
+            tile.desiredSquare[i] = square;
+
+            while (currentClaim < claim && !squareClaim.compare_exchange_weak(currentClaim, claim, std::memory_order_relaxed)) {
+            }
+        }
+    }
+}
+
+void SlimeMoldTiled::moveTile(Tile& tile) {
+    const int width = RunConfiguration::Environment::width;
+    const float chemoDeposition = RunConfiguration::Agent::chemoDeposition;
+    const float maxChemo = RunConfiguration::Agent::maxTotalChemo;
+    const int idxTileSelf = tileIndexAt(tile.originX, tile.originY);
+    int numAgentsStaying = 0;
+
+    tile.emigrants.clear();
+
+    for (int i = 0; i < tile.numAgents; i++) {
+        const int idxTile = tile.desiredTile[i];
+        int idxTileAfter = idxTileSelf;
+
+        if (idxTile != -1 && tiles[idxTile].squareClaims[tile.desiredSquare[i]].load(std::memory_order_relaxed) == agentClaim(tile.id[i])) {
+            // There is only one winner per square, so deposits never touch the same square from two threads, even
+            //  across tiles
+            auto& destination = tiles[idxTile];
+            float& chemo = destination.trailCurrent()[tile.desiredSquare[i]];
+
+            tile.x[i] = tile.desiredX[i];
+            tile.y[i] = tile.desiredY[i];
+            chemo = Utils::Math::clamp<float>(0.0f, maxChemo, chemo + chemoDeposition);
+
+            if (fusedPipeline) {
+                // The render image was made before the move, so it needs the deposit as well
+                dataTrailRender[static_cast<size_t>(tile.y[i]) * width + static_cast<size_t>(tile.x[i])] = static_cast<unsigned char>(chemo);
+            }
+
+            idxTileAfter = idxTile;
+        }
+        else {
+            const auto u = counterRngFloat(RunConfiguration::Environment::randomSeed, RNG_STREAM_MOVE_DIRECTION, step, tile.id[i]);
+            tile.direction[i] = 2.0f * static_cast<float>(Utils::PI) * u;
+        }
+
+        if (idxTileAfter != idxTileSelf) {
+            tile.emigrants.push_back({ { tile.x[i], tile.y[i], tile.direction[i] }, tile.id[i], idxTileAfter });
+        }
+        else {
+            tile.x[numAgentsStaying] = tile.x[i];
+            tile.y[numAgentsStaying] = tile.y[i];
+            tile.direction[numAgentsStaying] = tile.direction[i];
+            tile.id[numAgentsStaying] = tile.id[i];
+            numAgentsStaying++;
+        }
+    }
+
+    tile.numAgents = numAgentsStaying;
+}
+
+void SlimeMoldTiled::immigrateTile(Tile& tile) {
+    const int idxTileSelf = tileIndexAt(tile.originX, tile.originY);
+    const int tileX = tile.originX / tileSize;
+    const int tileY = tile.originY / tileSize;
+
+    tile.x.resize(tile.numAgents);
+    tile.y.resize(tile.numAgents);
+    tile.direction.resize(tile.numAgents);
+    tile.id.resize(tile.numAgents);
+
+    // Neighbours in a fixed order, so the agent order doesn't depend on the thread count
+    for (int neighbourY = std::max(0, tileY - 1); neighbourY <= std::min(numTilesY - 1, tileY + 1); neighbourY++) {
+        for (int neighbourX = std::max(0, tileX - 1); neighbourX <= std::min(numTilesX - 1, tileX + 1); neighbourX++) {
+            for (const auto& emigrant : tiles[neighbourY * numTilesX + neighbourX].emigrants) {
+                if (emigrant.idxTile == idxTileSelf) {
+                    tile.x.push_back(emigrant.agent.x);
+                    tile.y.push_back(emigrant.agent.y);
+                    tile.direction.push_back(emigrant.agent.direction);
+                    tile.id.push_back(emigrant.id);
+                }
+            }
+        }
+    }
+
+    tile.numAgents = static_cast<int>(tile.id.size());
+    padAgents(tile);
+}
+
+void SlimeMoldTiled::move() {
+    if (++claimEpoch == 0) {
+        clearSquareClaims();
+        claimEpoch = 1;
+    }
+
+    // 1. Desired positions and claims. Claims on other tiles are atomic like all others
+    forEachTile([this](Tile& tile) {
+        desiredMovesTile(tile);
+    });
+
+    // 2. Winners move and deposit, the rest turn. Agents that moved onto another tile leave this one
+    forEachTile([this](Tile& tile) {
+        moveTile(tile);
+    });
+
+    // 3. Agents arrive at their new tile
+    forEachTile([this](Tile& tile) {
+        immigrateTile(tile);
+    });
+
+    // 4. The interiors are final for this step. The halos are needed by the sense below and the diffusion of the
+    //  next step
+    forEachTile([this](Tile& tile) {
+        exchangeHalo(tile);
+    });
+}
+
+void SlimeMoldTiled::sortAgents() {
+    forEachTile([this](Tile& tile) {
+        // Order the agents of the tile by the square they are on
+        thread_local std::vector<int> order;
+        thread_local std::vector<int> squares;
+        thread_local std::vector<float> values;
+        thread_local std::vector<unsigned int> ids;
+        const int numAgents = tile.numAgents;
+
+        order.resize(numAgents);
+        squares.resize(numAgents);
+
+        for (int i = 0; i < numAgents; i++) {
+            order[i] = i;
+            squares[i] = trailIndex(tile, static_cast<int>(tile.x[i]), static_cast<int>(tile.y[i]));
+        }
+
+        std::stable_sort(order.begin(), order.end(), [](int a, int b) { return squares[a] < squares[b]; });
+
+        auto permute = [numAgents](std::vector<float>& v) {
+            values.assign(v.begin(), v.begin() + numAgents);
+
+            for (int i = 0; i < numAgents; i++) {
+                v[i] = values[order[i]];
+            }
+        };
+
+        permute(tile.x);
+        permute(tile.y);
+        permute(tile.direction);
+        ids.assign(tile.id.begin(), tile.id.begin() + numAgents);
+
+        for (int i = 0; i < numAgents; i++) {
+            tile.id[i] = ids[order[i]];
+        }
+    });
+}
+
+void SlimeMoldTiled::sense() {
+    // Whole blocks only, like SlimeMoldCpu. Padding agents are sensed and turned as well, which is harmless
+    forEachTile([this](Tile& tile) {
+        for (int agentIdx = 0; agentIdx < tile.numAgents; agentIdx += Simd::width) {
+            senseBlock(tile, agentIdx);
+        }
+    });
+}
+
+void SlimeMoldTiled::senseBlock(Tile& tile, int agentIdx) {
+    const auto rotationAngle = RunConfiguration::Agent::rotationAngle;
+    const Simd::Float vSensorAngle = Simd::set1(RunConfiguration::Agent::sensorAngle);
+    const Simd::Float x = Simd::load(&tile.x[agentIdx]);
+    const Simd::Float y = Simd::load(&tile.y[agentIdx]);
+    const Simd::Float direction = Simd::load(&tile.direction[agentIdx]);
+    const Simd::Float senseLeft = senseAtRotation(tile, x, y, Simd::sub(direction, vSensorAngle));
+    const Simd::Float senseForward = senseAtRotation(tile, x, y, direction);
+    const Simd::Float senseRight = senseAtRotation(tile, x, y, Simd::add(direction, vSensorAngle));
+
+    const Simd::Mask forwardHighest = Simd::maskAnd(Simd::cmpGt(senseForward, senseLeft), Simd::cmpGt(senseForward, senseRight));
+    const Simd::Mask forwardLowest = Simd::maskAnd(Simd::cmpLt(senseForward, senseLeft), Simd::cmpLt(senseForward, senseRight));
+    Simd::Float rotation = Simd::select(Simd::cmpLt(senseLeft, senseRight), Simd::set1(rotationAngle), Simd::set1(-rotationAngle));
+    const int randomLanes = Simd::maskBits(forwardLowest);
+
+    if (randomLanes != 0) {
+        // Rotate in random direction. Rare enough to draw the numbers one lane at a time
+        float rotations[Simd::width];
+
+        Simd::store(rotations, rotation);
+
+        for (int lane = 0; lane < Simd::width; lane++) {
+            if (randomLanes & (1 << lane)) {
+                const auto u = counterRngFloat(RunConfiguration::Environment::randomSeed, RNG_STREAM_SENSE, step, tile.id[agentIdx + lane]);
+                rotations[lane] = (u > 0.5) ? -rotationAngle : rotationAngle;
+            }
+        }
+
+        rotation = Simd::load(rotations);
+    }
+
+    rotation = Simd::select(forwardHighest, Simd::set1(0.0f), rotation);
+    Simd::store(&tile.direction[agentIdx], Simd::add(direction, rotation));
+}
+
+Simd::Float SlimeMoldTiled::senseAtRotation(const Tile& tile, Simd::Float x, Simd::Float y, Simd::Float direction) const {
+    const Simd::Float vSensorOffset = Simd::set1(static_cast<float>(RunConfiguration::Agent::sensorOffset));
+    Simd::Float sinDirection, cosDirection;
+
+    Simd::sincos(direction, sinDirection, cosDirection);
+
+    const Simd::Int sensorX = Simd::truncToInt(Simd::add(x, Simd::mul(vSensorOffset, cosDirection)));
+    const Simd::Int sensorY = Simd::truncToInt(Simd::add(y, Simd::mul(vSensorOffset, sinDirection)));
+
+    return measureChemoAroundPosition(tile, sensorX, sensorY, RunConfiguration::Agent::sensorWidth);
+}
+
+Simd::Float SlimeMoldTiled::measureChemoAroundPosition(const Tile& tile, Simd::Int x, Simd::Int y, int kernelSize) const {
+    const Simd::Float vWidth = Simd::set1(static_cast<float>(RunConfiguration::Environment::width));
+    const Simd::Float vHeight = Simd::set1(static_cast<float>(RunConfiguration::Environment::height));
+    const Simd::Float vStride = Simd::set1(static_cast<float>(tile.stride));
+    // World coordinates to coordinates in the padded tile
+    const Simd::Float vOffsetX = Simd::set1(static_cast<float>(haloWidth - tile.originX));
+    const Simd::Float vOffsetY = Simd::set1(static_cast<float>(haloWidth - tile.originY));
+    const Simd::Float vZero = Simd::set1(0.0f);
+    const Simd::Float centerX = Simd::toFloat(x);
+    const Simd::Float centerY = Simd::toFloat(y);
+    const float* trail = tile.trailMaps[tile.idxTrailCurrent].data();
+    Simd::Float totalChemo = vZero;
+
+    for (int xOffset = -kernelSize / 2; xOffset <= kernelSize / 2; xOffset++) {
+        const Simd::Float xd = Simd::add(centerX, Simd::set1(static_cast<float>(xOffset)));
+        const Simd::Mask xValid = Simd::maskAnd(Simd::cmpGe(xd, vZero), Simd::cmpLt(xd, vWidth));
+        const Simd::Float xLocal = Simd::add(xd, vOffsetX);
+
+        for (int yOffset = -kernelSize / 2; yOffset <= kernelSize / 2; yOffset++) {
+            const Simd::Float yd = Simd::add(centerY, Simd::set1(static_cast<float>(yOffset)));
+            const Simd::Mask valid = Simd::maskAnd(xValid, Simd::maskAnd(Simd::cmpGe(yd, vZero), Simd::cmpLt(yd, vHeight)));
+            const Simd::Int idxSrc = Simd::truncToInt(Simd::add(Simd::mul(Simd::add(yd, vOffsetY), vStride), xLocal));
+
+            // Squares outside the world are masked out of the gather and count as zero. All others are in the halo
+            totalChemo = Simd::add(totalChemo, TrailCodecFloat32::gather(trail, idxSrc, valid));
+        }
+    }
+
+    return totalChemo;
+}
+
+std::vector<Agent> SlimeMoldTiled::exportAgents() {
+    size_t numAgents = 0;
+
+    for (const auto& tile : tiles) {
+        numAgents += tile.numAgents;
+    }
+
+    std::vector<Agent> agents(numAgents);
+
+    for (const auto& tile : tiles) {
+        for (int i = 0; i < tile.numAgents; i++) {
+            auto& agent = agents[tile.id[i]];
+            agent.x = tile.x[i];
+            agent.y = tile.y[i];
+            agent.direction = tile.direction[i];
+        }
+    }
+
+    return agents;
+}
+
+std::vector<unsigned int> SlimeMoldTiled::exportAgentOrder() {
+    // Memory order is tile by tile
+    std::vector<unsigned int> order;
+
+    for (const auto& tile : tiles) {
+        order.insert(order.end(), tile.id.begin(), tile.id.begin() + tile.numAgents);
+    }
+
+    return order;
+}
+
+std::vector<float> SlimeMoldTiled::exportTrailMap() {
+    const int width = RunConfiguration::Environment::width;
+    std::vector<float> trailMap(RunConfiguration::Environment::numPixels());
+
+    for (auto& tile : tiles) {
+        for (int row = 0; row < tile.height; row++) {
+            const float* source = tile.trailCurrent() + trailIndex(tile, tile.originX, tile.originY + row);
+
+            std::copy(source, source + tile.width, trailMap.begin() + static_cast<size_t>(tile.originY + row) * width + tile.originX);
+        }
+    }
+
+    return trailMap;
+}
+
+SimulationState SlimeMoldTiled::exportState() {
+    const int width = RunConfiguration::Environment::width;
+    const size_t numPixels = RunConfiguration::Environment::numPixels();
+    SimulationState state;
+
+    state.step = step;
+    state.trailFormat = TrailFormat::Float32;
+
+    for (const auto& tile : tiles) {
+        for (int i = 0; i < tile.numAgents; i++) {
+            state.agents.push_back({ tile.x[i], tile.y[i], tile.direction[i] });
+            state.agentIds.push_back(tile.id[i]);
+        }
+    }
+
+    for (int map = 0; map < 2; map++) {
+        state.trailMaps[map].resize(numPixels * sizeof(float));
+
+        auto trailMap = reinterpret_cast<float*>(state.trailMaps[map].data());
+
+        for (auto& tile : tiles) {
+            const float* trail = tile.trailMaps[map == 0 ? tile.idxTrailCurrent : 1 - tile.idxTrailCurrent].data();
+
+            for (int row = 0; row < tile.height; row++) {
+                const float* source = trail + trailIndex(tile, tile.originX, tile.originY + row);
+
+                std::copy(source, source + tile.width, trailMap + static_cast<size_t>(tile.originY + row) * width + tile.originX);
+            }
+        }
+    }
+
+    return state;
+}
+
+void SlimeMoldTiled::importState(const SimulationStateView& state) {
+    const int width = RunConfiguration::Environment::width;
+    const size_t numPixels = RunConfiguration::Environment::numPixels();
+    std::vector<float> trailMap(numPixels);
+
+    step = state.step;
+    assignAgents(state.agents, state.agentIds, state.numAgents);
+
+    for (int map = 0; map < 2; map++) {
+        convertTrailMap(state.trailMaps[map], state.trailFormat, trailMap.data(), TrailFormat::Float32, numPixels);
+
+        for (auto& tile : tiles) {
+            float* trail = tile.trailMaps[map == 0 ? tile.idxTrailCurrent : 1 - tile.idxTrailCurrent].data();
+
+            for (int row = 0; row < tile.height; row++) {
+                const auto source = trailMap.begin() + static_cast<size_t>(tile.originY + row) * width + tile.originX;
+
+                std::copy(source, source + tile.width, trail + trailIndex(tile, tile.originX, tile.originY + row));
+            }
+        }
+    }
+
+    forEachTile([this](Tile& tile) {
+        exchangeHalo(tile);
+    });
+
+    // Claims of the old run could collide with the epochs of this one
+    clearSquareClaims();
+    claimEpoch = 0;
+
+    // The fused pipeline renders before moving, so the image has to be up to date when the next step starts
+    makeRenderImage();
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "diffusioncpu.h"
+#include "simd.h"
+#include "slimemold.h"
+
+/// <summary>
+/// CPU backend for maps too large for SlimeMoldCpu. The world is split into square tiles of tileSize x tileSize
+/// squares, and every tile has its own trail maps, agents and claim grid, so there is no allocation the size of the
+/// whole world (except the render image) and every phase runs tile by tile with the tile's data in cache.
+///
+/// Each trail map has a halo: a border of haloWidth squares around the tile holding a copy of the neighbouring tiles,
+/// wide enough for both the diffusion kernel and the sensors. Diffusion and sensing then only read the tile's own
+/// memory. The trail map only changes where agents deposit, so the halos are refreshed once per step, after the move:
+/// that copy serves the sense of the same step and the diffusion of the next.
+///
+/// Agents belong to the tile of the square they are on. A move is claimed in the claim grid of the tile owning the
+/// destination square, which is safe across tiles since claims are atomic, and agents that ended up on another tile
+/// migrate to it at the end of the move. Random numbers are drawn per agent id, as on the other backends, so where an
+/// agent is stored has no influence on the result.
+///
+/// Trail maps are always stored as float32.
+/// </summary>
+class SlimeMoldTiled : public SlimeMold {
+public:
+    SlimeMoldTiled(int tTileSize = RunConfiguration::Hardware::tileSize);
+    void diffusion();
+    void decay();
+    void move();
+    void swapBuffers();
+    void sense();
+    void makeRenderImage();
+    void diffuseDecayRender();
+    void sortAgents();
+    std::vector<Agent> exportAgents();
+    std::vector<unsigned int> exportAgentOrder();
+    std::vector<float> exportTrailMap();
+    SimulationState exportState();
+    void importState(const SimulationStateView& state);
+    int getNumTiles() const;
+    int getHaloWidth() const;
+private:
+    // An agent on its way to another tile
+    struct MigratingAgent {
+        Agent agent;
+        unsigned int id;
+        int idxTile;
+    };
+    struct Tile {
+        Tile(int tOriginX, int tOriginY, int tWidth, int tHeight, int haloWidth);
+        // Interior, in world squares
+        int originX;
+        int originY;
+        int width;
+        int height;
+        // Row length of the trail maps, including the halo on both sides
+        int stride;
+        std::vector<float> trailMaps[2];
+        int idxTrailCurrent;
+        DiffusionCpu diffusionEngine;
+        // Agents as structure of arrays, padded to a whole number of Simd::width. Padding agents are never exported
+        int numAgents;
+        std::vector<float> x;
+        std::vector<float> y;
+        std::vector<float> direction;
+        std::vector<unsigned int> id;
+        // Destination of each agent's move: the tile and the index of the square in its trail maps. Tile -1 if the
+        //  agent would leave the world
+        std::vector<float> desiredX;
+        std::vector<float> desiredY;
+        std::vector<int> desiredTile;
+        std::vector<int> desiredSquare;
+        // Claims on the squares, as in SlimeMoldCpu. Laid out like the trail maps, though only the interior is used
+        std::unique_ptr<std::atomic<unsigned long long>[]> squareClaims;
+        // Agents that left this tile during the last move
+        std::vector<MigratingAgent> emigrants;
+        float* trailCurrent();
+        float* trailNext();
+    };
+    int tileSize;
+    int haloWidth;
+    int numTilesX;
+    int numTilesY;
+    std::vector<Tile> tiles;
+    unsigned int claimEpoch;
+    // Tile owning world square (x, y)
+    int tileIndexAt(int x, int y) const;
+    // Index of world square (x, y) in the trail maps of tile, which has to be within its halo
+    int trailIndex(const Tile& tile, int x, int y) const;
+    // Run fn(tile) for every tile in parallel
+    template <class Fn>
+    void forEachTile(Fn fn);
+    // Distribute agents, in memory order, over the tiles
+    void assignAgents(const Agent* agents, const unsigned int* agentIds, size_t numAgents);
+    // Padding agents up to a whole number of Simd::width
+    void padAgents(Tile& tile);
+    void clearSquareClaims();
+    void diffuseTile(Tile& tile);
+    void decayRenderTile(Tile& tile, bool decay, bool render);
+    // Fill the halo of the current trail map of tile from its neighbours, zero outside the world
+    void exchangeHalo(Tile& tile);
+    // Desired moves of the agents of tile, and claims on their destinations
+    void desiredMovesTile(Tile& tile);
+    // Move or turn the agents of tile. Agents that moved onto another tile are taken out and put in its emigrants
+    void moveTile(Tile& tile);
+    // Take in the emigrants of the neighbouring tiles that moved onto tile
+    void immigrateTile(Tile& tile);
+    // Sense and rotate the Simd::width agents of tile starting at agentIdx
+    void senseBlock(Tile& tile, int agentIdx);
+    Simd::Float senseAtRotation(const Tile& tile, Simd::Float x, Simd::Float y, Simd::Float direction) const;
+    Simd::Float measureChemoAroundPosition(const Tile& tile, Simd::Int x, Simd::Int y, int kernelSize) const;
+    unsigned long long agentClaim(unsigned int agentId) const;
+};
@@ -0,0 +1,80 @@
+#include <algorithm>
+
+#include "summedareatable.h"
+#include "trailformat.h"
+
+// Columns per chunk of the column scan. Each chunk walks down the table row by row, so it should cover a few cache
+//  lines per row
+const int columnsPerChunk = 64;
+
+SummedAreaTable::SummedAreaTable(int tWidth, int tHeight) {
+    width = tWidth;
+    height = tHeight;
+    table = std::vector<long long>(static_cast<size_t>(width + 1) * (height + 1), 0);
+}
+
+void SummedAreaTable::build(const void* trailMap, TrailFormat trailFormat, ThreadPool& threadPool) {
+    dispatchTrailFormat(trailFormat, [&](auto codec) {
+        typedef decltype(codec) Codec;
+        auto trail = static_cast<const typename Codec::Storage*>(trailMap);
+
+        auto fn = [this, trail](int rowStart, int rowEndExclusive) -> void {
+            scanRows<Codec>(trail, rowStart, rowEndExclusive);
+        };
+
+        threadPool.parallelFor(fn, 0, height);
+    });
+
+    auto fn = [this](int colStart, int colEndExclusive) -> void {
+        scanColumns(colStart, colEndExclusive);
+    };
+
+    threadPool.parallelFor(fn, 1, width + 1, columnsPerChunk);
+}
+
+template <class Codec>
+void SummedAreaTable::scanRows(const typename Codec::Storage* trailMap, int rowStart, int rowEndExclusive) {
+    const float scale = static_cast<float>(1 << fractionBits);
+
+    for (int row = rowStart; row < rowEndExclusive; row++) {
+        const typename Codec::Storage* source = trailMap + static_cast<size_t>(row) * width;
+        long long* destination = table.data() + static_cast<size_t>(row + 1) * (width + 1) + 1;
+        long long sum = 0;
+
+        // Chemo is never negative. Scaling by a power of two is exact, so only the bits below 2^-fractionBits are lost
+        for (int x = 0; x < width; x++) {
+            sum += static_cast<long long>(Codec::decode(source[x]) * scale);
+            destination[x] = sum;
+        }
+    }
+}
+
+void SummedAreaTable::scanColumns(int colStart, int colEndExclusive) {
+    const size_t stride = width + 1;
+
+    for (int row = 1; row <= height; row++) {
+        const long long* above = table.data() + (row - 1) * stride;
+        long long* current = table.data() + row * stride;
+
+        for (int x = colStart; x < colEndExclusive; x++) {
+            current[x] += above[x];
+        }
+    }
+}
+
+float SummedAreaTable::boxSum(int xStart, int yStart, int xEndExclusive, int yEndExclusive) const {
+    const size_t stride = width + 1;
+    const size_t x0 = std::min(width, std::max(0, xStart));
+    const size_t y0 = std::min(height, std::max(0, yStart));
+    const size_t x1 = std::min(width, std::max(0, xEndExclusive));
+    const size_t y1 = std::min(height, std::max(0, yEndExclusive));
+
+    if (x1 <= x0 || y1 <= y0) {
+        return 0.0f;
+    }
+
+    const long long sum = table[y1 * stride + x1] - table[y0 * stride + x1] - table[y1 * stride + x0] + table[y0 * stride + x0];
+
+    // Same rounding as satBoxSum in kernels.cl
+    return static_cast<float>(sum) * (1.0f / (1 << fractionBits));
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <vector>
+
+#include "slimemold.h"
+#include "threadpool.h"
+
+/// <summary>
+/// Summed-area table of a trail map: entry (x, y) holds the sum of all pixels above and to the left of it, so the sum
+/// over any box is four lookups whatever its size. Used for sensing when the sensors are wide.
+///
+/// The table is built with a prefix scan along every row followed by one down every column, each spread over the
+/// thread pool. Entries are 64-bit fixed point with fractionBits fractional bits, which holds the sum of a whole map of
+/// maximum chemo exactly. A float table would lose the small values of a box to the large sums around it, and the
+/// result would depend on where the box is.
+/// </summary>
+class SummedAreaTable {
+public:
+    SummedAreaTable(int tWidth, int tHeight);
+    // Rebuild the table from trailMap, width * height pixels in trailFormat
+    void build(const void* trailMap, TrailFormat trailFormat, ThreadPool& threadPool);
+    // Sum over the pixels [xStart, xEndExclusive) x [yStart, yEndExclusive). Pixels outside the map count as zero
+    float boxSum(int xStart, int yStart, int xEndExclusive, int yEndExclusive) const;
+    static const int fractionBits = 24;
+private:
+    template <class Codec>
+    void scanRows(const typename Codec::Storage* trailMap, int rowStart, int rowEndExclusive);
+    void scanColumns(int colStart, int colEndExclusive);
+    int width;
+    int height;
+    // (width + 1) x (height + 1) entries. The first row and column are zero, so boxes at the border need no checks
+    std::vector<long long> table;
+};
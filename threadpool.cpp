@@ -0,0 +1,161 @@
+#include <algorithm>
+#include <cstdint>
+#include <new>
+
+#include "threadpool.h"
+
+// Each participant gets this many chunks when the grain size is picked automatically. More chunks than threads lets
+//  fast threads steal from slow ones.
+const int chunksPerThread = 8;
+// Number of times a parked thread polls for new work before blocking on a condition variable. Back-to-back
+//  parallelFor calls (one per phase) are then picked up without a kernel round trip.
+const int numSpinsBeforeWait = 4096;
+
+ThreadPool::ThreadPool(int tNumThreads) {
+    numThreads = tNumThreads > 0 ? tNumThreads : static_cast<int>(std::thread::hardware_concurrency());
+    numThreads = std::max(1, numThreads);
+    chunkRangeStorage = std::unique_ptr<unsigned char[]>(new unsigned char[(numThreads + 1) * sizeof(ChunkRange)]);
+
+    const auto address = reinterpret_cast<std::uintptr_t>(chunkRangeStorage.get());
+    const auto misalignment = address % alignof(ChunkRange);
+
+    chunkRanges = reinterpret_cast<ChunkRange*>(chunkRangeStorage.get() + (misalignment == 0 ? 0 : alignof(ChunkRange) - misalignment));
+    generation = 0;
+    numWorkersBusy = 0;
+    stopping = false;
+    taskFn = nullptr;
+    taskIdxStart = 0;
+    taskIdxEndExclusive = 0;
+    taskGrainSize = 1;
+
+    for (int i = 0; i < numThreads; i++) {
+        new (&chunkRanges[i]) ChunkRange();
+        chunkRanges[i].next = 0;
+        chunkRanges[i].endExclusive = 0;
+    }
+
+    // Participant 0 is the thread calling parallelFor
+    for (int participantIdx = 1; participantIdx < numThreads; participantIdx++) {
+        workers.push_back(std::thread(&ThreadPool::workerLoop, this, participantIdx));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+
+    cvWork.notify_all();
+
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+int ThreadPool::getNumThreads() const {
+    return numThreads;
+}
+
+void ThreadPool::parallelFor(const std::function<void(int, int)>& fn, int elementIdxStart, int elementIdxEndExclusive, int grainSize) {
+    const int numElements = elementIdxEndExclusive - elementIdxStart;
+
+    if (numElements <= 0) {
+        return;
+    }
+
+    if (grainSize <= 0) {
+        grainSize = std::max(1, numElements / (numThreads * chunksPerThread));
+    }
+
+    const int numChunks = static_cast<int>((static_cast<long long>(numElements) + grainSize - 1) / grainSize);
+
+    if (numThreads == 1 || numChunks == 1) {
+        fn(elementIdxStart, elementIdxEndExclusive);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        const int numParticipants = std::min(numThreads, numChunks);
+
+        for (int i = 0; i < numThreads; i++) {
+            if (i < numParticipants) {
+                chunkRanges[i].next = static_cast<int>(static_cast<long long>(numChunks) * i / numParticipants);
+                chunkRanges[i].endExclusive = static_cast<int>(static_cast<long long>(numChunks) * (i + 1) / numParticipants);
+            }
+            else {
+                chunkRanges[i].next = 0;
+                chunkRanges[i].endExclusive = 0;
+            }
+        }
+
+        taskFn = &fn;
+        taskIdxStart = elementIdxStart;
+        taskIdxEndExclusive = elementIdxEndExclusive;
+        taskGrainSize = grainSize;
+        numWorkersBusy = numThreads - 1;
+        generation++;
+    }
+
+    cvWork.notify_all();
+
+    runChunks(0);
+
+    for (int i = 0; i < numSpinsBeforeWait && numWorkersBusy.load() > 0; i++) {
+        std::this_thread::yield();
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    cvDone.wait(lock, [this] { return numWorkersBusy.load() == 0; });
+    taskFn = nullptr;
+}
+
+void ThreadPool::workerLoop(int participantIdx) {
+    unsigned int lastGeneration = 0;
+
+    while (true) {
+        for (int i = 0; i < numSpinsBeforeWait && generation.load() == lastGeneration; i++) {
+            std::this_thread::yield();
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cvWork.wait(lock, [this, lastGeneration] { return stopping || generation.load() != lastGeneration; });
+
+            if (stopping) {
+                return;
+            }
+
+            lastGeneration = generation.load();
+        }
+
+        runChunks(participantIdx);
+
+        if (numWorkersBusy.fetch_sub(1) == 1) {
+            // Take the lock so the notification can't slip in between the caller's check and its wait
+            std::lock_guard<std::mutex> lock(mutex);
+            cvDone.notify_one();
+        }
+    }
+}
+
+void ThreadPool::runChunks(int participantIdx) {
+    // Drain our own range first, then steal from the others in round-robin order
+    for (int i = 0; i < numThreads; i++) {
+        auto& range = chunkRanges[(participantIdx + i) % numThreads];
+
+        while (true) {
+            const int chunk = range.next.fetch_add(1);
+
+            if (chunk >= range.endExclusive) {
+                break;
+            }
+
+            const long long idxStart = taskIdxStart + static_cast<long long>(chunk) * taskGrainSize;
+            const long long idxEndExclusive = std::min<long long>(idxStart + taskGrainSize, taskIdxEndExclusive);
+
+            (*taskFn)(static_cast<int>(idxStart), static_cast<int>(idxEndExclusive));
+        }
+    }
+}
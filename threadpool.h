@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// <summary>
+/// Long-lived pool of worker threads used for the data-parallel phases of the simulation. The threads are created
+/// once and then parked between calls, so scheduling a parallelFor costs a wake-up rather than a thread creation.
+///
+/// The range given to parallelFor is cut into chunks of grainSize elements. Each participant (the workers plus the
+/// calling thread) starts on its own contiguous share of chunks and, when that runs dry, steals the remaining chunks
+/// of the other participants. Chunks are claimed with an atomic counter, so every element is visited exactly once.
+///
+/// ThreadPool threadPool(0);
+/// threadPool.parallelFor([&](int idxStart, int idxEndExclusive) { ... }, 0, numElements);
+///
+/// parallelFor is not re-entrant: call it from one thread at a time and never from inside a task.
+/// </summary>
+class ThreadPool {
+public:
+    // numThreads = 0 uses std::thread::hardware_concurrency(). The calling thread counts as one of the threads.
+    ThreadPool(int numThreads = 0);
+    ~ThreadPool();
+    // Run fn over [elementIdxStart, elementIdxEndExclusive). grainSize = 0 picks a chunk size that gives each thread a
+    //  handful of chunks to balance with.
+    void parallelFor(const std::function<void(int, int)>& fn, int elementIdxStart, int elementIdxEndExclusive, int grainSize = 0);
+    int getNumThreads() const;
+private:
+    // One range of chunk indices per participant, a cache line each, so the counters of different participants
+    //  never share one
+    struct alignas(64) ChunkRange {
+        std::atomic<int> next;
+        int endExclusive;
+    };
+    void workerLoop(int participantIdx);
+    void runChunks(int participantIdx);
+    int numThreads;
+    std::vector<std::thread> workers;
+    // Points into chunkRangeStorage. new only guarantees the alignment of ChunkRange from C++17 on, so the ranges are
+    //  placed at the first cache line boundary of the storage
+    ChunkRange* chunkRanges;
+    std::unique_ptr<unsigned char[]> chunkRangeStorage;
+    std::mutex mutex;
+    std::condition_variable cvWork;
+    std::condition_variable cvDone;
+    std::atomic<unsigned int> generation;
+    std::atomic<int> numWorkersBusy;
+    bool stopping;
+    // Describes the parallelFor currently in flight
+    const std::function<void(int, int)>* taskFn;
+    int taskIdxStart;
+    int taskIdxEndExclusive;
+    int taskGrainSize;
+};
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstring>
+
+#include "simd.h"
+#include "slimemold.h"
+
+/*
+Codecs for the trail map storage formats. Each one describes how a pixel is stored (Storage) and how to turn it into a
+float and back, for one value or a Simd::Float at a time. All arithmetic happens in float; a value is only rounded to
+the storage format when it is written back, and stores clamp to the largest value the format can hold.
+
+Code that touches the trail map is written once as a template over the codec and instantiated for the format in use
+with dispatchTrailFormat:
+
+    dispatchTrailFormat(format, [&](auto codec) {
+        typedef decltype(codec) Codec;
+        auto trail = reinterpret_cast<Codec::Storage*>(data);
+        ...
+    });
+
+The 16-bit formats read 4 bytes per gathered pixel, so trail buffers need trailPaddingBytes after the last pixel.
+*/
+
+const int trailPaddingBytes = 4;
+
+struct TrailCodecFloat32 {
+    typedef float Storage;
+    static float decode(Storage v) { return v; }
+    static Storage encode(float v) { return v; }
+    static Simd::Float load(const Storage* p) { return Simd::load(p); }
+    static void store(Storage* p, Simd::Float v) { Simd::store(p, v); }
+    static Simd::Float gather(const Storage* base, Simd::Int idx, Simd::Mask m) { return Simd::gather(base, idx, m); }
+};
+
+struct TrailCodecFloat16 {
+    typedef unsigned short Storage;
+    // Largest half float below RunConfiguration::Agent::maxTotalChemo, so a value never renders as 256
+    static constexpr float maxValue = 255.875f;
+    static float decode(Storage v) { return Simd::halfToFloat(v); }
+    static Storage encode(float v) { return Simd::floatToHalf(v < maxValue ? v : maxValue); }
+    static Simd::Float load(const Storage* p) { return Simd::loadHalf(p); }
+    static void store(Storage* p, Simd::Float v) { Simd::storeHalf(p, Simd::min(Simd::set1(maxValue), v)); }
+    static Simd::Float gather(const Storage* base, Simd::Int idx, Simd::Mask m) { return Simd::halfBitsToFloat(Simd::gatherU16(base, idx, m)); }
+};
+
+struct TrailCodecFixed8_8 {
+    typedef unsigned short Storage;
+    static constexpr float scale = 256.0f;
+    static constexpr float maxStored = 65535.0f;
+    static float decode(Storage v) { return v * (1.0f / scale); }
+    // Round to nearest
+    static Storage encode(float v) {
+        const float scaled = v * scale + 0.5f;
+        return static_cast<Storage>(scaled < 0.0f ? 0.0f : (scaled > maxStored ? maxStored : scaled));
+    }
+    static Simd::Float load(const Storage* p) { return Simd::mul(Simd::loadU16(p), Simd::set1(1.0f / scale)); }
+    static void store(Storage* p, Simd::Float v) {
+        const Simd::Float scaled = Simd::add(Simd::mul(v, Simd::set1(scale)), Simd::set1(0.5f));
+        Simd::storeU16(p, Simd::min(Simd::set1(maxStored), Simd::max(Simd::set1(0.0f), scaled)));
+    }
+    static Simd::Float gather(const Storage* base, Simd::Int idx, Simd::Mask m) { return Simd::mul(Simd::toFloat(Simd::gatherU16(base, idx, m)), Simd::set1(1.0f / scale)); }
+};
+
+inline int getTrailBytesPerPixel(TrailFormat format) {
+    return format == TrailFormat::Float32 ? 4 : 2;
+}
+
+inline const char* getTrailFormatName(TrailFormat format) {
+    switch (format) {
+    case TrailFormat::Float32:
+        return "float32";
+    case TrailFormat::Float16:
+        return "float16";
+    case TrailFormat::Fixed8_8:
+        return "fixed8.8";
+    }
+
+    return "unknown";
+}
+
+// Call fn with a default constructed codec of the given format
+template <class Fn>
+void dispatchTrailFormat(TrailFormat format, Fn&& fn) {
+    switch (format) {
+    case TrailFormat::Float16:
+        fn(TrailCodecFloat16());
+        break;
+    case TrailFormat::Fixed8_8:
+        fn(TrailCodecFixed8_8());
+        break;
+    default:
+        fn(TrailCodecFloat32());
+        break;
+    }
+}
+
+// Copy numPixels pixels from source to destination, converting between the formats if they differ
+inline void convertTrailMap(const void* source, TrailFormat sourceFormat, void* destination, TrailFormat destinationFormat, size_t numPixels) {
+    if (sourceFormat == destinationFormat) {
+        std::memcpy(destination, source, numPixels * getTrailBytesPerPixel(sourceFormat));
+        return;
+    }
+
+    dispatchTrailFormat(sourceFormat, [&](auto sourceCodec) {
+        typedef decltype(sourceCodec) SourceCodec;
+
+        dispatchTrailFormat(destinationFormat, [&](auto destinationCodec) {
+            typedef decltype(destinationCodec) DestinationCodec;
+            auto src = static_cast<const typename SourceCodec::Storage*>(source);
+            auto dst = static_cast<typename DestinationCodec::Storage*>(destination);
+
+            for (size_t i = 0; i < numPixels; i++) {
+                dst[i] = DestinationCodec::encode(SourceCodec::decode(src[i]));
+            }
+        });
+    });
+}
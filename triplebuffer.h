@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+
+/// <summary>
+/// Hands the latest value from one writer thread to one reader thread without locks, e.g. rendered frames from the
+/// simulation to the window. There are three buffers: the writer owns one, the reader owns one and the third holds the
+/// latest published value. Publishing and picking up swap a buffer with the middle one in a single atomic exchange, so
+/// neither side ever waits for the other. Values the reader doesn't get to in time are overwritten.
+///
+/// TripleBuffer<Frame> frames(Frame(size));
+///
+/// Writer:  fill(frames.getWriteBuffer()); frames.publish();
+/// Reader:  if (frames.update()) { show(frames.getReadBuffer()); }
+/// </summary>
+template <class T>
+class TripleBuffer {
+public:
+    TripleBuffer(const T& initial) : buffers{ initial, initial, initial }, idxWrite(0), middle(1), idxRead(2) {}
+    // Only call from the writer thread
+    T& getWriteBuffer() {
+        return buffers[idxWrite];
+    }
+    // Make the write buffer the latest value and continue in the previous middle buffer
+    void publish() {
+        idxWrite = middle.exchange(idxWrite | freshBit, std::memory_order_acq_rel) & indexMask;
+    }
+    // True when a published value hasn't been picked up by the reader yet. Can be called from either thread
+    bool hasUnreadValue() const {
+        return (middle.load(std::memory_order_acquire) & freshBit) != 0;
+    }
+    // Only call from the reader thread. Takes the latest published value, returns false if there is none newer than
+    //  the one already in the read buffer
+    bool update() {
+        if (!hasUnreadValue()) {
+            return false;
+        }
+
+        idxRead = middle.exchange(idxRead, std::memory_order_acq_rel) & indexMask;
+
+        return true;
+    }
+    // Only call from the reader thread
+    const T& getReadBuffer() const {
+        return buffers[idxRead];
+    }
+private:
+    // middle holds the index of the middle buffer plus freshBit when it was published after the reader's last update
+    static const int indexMask = 3;
+    static const int freshBit = 4;
+    T buffers[3];
+    int idxWrite;
+    std::atomic<int> middle;
+    int idxRead;
+};
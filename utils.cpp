@@ -1,6 +1,18 @@
+#include <atomic>
+#include <cstdio>
 #include <sstream>
 #include <fstream>
-#include <thread>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 #include "utils.h"
 
@@ -12,6 +24,163 @@ std::string Utils::Files::readAllFile(std::string path) {
     return buffer.str();
 }
 
+bool Utils::Files::readBinaryFile(const std::string& path, std::vector<unsigned char>& content) {
+    std::ifstream f(path, std::ios::binary | std::ios::ate);
+
+    if (!f) {
+        return false;
+    }
+
+    const auto size = static_cast<size_t>(f.tellg());
+
+    content.resize(size);
+    f.seekg(0);
+
+    return size == 0 || static_cast<bool>(f.read(reinterpret_cast<char*>(content.data()), size));
+}
+
+bool Utils::Files::writeBinaryFile(const std::string& path, const std::vector<unsigned char>& content) {
+    const std::string temporaryPath = makeTemporaryPath(path);
+
+    {
+        std::ofstream f(temporaryPath, std::ios::binary | std::ios::trunc);
+
+        if (!f || !f.write(reinterpret_cast<const char*>(content.data()), content.size())) {
+            f.close();
+            std::remove(temporaryPath.c_str());
+            return false;
+        }
+    }
+
+    return replaceFile(temporaryPath, path);
+}
+
+std::string Utils::Files::makeTemporaryPath(const std::string& path) {
+    static std::atomic<unsigned int> numTemporaryPaths(0);
+    std::stringstream temporaryPath;
+
+#ifdef _WIN32
+    const int processId = _getpid();
+#else
+    const int processId = static_cast<int>(getpid());
+#endif
+
+    temporaryPath << path << "." << processId << "." << numTemporaryPaths++ << ".tmp";
+
+    return temporaryPath.str();
+}
+
+bool Utils::Files::replaceFile(const std::string& from, const std::string& path) {
+    // Both replace path in one step, so there is always either the old or the new file. rename() doesn't replace an
+    //  existing file on Windows
+#ifdef _WIN32
+    const bool replaced = MoveFileExA(from.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    const bool replaced = std::rename(from.c_str(), path.c_str()) == 0;
+#endif
+
+    if (!replaced) {
+        std::remove(from.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+bool Utils::Files::createDirectory(const std::string& path) {
+#ifdef _WIN32
+    _mkdir(path.c_str());
+    struct _stat info;
+    return _stat(path.c_str(), &info) == 0 && (info.st_mode & _S_IFDIR) != 0;
+#else
+    mkdir(path.c_str(), 0755);
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+#endif
+}
+
+Utils::MappedFile::MappedFile(const std::string& path) {
+    mappedData = nullptr;
+    mappedSize = 0;
+    fileHandle = nullptr;
+    mappingHandle = nullptr;
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    LARGE_INTEGER fileSize;
+
+    if (file == INVALID_HANDLE_VALUE) {
+        return;
+    }
+
+    fileHandle = file;
+
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+        return;
+    }
+
+    mappingHandle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+    if (mappingHandle == nullptr) {
+        return;
+    }
+
+    mappedData = static_cast<const unsigned char*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+    mappedSize = mappedData != nullptr ? static_cast<size_t>(fileSize.QuadPart) : 0;
+#else
+    const int fd = open(path.c_str(), O_RDONLY);
+    struct stat info;
+
+    if (fd == -1) {
+        return;
+    }
+
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        void* mapped = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (mapped != MAP_FAILED) {
+            mappedData = static_cast<const unsigned char*>(mapped);
+            mappedSize = static_cast<size_t>(info.st_size);
+        }
+    }
+
+    // The mapping keeps the file alive
+    close(fd);
+#endif
+}
+
+Utils::MappedFile::~MappedFile() {
+#ifdef _WIN32
+    if (mappedData != nullptr) {
+        UnmapViewOfFile(mappedData);
+    }
+
+    if (mappingHandle != nullptr) {
+        CloseHandle(mappingHandle);
+    }
+
+    if (fileHandle != nullptr) {
+        CloseHandle(fileHandle);
+    }
+#else
+    if (mappedData != nullptr) {
+        munmap(const_cast<unsigned char*>(mappedData), mappedSize);
+    }
+#endif
+}
+
+bool Utils::MappedFile::isOpen() const {
+    return mappedData != nullptr;
+}
+
+const unsigned char* Utils::MappedFile::data() const {
+    return mappedData;
+}
+
+size_t Utils::MappedFile::size() const {
+    return mappedSize;
+}
+
 Utils::Random::Random() {
     floatDist = std::uniform_real_distribution<float>(0.0f, 1.0f);
 }
@@ -22,22 +191,4 @@ float Utils::Random::randFloat() {
 
 float Utils::Random::randomDirection() {
     return 2.0f * static_cast<float>(PI) * randFloat();
-}
-
-void Utils::runThreaded(const std::function<void(int, int)>& fn, int elementIdxStart, int elementIdxEndExclusive) {
-    const int numThreads = std::thread::hardware_concurrency();
-    int totalElements = elementIdxEndExclusive - elementIdxStart;
-    int batchSize = totalElements / numThreads;
-    std::vector<std::thread> threads;
-
-    for (int idxThread = 0; idxThread < numThreads; idxThread++) {
-        auto colStart = idxThread * batchSize;
-        auto colEndExclusive = std::min(totalElements, (idxThread + 1) * batchSize);
-        threads.push_back(std::thread(fn, colStart, colEndExclusive));
-    }
-
-    std::for_each(threads.begin(), threads.end(), [](std::thread& t)
-        {
-            t.join();
-        });
 }
\ No newline at end of file
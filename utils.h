@@ -2,13 +2,46 @@
 
 #include <vector>
 #include <random>
-#include <functional>
+#include <string>
+#include <algorithm>
 
 namespace Utils {
     constexpr double PI = 3.14159265358979323846;
 
     struct Files {
         static std::string readAllFile(std::string path);
+        // Returns false if the file can't be read
+        static bool readBinaryFile(const std::string& path, std::vector<unsigned char>& content);
+        // Writes to a temporary file first and renames it, so readers never see a half-written file
+        static bool writeBinaryFile(const std::string& path, const std::vector<unsigned char>& content);
+        // Returns true if the directory exists afterwards
+        static bool createDirectory(const std::string& path);
+        // Rename from to path, replacing path if it exists. Returns false and removes from on failure, leaving path as it
+        //  was
+        static bool replaceFile(const std::string& from, const std::string& path);
+        // A name next to path to write it under before replaceFile. Unique per process and call, so processes and
+        //  threads writing the same file never write to the same temporary file
+        static std::string makeTemporaryPath(const std::string& path);
+    };
+
+    // Read-only memory mapping of a whole file. Pages are read from disk when first touched, so opening even a huge
+    //  file is immediate and only the parts that are used get loaded.
+    class MappedFile {
+    public:
+        MappedFile(const std::string& path);
+        ~MappedFile();
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+        // False if the file couldn't be opened or mapped. Empty files can't be mapped either
+        bool isOpen() const;
+        const unsigned char* data() const;
+        size_t size() const;
+    private:
+        const unsigned char* mappedData;
+        size_t mappedSize;
+        // Windows file and mapping handles. Unused elsewhere, the file descriptor is closed right after mapping
+        void* fileHandle;
+        void* mappingHandle;
     };
 
     struct Math {
@@ -36,8 +69,6 @@ namespace Utils {
         std::uniform_real_distribution<float> floatDist;
         std::mt19937_64 engine;
     };
-
-    extern void runThreaded(const std::function<void(int, int)>& fn, int elementIdxStart, int elementIdxEndExclusive);
 };
 
 template <class T>
@@ -1,19 +1,122 @@
+#include <algorithm>
+#include <cmath>
+
 #include "videorecorder.h"
 
-VideoRecorder::VideoRecorder(const std::string tFileName, const double tFps, const int tFrameWidth, const int tFrameHeight, const double tVideoLengthS) {
-    int fourCC = -1;
-    cv::Size frameSize(tFrameWidth, tFrameHeight);
+VideoRecorder::VideoRecorder(const std::string tFileName, const double tFps, const int tFrameWidth, const int tFrameHeight, const double tVideoLengthS,
+    VideoFormat tFormat, int tQueueCapacity, VideoBackPressure tBackPressure) {
+    const int numFrameBuffers = std::max(1, tQueueCapacity);
 
     frameCounter = 0;
     numFramesToRecord = static_cast<int>(tFps * tVideoLengthS);
-    videoWriter = cv::VideoWriter(tFileName, cv::CAP_ANY, fourCC, tFps, frameSize, false);
-    videoWriter.set(cv::VIDEOWRITER_PROP_QUALITY, 100);
+    frameWidth = tFrameWidth;
+    frameHeight = tFrameHeight;
+    format = tFormat;
+    backPressure = tBackPressure;
+    closing = false;
+    queueDepth = 0;
+    maxQueueDepth = 0;
+    numDroppedFrames = 0;
+    numWrittenFrames = 0;
+
+    for (int i = 0; i < numFrameBuffers; i++) {
+        frameBuffers.push_back(std::vector<unsigned char>(static_cast<size_t>(frameWidth) * frameHeight));
+        freeBuffers.push_back(i);
+    }
+
+    open(tFileName, tFps);
+
+    // Nothing to record if the file couldn't be opened
+    if (!opened) {
+        frameCounter = numFramesToRecord;
+    }
+
+    encoderThread = std::thread(&VideoRecorder::encodeFrames, this);
 }
 
 VideoRecorder::~VideoRecorder() {
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        closing = true;
+    }
+
+    frameQueued.notify_one();
+    encoderThread.join();
+}
+
+void VideoRecorder::open(const std::string& fileName, double fps) {
+    if (format == VideoFormat::Encoded) {
+        int fourCC = -1;
+        cv::Size frameSize(frameWidth, frameHeight);
+
+        videoWriter = cv::VideoWriter(fileName, cv::CAP_ANY, fourCC, fps, frameSize, false);
+        videoWriter.set(cv::VIDEOWRITER_PROP_QUALITY, 100);
+        opened = videoWriter.isOpened();
+    }
+    else {
+        rawStream.open(fileName, std::ios::binary);
+        opened = rawStream.is_open();
+
+        if (opened && format == VideoFormat::Y4m) {
+            // Frame rate as a fraction, in thousandths of a frame per second
+            rawStream << "YUV4MPEG2 W" << frameWidth << " H" << frameHeight << " F" << std::lround(fps * 1000.0) << ":1000 Ip A1:1 Cmono\n";
+        }
+    }
+}
+
+void VideoRecorder::write(const std::vector<unsigned char>& frame) {
+    if (format == VideoFormat::Encoded) {
+        videoWriter << cv::Mat(frameHeight, frameWidth, CV_8UC1, const_cast<unsigned char*>(frame.data()));
+    }
+    else {
+        if (format == VideoFormat::Y4m) {
+            rawStream << "FRAME\n";
+        }
+
+        rawStream.write(reinterpret_cast<const char*>(frame.data()), frame.size());
+    }
+}
+
+void VideoRecorder::close() {
     if (videoWriter.isOpened()) {
         videoWriter.release();
     }
+
+    if (rawStream.is_open()) {
+        rawStream.close();
+    }
+}
+
+void VideoRecorder::encodeFrames() {
+    while (true) {
+        int idxBuffer;
+
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+
+            frameQueued.wait(lock, [this]() { return !queuedBuffers.empty() || closing; });
+
+            if (queuedBuffers.empty()) {
+                break;
+            }
+
+            idxBuffer = queuedBuffers.front();
+            queuedBuffers.pop_front();
+        }
+
+        write(frameBuffers[idxBuffer]);
+        numWrittenFrames++;
+
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            freeBuffers.push_back(idxBuffer);
+            queueDepth--;
+        }
+
+        bufferFreed.notify_one();
+    }
+
+    close();
 }
 
 bool VideoRecorder::writeFrame(const cv::Mat& frame) {
@@ -21,17 +124,64 @@ bool VideoRecorder::writeFrame(const cv::Mat& frame) {
         return true;
     }
 
-    if (!videoWriter.isOpened()) {
-        return true;
+    // The rows are copied frameWidth bytes at a time
+    if (frame.cols != frameWidth || frame.rows != frameHeight || frame.type() != CV_8UC1) {
+        return false;
     }
 
-    videoWriter << frame;
+    int idxBuffer;
 
-    if (++frameCounter == numFramesToRecord) {
-        videoWriter.release();
-        return true;
+    {
+        std::unique_lock<std::mutex> lock(queueMutex);
+
+        if (freeBuffers.empty()) {
+            if (backPressure == VideoBackPressure::Drop) {
+                numDroppedFrames++;
+                return false;
+            }
+
+            bufferFreed.wait(lock, [this]() { return !freeBuffers.empty(); });
+        }
+
+        idxBuffer = freeBuffers.back();
+        freeBuffers.pop_back();
     }
-    else {
-        return false;
+
+    // The copy is done without the lock, the buffer belongs to this thread until it's queued
+    auto& buffer = frameBuffers[idxBuffer];
+
+    for (int row = 0; row < frameHeight; row++) {
+        const unsigned char* src = frame.ptr<unsigned char>(row);
+        std::copy(src, src + frameWidth, buffer.begin() + static_cast<size_t>(row) * frameWidth);
+    }
+
+    const bool done = (++frameCounter == numFramesToRecord);
+
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        queuedBuffers.push_back(idxBuffer);
+        // That was the last frame of the video, so the encoder can close the file once it has written the queue
+        closing = closing || done;
+        maxQueueDepth = std::max(maxQueueDepth.load(), ++queueDepth);
     }
-}
\ No newline at end of file
+
+    frameQueued.notify_one();
+
+    return done;
+}
+
+int VideoRecorder::getQueueDepth() const {
+    return queueDepth;
+}
+
+int VideoRecorder::getMaxQueueDepth() const {
+    return maxQueueDepth;
+}
+
+int VideoRecorder::getNumDroppedFrames() const {
+    return numDroppedFrames;
+}
+
+int VideoRecorder::getNumWrittenFrames() const {
+    return numWrittenFrames;
+}
@@ -1,29 +1,80 @@
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 #include <opencv2/videoio.hpp>
 
+#include "slimemold.h"
+
 /// <summary>
-/// This class handles video recording, utilizing the OpenCV class VideoWriter. A common use case is turning consecutive window frames into a video. Example use case:
-/// 
+/// This class handles video recording of 8-bit grayscale frames, e.g. turning consecutive window frames into a video.
+/// Example use case:
+///
 /// VideoRecorder videoRecorder("output.mp4", 30, windowWidth, windowHeight, 2);
 /// cv::Mat img = cv::Mat(windowHeight, windowWidth, CV_8UC1);
-/// 
+///
 /// while (!done) {
 ///     ...
 ///     videoRecorder.writeFrame(img);
 ///     ...
 /// }
-/// 
+///
+/// Frames are written by a thread of its own. writeFrame only copies the frame into a free buffer of a fixed pool and
+/// queues it, so the caller doesn't pay for encoding. When all buffers are queued, the VideoBackPressure policy decides
+/// whether writeFrame waits for the encoder or drops the frame. Nothing is allocated per frame.
+///
+/// VideoFormat::Raw and VideoFormat::Y4m stream the pixels straight to the file without encoding, for when the video
+/// is processed offline anyway, e.g. ffmpeg -i output.y4m output.mp4.
 /// </summary>
 class VideoRecorder {
 public:
-    VideoRecorder(const std::string tFileName, const double tFps, const int tFrameWidth, const int tFrameHeight, const double tVideoLengthS);
+    VideoRecorder(const std::string tFileName, const double tFps, const int tFrameWidth, const int tFrameHeight, const double tVideoLengthS,
+        VideoFormat tFormat = VideoFormat::Encoded, int tQueueCapacity = 8, VideoBackPressure tBackPressure = VideoBackPressure::Drop);
+    // Writes all queued frames before returning
     ~VideoRecorder();
-    // Write a frame to the stream. When all frames are written, the stream is closed. Returns true when the stream is done.
+    // Queue a CV_8UC1 frame of the size given to the constructor. When all frames are queued, the stream is closed.
+    //  Returns true when the stream is done. Dropped frames don't count towards the length of the video, and neither do
+    //  frames of another size or type, which are ignored.
     bool writeFrame(const cv::Mat& frame);
+    // Frames queued but not written yet, including the one being written
+    int getQueueDepth() const;
+    int getMaxQueueDepth() const;
+    int getNumDroppedFrames() const;
+    int getNumWrittenFrames() const;
 private:
+    void encodeFrames();
+    void open(const std::string& fileName, double fps);
+    void write(const std::vector<unsigned char>& frame);
+    void close();
+    // Frames accepted by writeFrame. Only used by the thread calling writeFrame
     int frameCounter;
     int numFramesToRecord;
+    bool opened;
+    int frameWidth;
+    int frameHeight;
+    VideoFormat format;
+    VideoBackPressure backPressure;
     cv::VideoWriter videoWriter;
-};
\ No newline at end of file
+    std::ofstream rawStream;
+    // Pool of frame buffers. A buffer is free, queued or being written by the encoder
+    std::vector<std::vector<unsigned char>> frameBuffers;
+    std::vector<int> freeBuffers;
+    std::deque<int> queuedBuffers;
+    bool closing;
+    std::mutex queueMutex;
+    // Signals the encoder when a frame is queued or the recorder closes
+    std::condition_variable frameQueued;
+    // Signals writeFrame when a buffer is free again
+    std::condition_variable bufferFreed;
+    std::atomic<int> queueDepth;
+    std::atomic<int> maxQueueDepth;
+    std::atomic<int> numDroppedFrames;
+    std::atomic<int> numWrittenFrames;
+    std::thread encoderThread;
+};
@@ -0,0 +1,94 @@
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+#include "programbinarycache.h"
+#include "utils.h"
+#include "workgroupprofile.h"
+
+// Bump to throw away all existing profiles, e.g. if the file layout changes
+const char* const workGroupProfileVersion = "slimemold-work-groups-1";
+
+WorkGroupProfile::WorkGroupProfile(const std::string& tDirectory, const std::string& tKey) {
+    directory = tDirectory;
+    key = std::string(workGroupProfileVersion) + "\n" + tKey;
+
+    // The empty line after the key is what ends it in the file
+    if (key.back() != '\n') {
+        key += "\n";
+    }
+}
+
+std::string WorkGroupProfile::getPath() const {
+    std::stringstream path;
+
+    if (directory.empty()) {
+        return "";
+    }
+
+    path << directory << "/" << std::hex << std::setw(16) << std::setfill('0') << ProgramBinaryCache::hash(key) << ".workgroups";
+
+    return path.str();
+}
+
+bool WorkGroupProfile::load(const std::function<bool(const std::string& launch, const WorkGroupChoice& choice)>& isValid) {
+    std::vector<unsigned char> content;
+
+    // Layout: the key, an empty line, then "launch plain|tiled width height ms" per launch
+    if (directory.empty() || !Utils::Files::readBinaryFile(getPath(), content) || content.size() < key.size() + 1
+        || std::string(content.begin(), content.begin() + key.size()) != key || content[key.size()] != '\n') {
+        return false;
+    }
+
+    std::stringstream lines(std::string(content.begin() + key.size() + 1, content.end()));
+    std::map<std::string, WorkGroupChoice> loaded;
+    std::string line;
+
+    while (std::getline(lines, line)) {
+        std::stringstream fields(line);
+        std::string launch, variant;
+        WorkGroupChoice choice;
+
+        if (line.empty()) {
+            continue;
+        }
+
+        if (!(fields >> launch >> variant >> choice.localSize[0] >> choice.localSize[1] >> choice.ms) || (variant != "plain" && variant != "tiled")) {
+            return false;
+        }
+
+        choice.tiled = variant == "tiled";
+
+        if (loaded.count(launch) > 0 || !isValid(launch, choice)) {
+            return false;
+        }
+
+        loaded[launch] = choice;
+    }
+
+    choices = loaded;
+
+    return true;
+}
+
+bool WorkGroupProfile::save() const {
+    std::stringstream content;
+
+    if (directory.empty() || !Utils::Files::createDirectory(directory)) {
+        return false;
+    }
+
+    content << key << "\n";
+
+    for (auto& entry : choices) {
+        const auto& choice = entry.second;
+
+        content << entry.first << " " << (choice.tiled ? "tiled" : "plain") << " " << choice.localSize[0] << " " << choice.localSize[1]
+            << " " << (std::isfinite(choice.ms) ? choice.ms : -1.0) << "\n";
+    }
+
+    const std::string text = content.str();
+
+    return Utils::Files::writeBinaryFile(getPath(), std::vector<unsigned char>(text.begin(), text.end()));
+}
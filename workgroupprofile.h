@@ -0,0 +1,40 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <string>
+
+// How an OpenCL kernel launch of SlimeMoldOpenCl is run
+struct WorkGroupChoice {
+    // The tiled kernel (diffuseLocal or senseLocal) instead of the plain one
+    bool tiled;
+    // Local work size. For the tiled kernels the width and height of their work-groups, otherwise 0 = left to the
+    //  driver, and 1-dimensional launches only use the first
+    size_t localSize[2];
+    // Time of a launch when it was tuned, -1 if it couldn't be timed. Only for information
+    double ms;
+};
+
+/// <summary>
+/// The fastest local work size and kernel variant of each kernel launch of SlimeMoldOpenCl on one device, as measured by
+/// SlimeMoldOpenCl::tuneWorkGroups. Kept as a small text file in the kernel cache directory, one launch per line, so
+/// later runs can skip the tuning. The key (device, driver, build options and population) is written at the top of the
+/// file and has to match, so another map size or a driver update is tuned afresh rather than using a stale profile.
+/// Delete the file to tune again.
+/// </summary>
+class WorkGroupProfile {
+public:
+    WorkGroupProfile(const std::string& tDirectory, const std::string& tKey);
+    // False if there is no profile for the key, it can't be read or isValid rejects one of its launches, e.g. because
+    //  the device can't run a size
+    bool load(const std::function<bool(const std::string& launch, const WorkGroupChoice& choice)>& isValid);
+    // False if the directory is "" or the file can't be written
+    bool save() const;
+    // "" without a directory
+    std::string getPath() const;
+    // By launch: diffuse, decay, desiredMoves, move and sense
+    std::map<std::string, WorkGroupChoice> choices;
+private:
+    std::string directory;
+    std::string key;
+};